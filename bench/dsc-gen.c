@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+
+#include "dsc-generator.h"
+
+/* Writes a synthetic DSC document to the file given as argument, or to
+ * the standard output.
+ */
+
+static void
+usage (const char *program)
+{
+	fprintf (stderr,
+		 "Usage: %s [OPTION]... [FILE]\n"
+		 "  -p PAGES   number of pages (1000)\n"
+		 "  -l LINES   lines of PostScript per page (4)\n"
+		 "  -w LENGTH  length of those lines (64)\n"
+		 "  -b SIZE    %%%%BeginBinary payload per page\n"
+		 "  -d SIZE    %%%%BeginData payload per page\n"
+		 "  -n DEPTH   nested %%%%BeginDocument sections per page\n"
+		 "  -a         defer the header values to the trailer\n"
+		 "  -e         wrap the document in a DOS EPS header\n",
+		 program);
+}
+
+int main (int argc, char **argv)
+{
+	DscParams params;
+	FILE     *file = stdout;
+	int       ok;
+	int       c;
+
+	dsc_params_init (&params);
+	while ((c = getopt (argc, argv, "p:l:w:b:d:n:ae")) != -1) {
+		switch (c) {
+		case 'p':
+			params.n_pages = strtoul (optarg, NULL, 10);
+			break;
+		case 'l':
+			params.n_lines = strtoul (optarg, NULL, 10);
+			break;
+		case 'w':
+			params.line_length = strtoul (optarg, NULL, 10);
+			break;
+		case 'b':
+			params.binary_size = strtoul (optarg, NULL, 10);
+			break;
+		case 'd':
+			params.data_size = strtoul (optarg, NULL, 10);
+			break;
+		case 'n':
+			params.document_depth = strtoul (optarg, NULL, 10);
+			break;
+		case 'a':
+			params.atend = 1;
+			break;
+		case 'e':
+			params.dos_eps = 1;
+			break;
+		default:
+			usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		file = fopen (argv[optind], "wb");
+		if (!file) {
+			printf ("Error opening file %s\n", argv[optind]);
+			return 1;
+		}
+	}
+
+	ok = dsc_generate (&params, file);
+	if (file != stdout)
+		ok = fclose (file) == 0 && ok;
+	if (!ok) {
+		fprintf (stderr, "Error writing the document\n");
+		return 1;
+	}
+
+	return 0;
+}
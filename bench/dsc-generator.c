@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsc-generator.h"
+
+/* Writes synthetic DSC documents for the benchmarks. The binary payloads
+ * contain lines that look like DSC comments, a scanner that doesn't skip
+ * them finds pages that don't exist.
+ */
+
+#define MIN_LINE_LENGTH 24
+
+void
+dsc_params_init (DscParams *params)
+{
+	memset (params, 0, sizeof (DscParams));
+	params->n_pages = 1000;
+	params->n_lines = 4;
+	params->line_length = 64;
+}
+
+static void
+write_payload (FILE        *file,
+	       unsigned int size,
+	       unsigned int seed)
+{
+	static const char fake[] = "\n%%Page: 0 0\n%%Trailer\n%%EOF\n";
+	unsigned int state = seed * 2654435761u + 1;
+	unsigned int i;
+
+	for (i = 0; i + 1 < size; i++) {
+		state = state * 1103515245 + 12345;
+		if ((state >> 16) % 512 == 0 && i + sizeof (fake) < size) {
+			fputs (fake, file);
+			i += sizeof (fake) - 2;
+			continue;
+		}
+		fputc ((state >> 16) & 0xff, file);
+	}
+	if (size > 0)
+		fputc ('\n', file);
+}
+
+static void
+write_lines (FILE        *file,
+	     unsigned int n_lines,
+	     unsigned int line_length)
+{
+	unsigned int i, j;
+
+	if (line_length < MIN_LINE_LENGTH)
+		line_length = MIN_LINE_LENGTH;
+
+	for (i = 0; i < n_lines; i++) {
+		/* "72 700 moveto (" is 15 bytes and ") show\n" 7 */
+		fprintf (file, "72 %3u moveto (", 700 - (i % 600));
+		for (j = 0; j < line_length - 22; j++)
+			fputc ('a' + (i + j) % 26, file);
+		fputs (") show\n", file);
+	}
+}
+
+static void
+write_document (FILE        *file,
+		unsigned int depth)
+{
+	fprintf (file,
+		 "%%%%BeginDocument: nested-%u.eps\n"
+		 "%%!PS-Adobe-3.0 EPSF-3.0\n"
+		 "%%%%BoundingBox: 0 0 100 100\n"
+		 "%%%%Pages: 1\n"
+		 "%%%%EndComments\n"
+		 "%%%%Page: 1 1\n"
+		 "0 0 moveto 100 100 lineto stroke\n",
+		 depth);
+	if (depth > 1)
+		write_document (file, depth - 1);
+	fprintf (file,
+		 "%%%%Trailer\n"
+		 "%%%%EOF\n"
+		 "%%%%EndDocument\n");
+}
+
+static void
+write_page (const DscParams *params,
+	    FILE            *file,
+	    unsigned int     page)
+{
+	fprintf (file,
+		 "%%%%Page: %u %u\n"
+		 "%%%%BeginPageSetup\n"
+		 "/pagesave save def\n"
+		 "%%%%EndPageSetup\n",
+		 page, page);
+	write_lines (file, params->n_lines, params->line_length);
+	if (params->binary_size > 0) {
+		fprintf (file, "%%%%BeginBinary: %u\n", params->binary_size);
+		write_payload (file, params->binary_size, page);
+		fputs ("%%EndBinary\n", file);
+	}
+	if (params->data_size > 0) {
+		fprintf (file, "%%%%BeginData: %u Binary Bytes\n", params->data_size);
+		write_payload (file, params->data_size, ~page);
+		fputs ("%%EndData\n", file);
+	}
+	if (params->document_depth > 0)
+		write_document (file, params->document_depth);
+	fputs ("pagesave restore\nshowpage\n", file);
+}
+
+static int
+write_postscript (const DscParams *params,
+		  FILE            *file)
+{
+	unsigned int i;
+
+	fprintf (file, "%%!PS-Adobe-3.0%s\n", params->dos_eps ? " EPSF-3.0" : "");
+	if (params->atend) {
+		fputs ("%%BoundingBox: (atend)\n"
+		       "%%Pages: (atend)\n"
+		       "%%PageOrder: (atend)\n", file);
+	} else {
+		fprintf (file,
+			 "%%%%BoundingBox: 0 0 612 792\n"
+			 "%%%%Pages: %u\n"
+			 "%%%%PageOrder: Ascend\n",
+			 params->n_pages);
+	}
+	fputs ("%%Title: synthetic document\n"
+	       "%%Creator: dsc-gen\n"
+	       "%%EndComments\n"
+	       "%%BeginProlog\n"
+	       "/F { /Helvetica findfont 12 scalefont setfont } def\n"
+	       "%%EndProlog\n"
+	       "%%BeginSetup\n"
+	       "F\n"
+	       "%%EndSetup\n", file);
+
+	for (i = 1; i <= params->n_pages; i++)
+		write_page (params, file, i);
+
+	fputs ("%%Trailer\n", file);
+	if (params->atend) {
+		fprintf (file,
+			 "%%%%BoundingBox: 0 0 612 792\n"
+			 "%%%%Pages: %u\n"
+			 "%%%%PageOrder: Ascend\n",
+			 params->n_pages);
+	}
+	fputs ("%%EOF\n", file);
+
+	return !ferror (file);
+}
+
+static void
+write_uint32 (FILE         *file,
+	      unsigned long value)
+{
+	fputc (value & 0xff, file);
+	fputc ((value >> 8) & 0xff, file);
+	fputc ((value >> 16) & 0xff, file);
+	fputc ((value >> 24) & 0xff, file);
+}
+
+int
+dsc_generate (const DscParams *params,
+	      FILE            *file)
+{
+	FILE *ps;
+	char  buf[BUFSIZ];
+	long  length;
+	size_t n;
+	int   ok;
+
+	if (!params->dos_eps)
+		return write_postscript (params, file);
+
+	/* The header needs the length of the PostScript section */
+	ps = tmpfile ();
+	if (!ps)
+		return 0;
+	ok = write_postscript (params, ps);
+	length = ftell (ps);
+	rewind (ps);
+
+	fwrite ("\305\320\323\306", 1, 4, file);
+	write_uint32 (file, 30);	/* PostScript section */
+	write_uint32 (file, length);
+	write_uint32 (file, 0);		/* no WMF preview */
+	write_uint32 (file, 0);
+	write_uint32 (file, 0);		/* no TIFF preview */
+	write_uint32 (file, 0);
+	fputc (0xff, file);		/* no checksum */
+	fputc (0xff, file);
+
+	while (ok && (n = fread (buf, 1, sizeof (buf), ps)) > 0)
+		ok = fwrite (buf, 1, n, file) == n;
+	fclose (ps);
+
+	return ok && !ferror (file);
+}
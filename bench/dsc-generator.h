@@ -0,0 +1,24 @@
+#ifndef DSC_GENERATOR_H
+#define DSC_GENERATOR_H
+
+#include <stdio.h>
+
+/* Shape of a synthetic DSC document. Every page has n_lines lines of
+ * line_length bytes of PostScript, followed by the optional sections.
+ */
+typedef struct {
+	unsigned int n_pages;
+	unsigned int n_lines;		/* per page */
+	unsigned int line_length;
+	unsigned int binary_size;	/* of a %%BeginBinary section per page, 0 for none */
+	unsigned int data_size;		/* of a %%BeginData section per page, 0 for none */
+	unsigned int document_depth;	/* nested %%BeginDocument sections per page */
+	int          atend;		/* header values deferred to the trailer */
+	int          dos_eps;		/* wrapped in a DOS EPS binary header */
+} DscParams;
+
+void dsc_params_init (DscParams       *params);
+int  dsc_generate    (const DscParams *params,
+		      FILE            *file);
+
+#endif /* DSC_GENERATOR_H */
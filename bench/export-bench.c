@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <libspectre/spectre.h>
+
+/* Measures how long exporting every page of a document to PostScript
+ * takes. Without a document, one with 100000 small pages is created
+ * and used instead.
+ */
+
+#define DEFAULT_N_PAGES 100000
+
+static double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+create_document (const char  *filename,
+		 unsigned int n_pages)
+{
+	FILE        *file;
+	unsigned int i;
+
+	file = fopen (filename, "wb");
+	if (!file)
+		return 0;
+
+	fprintf (file,
+		 "%%!PS-Adobe-3.0\n"
+		 "%%%%Pages: %u\n"
+		 "%%%%EndComments\n"
+		 "%%%%BeginProlog\n"
+		 "/F { /Helvetica findfont 12 scalefont setfont } def\n"
+		 "%%%%EndProlog\n",
+		 n_pages);
+	for (i = 1; i <= n_pages; i++) {
+		fprintf (file,
+			 "%%%%Page: %u %u\n"
+			 "F 72 720 moveto (Page %u) show\n"
+			 "showpage\n",
+			 i, i, i);
+	}
+	fprintf (file,
+		 "%%%%Trailer\n"
+		 "%%%%EOF\n");
+
+	return fclose (file) == 0;
+}
+
+static int
+export_document (SpectreDocument *document,
+		 const char      *output)
+{
+	SpectreExporter *exporter;
+	SpectreStatus    status;
+	unsigned int     n_pages;
+	unsigned int     i;
+
+	exporter = spectre_exporter_new (document, SPECTRE_EXPORTER_FORMAT_PS);
+	if (!exporter)
+		return 0;
+
+	status = spectre_exporter_begin (exporter, output);
+	n_pages = spectre_document_get_n_pages (document);
+	for (i = 0; !status && i < n_pages; i++)
+		status = spectre_exporter_do_page (exporter, i);
+	if (!status)
+		status = spectre_exporter_end (exporter);
+	spectre_exporter_free (exporter);
+
+	return status == SPECTRE_STATUS_SUCCESS;
+}
+
+int main (int argc, char **argv)
+{
+	SpectreDocument *document;
+	char             input[] = "/tmp/export-bench-XXXXXX";
+	char             output[] = "/tmp/export-bench-out-XXXXXX";
+	const char      *filename;
+	int              fd;
+	double           start, load, export;
+	int              ok;
+
+	if (argc > 1) {
+		filename = argv[1];
+	} else {
+		fd = mkstemp (input);
+		if (fd >= 0)
+			close (fd);
+		if (fd < 0 || !create_document (input, DEFAULT_N_PAGES)) {
+			printf ("Error creating the document\n");
+			return 1;
+		}
+		filename = input;
+	}
+
+	fd = mkstemp (output);
+	if (fd < 0) {
+		printf ("Error creating the output file\n");
+		return 1;
+	}
+	close (fd);
+
+	start = now ();
+	document = spectre_document_new ();
+	spectre_document_load (document, filename);
+	load = now () - start;
+	if (spectre_document_status (document)) {
+		printf ("Error loading document %s: %s\n", filename,
+			spectre_status_to_string (spectre_document_status (document)));
+		spectre_document_free (document);
+		return 1;
+	}
+
+	start = now ();
+	ok = export_document (document, output);
+	export = now () - start;
+
+	printf ("%s: %u pages\n", filename, spectre_document_get_n_pages (document));
+	printf ("load:   %8.3f s\n", load);
+	printf ("export: %8.3f s, %.0f pages/s\n", export,
+		spectre_document_get_n_pages (document) / export);
+
+	spectre_document_free (document);
+	unlink (output);
+	if (filename == input)
+		unlink (input);
+
+	if (!ok) {
+		printf ("Error exporting document\n");
+		return 1;
+	}
+
+	return 0;
+}
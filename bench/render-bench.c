@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <libspectre/spectre.h>
+
+#include "spectre-utils.h"
+
+/* Renders the pages of the documents given as arguments and reports
+ * how long each phase of a render takes. The library is built in, with
+ * SPECTRE_PHASE_TIMINGS.
+ */
+
+#define N_TIMES (SPECTRE_N_PHASES + 1)	/* the phases and the whole render */
+
+static const char *phase_names[N_TIMES] = {
+	"create_instance",
+	"init_with_args",
+	"prolog",
+	"setup",
+	"page",
+	"trailer",
+	"display_copy",
+	"rotation",
+	"total"
+};
+
+typedef struct {
+	double      *times[N_TIMES];	/* in seconds, for every render */
+	unsigned int n_renders;
+	unsigned int size;
+	unsigned int n_errors;
+} Samples;
+
+static double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+samples_add (Samples      *samples,
+	     const double *times)
+{
+	unsigned int i;
+
+	if (samples->n_renders == samples->size) {
+		unsigned int size = samples->size ? samples->size * 2 : 256;
+
+		for (i = 0; i < N_TIMES; i++) {
+			double *grown;
+
+			grown = realloc (samples->times[i], size * sizeof (double));
+			if (!grown)
+				return 0;
+			samples->times[i] = grown;
+		}
+		samples->size = size;
+	}
+
+	for (i = 0; i < N_TIMES; i++)
+		samples->times[i][samples->n_renders] = times[i];
+	samples->n_renders++;
+
+	return 1;
+}
+
+static int
+compare_doubles (const void *a,
+		 const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank of sorted values */
+static double
+percentile (const double *sorted,
+	    unsigned int  n,
+	    unsigned int  p)
+{
+	unsigned int rank = (n * p + 99) / 100;
+
+	return n ? sorted[rank > 0 ? rank - 1 : 0] : 0;
+}
+
+static double
+mean (const double *values,
+      unsigned int  n)
+{
+	double sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum += values[i];
+
+	return n ? sum / n : 0;
+}
+
+static int
+render_document (const char           *filename,
+		 SpectreRenderContext *rc,
+		 unsigned int          max_pages,
+		 unsigned int          iterations,
+		 Samples              *samples)
+{
+	SpectreDocument *document;
+	unsigned int     n_pages;
+	unsigned int     i, j;
+
+	document = spectre_document_new ();
+	spectre_document_load (document, filename);
+	if (spectre_document_status (document)) {
+		printf ("Error loading document %s: %s\n", filename,
+			spectre_status_to_string (spectre_document_status (document)));
+		spectre_document_free (document);
+		samples->n_errors++;
+		return 1;
+	}
+
+	n_pages = spectre_document_get_n_pages (document);
+	if (max_pages > 0 && n_pages > max_pages)
+		n_pages = max_pages;
+
+	for (i = 0; i < n_pages; i++) {
+		SpectrePage *page;
+
+		page = spectre_document_get_page (document, i);
+		if (!page) {
+			samples->n_errors++;
+			continue;
+		}
+
+		for (j = 0; j < iterations; j++) {
+			unsigned char *data = NULL;
+			double         times[N_TIMES];
+			double         start;
+			int            row_length;
+			unsigned int   k;
+
+			_spectre_phase_reset ();
+			start = now ();
+			spectre_page_render (page, rc, &data, &row_length);
+			times[SPECTRE_N_PHASES] = now () - start;
+			free (data);
+
+			if (spectre_page_status (page)) {
+				samples->n_errors++;
+				break;
+			}
+
+			for (k = 0; k < SPECTRE_N_PHASES; k++)
+				times[k] = _spectre_phase_get (k);
+			if (!samples_add (samples, times)) {
+				spectre_page_free (page);
+				spectre_document_free (document);
+				return 0;
+			}
+		}
+		spectre_page_free (page);
+	}
+
+	spectre_document_free (document);
+
+	return 1;
+}
+
+static void
+write_json (FILE          *file,
+	    const Samples *samples,
+	    double         dpi,
+	    unsigned int   rotation,
+	    unsigned int   antialias)
+{
+	unsigned int i;
+
+	fprintf (file,
+		 "{\n"
+		 "  \"dpi\": %g,\n"
+		 "  \"rotation\": %u,\n"
+		 "  \"antialias_bits\": %u,\n"
+		 "  \"renders\": %u,\n"
+		 "  \"errors\": %u,\n"
+		 "  \"unit\": \"ms\",\n"
+		 "  \"phases\": {\n",
+		 dpi, rotation, antialias,
+		 samples->n_renders, samples->n_errors);
+	for (i = 0; i < N_TIMES; i++) {
+		const double *times = samples->times[i];
+		unsigned int  n = samples->n_renders;
+
+		fprintf (file,
+			 "    \"%s\": { \"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"mean\": %.6f }%s\n",
+			 phase_names[i],
+			 percentile (times, n, 50) * 1000,
+			 percentile (times, n, 95) * 1000,
+			 percentile (times, n, 99) * 1000,
+			 mean (times, n) * 1000,
+			 i < N_TIMES - 1 ? "," : "");
+	}
+	fprintf (file,
+		 "  }\n"
+		 "}\n");
+}
+
+static void
+usage (const char *program)
+{
+	printf ("Usage: %s [OPTION]... FILE...\n"
+		"  -r DPI       resolution (72)\n"
+		"  -o DEGREES   rotation, 0, 90, 180 or 270 (0)\n"
+		"  -a BITS      text and graphics antialias bits, 1, 2 or 4 (4)\n"
+		"  -n COUNT     renders of every page (1)\n"
+		"  -p PAGES     pages of every document, 0 for all (0)\n"
+		"  -j FILE      write the results as JSON to FILE, - for stdout\n"
+		"  -t FILE      write a Chrome trace of the renders to FILE\n",
+		program);
+}
+
+int main (int argc, char **argv)
+{
+	SpectreRenderContext *rc;
+	Samples               samples;
+	const char           *json = NULL;
+	const char           *trace = NULL;
+	double                dpi = 72;
+	unsigned int          rotation = 0;
+	unsigned int          antialias = 4;
+	unsigned int          iterations = 1;
+	unsigned int          max_pages = 0;
+	unsigned int          i;
+	int                   ok = 1;
+	int                   c;
+
+	while ((c = getopt (argc, argv, "r:o:a:n:p:j:t:")) != -1) {
+		switch (c) {
+		case 'r':
+			dpi = strtod (optarg, NULL);
+			break;
+		case 'o':
+			rotation = strtoul (optarg, NULL, 10);
+			break;
+		case 'a':
+			antialias = strtoul (optarg, NULL, 10);
+			break;
+		case 'n':
+			iterations = strtoul (optarg, NULL, 10);
+			break;
+		case 'p':
+			max_pages = strtoul (optarg, NULL, 10);
+			break;
+		case 'j':
+			json = optarg;
+			break;
+		case 't':
+			trace = optarg;
+			break;
+		default:
+			usage (argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc || dpi <= 0 || iterations == 0) {
+		usage (argv[0]);
+		return 1;
+	}
+
+	rc = spectre_render_context_new ();
+	spectre_render_context_set_resolution (rc, dpi, dpi);
+	spectre_render_context_set_rotation (rc, rotation);
+	spectre_render_context_set_antialias_bits (rc, antialias, antialias);
+
+	if (trace && spectre_trace_start (trace)) {
+		printf ("Error writing %s\n", trace);
+		spectre_render_context_free (rc);
+		return 1;
+	}
+
+	memset (&samples, 0, sizeof (Samples));
+	for (i = optind; ok && i < (unsigned int) argc; i++)
+		ok = render_document (argv[i], rc, max_pages, iterations, &samples);
+	spectre_render_context_free (rc);
+
+	if (trace && spectre_trace_stop ()) {
+		printf ("Error writing %s\n", trace);
+		ok = 0;
+	}
+
+	/* Sorted for the percentiles */
+	for (i = 0; samples.n_renders > 0 && i < N_TIMES; i++)
+		qsort (samples.times[i], samples.n_renders, sizeof (double), compare_doubles);
+
+	if (ok && !(json && strcmp (json, "-") == 0)) {
+		printf ("%u renders, %u errors, %g dpi, rotation %u, antialias bits %u\n",
+			samples.n_renders, samples.n_errors, dpi, rotation, antialias);
+		printf ("%-16s %10s %10s %10s %10s\n",
+			"phase (ms)", "p50", "p95", "p99", "mean");
+		for (i = 0; i < N_TIMES; i++) {
+			const double *times = samples.times[i];
+			unsigned int  n = samples.n_renders;
+
+			printf ("%-16s %10.3f %10.3f %10.3f %10.3f\n", phase_names[i],
+				percentile (times, n, 50) * 1000,
+				percentile (times, n, 95) * 1000,
+				percentile (times, n, 99) * 1000,
+				mean (times, n) * 1000);
+		}
+	}
+
+	if (ok && json) {
+		FILE *file = strcmp (json, "-") == 0 ? stdout : fopen (json, "w");
+
+		if (file) {
+			write_json (file, &samples, dpi, rotation, antialias);
+			if (file != stdout)
+				ok = fclose (file) == 0;
+		} else {
+			printf ("Error writing %s\n", json);
+			ok = 0;
+		}
+	}
+
+	for (i = 0; i < N_TIMES; i++)
+		free (samples.times[i]);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "spectre-utils.h"
+#include "ps.h"
+
+#include "dsc-generator.h"
+
+/* Measures how fast psscan() scans documents, the ones given as arguments
+ * or a set of synthetic documents written to /tmp. Every document is
+ * scanned in its own process, so that the peak RSS is its own.
+ */
+
+#define DEFAULT_ITERATIONS 3
+
+typedef struct {
+	const char *name;
+	DscParams   params;
+} Shape;
+
+/* pages, lines, line length, binary, data, nesting, atend, DOS EPS */
+static const Shape shapes[] = {
+	{ "1-page",     { 1,       4,  64,   0,     0,     0, 0, 0 } },
+	{ "1k-pages",   { 1000,    4,  64,   0,     0,     0, 0, 0 } },
+	{ "100k-pages", { 100000,  4,  64,   0,     0,     0, 0, 0 } },
+	{ "1M-pages",   { 1000000, 1,  32,   0,     0,     0, 0, 0 } },
+	{ "long-lines", { 1000,    16, 4096, 0,     0,     0, 0, 0 } },
+	{ "binary-64k", { 1000,    4,  64,   65536, 0,     0, 0, 0 } },
+	{ "data-64k",   { 1000,    4,  64,   0,     65536, 0, 0, 0 } },
+	{ "nested-8",   { 10000,   4,  64,   0,     0,     8, 0, 0 } },
+	{ "atend",      { 100000,  4,  64,   0,     0,     0, 1, 0 } },
+	{ "dos-eps",    { 1000,    4,  64,   0,     0,     0, 0, 1 } }
+};
+
+static double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs in the child process */
+static int
+scan_document (const char  *name,
+	       const char  *filename,
+	       unsigned int iterations)
+{
+	struct rusage usage;
+	struct stat   st;
+	double        best = 0;
+	double        mb;
+	unsigned long long n_allocations = 0;
+	unsigned int  n_pages = 0;
+	unsigned int  i;
+
+	if (stat (filename, &st) != 0) {
+		printf ("Error opening file %s\n", filename);
+		return 1;
+	}
+	mb = st.st_size / (1024.0 * 1024.0);
+
+	for (i = 0; i < iterations; i++) {
+		struct document *doc;
+		SpectreStats     stats;
+		FILE            *file;
+		double           start, elapsed;
+
+		file = fopen (filename, "rb");
+		if (!file) {
+			printf ("Error opening file %s\n", filename);
+			return 1;
+		}
+
+		spectre_stats_reset ();
+		start = now ();
+		doc = psscan (file, filename, SCANSTYLE_NORMAL);
+		elapsed = now () - start;
+		spectre_stats_get (&stats);
+		n_allocations = stats.allocations;
+		fclose (file);
+
+		if (!doc) {
+			printf ("Error scanning file %s\n", filename);
+			return 1;
+		}
+		n_pages = doc->numpages;
+		psdocdestroy (doc);
+
+		if (i == 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	getrusage (RUSAGE_SELF, &usage);
+
+	printf ("%-14s %9.1f %8u %9.3f %9.1f %11.0f %9.1f %11llu\n",
+		name, mb, n_pages, best,
+		best > 0 ? mb / best : 0,
+		best > 0 ? n_pages / best : 0,
+		usage.ru_maxrss / 1024.0, n_allocations);
+	fflush (stdout);
+
+	return 0;
+}
+
+static int
+run (const char  *name,
+     const char  *filename,
+     unsigned int iterations)
+{
+	pid_t pid;
+	int   status;
+
+	fflush (stdout);
+	pid = fork ();
+	if (pid < 0)
+		return scan_document (name, filename, iterations);
+	if (pid == 0)
+		_exit (scan_document (name, filename, iterations));
+
+	if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status))
+		return 1;
+
+	return WEXITSTATUS (status);
+}
+
+static int
+run_shape (const Shape *shape,
+	   unsigned int iterations)
+{
+	char  filename[] = "/tmp/scan-bench-XXXXXX";
+	FILE *file;
+	int   fd;
+	int   ok;
+
+	fd = mkstemp (filename);
+	file = fd >= 0 ? fdopen (fd, "wb") : NULL;
+	if (!file) {
+		if (fd >= 0)
+			close (fd);
+		printf ("Error creating the document\n");
+		return 1;
+	}
+	ok = dsc_generate (&shape->params, file);
+	ok = fclose (file) == 0 && ok;
+	if (!ok) {
+		printf ("Error creating the document\n");
+		unlink (filename);
+		return 1;
+	}
+
+	ok = run (shape->name, filename, iterations) == 0;
+	unlink (filename);
+
+	return ok ? 0 : 1;
+}
+
+int main (int argc, char **argv)
+{
+	unsigned int iterations = DEFAULT_ITERATIONS;
+	unsigned int i;
+	int          status = 0;
+	int          c;
+
+	while ((c = getopt (argc, argv, "i:")) != -1) {
+		switch (c) {
+		case 'i':
+			iterations = strtoul (optarg, NULL, 10);
+			break;
+		default:
+			printf ("Usage: %s [-i ITERATIONS] [FILE]...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations == 0)
+		iterations = 1;
+
+	printf ("%-14s %9s %8s %9s %9s %11s %9s %11s\n",
+		"document", "MB", "pages", "time (s)", "MB/s", "pages/s",
+		"RSS (MB)", "allocations");
+
+	if (optind < argc) {
+		for (i = optind; i < (unsigned int) argc; i++) {
+			const char *name = strrchr (argv[i], '/');
+
+			status |= run (name ? name + 1 : argv[i], argv[i], iterations);
+		}
+	} else {
+		for (i = 0; i < sizeof (shapes) / sizeof (shapes[0]); i++)
+			status |= run_shape (&shapes[i], iterations);
+	}
+
+	return status;
+}
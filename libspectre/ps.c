@@ -61,6 +61,7 @@
 
 #define USE_ACROREAD_WORKAROUND
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 
 #include <string.h>
@@ -72,8 +73,22 @@
 #define BUFSIZ 1024
 #endif
 #include <ctype.h>
+#include <limits.h>
 
 #include "spectre-utils.h"
+#include "spectre-zindex.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "ps.h"
 
@@ -93,13 +108,17 @@
 #define IIMESSAGE(it1,it2)
 #define INFIIMESSAGE(txt,it1,it2)
 
-#define PS_malloc(sss)        malloc    ((size_t)(sss)               )
-#define PS_calloc(ccc,sss)    calloc    ((size_t)(ccc),(size_t)(sss) )
-#define PS_realloc(ppp,sss)   realloc   ((void*) (ppp),(size_t)(sss) )
+/* allocations are counted when the library keeps statistics */
+#define PS_COUNT(aaa,sss)     (_spectre_stats_add(allocations, 1),	\
+                               _spectre_stats_add(allocated_bytes, (sss)), (aaa))
+
+#define PS_malloc(sss)        PS_COUNT(malloc    ((size_t)(sss)               ), (sss))
+#define PS_calloc(ccc,sss)    PS_COUNT(calloc    ((size_t)(ccc),(size_t)(sss) ), (ccc)*(sss))
+#define PS_realloc(ppp,sss)   PS_COUNT(realloc   ((void*) (ppp),(size_t)(sss) ), (sss))
 #define PS_free(ppp)          free      ((void*) (ppp)               )
 #define PS_cfree(ppp)         cfree     ((void*) (ppp)               )
-#define PS_XtMalloc(sss)      malloc    ((size_t)(sss)               )
-#define PS_XtRealloc(ppp,sss) realloc   ((void*) (ppp),(size_t)(sss) )
+#define PS_XtMalloc(sss)      PS_COUNT(malloc    ((size_t)(sss)               ), (sss))
+#define PS_XtRealloc(ppp,sss) PS_COUNT(realloc   ((void*) (ppp),(size_t)(sss) ), (sss))
 #define PS_XtFree(ppp)        free      ((void*) (ppp)               )
 
 
@@ -171,11 +190,18 @@ typedef enum {
 /*--------------------------------------------------*/
 /* Declarations for ps_io_*() routines. */
 
-typedef struct FileDataStruct_ *FileData;
+#define SKIPPED_LINE "% ps_io_fgetchars: skipped line"
 
 typedef struct FileDataStruct_ {
-   FILE *file;           /* file */
-   int   filepos;        /* file position corresponding to the start of the line */
+   FILE *file;           /* file, NULL when reading from data or desc */
+   int   desc;           /* read with pread(), -1 when reading from file or data */
+   off_t desc_pos;       /* read position in desc */
+   const char *data;     /* document contents, NULL when reading from file */
+   long  data_length;    /* length of data */
+   long  data_pos;       /* read position in data */
+   struct spool *spool;  /* grows data on demand, NULL if data is complete */
+   SpectreZReader *zreader; /* decompresses the input, NULL if not compressed */
+   off_t filepos;        /* file position corresponding to the start of the line */
    char *buf;            /* buffer */
    int   buf_size;       /* size of buffer */
    int   buf_end;        /* last char in buffer given as offset to buf */
@@ -184,30 +210,82 @@ typedef struct FileDataStruct_ {
    int   line_len;       /* length of line, i.e. (line_end-line_begin) */
    char  line_termchar;  /* char exchanged for a '\0' at end of line */
    int   status;         /* 0 = okay, 1 = failed */
+   struct skiprange *skips; /* ranges known to contain no DSC comments */
+   unsigned int n_skips;
+   unsigned int max_skips;
+   unsigned int next_skip;
+   char  empty_line[1];  /* returned when no line could be read */
+   char  skipped_line[sizeof(SKIPPED_LINE)]; /* returned for skipped sections */
 } FileDataStruct;
 
+/* Copy of a non-seekable input, read as the scan needs it */
+struct spool {
+   FILE *file;           /* input, NULL once it has been read completely */
+   char *data;
+   long  length;
+   long  allocated;
+};
+
+#define SPOOL_CHUNK_SIZE 65536
+
+/* A range of the file without any line starting with %%.
+   from is the start of a line and to is either the start of
+   a DSC comment line or the end of the file. */
+struct skiprange {
+   off_t from;
+   off_t to;
+};
+
+/* State of a suspended page scan, see psscan_pages() */
+struct scanstate {
+   off_t         enddoseps;
+   int           respect_eof;
+   int           bb_set;
+   int           pages_set;
+   int           page_order_set;
+   int           orientation_set;
+   unsigned int  declared_pages;  /* page count given by %%Pages:, if any */
+   unsigned int  maxpages;        /* number of allocated pages */
+   unsigned int  nextpage;
+   int           ignore;
+   char         *line;            /* first line of the next page */
+   off_t         position;
+   off_t         beginsection;
+   off_t         line_len;
+   off_t         section_len;
+   int           parallel;        /* look for page boundaries in parallel */
+};
+
 static FileData ps_io_init PT((FILE *));
+static FileData ps_io_init_data PT((const char *, long));
+static FileData ps_io_init_doc PT((FILE *, Document));
+static FileData ps_io_init_desc PT((int));
+static FileData ps_io_init_spool PT((struct spool *));
+static FileData ps_io_init_zindex PT((SpectreZIndex *, int));
+static void     ps_io_spool PT((FileData, long));
+static size_t   ps_io_fread PT((void *, size_t, size_t, FileData));
 static void     ps_io_exit PT((FileData));
 static void     ps_io_rewind PT((FileData));
 static char    *ps_io_fgetchars PT((FileData, int));
-static int      ps_io_fseek PT((FileData, int));
-static int      ps_io_ftell PT((FileData));
-
-static char    *readline PT((FileData, long, char **, long *, unsigned int *));
-static char    *readlineuntil PT((FileData, long, char **, long *, unsigned int *, char));
+static int      ps_io_fseek PT((FileData, off_t));
+static int      ps_io_fileno PT((FileData));
+static off_t    ps_io_ftell PT((FileData));
+static int      ps_io_copy PT((FileData, FILE *, off_t));
+static void     ps_io_find_skips PT((FileData));
+static int      ps_io_skip PT((FileData, off_t *));
+
+static char    *readline PT((FileData, off_t, char **, off_t *, off_t *));
+static char    *readlineuntil PT((FileData, off_t, char **, off_t *, off_t *, char));
 static char    *gettextline PT((char *));
 static char    *ps_gettext PT((char *,char **));
 static int      blank PT((char *));
-static char    *pscopyuntil PT((FileData,FILE *,long,long,char *));
+static char    *pscopyuntil PT((FileData,FILE *,off_t,off_t,char *));
 
 /* DOS EPS header reading */
 static unsigned long   ps_read_doseps PT((FileData, DOSEPS *));
 static PS_DWORD        reorder_dword PT((PS_DWORD));
 static PS_WORD         reorder_word PT((PS_WORD));
 
-static char    *skipped_line = "% ps_io_fgetchars: skipped line";
-static char    *empty_string = "";
-
 static Boolean scan_boundingbox(int *bb, const char *line)
 {
     char fllx[21], flly[21], furx[21], fury[21];
@@ -364,155 +442,583 @@ static Boolean scan_boundingbox(int *bb, const char *line)
 #define CHECK_MALLOCED(aaa)
 
 /*###########################################################*/
-/* psscan */
+/*
+ *	media_grow -- make room for one more media. The array holds the
+ *	next power of two entries, so that documents listing a lot of
+ *	them are not copied again for every one.
+ */
 /*###########################################################*/
 
-struct document *
-psscan(FILE *file, const char *filename, int scanstyle)
+static Media
+media_grow(Media media, unsigned int nummedia)
 {
-    struct document *doc;
-    int bb_set = NONE;
-    int pages_set = NONE;
-    int page_order_set = NONE;
-    int orientation_set = NONE;
-    int page_bb_set = NONE;
-    int page_media_set = NONE;
-    int preread;		/* flag which tells the readline isn't needed */
+    if (nummedia & (nummedia - 1))
+	return media;
+    return (Media) PS_realloc(media, (nummedia ? nummedia * 2 : 1) * sizeof(MediaStruct));
+}
+
+/*###########################################################*/
+/*
+ *	media_sort, media_find -- look up the media of a page among the
+ *	media of the document sorted by name, a linear search for every
+ *	page is quadratic with documents that list a lot of them. Equal
+ *	names keep their order, so that the first one is found.
+ */
+/*###########################################################*/
+
+static int
+media_compare(const void *a, const void *b)
+{
+    ConstMedia ma = *(const ConstMedia *) a;
+    ConstMedia mb = *(const ConstMedia *) b;
+    int result = strcmp(ma->name, mb->name);
+
+    return result ? result : (ma > mb) - (ma < mb);
+}
+
+static int
+media_compare_nocase(const void *a, const void *b)
+{
+    ConstMedia ma = *(const ConstMedia *) a;
+    ConstMedia mb = *(const ConstMedia *) b;
+    int result = _spectre_strcasecmp(ma->name, mb->name);
+
+    return result ? result : (ma > mb) - (ma < mb);
+}
+
+static ConstMedia *
+media_sort(const struct document *doc, int nocase)
+{
+    ConstMedia *sorted;
     unsigned int i;
-    unsigned int maxpages = 0;
-    unsigned int nextpage = 1;	/* Next expected page */
-    unsigned int thispage;
-    int ignore = 0;		/* whether to ignore page ordinals */
-    char *label;
-    char *line;
-                           	/* 255 characters + 1 newline + 1 NULL */
-    char text[PSLINELENGTH];	/* Temporary storage for text */
-    long position;		/* Position of the current line */
-    long beginsection;		/* Position of the beginning of the section */
-    unsigned int line_len; 	/* Length of the current line */
-    unsigned int section_len = 0; /* Place to accumulate the section length */
-    char *next_char;		/* 1st char after text returned by ps_gettext() */
-    char *cp;
-    ConstMedia dmp;
-    long enddoseps;             /* zero of not DOS EPS, otherwise position of end of ps section */
-    DOSEPS doseps;
-    FileData fd;
-    int respect_eof;            /* Derived from the scanstyle argument.
-                                   If set to 0 EOF comments will be ignored,
-                                   if set to 1 they will be taken seriously.
-                                   Purpose; Out there are many documents which 
-                                   include other DSC conforming documents without
-                                   without enclosing them by 'BeginDocument' and
-                                   'EndDocument' comments. This may cause fake EOF 
-				   comments to appear in the body of a page.
-				   Similarly, if respect_eof is set to false
-				   'Trailer' comments are ignored except of the
-				   last one found in the document.
-				*/
-    int ignore_dsc;             /* Derived from scanstyle.
-				   If set the document structure will be ignored.
-				*/
-    BEGINMESSAGE(psscan)
 
-    respect_eof = (scanstyle & SCANSTYLE_IGNORE_EOF) ? 0 : 1;
-    ignore_dsc = (scanstyle & SCANSTYLE_IGNORE_DSC) ? 1 : 0;
+    if (doc->nummedia == 0)
+	return NULL;
+    sorted = (ConstMedia *) PS_malloc(doc->nummedia * sizeof(ConstMedia));
+    if (!sorted)
+	return NULL;
+    for (i = 0; i < doc->nummedia; i++)
+	sorted[i] = doc->media + i;
+    qsort(sorted, doc->nummedia, sizeof(ConstMedia),
+	  nocase ? media_compare_nocase : media_compare);
+    return sorted;
+}
 
-    if (ignore_dsc) {
-      INFMESSAGE(ignoring DSC)
-      ENDMESSAGE(psscan)
-      return(NULL);
-    }
+static ConstMedia
+media_find(const struct document *doc, ConstMedia *sorted, const char *name, int nocase)
+{
+    unsigned int low = 0, high = doc->nummedia;
+    unsigned int i;
 
-    fd = ps_io_init(file);
-    
-    /* rjl: check for DOS EPS files and almost DSC files that start with ^D */
-    enddoseps = ps_read_doseps (fd, &doseps);
-    if (!readline(fd, enddoseps, &line, &position, &line_len)) {
-	fprintf(stderr, "Warning: empty file.\n");
-        ENDMESSAGE(psscan)
-        ps_io_exit(fd);
-	return(NULL);
-    }
+    if (!name)
+	return NULL;
 
-    /* HP printer job language data follows. Some printer drivers add pjl
-     * commands to switch a pjl printer to postscript mode. If no PS header
-     * follows, this seems to be a real pjl file. */
-    if(iscomment(line, "\033%-12345X@PJL")) {
-        /* read until first DSC comment */
-        readlineuntil(fd, enddoseps, &line, &position, &line_len, '%');
-	if(line[0] != '%') {
-	    fprintf(stderr, "psscan error: input files seems to be a PJL file.\n");
-	    ENDMESSAGE(psscan)
-	    ps_io_exit(fd);
-	    return (NULL);
+    /* Memory allocation failed, search them all */
+    if (!sorted) {
+	for (i = 0; i < doc->nummedia; i++) {
+	    if ((nocase ? _spectre_strcasecmp(name, doc->media[i].name) :
+			  strcmp(name, doc->media[i].name)) == 0)
+		return doc->media + i;
 	}
+	return NULL;
     }
 
-    // Initialize text so that all the strcmp we do after sscanf don't
-    // end up reading uninitialized memory if the sscanf fails
-    text[0] = '\0';
-
-    /* Header comments */
-    
-    /* Header should start with "%!PS-Adobe-", but some programms omit
-     * parts of this or add a ^D at the beginning. */
-    if ((iscomment(line,"%!PS") || iscomment(line, "\004%!PS"))) {
-      INFMESSAGE(found "PS-Adobe-" comment)
+    /* The first one that is not lower than name */
+    while (low < high) {
+	unsigned int middle = low + (high - low) / 2;
 
-      doc = (struct document *) PS_calloc(1, sizeof(struct document));
-      CHECK_MALLOCED(doc);
+	if ((nocase ? _spectre_strcasecmp(sorted[middle]->name, name) :
+		      strcmp(sorted[middle]->name, name)) < 0)
+	    low = middle + 1;
+	else
+	    high = middle;
+    }
+    if (low < doc->nummedia &&
+	(nocase ? _spectre_strcasecmp(sorted[low]->name, name) :
+		  strcmp(sorted[low]->name, name)) == 0)
+	return sorted[low];
+    return NULL;
+}
 
-      /* ignore possible leading ^D */
-      if (*line == '\004') {
-	  position++;
-	  line_len--;
-      }
+/*###########################################################*/
+/*
+ *	psscan_pages -- scan the pages and the trailer of a document
+ *	whose header, prolog and setup sections have already been scanned.
+ *	When maxscan is not zero the scan stops right before the page that
+ *	follows the first maxscan pages, leaving in doc->scan what is needed
+ *	to resume it later with psscancontinue().
+ */
+/*###########################################################*/
 
-      doc->ref_count = 1;
-      doc->filename = _spectre_strdup (filename);
-      doc->beginheader = position;
-      section_len = line_len;
+static void
+psscan_pages(FileData fd, struct document *doc, unsigned int maxscan)
+{
+    struct scanstate *st = doc->scan;
+    off_t enddoseps = st->enddoseps;
+    int respect_eof = st->respect_eof;
+    int bb_set = st->bb_set;
+    int pages_set = st->pages_set;
+    int page_order_set = st->page_order_set;
+    int orientation_set = st->orientation_set;
+    int page_bb_set = NONE;
+    int preread;
+    unsigned int maxpages = st->maxpages;
+    unsigned int nextpage = st->nextpage;
+    unsigned int thispage;
+    int ignore = st->ignore;
+    char *label;
+    char *line = st->line;
+    char text[PSLINELENGTH];
+    off_t position = st->position;
+    off_t beginsection = st->beginsection;
+    off_t line_len = st->line_len;
+    off_t section_len = st->section_len;
+    char *next_char;
+    char *cp;
+    ConstMedia *media_sorted = NULL;	/* looked up by %%PageMedia: */
+    ConstMedia *media_sorted_nocase = NULL;	/* and by %%PaperSize: */
 
-      text[0] = '\0';
-      sscanf(line, "%%!%256s %*s", text);
-      doc->format = _spectre_strdup (text);
-      
-      text[0] = '\0';
-      sscanf(line, "%*s %256s", text);
-      doc->epsf = iscomment(text, "EPSF");
-    } else {
-	/* There are postscript documents that do not have
-	   %PS at the beginning, usually unstructured. We should GS decide
-	   For instance, the tech reports at this university:
+    BEGINMESSAGE(psscan_pages)
 
-	   http://svrc.it.uq.edu.au/Bibliography/svrc-tr.html?94-45
+    text[0] = '\0';
 
-	   add ugly PostScript before the actual document. 
+    /* Only DSC comments matter from here on, when the whole document
+       is going to be scanned look for them in parallel first so that
+       the lines in between can be skipped. */
+    if (!maxscan && st->parallel && !enddoseps)
+	ps_io_find_skips(fd);
 
-	   GS and gv is
-	   able to display them correctly as unstructured PS.
+newpage:
+    while (DSCcomment(line) && iscomment(line+2, "Page:")) {
+	label = ps_gettext(line+length("%%Page:"), &next_char);
+	if (sscanf(next_char, "%u", &thispage) != 1) thispage = 0;
+	if (nextpage == 1) {
+	    ignore = thispage != 1;
+	}
+	if (!ignore && thispage != nextpage) {
+	    PS_free(label);
+	    doc->numpages--;
+	    goto continuepage;
+	}
+	if (maxscan && doc->numpages >= maxscan) {
+	    INFMESSAGE(suspending scan)
+	    PS_free(label);
+	    st->maxpages = maxpages;
+	    st->nextpage = nextpage;
+	    st->ignore = ignore;
+	    st->line = line;
+	    st->position = position;
+	    st->beginsection = beginsection;
+	    st->line_len = line_len;
+	    st->section_len = section_len;
+	    PS_free(media_sorted);
+	    PS_free(media_sorted_nocase);
+	    ENDMESSAGE(psscan_pages)
+	    return;
+	}
+	nextpage++;
+	if (doc->numpages == maxpages) {
+	    /* %%Pages: may be wrong, grow geometrically anyway */
+	    maxpages = maxpages < 16 ? maxpages + 16 : maxpages * 2;
+	    doc->pages = (struct page *)
+			 PS_realloc(doc->pages, maxpages*sizeof (struct page));
+            CHECK_MALLOCED(doc->pages);
 
-	   In a way, this makes sense, a program PostScript does not need
-	   the !PS at the beginning.
-	*/
-	doc = (struct document *) PS_calloc(1, sizeof(struct document));
-	CHECK_MALLOCED(doc);
-	doc->ref_count = 1;
-	doc->filename = _spectre_strdup (filename);
-	doc->default_page_orientation = NONE;
-	doc->orientation = NONE;
+	}
+	memset(&(doc->pages[doc->numpages]), 0, sizeof(struct page));
+	page_bb_set = NONE;
+	doc->pages[doc->numpages].label = label;
+	if (beginsection) {
+	    doc->pages[doc->numpages].begin = beginsection;
+	    beginsection = 0;
+	} else {
+	    doc->pages[doc->numpages].begin = position;
+	    section_len = line_len;
+	}
+continuepage:
+	while (readline(fd, enddoseps, &line, &position, &line_len) &&
+	       !(DSCcomment(line) &&
+	         (iscomment(line+2, "Page:") ||
+	          iscomment(line+2, "Trailer") ||
+	          (respect_eof && iscomment(line+2, "EOF"))))) {
+	    section_len += line_len;
+	    if (!DSCcomment(line)) {
+		/* Do nothing */
+	    } else if (doc->pages[doc->numpages].orientation == NONE &&
+		iscomment(line+2, "PageOrientation:")) {
+		const int res = sscanf(line+length("%%PageOrientation:"), "%256s", text);
+		if (res != EOF) {
+		    if (strcmp(text, "Portrait") == 0) {
+			doc->pages[doc->numpages].orientation = PORTRAIT;
+		    } else if (strcmp(text, "Landscape") == 0) {
+			doc->pages[doc->numpages].orientation = LANDSCAPE;
+		    } else if (strcmp(text, "Seascape") == 0) {
+			doc->pages[doc->numpages].orientation = SEASCAPE;
+		    } else if (strcmp(text, "UpsideDown") == 0) {
+			doc->pages[doc->numpages].orientation = UPSIDEDOWN;
+		    }
+		}
+	    } else if (doc->pages[doc->numpages].media == NULL &&
+		       iscomment(line+2, "PageMedia:")) {
+		cp = ps_gettext(line+length("%%PageMedia:"), NULL);
+		if (!media_sorted)
+		    media_sorted = media_sort(doc, False);
+		doc->pages[doc->numpages].media = media_find(doc, media_sorted, cp, False);
+		PS_free(cp);
+	    } else if (doc->pages[doc->numpages].media == NULL &&
+		       iscomment(line+2, "PaperSize:")) {
+		cp = ps_gettext(line+length("%%PaperSize:"), NULL);
+		/* Note: Paper size comment uses down cased paper size
+		 * name.  Case insensitive compares are only used for
+		 * PaperSize comments.
+		 */
+		if (!media_sorted_nocase)
+		    media_sorted_nocase = media_sort(doc, True);
+		doc->pages[doc->numpages].media = media_find(doc, media_sorted_nocase, cp, True);
+		PS_free(cp);
+	    } else if ((page_bb_set == NONE || page_bb_set == ATEND) &&
+		       iscomment(line+2, "PageBoundingBox:")) {
+		const int res = sscanf(line+length("%%PageBoundingBox:"), "%256s", text);
+		if ((res != EOF) && (strcmp(text, "(atend)") == 0 || strcmp(text, "atend") == 0)) {
+		    page_bb_set = ATEND;
+		} else {
+		    if (scan_boundingbox(doc->pages[doc->numpages].boundingbox,
+				line+length("%%PageBoundingBox:")))
+			if(page_bb_set == NONE)
+			    page_bb_set = 1;
+		}
+	    }
+	}
+	section_len += line_len;
+	doc->pages[doc->numpages].end = position;
+	doc->pages[doc->numpages].len = section_len - line_len;
+	doc->numpages++;
     }
 
-    if (enddoseps) { /* rjl: add doseps header */
-        doc->doseps = (DOSEPS *) malloc(sizeof(DOSEPS));
-	*(doc->doseps) = doseps;
+    /* Document Trailer */
+
+    if (beginsection) {
+	doc->begintrailer = beginsection;
+	beginsection = 0;
+    } else {
+	doc->begintrailer = position;
+	section_len = line_len;
     }
-    
-    preread = 0;
-    while (preread || readline(fd, enddoseps, &line, &position, &line_len)) {
-	if (!preread) section_len += line_len;
-	preread = 0;
-	if (line[0] != '%' ||
+
+    preread = 1;
+    while ((preread ||
+	    readline(fd, enddoseps, &line, &position, &line_len)) &&
+ 	   !(respect_eof && DSCcomment(line) && iscomment(line+2, "EOF"))) {
+	if (!preread) section_len += line_len;
+	preread = 0;
+	if (!DSCcomment(line)) {
+	    /* Do nothing */
+	} else if (iscomment(line+2, "Page:")) {
+	    PS_free(ps_gettext(line+length("%%Page:"), &next_char));
+	    if (sscanf(next_char, "%u", &thispage) != 1) thispage = 0;
+	    if (!ignore && thispage == nextpage) {
+		if (doc->numpages > 0) {
+		    doc->pages[doc->numpages-1].end = position;
+		    doc->pages[doc->numpages-1].len += section_len - line_len;
+		} else {
+		    if (doc->endsetup) {
+			doc->endsetup = position;
+			doc->endsetup += section_len - line_len;
+		    } else if (doc->endprolog) {
+			doc->endprolog = position;
+			doc->endprolog += section_len - line_len;
+		    }
+		}
+		goto newpage;
+	    }
+	} else if (!respect_eof && iscomment(line+2, "Trailer")) {
+	    /* What we thought was the start of the trailer was really */
+	    /* the trailer of an EPS on the page. */
+	    /* Set the end of the page to this trailer and keep scanning. */
+	    if (doc->numpages > 0) {
+		doc->pages[ doc->numpages-1 ].end = position;
+		doc->pages[ doc->numpages-1 ].len += section_len - line_len;
+	    }
+	    doc->begintrailer = position;
+	    section_len = line_len;
+	} else if (bb_set == ATEND && iscomment(line+2, "BoundingBox:")) {
+	    scan_boundingbox(doc->boundingbox, line + length("%%BoundingBox:"));
+	} else if (orientation_set == ATEND &&
+		   iscomment(line+2, "Orientation:")) {
+	    sscanf(line+length("%%Orientation:"), "%256s", text);
+	    if (strcmp(text, "Portrait") == 0) {
+		doc->orientation = PORTRAIT;
+	    } else if (strcmp(text, "Landscape") == 0) {
+		doc->orientation = LANDSCAPE;
+	    } else if (strcmp(text, "Seascape") == 0) {
+	        doc->orientation = SEASCAPE;
+	    } else if (strcmp(text, "UpsideDown") == 0) {
+	        doc->orientation = UPSIDEDOWN;
+	    }
+	} else if (page_order_set == ATEND && iscomment(line+2, "PageOrder:")) {
+	    sscanf(line+length("%%PageOrder:"), "%256s", text);
+	    if (strcmp(text, "Ascend") == 0) {
+		doc->pageorder = ASCEND;
+	    } else if (strcmp(text, "Descend") == 0) {
+		doc->pageorder = DESCEND;
+	    } else if (strcmp(text, "Special") == 0) {
+		doc->pageorder = SPECIAL;
+	    }
+	} else if (pages_set == ATEND && iscomment(line+2, "Pages:")) {
+	    int page_order;
+	    if (sscanf(line+length("%%Pages:"), "%*u %d", &page_order) == 1) {
+		if (page_order_set == NONE) {
+		    if (page_order == -1) doc->pageorder = DESCEND;
+		    else if (page_order == 0) doc->pageorder = SPECIAL;
+		    else if (page_order == 1) doc->pageorder = ASCEND;
+		}
+	    }
+	}
+    }
+    section_len += line_len;
+    if (DSCcomment(line) && iscomment(line+2, "EOF")) {
+        readline(fd, enddoseps, &line, &position, &line_len);
+	section_len += line_len;
+    } else if (doc->doseps) {
+        /* No EOF, make sure endtrailer <= ps_end */
+        off_t ps_end = doc->doseps->ps_begin + doc->doseps->ps_length;
+        if (position > ps_end) {
+            position = ps_end;
+	    section_len = position - doc->begintrailer;
+	    line_len = 0;
+	}
+    }
+    doc->endtrailer = position;
+    doc->lentrailer = section_len - line_len;
+
+#if 0
+    section_len = line_len;
+    preread = 1;
+    while (preread ||
+	   readline(fd, enddoseps, &line, &position, &line_len)) {
+	if (!preread) section_len += line_len;
+	preread = 0;
+	if (DSCcomment(line) && iscomment(line+2, "Page:")) {
+	    PS_free(ps_gettext(line+length("%%Page:"), &next_char));
+	    if (sscanf(next_char, "%d", &thispage) != 1) thispage = 0;
+	    if (!ignore && thispage == nextpage) {
+		if (doc->numpages > 0) {
+		    doc->pages[doc->numpages-1].end = position;
+		    doc->pages[doc->numpages-1].len += doc->lentrailer +
+						       section_len - line_len;
+		} else {
+		    if (doc->endsetup) {
+			doc->endsetup = position;
+			doc->endsetup += doc->lentrailer +
+					 section_len - line_len;
+		    } else if (doc->endprolog) {
+			doc->endprolog = position;
+			doc->endprolog += doc->lentrailer +
+					  section_len - line_len;
+		    }
+		}
+		goto newpage;
+	    }
+	}
+    }
+#endif
+
+    /* Keep whatever follows the document, so it can be saved */
+    if (fd->spool)
+	ps_io_spool(fd, LONG_MAX);
+
+    /* Kept to scan the last page again if the file grows */
+    st->maxpages = maxpages;
+    st->ignore = ignore;
+    st->line = NULL;
+    doc->scan = NULL;
+    doc->resume = st;
+    PS_free(media_sorted);
+    PS_free(media_sorted_nocase);
+    ENDMESSAGE(psscan_pages)
+}
+
+/*###########################################################*/
+/* psscan */
+/*###########################################################*/
+
+struct document *
+psscan(FILE *file, const char *filename, int scanstyle)
+{
+    return psscanpartial(file, filename, scanstyle, 0);
+}
+
+static struct document *
+psscan_fd(FileData fd, const char *filename, int scanstyle, unsigned int maxscan);
+
+struct document *
+psscanpartial(FILE *file, const char *filename, int scanstyle, unsigned int maxscan)
+{
+    struct document *doc;
+    SpectreZIndex *zindex;
+
+    /* Compressed files are indexed while they are scanned */
+    zindex = spectre_zindex_new(fileno(file));
+    if (!zindex)
+	return psscan_fd(ps_io_init(file), filename, scanstyle, maxscan);
+
+    doc = psscan_fd(ps_io_init_zindex(zindex, True), filename, scanstyle, maxscan);
+    if (doc)
+	doc->zindex = zindex;
+    else
+	spectre_zindex_free(zindex);
+    return doc;
+}
+
+struct document *
+psscandata(const char *data, long length, const char *filename, int scanstyle, unsigned int maxscan)
+{
+    return psscan_fd(ps_io_init_data(data, length), filename, scanstyle, maxscan);
+}
+
+struct document *
+psscanstream(FILE *file, const char *filename, int scanstyle, unsigned int maxscan)
+{
+    struct document *doc;
+    struct spool *spool;
+
+    spool = (struct spool *) PS_calloc(1, sizeof(struct spool));
+    CHECK_MALLOCED(spool);
+    spool->file = file;
+    spool->allocated = SPOOL_CHUNK_SIZE;
+    spool->data = (char *) PS_calloc(1, spool->allocated);
+    CHECK_MALLOCED(spool->data);
+
+    doc = psscan_fd(ps_io_init_spool(spool), filename, scanstyle, maxscan);
+    if (!doc) {
+	PS_free(spool->data);
+	PS_free(spool);
+    }
+    return doc;
+}
+
+/*###########################################################*/
+/*
+ *	psscan_header -- scan the header comments of a document. The
+ *	state needed to scan the rest of it, including the first line
+ *	after the header, is left in st.
+ */
+/*###########################################################*/
+
+static struct document *
+psscan_header(FileData fd, const char *filename, struct scanstate *st)
+{
+    struct document *doc;
+    int bb_set = NONE;
+    int pages_set = NONE;
+    int page_order_set = NONE;
+    int orientation_set = NONE;
+    int preread;		/* flag which tells the readline isn't needed */
+    unsigned int i;
+    unsigned int maxpages = 0;
+    char *line;
+                           	/* 255 characters + 1 newline + 1 NULL */
+    char text[PSLINELENGTH];	/* Temporary storage for text */
+    off_t position;		/* Position of the current line */
+    off_t line_len; 		/* Length of the current line */
+    off_t section_len = 0;	/* Place to accumulate the section length */
+    char *next_char;		/* 1st char after text returned by ps_gettext() */
+    char *cp;
+    ConstMedia dmp;
+    off_t enddoseps;            /* zero of not DOS EPS, otherwise position of end of ps section */
+    DOSEPS doseps;
+
+    BEGINMESSAGE(psscan_header)
+
+    /* rjl: check for DOS EPS files and almost DSC files that start with ^D */
+    enddoseps = ps_read_doseps (fd, &doseps);
+    if (!readline(fd, enddoseps, &line, &position, &line_len)) {
+	fprintf(stderr, "Warning: empty file.\n");
+        ENDMESSAGE(psscan_header)
+	return(NULL);
+    }
+
+    /* HP printer job language data follows. Some printer drivers add pjl
+     * commands to switch a pjl printer to postscript mode. If no PS header
+     * follows, this seems to be a real pjl file. */
+    if(iscomment(line, "\033%-12345X@PJL")) {
+        /* read until first DSC comment */
+        readlineuntil(fd, enddoseps, &line, &position, &line_len, '%');
+	if(line[0] != '%') {
+	    fprintf(stderr, "psscan error: input files seems to be a PJL file.\n");
+	    ENDMESSAGE(psscan_header)
+	    return (NULL);
+	}
+    }
+
+    // Initialize text so that all the strcmp we do after sscanf don't
+    // end up reading uninitialized memory if the sscanf fails
+    text[0] = '\0';
+
+    /* Header comments */
+    
+    /* Header should start with "%!PS-Adobe-", but some programms omit
+     * parts of this or add a ^D at the beginning. */
+    if ((iscomment(line,"%!PS") || iscomment(line, "\004%!PS"))) {
+      INFMESSAGE(found "PS-Adobe-" comment)
+
+      doc = (struct document *) PS_calloc(1, sizeof(struct document));
+      CHECK_MALLOCED(doc);
+
+      /* ignore possible leading ^D */
+      if (*line == '\004') {
+	  position++;
+	  line_len--;
+      }
+
+      doc->ref_count = 1;
+      doc->filename = _spectre_strdup (filename);
+      doc->spool = fd->spool;
+      doc->fd = -1;
+      doc->beginheader = position;
+      section_len = line_len;
+
+      text[0] = '\0';
+      sscanf(line, "%%!%256s %*s", text);
+      doc->format = _spectre_strdup (text);
+      
+      text[0] = '\0';
+      sscanf(line, "%*s %256s", text);
+      doc->epsf = iscomment(text, "EPSF");
+    } else {
+	/* There are postscript documents that do not have
+	   %PS at the beginning, usually unstructured. We should GS decide
+	   For instance, the tech reports at this university:
+
+	   http://svrc.it.uq.edu.au/Bibliography/svrc-tr.html?94-45
+
+	   add ugly PostScript before the actual document. 
+
+	   GS and gv is
+	   able to display them correctly as unstructured PS.
+
+	   In a way, this makes sense, a program PostScript does not need
+	   the !PS at the beginning.
+	*/
+	doc = (struct document *) PS_calloc(1, sizeof(struct document));
+	CHECK_MALLOCED(doc);
+	doc->ref_count = 1;
+	doc->filename = _spectre_strdup (filename);
+	doc->fd = -1;
+	doc->default_page_orientation = NONE;
+	doc->orientation = NONE;
+    }
+
+    if (enddoseps) { /* rjl: add doseps header */
+        doc->doseps = (DOSEPS *) malloc(sizeof(DOSEPS));
+	*(doc->doseps) = doseps;
+    }
+    
+    preread = 0;
+    while (preread || readline(fd, enddoseps, &line, &position, &line_len)) {
+	if (!preread) section_len += line_len;
+	preread = 0;
+	if (line[0] != '%' ||
 	    iscomment(line+1, "%EndComments") ||
 	    line[1] == ' ' || line[1] == '\t' || line[1] == '\n' ||
 	    !isprint(line[1])) {
@@ -625,10 +1131,7 @@ psscan(FILE *file, const char *filename, int scanstyle)
 	    while (readline(fd, enddoseps, &line, &position, &line_len) &&
 		   DSCcomment(line) && iscomment(line+2, "+")) {
 		section_len += line_len;
-		doc->media = (Media)
-			     PS_realloc(doc->media,
-				     (doc->nummedia+1)*
-				     sizeof (MediaStruct));
+		doc->media = media_grow(doc->media, doc->nummedia);
 		CHECK_MALLOCED(doc->media);
 		memset (doc->media + doc->nummedia, 0, sizeof (MediaStruct));
 		doc->media[doc->nummedia].name = ps_gettext(line+length("%%+"),
@@ -681,10 +1184,7 @@ psscan(FILE *file, const char *filename, int scanstyle)
 		}
 	    }
 	    while ((cp = ps_gettext(next_char, &next_char))) {
-		doc->media = (Media)
-			     PS_realloc(doc->media,
-				     (doc->nummedia+1)*
-				     sizeof (MediaStruct));
+		doc->media = media_grow(doc->media, doc->nummedia);
                 CHECK_MALLOCED(doc->media);
 		memset (doc->media + doc->nummedia, 0, sizeof (MediaStruct));
 		doc->media[doc->nummedia].name = cp;
@@ -719,10 +1219,7 @@ psscan(FILE *file, const char *filename, int scanstyle)
 		section_len += line_len;
 		next_char = line + length("%%+");
 		while ((cp = ps_gettext(next_char, &next_char))) {
-		    doc->media = (Media)
-				 PS_realloc(doc->media,
-					 (doc->nummedia+1)*
-					 sizeof (MediaStruct));
+		    doc->media = media_grow(doc->media, doc->nummedia);
                     CHECK_MALLOCED(doc->media);
 		    memset (doc->media + doc->nummedia, 0, sizeof (MediaStruct));
 		    doc->media[doc->nummedia].name = cp;
@@ -759,6 +1256,86 @@ psscan(FILE *file, const char *filename, int scanstyle)
     doc->endheader = position;
     doc->lenheader = section_len - line_len;
 
+    st->enddoseps = enddoseps;
+    st->bb_set = bb_set;
+    st->pages_set = pages_set;
+    st->page_order_set = page_order_set;
+    st->orientation_set = orientation_set;
+    st->declared_pages = maxpages;
+    st->line = line;
+    st->position = position;
+    st->line_len = line_len;
+    st->section_len = section_len;
+
+    ENDMESSAGE(psscan_header)
+    return doc;
+}
+
+static struct document *
+psscan_doc(FileData fd, const char *filename, int scanstyle, unsigned int maxscan)
+{
+    struct document *doc;
+    struct scanstate *st;
+    int page_bb_set = NONE;
+    int page_media_set = NONE;
+    int preread;		/* flag which tells the readline isn't needed */
+    unsigned int i;
+    unsigned int maxpages;
+    unsigned int nextpage = 1;	/* Next expected page */
+    int ignore = 0;		/* whether to ignore page ordinals */
+    char *line;
+                           	/* 255 characters + 1 newline + 1 NULL */
+    char text[PSLINELENGTH];	/* Temporary storage for text */
+    off_t position;		/* Position of the current line */
+    off_t beginsection;		/* Position of the beginning of the section */
+    off_t line_len; 		/* Length of the current line */
+    off_t section_len;		/* Place to accumulate the section length */
+    char *cp;
+    ConstMedia dmp;
+    off_t enddoseps;            /* zero of not DOS EPS, otherwise position of end of ps section */
+    int respect_eof;            /* Derived from the scanstyle argument.
+                                   If set to 0 EOF comments will be ignored,
+                                   if set to 1 they will be taken seriously.
+                                   Purpose; Out there are many documents which 
+                                   include other DSC conforming documents without
+                                   without enclosing them by 'BeginDocument' and
+                                   'EndDocument' comments. This may cause fake EOF 
+				   comments to appear in the body of a page.
+				   Similarly, if respect_eof is set to false
+				   'Trailer' comments are ignored except of the
+				   last one found in the document.
+				*/
+    int ignore_dsc;             /* Derived from scanstyle.
+				   If set the document structure will be ignored.
+				*/
+    BEGINMESSAGE(psscan)
+
+    respect_eof = (scanstyle & SCANSTYLE_IGNORE_EOF) ? 0 : 1;
+    ignore_dsc = (scanstyle & SCANSTYLE_IGNORE_DSC) ? 1 : 0;
+
+    if (ignore_dsc) {
+      INFMESSAGE(ignoring DSC)
+      ENDMESSAGE(psscan)
+      ps_io_exit(fd);
+      return(NULL);
+    }
+
+    st = (struct scanstate *) PS_calloc(1, sizeof(struct scanstate));
+    CHECK_MALLOCED(st);
+    doc = psscan_header(fd, filename, st);
+    if (!doc) {
+        PS_free(st);
+        ENDMESSAGE(psscan)
+        ps_io_exit(fd);
+        return(NULL);
+    }
+    enddoseps = st->enddoseps;
+    maxpages = st->declared_pages;
+    line = st->line;
+    position = st->position;
+    line_len = st->line_len;
+    section_len = st->section_len;
+
     /* Optional Preview comments for encapsulated PostScript files */ 
 
     beginsection = position;
@@ -1006,239 +1583,283 @@ psscan(FILE *file, const char *filename, int scanstyle)
 	section_len += line_len;
     }
 
+    st->respect_eof = respect_eof;
+    st->parallel = (scanstyle & SCANSTYLE_SERIAL) ? 0 : 1;
+    st->nextpage = nextpage;
+    st->ignore = ignore;
+    st->line = line;
+    st->position = position;
+    st->beginsection = beginsection;
+    st->line_len = line_len;
+    st->section_len = section_len;
+
     if (maxpages == 0) {
 	maxpages = 1;
 	PS_free(doc->pages);
 	doc->pages = (struct page *) PS_calloc(maxpages, sizeof(struct page));
 	CHECK_MALLOCED(doc->pages);
     }
+    st->maxpages = maxpages;
+    doc->scan = st;
 
-newpage:
-    while (DSCcomment(line) && iscomment(line+2, "Page:")) {
-	label = ps_gettext(line+length("%%Page:"), &next_char);
-	if (sscanf(next_char, "%u", &thispage) != 1) thispage = 0;
-	if (nextpage == 1) {
-	    ignore = thispage != 1;
-	}
-	if (!ignore && thispage != nextpage) {
-	    PS_free(label);
-	    doc->numpages--;
-	    goto continuepage;
-	}
-	nextpage++;
-	if (doc->numpages == maxpages) {
-	    maxpages++;
-	    doc->pages = (struct page *)
-			 PS_realloc(doc->pages, maxpages*sizeof (struct page));
-            CHECK_MALLOCED(doc->pages);
+    /* Values deferred to the trailer are needed by every page,
+       so those documents are always scanned completely. */
+    if (st->bb_set == ATEND || st->orientation_set == ATEND ||
+	st->page_order_set == ATEND || doc->pageorder == DESCEND)
+	maxscan = 0;
 
-	}
-	memset(&(doc->pages[doc->numpages]), 0, sizeof(struct page));
-	page_bb_set = NONE;
-	doc->pages[doc->numpages].label = label;
-	if (beginsection) {
-	    doc->pages[doc->numpages].begin = beginsection;
-	    beginsection = 0;
+    psscan_pages(fd, doc, maxscan);
+
+    /* The spool may have moved while scanning */
+    doc->data = fd->data;
+    doc->data_length = fd->data_length;
+
+    ENDMESSAGE(psscan)
+    ps_io_exit(fd);
+    return doc;
+}
+
+/* Every scan is a trace span */
+static struct document *
+psscan_fd(FileData fd, const char *filename, int scanstyle, unsigned int maxscan)
+{
+    struct document *doc;
+
+    _spectre_trace_begin("psscan", "file", filename, (const char *) NULL);
+    doc = psscan_doc(fd, filename, scanstyle, maxscan);
+    _spectre_trace_end("psscan");
+    return doc;
+}
+
+/*###########################################################*/
+/*
+ *	psprobe -- scan the header comments of a document and, for the
+ *	values deferred to the trailer, the end of the document. The
+ *	trailer is looked for in a growing tail of the file, so only
+ *	what follows the last page is usually read.
+ */
+/*###########################################################*/
+
+#define PROBE_TAIL_SIZE 16384
+
+static void
+psprobe_trailer(FileData fd, struct document *doc, struct scanstate *st)
+{
+    struct stat stat_buf;
+    char text[PSLINELENGTH];
+    char *line;
+    off_t end = -1;		/* end of the PostScript, -1 to read until EOF */
+    off_t tail;
+    int trailer;		/* whether the lines are in a trailer */
+    int found = 0;
+
+    BEGINMESSAGE(psprobe_trailer)
+
+    text[0] = '\0';
+    if (st->enddoseps) {
+	end = st->enddoseps;
+    } else if (!fd->zreader && fstat(ps_io_fileno(fd), &stat_buf) == 0 &&
+	       S_ISREG(stat_buf.st_mode)) {
+	end = stat_buf.st_size;
+    }
+
+    for (tail = PROBE_TAIL_SIZE; !found; tail *= 2) {
+	off_t begin = doc->endheader;
+
+	trailer = 0;
+	if (end >= 0 && end - tail > begin) {
+	    /* Start at the beginning of a line */
+	    begin = end - tail;
+	    ps_io_fseek(fd, begin - 1);
+	    ps_io_fgetchars(fd, -1);
 	} else {
-	    doc->pages[doc->numpages].begin = position;
-	    section_len = line_len;
+	    ps_io_fseek(fd, begin);
 	}
-continuepage:
-	while (readline(fd, enddoseps, &line, &position, &line_len) &&
-	       !(DSCcomment(line) &&
-	         (iscomment(line+2, "Page:") ||
-	          iscomment(line+2, "Trailer") ||
-	          (respect_eof && iscomment(line+2, "EOF"))))) {
-	    section_len += line_len;
+
+	while ((end < 0 || ps_io_ftell(fd) < end) &&
+	       (line = ps_io_fgetchars(fd, -1))) {
 	    if (!DSCcomment(line)) {
 		/* Do nothing */
-	    } else if (doc->pages[doc->numpages].orientation == NONE &&
-		iscomment(line+2, "PageOrientation:")) {
-		const int res = sscanf(line+length("%%PageOrientation:"), "%256s", text);
-		if (res != EOF) {
-		    if (strcmp(text, "Portrait") == 0) {
-			doc->pages[doc->numpages].orientation = PORTRAIT;
-		    } else if (strcmp(text, "Landscape") == 0) {
-			doc->pages[doc->numpages].orientation = LANDSCAPE;
-		    } else if (strcmp(text, "Seascape") == 0) {
-			doc->pages[doc->numpages].orientation = SEASCAPE;
-		    } else if (strcmp(text, "UpsideDown") == 0) {
-			doc->pages[doc->numpages].orientation = UPSIDEDOWN;
-		    }
-		}
-	    } else if (doc->pages[doc->numpages].media == NULL &&
-		       iscomment(line+2, "PageMedia:")) {
-		cp = ps_gettext(line+length("%%PageMedia:"), NULL);
-		for (dmp = doc->media, i=0; i<doc->nummedia; i++, dmp++) {
-		    if (cp && strcmp(cp, dmp->name) == 0) {
-			doc->pages[doc->numpages].media = dmp;
-			break;
-		    }
+	    } else if (iscomment(line+2, "Trailer")) {
+		trailer = found = 1;
+	    } else if (iscomment(line+2, "EOF")) {
+		trailer = 0;
+	    } else if (!trailer) {
+		/* Do nothing */
+	    } else if (st->bb_set == ATEND && iscomment(line+2, "BoundingBox:")) {
+		scan_boundingbox(doc->boundingbox, line + length("%%BoundingBox:"));
+	    } else if (st->orientation_set == ATEND &&
+		       iscomment(line+2, "Orientation:")) {
+		sscanf(line+length("%%Orientation:"), "%256s", text);
+		if (strcmp(text, "Portrait") == 0) {
+		    doc->orientation = PORTRAIT;
+		} else if (strcmp(text, "Landscape") == 0) {
+		    doc->orientation = LANDSCAPE;
+		} else if (strcmp(text, "Seascape") == 0) {
+		    doc->orientation = SEASCAPE;
+		} else if (strcmp(text, "UpsideDown") == 0) {
+		    doc->orientation = UPSIDEDOWN;
 		}
-		PS_free(cp);
-	    } else if (doc->pages[doc->numpages].media == NULL &&
-		       iscomment(line+2, "PaperSize:")) {
-		cp = ps_gettext(line+length("%%PaperSize:"), NULL);
-		for (dmp = doc->media, i=0; i<doc->nummedia; i++, dmp++) {
-		    /* Note: Paper size comment uses down cased paper size
-		     * name.  Case insensitive compares are only used for
-		     * PaperSize comments.
-		     */
-		    if (cp && _spectre_strcasecmp(cp, dmp->name) == 0) {
-			doc->pages[doc->numpages].media = dmp;
-			break;
-		    }
+	    } else if (st->page_order_set == ATEND && iscomment(line+2, "PageOrder:")) {
+		sscanf(line+length("%%PageOrder:"), "%256s", text);
+		if (strcmp(text, "Ascend") == 0) {
+		    doc->pageorder = ASCEND;
+		} else if (strcmp(text, "Descend") == 0) {
+		    doc->pageorder = DESCEND;
+		} else if (strcmp(text, "Special") == 0) {
+		    doc->pageorder = SPECIAL;
 		}
-		PS_free(cp);
-	    } else if ((page_bb_set == NONE || page_bb_set == ATEND) &&
-		       iscomment(line+2, "PageBoundingBox:")) {
-		const int res = sscanf(line+length("%%PageBoundingBox:"), "%256s", text);
-		if ((res != EOF) && (strcmp(text, "(atend)") == 0 || strcmp(text, "atend") == 0)) {
-		    page_bb_set = ATEND;
-		} else {
-		    if (scan_boundingbox(doc->pages[doc->numpages].boundingbox,
-				line+length("%%PageBoundingBox:")))
-			if(page_bb_set == NONE)
-			    page_bb_set = 1;
+	    } else if (st->pages_set == ATEND && iscomment(line+2, "Pages:")) {
+		int page_order;
+
+		switch (sscanf(line+length("%%Pages:"), "%u %d",
+			       &st->declared_pages, &page_order)) {
+		    case 2:
+			if (st->page_order_set == NONE) {
+			    if (page_order == -1) doc->pageorder = DESCEND;
+			    else if (page_order == 0) doc->pageorder = SPECIAL;
+			    else if (page_order == 1) doc->pageorder = ASCEND;
+			}
+			break;
+		    case 1:
+			break;
+		    default:
+			st->declared_pages = 0;
 		}
 	    }
 	}
-	section_len += line_len;
-	doc->pages[doc->numpages].end = position;
-	doc->pages[doc->numpages].len = section_len - line_len;
-	doc->numpages++;
+
+	/* The whole document has been read */
+	if (begin == doc->endheader)
+	    break;
     }
 
-    /* Document Trailer */
+    ENDMESSAGE(psprobe_trailer)
+}
 
-    if (beginsection) {
-	doc->begintrailer = beginsection;
-	beginsection = 0;
-    } else {
-	doc->begintrailer = position;
-	section_len = line_len;
+struct document *
+psprobe(FILE *file, const char *filename, unsigned int *pagesP)
+{
+    struct document *doc;
+    struct scanstate st;
+    SpectreZIndex *zindex;
+    FileData fd;
+
+    BEGINMESSAGE(psprobe)
+
+    zindex = spectre_zindex_new(fileno(file));
+    fd = zindex ? ps_io_init_zindex(zindex, False) : ps_io_init(file);
+
+    memset(&st, 0, sizeof(struct scanstate));
+    doc = psscan_header(fd, filename, &st);
+    if (doc) {
+	/* Only the header was scanned, there are no pages yet */
+	PS_free(doc->pages);
+	doc->pages = NULL;
+	if (st.bb_set == ATEND || st.pages_set == ATEND ||
+	    st.page_order_set == ATEND || st.orientation_set == ATEND)
+	    psprobe_trailer(fd, doc, &st);
+	*pagesP = st.declared_pages;
     }
 
-    preread = 1;
-    while ((preread ||
-	    readline(fd, enddoseps, &line, &position, &line_len)) &&
- 	   !(respect_eof && DSCcomment(line) && iscomment(line+2, "EOF"))) {
-	if (!preread) section_len += line_len;
-	preread = 0;
-	if (!DSCcomment(line)) {
-	    /* Do nothing */
-	} else if (iscomment(line+2, "Page:")) {
-	    PS_free(ps_gettext(line+length("%%Page:"), &next_char));
-	    if (sscanf(next_char, "%u", &thispage) != 1) thispage = 0;
-	    if (!ignore && thispage == nextpage) {
-		if (doc->numpages > 0) {
-		    doc->pages[doc->numpages-1].end = position;
-		    doc->pages[doc->numpages-1].len += section_len - line_len;
-		} else {
-		    if (doc->endsetup) {
-			doc->endsetup = position;
-			doc->endsetup += section_len - line_len;
-		    } else if (doc->endprolog) {
-			doc->endprolog = position;
-			doc->endprolog += section_len - line_len;
-		    }
-		}
-		goto newpage;
-	    }
-	} else if (!respect_eof && iscomment(line+2, "Trailer")) {
-	    /* What we thought was the start of the trailer was really */
-	    /* the trailer of an EPS on the page. */
-	    /* Set the end of the page to this trailer and keep scanning. */
-	    if (doc->numpages > 0) {
-		doc->pages[ doc->numpages-1 ].end = position;
-		doc->pages[ doc->numpages-1 ].len += section_len - line_len;
-	    }
-	    doc->begintrailer = position;
-	    section_len = line_len;
-	} else if (bb_set == ATEND && iscomment(line+2, "BoundingBox:")) {
-	    scan_boundingbox(doc->boundingbox, line + length("%%BoundingBox:"));
-	} else if (orientation_set == ATEND &&
-		   iscomment(line+2, "Orientation:")) {
-	    sscanf(line+length("%%Orientation:"), "%256s", text);
-	    if (strcmp(text, "Portrait") == 0) {
-		doc->orientation = PORTRAIT;
-	    } else if (strcmp(text, "Landscape") == 0) {
-		doc->orientation = LANDSCAPE;
-	    } else if (strcmp(text, "Seascape") == 0) {
-	        doc->orientation = SEASCAPE;
-	    } else if (strcmp(text, "UpsideDown") == 0) {
-	        doc->orientation = UPSIDEDOWN;
-	    }
-	} else if (page_order_set == ATEND && iscomment(line+2, "PageOrder:")) {
-	    sscanf(line+length("%%PageOrder:"), "%256s", text);
-	    if (strcmp(text, "Ascend") == 0) {
-		doc->pageorder = ASCEND;
-	    } else if (strcmp(text, "Descend") == 0) {
-		doc->pageorder = DESCEND;
-	    } else if (strcmp(text, "Special") == 0) {
-		doc->pageorder = SPECIAL;
-	    }
-	} else if (pages_set == ATEND && iscomment(line+2, "Pages:")) {
-	    int page_order;
-	    if (sscanf(line+length("%%Pages:"), "%*u %d", &page_order) == 1) {
-		if (page_order_set == NONE) {
-		    if (page_order == -1) doc->pageorder = DESCEND;
-		    else if (page_order == 0) doc->pageorder = SPECIAL;
-		    else if (page_order == 1) doc->pageorder = ASCEND;
-		}
-	    }
-	}
+    ps_io_exit(fd);
+    if (zindex)
+	spectre_zindex_free(zindex);
+    ENDMESSAGE(psprobe)
+    return doc;
+}
+
+int
+psscancontinue(FILE *file, struct document *doc, unsigned int maxscan)
+{
+    struct scanstate *st = doc->scan;
+    FileData fd;
+
+    BEGINMESSAGE(psscancontinue)
+    if (!st) {
+	ENDMESSAGE(psscancontinue)
+	return True;
     }
-    section_len += line_len;
-    if (DSCcomment(line) && iscomment(line+2, "EOF")) {
-        readline(fd, enddoseps, &line, &position, &line_len);
-	section_len += line_len;
-    } else if (doc->doseps) {
-        /* No EOF, make sure endtrailer <= ps_end */
-        long ps_end = doc->doseps->ps_begin + doc->doseps->ps_length;
-        if (position > ps_end) {
-            position = ps_end;
-	    section_len = position - doc->begintrailer;
-	    line_len = 0;
-	}
+    if (maxscan && doc->numpages >= maxscan) {
+	ENDMESSAGE(psscancontinue)
+	return False;
     }
-    doc->endtrailer = position;
-    doc->lentrailer = section_len - line_len;
 
-#if 0
-    section_len = line_len;
-    preread = 1;
-    while (preread ||
-	   readline(fd, enddoseps, &line, &position, &line_len)) {
-	if (!preread) section_len += line_len;
-	preread = 0;
-	if (DSCcomment(line) && iscomment(line+2, "Page:")) {
-	    PS_free(ps_gettext(line+length("%%Page:"), &next_char));
-	    if (sscanf(next_char, "%d", &thispage) != 1) thispage = 0;
-	    if (!ignore && thispage == nextpage) {
-		if (doc->numpages > 0) {
-		    doc->pages[doc->numpages-1].end = position;
-		    doc->pages[doc->numpages-1].len += doc->lentrailer +
-						       section_len - line_len;
-		} else {
-		    if (doc->endsetup) {
-			doc->endsetup = position;
-			doc->endsetup += doc->lentrailer +
-					 section_len - line_len;
-		    } else if (doc->endprolog) {
-			doc->endprolog = position;
-			doc->endprolog += doc->lentrailer +
-					  section_len - line_len;
-		    }
-		}
-		goto newpage;
-	    }
-	}
+    /* The line the scan was suspended at is read again, nothing
+       before it is needed to resume. */
+    if (doc->zindex)
+	fd = ps_io_init_zindex(doc->zindex, True);
+    else
+	fd = ps_io_init_doc(file, doc);
+    ps_io_fseek(fd, st->position);
+    readline(fd, st->enddoseps, &st->line, &st->position, &st->line_len);
+
+    _spectre_trace_begin("psscan", "file", doc->filename, (const char *) NULL);
+    psscan_pages(fd, doc, maxscan);
+    _spectre_trace_end("psscan");
+
+    doc->data = fd->data;
+    doc->data_length = fd->data_length;
+
+    ps_io_exit(fd);
+    ENDMESSAGE(psscancontinue)
+    return doc->scan == NULL;
+}
+
+int
+psscanresume(FILE *file, struct document *doc)
+{
+    struct scanstate *st = doc->resume;
+    unsigned int last;
+    FileData fd;
+
+    BEGINMESSAGE(psscanresume)
+    /* Only complete scans of plain files are resumed, the first page
+       may begin before its %%Page: comment so at least two are needed. */
+    if (!st || doc->scan || doc->zindex || doc->data || doc->spool ||
+	st->enddoseps || doc->numpages < 2) {
+	ENDMESSAGE(psscanresume)
+	return False;
     }
-#endif
-    ENDMESSAGE(psscan)
+
+    last = doc->numpages - 1;
+    fd = ps_io_init_doc(file, doc);
+    ps_io_fseek(fd, doc->pages[last].begin);
+    if (!readline(fd, st->enddoseps, &st->line, &st->position, &st->line_len) ||
+	!DSCcomment(st->line) || !iscomment(st->line+2, "Page:")) {
+	INFMESSAGE(last page moved)
+	ps_io_exit(fd);
+	ENDMESSAGE(psscanresume)
+	return False;
+    }
+
+    /* The last page and the trailer are scanned again as if the scan
+       had been suspended right before that page. */
+    if (doc->pages[last].label) PS_free(doc->pages[last].label);
+    doc->numpages = last;
+    st->nextpage = last + 1;
+    st->beginsection = 0;
+    st->section_len = 0;
+    doc->scan = st;
+    doc->resume = NULL;
+
+    psscan_pages(fd, doc, 0);
+
     ps_io_exit(fd);
-    return doc;
+    ENDMESSAGE(psscanresume)
+    return True;
+}
+
+unsigned int
+psscanestimate(const struct document *doc)
+{
+    if (!doc->scan)
+	return doc->numpages;
+
+    /* A suspended scan always stops before a new page */
+    if (doc->scan->declared_pages > doc->numpages)
+	return doc->scan->declared_pages;
+    return doc->numpages + 1;
 }
 
 /*###########################################################*/
@@ -1270,6 +1891,14 @@ psfree(struct document *doc)
 	if (doc->media) PS_free(doc->media);
 	if (doc->languagelevel) PS_free(doc->languagelevel);
 	if (doc->doseps) free(doc->doseps); /* rjl: */
+	if (doc->scan) PS_free(doc->scan);
+	if (doc->resume) PS_free(doc->resume);
+	if (doc->spool) {
+	    PS_free(doc->spool->data);
+	    PS_free(doc->spool);
+	}
+	if (doc->fd >= 0) close(doc->fd);
+	spectre_zindex_free(doc->zindex);
 	PS_free(doc);
     }
     ENDMESSAGE(psfree)
@@ -1281,10 +1910,9 @@ psdocdestroy (struct document *doc)
     if (!doc)
         return;
 
-    _spectre_assert (doc->ref_count > 0);
+    _spectre_assert (_spectre_atomic_get (&doc->ref_count) > 0);
 
-    doc->ref_count--;
-    if (doc->ref_count)
+    if (!_spectre_atomic_dec_and_test (&doc->ref_count))
         return;
 
     psfree (doc);
@@ -1296,9 +1924,9 @@ psdocreference (struct document *doc)
     if (!doc)
         return NULL;
 
-    _spectre_assert (doc->ref_count > 0);
+    _spectre_assert (_spectre_atomic_get (&doc->ref_count) > 0);
 
-    doc->ref_count++;
+    _spectre_atomic_inc (&doc->ref_count);
 
     return doc;
 }
@@ -1435,49 +2063,230 @@ ps_gettext(line, next_char)
 }
 
 /*----------------------------------------------------------*/
-/* ps_io_init */
+/* ps_io_init */
+/*----------------------------------------------------------*/
+
+#define FD_FILE             (fd->file)
+#define FD_FILEPOS	    (fd->filepos)
+#define FD_LINE_BEGIN       (fd->line_begin)
+#define FD_LINE_END	    (fd->line_end)
+#define FD_LINE_LEN	    (fd->line_len)
+#define FD_LINE_TERMCHAR    (fd->line_termchar)
+#define FD_BUF		    (fd->buf)
+#define FD_BUF_END	    (fd->buf_end)
+#define FD_BUF_SIZE	    (fd->buf_size)
+#define FD_STATUS	    (fd->status)
+
+#define FD_STATUS_OKAY        0
+#define FD_STATUS_BUFTOOLARGE 1
+#define FD_STATUS_NOMORECHARS 2
+
+#define LINE_CHUNK_SIZE     4096
+#define MAX_PS_IO_FGETCHARS_BUF_SIZE 57344
+#define BREAK_PS_IO_FGETCHARS_BUF_SIZE 49152
+
+static FileData ps_io_init(file)
+   FILE *file;
+{
+   FileData fd;
+   size_t size = sizeof(FileDataStruct);
+
+   BEGINMESSAGE(ps_io_init)
+
+   fd = (FileData) PS_XtMalloc(size);
+   memset((void*) fd ,0,(size_t)size);
+
+   rewind(file);
+   FD_FILE      = file;
+   fd->desc     = -1;
+   FD_FILEPOS   = ftello(file);
+   FD_BUF_SIZE  = (2*LINE_CHUNK_SIZE)+1;
+   FD_BUF       = PS_XtMalloc(FD_BUF_SIZE);
+   FD_BUF[0]    = '\0';
+   strcpy(fd->skipped_line, SKIPPED_LINE);
+   
+   ENDMESSAGE(ps_io_init)
+	   
+   return(fd);
+}
+
+static FileData
+ps_io_init_data(const char *data, long length)
+{
+   FileData fd;
+
+   BEGINMESSAGE(ps_io_init_data)
+
+   fd = (FileData) PS_XtMalloc(sizeof(FileDataStruct));
+   memset((void*) fd, 0, sizeof(FileDataStruct));
+
+   fd->data        = data;
+   fd->data_length = length;
+   fd->desc        = -1;
+   FD_BUF_SIZE     = (2*LINE_CHUNK_SIZE)+1;
+   FD_BUF          = PS_XtMalloc(FD_BUF_SIZE);
+   FD_BUF[0]       = '\0';
+   strcpy(fd->skipped_line, SKIPPED_LINE);
+
+   ENDMESSAGE(ps_io_init_data)
+
+   return(fd);
+}
+
+static FileData
+ps_io_init_spool(struct spool *spool)
+{
+   FileData fd;
+
+   fd = ps_io_init_data(spool->data, spool->length);
+   fd->spool = spool;
+
+   return(fd);
+}
+
+static FileData
+ps_io_init_zindex(SpectreZIndex *zindex, int build)
+{
+   FileData fd;
+
+   fd = ps_io_init_data(NULL, 0);
+   fd->zreader = spectre_zreader_new(zindex, build);
+   CHECK_MALLOCED(fd->zreader);
+
+   return(fd);
+}
+
+/*
+   Reads from a descriptor shared with other readers, with positional
+   reads that don't move its offset, so that several of them can read
+   from it at the same time.
+*/
+static FileData
+ps_io_init_desc(int desc)
+{
+   FileData fd;
+
+   BEGINMESSAGE(ps_io_init_desc)
+
+   fd = (FileData) PS_XtMalloc(sizeof(FileDataStruct));
+   memset((void*) fd, 0, sizeof(FileDataStruct));
+
+   fd->desc        = desc;
+   FD_BUF_SIZE     = (2*LINE_CHUNK_SIZE)+1;
+   FD_BUF          = PS_XtMalloc(FD_BUF_SIZE);
+   FD_BUF[0]       = '\0';
+   strcpy(fd->skipped_line, SKIPPED_LINE);
+
+   ENDMESSAGE(ps_io_init_desc)
+
+   return(fd);
+}
+
+/* Reads from the document contents if it was loaded from memory, and
+   from the descriptor kept by the document when no file is given */
+static FileData
+ps_io_init_doc(FILE *file, Document d)
+{
+   if (d->zindex)
+      return ps_io_init_zindex(d->zindex, False);
+   if (d->spool)
+      return ps_io_init_spool(d->spool);
+   if (d->data)
+      return ps_io_init_data(d->data, d->data_length);
+   if (!file && d->fd >= 0)
+      return ps_io_init_desc(d->fd);
+   return ps_io_init(file);
+}
+
+/* The descriptor of the input file, -1 when reading from data */
+static int
+ps_io_fileno(FileData fd)
+{
+   if (fd->desc >= 0)
+      return fd->desc;
+   return FD_FILE ? fileno(FD_FILE) : -1;
+}
+
+/*----------------------------------------------------------*/
+/* ps_io_fread */
 /*----------------------------------------------------------*/
 
-#define FD_FILE             (fd->file)
-#define FD_FILEPOS	    (fd->filepos)
-#define FD_LINE_BEGIN       (fd->line_begin)
-#define FD_LINE_END	    (fd->line_end)
-#define FD_LINE_LEN	    (fd->line_len)
-#define FD_LINE_TERMCHAR    (fd->line_termchar)
-#define FD_BUF		    (fd->buf)
-#define FD_BUF_END	    (fd->buf_end)
-#define FD_BUF_SIZE	    (fd->buf_size)
-#define FD_STATUS	    (fd->status)
+static size_t
+ps_io_fread(void *ptr, size_t size, size_t nmemb, FileData fd)
+{
+   size_t n;
+
+   if (fd->zreader)
+      return spectre_zreader_read(fd->zreader, ptr, size * nmemb) / size;
+   if (fd->desc >= 0) {
+      size_t done = 0;
+
+      while (done < size * nmemb) {
+         ssize_t r = pread(fd->desc, (char *) ptr + done, size * nmemb - done,
+                           fd->desc_pos + done);
+         if (r < 0 && errno == EINTR) continue;
+         if (r <= 0) break;
+         done += r;
+      }
+      /* a partial element is read again after a seek, like fread does */
+      fd->desc_pos += done / size * size;
+      return done / size;
+   }
+   if (!fd->data)
+      return fread(ptr, size, nmemb, FD_FILE);
 
-#define FD_STATUS_OKAY        0
-#define FD_STATUS_BUFTOOLARGE 1
-#define FD_STATUS_NOMORECHARS 2
+   if (fd->spool && fd->data_pos + (long)(size * nmemb) > fd->data_length)
+      ps_io_spool(fd, fd->data_pos + size * nmemb);
 
-#define LINE_CHUNK_SIZE     4096
-#define MAX_PS_IO_FGETCHARS_BUF_SIZE 57344
-#define BREAK_PS_IO_FGETCHARS_BUF_SIZE 49152
+   n = (size_t)(fd->data_length - fd->data_pos) / size;
+   if (n > nmemb)
+      n = nmemb;
+   memcpy(ptr, fd->data + fd->data_pos, n * size);
+   fd->data_pos += n * size;
 
-static FileData ps_io_init(file)
-   FILE *file;
+   return n;
+}
+
+/*----------------------------------------------------------*/
+/* ps_io_spool */
+/*----------------------------------------------------------*/
+
+/* Reads from the spooled input until at least length bytes are
+   available, or until its end. Only what is asked for is read,
+   so that pages are available as soon as they arrive. */
+static void
+ps_io_spool(FileData fd, long length)
 {
-   FileData fd;
-   size_t size = sizeof(FileDataStruct);
+   struct spool *spool = fd->spool;
 
-   BEGINMESSAGE(ps_io_init)
+   while (spool->file && spool->length < length) {
+      size_t to_read;
+      size_t n;
 
-   fd = (FileData) PS_XtMalloc(size);
-   memset((void*) fd ,0,(size_t)size);
+      if (spool->length == spool->allocated) {
+         char *data;
 
-   rewind(file);
-   FD_FILE      = file;
-   FD_FILEPOS   = ftell(file);
-   FD_BUF_SIZE  = (2*LINE_CHUNK_SIZE)+1;
-   FD_BUF       = PS_XtMalloc(FD_BUF_SIZE);
-   FD_BUF[0]    = '\0';
-   
-   ENDMESSAGE(ps_io_init)
-	   
-   return(fd);
+         data = (char *) PS_realloc(spool->data, spool->allocated * 2);
+         if (!data)
+            break;
+         spool->data = data;
+         spool->allocated *= 2;
+      }
+
+      to_read = spool->allocated - spool->length;
+      if ((long) to_read > length - spool->length)
+         to_read = length - spool->length;
+      n = fread(spool->data + spool->length, 1, to_read, spool->file);
+      if (n == 0) {
+         INFMESSAGE(end of spooled input)
+         spool->file = NULL;
+         break;
+      }
+      spool->length += n;
+   }
+
+   fd->data = spool->data;
+   fd->data_length = spool->length;
 }
 
 /*----------------------------------------------------------*/
@@ -1488,8 +2297,19 @@ static void
 ps_io_rewind(fd)
    FileData fd;
 {
-   rewind(FD_FILE);
-   FD_FILEPOS       = ftell(FD_FILE);
+   if (fd->zreader) {
+      spectre_zreader_seek(fd->zreader, 0);
+      FD_FILEPOS    = 0;
+   } else if (fd->data) {
+      fd->data_pos  = 0;
+      FD_FILEPOS    = 0;
+   } else if (fd->desc >= 0) {
+      fd->desc_pos  = 0;
+      FD_FILEPOS    = 0;
+   } else {
+      rewind(FD_FILE);
+      FD_FILEPOS    = ftello(FD_FILE);
+   }
    FD_BUF[0]        = '\0';
    FD_BUF_END       = 0;
    FD_BUF_SIZE      = 0;
@@ -1510,6 +2330,8 @@ ps_io_exit(fd)
 {
    BEGINMESSAGE(ps_io_exit)
    PS_XtFree(FD_BUF);
+   PS_XtFree(fd->skips);
+   spectre_zreader_free(fd->zreader);
    PS_XtFree(fd);
    ENDMESSAGE(ps_io_exit)
 }
@@ -1521,11 +2343,21 @@ ps_io_exit(fd)
 static int
 ps_io_fseek(fd,offset)
    FileData fd;
-   int offset;
+   off_t offset;
 {
    int status;
    BEGINMESSAGE(ps_io_fseek)
-   status=fseek(FD_FILE,(long)offset,SEEK_SET);
+   if (fd->zreader) {
+      status = spectre_zreader_seek(fd->zreader, offset);
+   } else if (fd->data) {
+      status = (offset >= 0 && offset <= fd->data_length) ? 0 : -1;
+      if (status == 0) fd->data_pos = offset;
+   } else if (fd->desc >= 0) {
+      status = offset >= 0 ? 0 : -1;
+      if (status == 0) fd->desc_pos = offset;
+   } else {
+      status=fseeko(FD_FILE,offset,SEEK_SET);
+   }
    FD_BUF_END = FD_LINE_BEGIN = FD_LINE_END = FD_LINE_LEN = 0;
    FD_FILEPOS = offset;
    FD_STATUS  = FD_STATUS_OKAY;
@@ -1537,7 +2369,7 @@ ps_io_fseek(fd,offset)
 /* ps_io_ftell */
 /*----------------------------------------------------------*/
 
-static int
+static off_t
 ps_io_ftell(fd)
    FileData fd;
 {
@@ -1547,6 +2379,487 @@ ps_io_ftell(fd)
    return(FD_FILEPOS);
 }
 
+/*----------------------------------------------------------*/
+/* ps_io_copy */
+/*----------------------------------------------------------*/
+
+#define COPY_BUFFER_SIZE    (256*1024)
+#define COPY_KERNEL_SIZE    (64*1024*1024)
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SENDFILE)
+/*
+   Copies from in to out without going through user space, returns
+   False when the kernel can't copy between them, with *posP telling
+   how far it got.
+*/
+static int
+ps_io_copy_kernel(int in, int out, off_t *posP, off_t end)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+   int use_copy_file_range = 1;
+#endif
+
+   while (end < 0 || *posP < end) {
+      size_t count = COPY_KERNEL_SIZE;
+      ssize_t n = -1;
+      int interrupted = 0;	/* errno is only looked at right after a call */
+
+      if (end >= 0 && end - *posP < (off_t) count) count = end - *posP;
+#ifdef HAVE_COPY_FILE_RANGE
+      if (use_copy_file_range) {
+         loff_t pos = *posP;
+
+         n = copy_file_range(in, &pos, out, NULL, count, 0);
+         if (n < 0) {
+            if (errno == EINTR) interrupted = 1;
+            else use_copy_file_range = 0;
+         }
+      }
+#endif
+#ifdef HAVE_SENDFILE
+      if (n < 0 && !interrupted) {
+         off_t pos = *posP;
+
+         n = sendfile(out, in, &pos, count);
+         if (n < 0 && errno == EINTR) interrupted = 1;
+      }
+#endif
+      if (n == 0) break;
+      if (n < 0) {
+         if (interrupted) continue;
+         INFMESSAGE(no kernel copy)
+         return False;
+      }
+      *posP += n;
+   }
+   return True;
+}
+#endif
+
+/*
+   Copies the input from the current position until end, or until
+   its end when end is negative, leaving the input after what was
+   copied. Plain files are copied by the kernel when possible, the
+   rest through a large buffer after what had already been read.
+   Returns False when end is in the middle of a line.
+*/
+static int
+ps_io_copy(fd, to, end)
+   FileData fd;
+   FILE *to;
+   off_t end;
+{
+   off_t begin = FD_FILEPOS;
+   off_t pos = begin;
+   char last = '\n';
+   char next;
+   int have_next = 0;
+   int done = 0;
+
+   BEGINMESSAGE(ps_io_copy)
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SENDFILE)
+   /* Not worth it when it has already been read */
+   if (!fd->zreader && !fd->data && (end < 0 || end - pos > FD_BUF_END - FD_LINE_END) &&
+       fileno(to) >= 0 && fflush(to) == 0) {
+      done = ps_io_copy_kernel(ps_io_fileno(fd), fileno(to), &pos, end);
+      /* resync the stream with what was written behind its back */
+      fseeko(to, 0, SEEK_CUR);
+      if (pos != begin) {
+         ps_io_fseek(fd, pos);
+         if (pread(ps_io_fileno(fd), &last, 1, pos - 1) != 1) last = '\n';
+      }
+   }
+#endif
+   if (!done) {
+      char *buf;
+      size_t size = COPY_BUFFER_SIZE;
+      off_t avail = FD_BUF_END - FD_LINE_END;
+
+      if (end >= 0 && end - pos < avail) avail = end - pos;
+      if (avail > 0) {
+         buf = ps_io_fgetchars(fd, (int) avail);
+         if (buf) {
+            fwrite(buf, sizeof(char), FD_LINE_LEN, to);
+            pos += FD_LINE_LEN;
+            last = buf[FD_LINE_LEN - 1];
+            if (FD_LINE_END < FD_BUF_END) {
+               next = FD_LINE_TERMCHAR;
+               have_next = 1;
+            }
+         }
+      }
+
+      /* Nothing more has been read, continue from the input */
+      if (FD_LINE_END == FD_BUF_END && (end < 0 || pos < end)) {
+         if (end >= 0 && end - pos < (off_t) size) size = end - pos;
+         buf = (char *) PS_XtMalloc(size);
+         while (buf && (end < 0 || pos < end)) {
+            size_t count = size;
+            size_t n;
+
+            if (end >= 0 && end - pos < (off_t) count) count = end - pos;
+            n = ps_io_fread(buf, 1, count, fd);
+            if (n == 0) break;
+            fwrite(buf, 1, n, to);
+            pos += n;
+            last = buf[n - 1];
+         }
+         PS_XtFree(buf);
+         FD_FILEPOS = pos;
+      }
+   }
+
+   /* A line ends in "\n", "\r" or "\r\n" */
+   done = end < 0 || pos != end || last == '\n';
+   if (!done && last == '\r') {
+      if (!have_next) {
+         have_next = ps_io_fread(&next, 1, 1, fd) == 1;
+         ps_io_fseek(fd, pos);
+      }
+      done = !have_next || next != '\n';
+   }
+   ENDMESSAGE(ps_io_copy)
+   return done;
+}
+
+/*----------------------------------------------------------*/
+/* ps_io_find_skips */
+/*----------------------------------------------------------*/
+
+/*
+   Scanning the pages of a document only needs the lines starting
+   with %%, everything else just adds to the length of the section.
+   For large files the chunks of the file are searched for those
+   lines in parallel, and the ranges in between are then skipped by
+   readline() at once. The search doesn't know about the nesting of
+   %%BeginDocument and friends, it doesn't need to: readline() still
+   reads every DSC comment and handles nesting as usual. Line
+   boundaries are only ambiguous after %%BeginData and %%BeginBinary
+   byte counts, or when ps_io_fgetchars() breaks a line artificially,
+   in those cases nothing is skipped at all.
+*/
+
+#ifndef SKIP_MIN_FILE_SIZE
+#define SKIP_MIN_FILE_SIZE  (4*1024*1024)
+#endif
+#ifndef SKIP_MIN_CHUNK_SIZE
+#define SKIP_MIN_CHUNK_SIZE (1024*1024)
+#endif
+#ifndef SKIP_MIN_RANGE
+#define SKIP_MIN_RANGE      (64*1024)   /* a seek costs about as much as reading this */
+#endif
+#ifndef SKIP_N_CPUS
+#define SKIP_N_CPUS         sysconf(_SC_NPROCESSORS_ONLN)   /* tests force a chunk count */
+#endif
+#define SKIP_MAX_THREADS    16
+#define SKIP_READ_SIZE      (64*1024)
+#define SKIP_LOOKAHEAD      16
+#define SKIP_MAX_LINE_LEN   (BREAK_PS_IO_FGETCHARS_BUF_SIZE/2)
+
+#ifdef HAVE_PTHREAD
+
+struct skipchunk {
+   int               fd;
+   const char       *data;        /* document contents, NULL to read from fd */
+   off_t             begin;       /* first byte of the chunk */
+   off_t             end;         /* first byte after the chunk */
+   off_t             file_end;
+   off_t             first_line;  /* first line start in the chunk, -1 if none */
+   off_t             last_line;   /* last line start in the chunk, -1 if none */
+   off_t             first_dsc;   /* first DSC comment in the chunk, -1 if none */
+   off_t             after_dsc;   /* first line start after the last DSC comment, -1 if none */
+   struct skiprange *skips;
+   unsigned int      n_skips;
+   unsigned int      max_skips;
+   int               ambiguous;   /* line boundaries depend on the reader */
+};
+
+static int
+ps_io_add_skip(struct skiprange **skips, unsigned int *n_skips,
+	       unsigned int *max_skips, off_t from, off_t to)
+{
+   if (*n_skips == *max_skips) {
+      unsigned int max = *max_skips ? *max_skips * 2 : 64;
+      struct skiprange *tmp;
+
+      tmp = (struct skiprange *) PS_realloc(*skips, max * sizeof(struct skiprange));
+      if (!tmp)
+	 return 0;
+      *skips = tmp;
+      *max_skips = max;
+   }
+   (*skips)[*n_skips].from = from;
+   (*skips)[*n_skips].to = to;
+   (*n_skips)++;
+   return 1;
+}
+
+static ssize_t
+ps_io_read_chunk(struct skipchunk *chunk, char *buf, size_t count, off_t offset)
+{
+   if (chunk->data) {
+      memcpy(buf, chunk->data + offset, count);
+      return count;
+   }
+   return pread(chunk->fd, buf, count, offset);
+}
+
+static void
+ps_io_scan_line(struct skipchunk *chunk, const char *line, off_t pos, off_t *fromP)
+{
+   if (chunk->last_line >= 0 && pos - chunk->last_line > SKIP_MAX_LINE_LEN)
+      chunk->ambiguous = 1;
+   if (chunk->first_line < 0)
+      chunk->first_line = pos;
+   chunk->last_line = pos;
+
+   if (line[0] == '%' && line[1] == '%') {
+      if (_spectre_strncasecmp(line, "%%BeginData", 11) == 0 ||
+	  _spectre_strncasecmp(line, "%%BeginBinary", 13) == 0)
+	 chunk->ambiguous = 1;
+      if (chunk->first_dsc < 0)
+	 chunk->first_dsc = pos;
+      else if (*fromP >= 0 && pos - *fromP >= SKIP_MIN_RANGE &&
+	       !ps_io_add_skip(&chunk->skips, &chunk->n_skips,
+			       &chunk->max_skips, *fromP, pos))
+	 chunk->ambiguous = 1;
+      *fromP = -1;
+   } else if (*fromP < 0 && chunk->first_dsc >= 0) {
+      *fromP = pos;
+   }
+}
+
+static void *
+ps_io_scan_chunk(void *data)
+{
+   struct skipchunk *chunk = (struct skipchunk *) data;
+   char *buf;
+   char prev = '\n';
+   off_t from = -1;	/* first line start after the last DSC comment */
+   off_t offset;
+
+   buf = PS_malloc(SKIP_READ_SIZE + SKIP_LOOKAHEAD + 1);
+   if (!buf ||
+       (chunk->begin > 0 && ps_io_read_chunk(chunk, &prev, 1, chunk->begin - 1) != 1)) {
+      chunk->ambiguous = 1;
+      PS_free(buf);
+      return NULL;
+   }
+
+   for (offset = chunk->begin; offset < chunk->end && !chunk->ambiguous; offset += SKIP_READ_SIZE) {
+      off_t want = chunk->file_end - offset;
+      off_t valid = chunk->end - offset;
+      ssize_t n;
+      long i;
+
+      if (want > SKIP_READ_SIZE + SKIP_LOOKAHEAD) want = SKIP_READ_SIZE + SKIP_LOOKAHEAD;
+      if (valid > SKIP_READ_SIZE) valid = SKIP_READ_SIZE;
+
+      n = ps_io_read_chunk(chunk, buf, want, offset);
+      if (n != want) {
+	 chunk->ambiguous = 1;
+	 break;
+      }
+      buf[n] = '\0';
+
+      /* Same line ends as ps_io_fgetchars(): \n, \r or \r\n */
+      if (!memchr(buf, '\r', valid)) {
+	 char *eol;
+
+	 i = 0;
+	 if (prev != '\n' && (prev != '\r' || buf[0] == '\n')) {
+	    eol = memchr(buf, '\n', valid);
+	    i = eol ? eol - buf + 1 : valid;
+	 }
+	 while (i < valid) {
+	    ps_io_scan_line(chunk, buf + i, offset + i, &from);
+	    eol = memchr(buf + i, '\n', valid - i);
+	    i = eol ? eol - buf + 1 : valid;
+	 }
+      } else {
+	 for (i = 0; i < valid; i++) {
+	    if (prev == '\n' || (prev == '\r' && buf[i] != '\n'))
+	       ps_io_scan_line(chunk, buf + i, offset + i, &from);
+	    prev = buf[i];
+	 }
+      }
+      prev = buf[valid - 1];
+   }
+   chunk->after_dsc = from;
+
+   PS_free(buf);
+   return NULL;
+}
+
+static void
+ps_io_find_skips(FileData fd)
+{
+   struct stat stat_buf;
+   struct skipchunk *chunks;
+   pthread_t *threads;
+   int *started;
+   off_t begin = FD_FILEPOS;
+   off_t end;
+   off_t chunk_size;
+   off_t open = begin;
+   off_t last_line = -1;
+   long n_cpus;
+   int ambiguous = 0;
+   int n_chunks;
+   int i;
+
+   BEGINMESSAGE(ps_io_find_skips)
+
+   if (fd->zreader) {
+      /* Compressed input can only be read in order */
+      ENDMESSAGE(ps_io_find_skips)
+      return;
+   } else if (fd->data) {
+      /* All of it is needed anyway */
+      if (fd->spool)
+	 ps_io_spool(fd, LONG_MAX);
+      end = fd->data_length;
+   } else if (fstat(ps_io_fileno(fd), &stat_buf) == 0 && S_ISREG(stat_buf.st_mode)) {
+      end = stat_buf.st_size;
+   } else {
+      ENDMESSAGE(ps_io_find_skips)
+      return;
+   }
+   if (end - begin < SKIP_MIN_FILE_SIZE) {
+      ENDMESSAGE(ps_io_find_skips)
+      return;
+   }
+
+   n_cpus = SKIP_N_CPUS;
+   n_chunks = (end - begin) / SKIP_MIN_CHUNK_SIZE;
+   if (n_chunks > n_cpus) n_chunks = n_cpus;
+   if (n_chunks > SKIP_MAX_THREADS) n_chunks = SKIP_MAX_THREADS;
+   if (n_chunks < 2) {
+      INFMESSAGE(not worth scanning in parallel)
+      ENDMESSAGE(ps_io_find_skips)
+      return;
+   }
+
+   chunks = (struct skipchunk *) PS_calloc(n_chunks, sizeof(struct skipchunk));
+   threads = (pthread_t *) PS_calloc(n_chunks, sizeof(pthread_t));
+   started = (int *) PS_calloc(n_chunks, sizeof(int));
+   if (!chunks || !threads || !started) {
+      PS_free(chunks);
+      PS_free(threads);
+      PS_free(started);
+      ENDMESSAGE(ps_io_find_skips)
+      return;
+   }
+
+   chunk_size = (end - begin) / n_chunks;
+   for (i = 0; i < n_chunks; i++) {
+      chunks[i].fd = ps_io_fileno(fd);
+      chunks[i].data = fd->data;
+      chunks[i].begin = begin + i * chunk_size;
+      chunks[i].end = (i == n_chunks - 1) ? end : begin + (i + 1) * chunk_size;
+      chunks[i].file_end = end;
+      chunks[i].first_line = chunks[i].last_line = -1;
+      chunks[i].first_dsc = chunks[i].after_dsc = -1;
+   }
+
+   /* The first chunk is scanned by this thread, and so is any
+      chunk whose thread couldn't be created. */
+   for (i = 1; i < n_chunks; i++)
+      started[i] = pthread_create(&threads[i], NULL, ps_io_scan_chunk, &chunks[i]) == 0;
+   for (i = 0; i < n_chunks; i++)
+      if (!started[i])
+	 ps_io_scan_chunk(&chunks[i]);
+   for (i = 1; i < n_chunks; i++)
+      if (started[i])
+	 pthread_join(threads[i], NULL);
+
+   /* Stitch the chunks together, ranges can span several chunks */
+   for (i = 0; i < n_chunks && !ambiguous; i++) {
+      struct skipchunk *chunk = &chunks[i];
+      unsigned int j;
+
+      if (chunk->ambiguous) {
+	 ambiguous = 1;
+	 break;
+      }
+      /* No line starts in the chunk, the gap is checked by the next one */
+      if (chunk->first_line < 0)
+	 continue;
+      if (last_line >= 0 && chunk->first_line - last_line > SKIP_MAX_LINE_LEN) {
+	 ambiguous = 1;
+	 break;
+      }
+      last_line = chunk->last_line;
+
+      if (open < 0)
+	 open = chunk->first_line;
+      if (chunk->first_dsc < 0)
+	 continue;
+
+      if (chunk->first_dsc - open >= SKIP_MIN_RANGE &&
+	  !ps_io_add_skip(&fd->skips, &fd->n_skips, &fd->max_skips, open, chunk->first_dsc))
+	 ambiguous = 1;
+      for (j = 0; j < chunk->n_skips && !ambiguous; j++)
+	 ambiguous = !ps_io_add_skip(&fd->skips, &fd->n_skips, &fd->max_skips,
+				     chunk->skips[j].from, chunk->skips[j].to);
+      open = chunk->after_dsc;
+   }
+
+   if (!ambiguous && end - last_line > SKIP_MAX_LINE_LEN)
+      ambiguous = 1;
+   if (!ambiguous && open >= 0 && end - open >= SKIP_MIN_RANGE)
+      ambiguous = !ps_io_add_skip(&fd->skips, &fd->n_skips, &fd->max_skips, open, end);
+
+   if (ambiguous) {
+      INFMESSAGE(ambiguous line boundaries)
+      PS_free(fd->skips);
+      fd->skips = NULL;
+      fd->n_skips = fd->max_skips = 0;
+   }
+   fd->next_skip = 0;
+
+   for (i = 0; i < n_chunks; i++)
+      PS_free(chunks[i].skips);
+   PS_free(chunks);
+   PS_free(threads);
+   PS_free(started);
+
+   ENDMESSAGE(ps_io_find_skips)
+}
+
+#else /* !HAVE_PTHREAD */
+
+static void
+ps_io_find_skips(FileData fd)
+{
+}
+
+#endif /* HAVE_PTHREAD */
+
+/*----------------------------------------------------------*/
+/* ps_io_skip */
+/*----------------------------------------------------------*/
+
+static int
+ps_io_skip(FileData fd, off_t *line_lenP)
+{
+   struct skiprange *skip;
+
+   while (fd->next_skip < fd->n_skips && fd->skips[fd->next_skip].to <= FD_FILEPOS)
+      fd->next_skip++;
+   if (fd->next_skip == fd->n_skips)
+      return 0;
+
+   skip = &fd->skips[fd->next_skip];
+   if (FD_FILEPOS < skip->from)
+      return 0;
+
+   *line_lenP = skip->to - FD_FILEPOS;
+   ps_io_fseek(fd, skip->to);
+   fd->next_skip++;
+   return 1;
+}
+
 /*----------------------------------------------------------*/
 /* ps_io_fgetchars */
 /*----------------------------------------------------------*/
@@ -1570,6 +2883,7 @@ static char * ps_io_fgetchars(fd,num)
 {
    char *eol=NULL,*tmp;
    size_t size_of_char = sizeof(char);
+   int cr_pending = 0;
 
    BEGINMESSAGE(ps_io_fgetchars)
 
@@ -1598,6 +2912,12 @@ static char * ps_io_fgetchars(fd,num)
    do {
       if (num<0) { /* reading whole line */
          if (FD_BUF_END-FD_LINE_END) {
+            if (cr_pending) {
+               /* the previous read ended with '\r', its '\n' may follow */
+               eol = FD_BUF + FD_LINE_END;
+               if (*eol=='\n') eol++;
+               break;
+            }
  	    /* strpbrk is faster but fails on lines with embedded NULLs 
               eol = strpbrk(FD_BUF+FD_LINE_END,"\n\r");
             */
@@ -1605,7 +2925,11 @@ static char * ps_io_fgetchars(fd,num)
 	    eol = FD_BUF + FD_LINE_END;
 	    while (eol < tmp && *eol != '\n' && *eol != '\r') eol++;
 	    if (eol >= tmp) eol = NULL;
-            if (eol) {
+            if (eol && *eol=='\r' && eol+1 == tmp) {
+               /* don't split a "\r\n" between two reads, so that lines
+                  don't depend on where reading started */
+               cr_pending = 1;
+            } else if (eol) {
                if (*eol=='\r' && *(eol+1)=='\n') eol += 2;
                else eol++;
                break;
@@ -1620,7 +2944,7 @@ static char * ps_io_fgetchars(fd,num)
 
       INFMESSAGE(no end of line yet)
 
-      if (FD_BUF_END - FD_LINE_BEGIN > BREAK_PS_IO_FGETCHARS_BUF_SIZE) {
+      if (!cr_pending && FD_BUF_END - FD_LINE_BEGIN > BREAK_PS_IO_FGETCHARS_BUF_SIZE) {
 	INFMESSAGE(breaking line artificially)
 	eol = FD_BUF + FD_BUF_END - 1;
 	break;
@@ -1654,9 +2978,13 @@ static char * ps_io_fgetchars(fd,num)
 
       FD_LINE_END = FD_BUF_END;
       /* read() seems to fail sometimes (? ? ?) so we always use fread ###jp###,07/31/96*/
-      FD_BUF_END += fread(FD_BUF+FD_BUF_END,size_of_char,LINE_CHUNK_SIZE,FD_FILE);
+      FD_BUF_END += ps_io_fread(FD_BUF+FD_BUF_END,size_of_char,LINE_CHUNK_SIZE,fd);
 
       FD_BUF[FD_BUF_END] = '\0';
+      if (FD_BUF_END-FD_LINE_END == 0 && cr_pending) {
+         eol = FD_BUF + FD_BUF_END;
+         break;
+      }
       if (FD_BUF_END-FD_LINE_END == 0) {
          INFMESSAGE(failed to read more chars)
          ENDMESSAGE(ps_io_fgetchars)
@@ -1684,7 +3012,7 @@ static char * ps_io_fgetchars(fd,num)
       case).
       (Tim Adye, adye@v2.rl.ac.uk)
       */
-      FD_FILEPOS         = ftell(FD_FILE);
+      FD_FILEPOS         = ftello(FD_FILE);
    } else
 #endif /* USE_FTELL_FOR_FILEPOS */
       FD_FILEPOS        += FD_LINE_LEN;
@@ -1713,12 +3041,12 @@ static char * ps_io_fgetchars(fd,num)
 
 static char * readline (fd, enddoseps, lineP, positionP, line_lenP)
    FileData fd;
-   long enddoseps;
+   off_t enddoseps;
    char **lineP;
-   long *positionP;
-   unsigned int *line_lenP;
+   off_t *positionP;
+   off_t *line_lenP;
 {
-   unsigned int nbytes=0;
+   off_t nbytes=0;
    int skipped=0;
    int nesting_level=0;
    char *line;
@@ -1730,12 +3058,23 @@ static char * readline (fd, enddoseps, lineP, positionP, line_lenP)
        if (*positionP >= enddoseps)
            return NULL;    /* don't read any more, we have reached end of dos eps section */
    }
+
+   if (fd->skips && ps_io_skip(fd, line_lenP)) {
+      INFMESSAGE(skipped lines without DSC comments)
+      if (positionP) {
+         _spectre_stats_add(scan_lines, 1);
+         _spectre_stats_add(scan_bytes, *line_lenP);
+      }
+      *lineP = fd->skipped_line;
+      ENDMESSAGE(readline)
+      return(fd->skipped_line);
+   }
    
    line = ps_io_fgetchars(fd,-1);
    if (!line) {
       INFMESSAGE(could not get line)
       *line_lenP = 0;
-      *lineP     = empty_string;
+      *lineP     = fd->empty_line;
       ENDMESSAGE(readline)
       return(NULL); 
    }
@@ -1807,12 +3146,12 @@ static char * readline (fd, enddoseps, lineP, positionP, line_lenP)
    else if IS_BEGIN("ProcSet")    SKIP_UNTIL_1("EndProcSet")
    else if IS_BEGIN("Resource")   SKIP_UNTIL_1("EndResource")
    else if IS_BEGIN("Data:")      {
-      int  num;
+      long long num;
       char text[101];
       INFMESSAGE(encountered "BeginData:")
       if (FD_LINE_LEN > 100) FD_BUF[100] = '\0';
       text[0] = '\0';
-      if (sscanf(line+length("%%BeginData:"), "%d %*s %100s", &num, text) >= 1) {
+      if (sscanf(line+length("%%BeginData:"), "%lld %*s %100s", &num, text) >= 1) {
          if (strcmp(text, "Lines") == 0) {
             INFIMESSAGE(number of lines to skip:,num)
             while (num) {
@@ -1824,7 +3163,7 @@ static char * readline (fd, enddoseps, lineP, positionP, line_lenP)
             int read_chunk_size = LINE_CHUNK_SIZE;
             INFIMESSAGE(number of chars to skip:,num)
             while (num>0) {
-               if (num <= LINE_CHUNK_SIZE) read_chunk_size=num;
+               if (num <= LINE_CHUNK_SIZE) read_chunk_size=(int)num;
                line = ps_io_fgetchars(fd,read_chunk_size);
                if (line) *line_lenP += FD_LINE_LEN;
                num -= read_chunk_size;
@@ -1834,13 +3173,13 @@ static char * readline (fd, enddoseps, lineP, positionP, line_lenP)
       SKIP_UNTIL_1("EndData")
    }
    else if IS_BEGIN("Binary:") {
-      int  num;
+      long long num;
       INFMESSAGE(encountered "BeginBinary:")
-      if (sscanf(line+length("%%BeginBinary:"), "%d", &num) == 1) {
+      if (sscanf(line+length("%%BeginBinary:"), "%lld", &num) == 1) {
          int read_chunk_size = LINE_CHUNK_SIZE;
          INFIMESSAGE(number of chars to skip:,num)
          while (num>0) {
-            if (num <= LINE_CHUNK_SIZE) read_chunk_size=num;
+            if (num <= LINE_CHUNK_SIZE) read_chunk_size=(int)num;
             line = ps_io_fgetchars(fd,read_chunk_size);
             if (line) *line_lenP += FD_LINE_LEN;
             num -= read_chunk_size;
@@ -1852,11 +3191,17 @@ static char * readline (fd, enddoseps, lineP, positionP, line_lenP)
    if (skipped) {
       INFMESSAGE(skipped lines)
       *line_lenP += nbytes;
-      *lineP = skipped_line;      
+      *lineP = fd->skipped_line;      
    } else {
       *lineP = FD_BUF+FD_LINE_BEGIN;
    }
 
+   /* nested calls skipping sections are counted by the outer one */
+   if (positionP) {
+      _spectre_stats_add(scan_lines, 1);
+      _spectre_stats_add(scan_bytes, *line_lenP);
+   }
+
    ENDMESSAGE(readline)
    return(FD_BUF+FD_LINE_BEGIN);
 }
@@ -1869,7 +3214,7 @@ static char * readline (fd, enddoseps, lineP, positionP, line_lenP)
 */
 /*----------------------------------------------------------*/
 
-static char * readlineuntil (FileData fd, long enddoseps, char **lineP, long *positionP, unsigned int *line_lenP, char charP)
+static char * readlineuntil (FileData fd, off_t enddoseps, char **lineP, off_t *positionP, off_t *line_lenP, char charP)
 {
    char *line;
 
@@ -1880,7 +3225,7 @@ static char * readlineuntil (FileData fd, long enddoseps, char **lineP, long *po
        if (!line) {
            INFMESSAGE(could not get line)
 	   *line_lenP = 0;
-	   *lineP     = empty_string;
+	   *lineP     = fd->empty_line;
 	   ENDMESSAGE(readline)
 	   return(NULL);
        }
@@ -1907,8 +3252,8 @@ char *
 pscopyuntil(fd, to, begin, end, comment)
    FileData fd;
    FILE *to;
-   long begin;			/* set negative to avoid initial seek */
-   long end;
+   off_t begin;			/* set negative to avoid initial seek */
+   off_t end;			/* set negative to copy until the end */
    char *comment;
 {
    char *line;
@@ -1923,8 +3268,18 @@ pscopyuntil(fd, to, begin, end, comment)
       INFMESSAGE(will copy until specified file position)
       comment_length = 0;
    }
-   if (begin >= 0) ps_io_fseek(fd, begin);
-   while (ps_io_ftell(fd) < end) {
+   /* Sections copied in order are read on without seeking */
+   if (begin >= 0 && begin != ps_io_ftell(fd)) ps_io_fseek(fd, begin);
+   if (!comment) {
+      /* Nothing to look for, the bytes are copied as they are. A
+         section ending in the middle of a line is copied until the
+         end of that line, like it would be line by line. */
+      if (!ps_io_copy(fd, to, end) && (line = ps_io_fgetchars(fd,-1)))
+         fwrite(line, sizeof(char), FD_LINE_LEN, to);
+      ENDMESSAGE(pscopyuntil)
+      return NULL;
+   }
+   while (end < 0 || ps_io_ftell(fd) < end) {
       line = ps_io_fgetchars(fd,-1);
       if (!line) break;
       if (comment && strncmp(line, comment, comment_length) == 0) {
@@ -1938,12 +3293,12 @@ pscopyuntil(fd, to, begin, end, comment)
       fputs(line, to);
       if  (!IS_COMMENT("Begin"))     {} /* Do nothing */
       else if IS_BEGIN("Data:")      {
-         int  num;
+         long long num;
          char text[101];
          INFMESSAGE(encountered "BeginData:")
          if (FD_LINE_LEN > 100) FD_BUF[100] = '\0';
          text[0] = '\0';
-         if (sscanf(line+length("%%BeginData:"), "%d %*s %100s", &num, text) >= 1) {
+         if (sscanf(line+length("%%BeginData:"), "%lld %*s %100s", &num, text) >= 1) {
             if (strcmp(text, "Lines") == 0) {
                INFIMESSAGE(number of lines:,num)
                while (num) {
@@ -1955,7 +3310,7 @@ pscopyuntil(fd, to, begin, end, comment)
                int read_chunk_size = LINE_CHUNK_SIZE;
                INFIMESSAGE(number of chars:,num)
                while (num>0) {
-                  if (num <= LINE_CHUNK_SIZE) read_chunk_size=num;
+                  if (num <= LINE_CHUNK_SIZE) read_chunk_size=(int)num;
                   line = ps_io_fgetchars(fd,read_chunk_size);
                   if (line) fwrite(line,sizeof(char),FD_LINE_LEN, to);
                   num -= read_chunk_size;
@@ -1964,13 +3319,13 @@ pscopyuntil(fd, to, begin, end, comment)
          }
       }
       else if IS_BEGIN("Binary:") {
-         int  num;
+         long long num;
          INFMESSAGE(encountered "BeginBinary:")
-         if (sscanf(line+length("%%BeginBinary:"), "%d", &num) == 1) {
+         if (sscanf(line+length("%%BeginBinary:"), "%lld", &num) == 1) {
             int read_chunk_size = LINE_CHUNK_SIZE;
             INFIMESSAGE(number of chars:,num)
             while (num>0) {
-               if (num <= LINE_CHUNK_SIZE) read_chunk_size=num;
+               if (num <= LINE_CHUNK_SIZE) read_chunk_size=(int)num;
                line = ps_io_fgetchars(fd,read_chunk_size);
                if (line) fwrite(line, sizeof (char),FD_LINE_LEN, to);
                num -= read_chunk_size;
@@ -1982,6 +3337,34 @@ pscopyuntil(fd, to, begin, end, comment)
    return NULL;
 }
 
+/*----------------------------------------------------------*/
+/* pssectioncontains */
+/*----------------------------------------------------------*/
+
+int
+pssectioncontains (FILE *from, Document d, off_t begin, off_t end, const char *str)
+{
+   FileData fd;
+   char *line;
+   int found = False;
+
+   BEGINMESSAGE(pssectioncontains)
+   if (begin >= end) {
+      ENDMESSAGE(pssectioncontains)
+      return False;
+   }
+   fd = ps_io_init_doc(from, d);
+   ps_io_fseek(fd, begin);
+   while (!found && ps_io_ftell(fd) < end) {
+      line = ps_io_fgetchars(fd,-1);
+      if (!line) break;
+      found = strstr(line, str) != NULL;
+   }
+   ps_io_exit(fd);
+   ENDMESSAGE(pssectioncontains)
+   return found;
+}
+
 /*----------------------------------------------------------*/
 /* blank */
 /* Check whether the line contains nothing but white space. */
@@ -1999,35 +3382,57 @@ static int blank(line)
 }
 
 void
-pscopy (FILE *from, FILE *to, Document d, long begin, long end)
+pscopy (FILE *from, FILE *to, Document d, off_t begin, off_t end)
 {
     FileData fd;
 
-    fd = ps_io_init(from);
+    fd = ps_io_init_doc(from, d);
     pscopyuntil(fd, to, begin, end, NULL);
     ps_io_exit(fd);
 }
 
+FileData
+pscopyopen (FILE *from, Document d)
+{
+    return ps_io_init_doc(from, d);
+}
+
+void
+pscopyclose (FileData fd)
+{
+    ps_io_exit(fd);
+}
+
 void
 pscopyheaders (FILE *from, FILE *to, Document d)
 {
-    char *comment;
-    Boolean pages_written = False;
-    int here;
     FileData fd;
 
-    fd = ps_io_init(from);
+    fd = ps_io_init_doc(from, d);
+    pscopyheadersfd(fd, to, d);
+    ps_io_exit(fd);
+}
+
+void
+pscopyheadersfd (FileData fd, FILE *to, Document d)
+{
+    char *comment;
+    Boolean pages_written = False;
+    off_t here;
 
     here = d->beginheader;
-    while ((comment=pscopyuntil(fd,to,here,d->endheader,"%%Pages:"))) {
+    while ((comment=pscopyuntil(fd,to,here,d->endheader,"%%Page"))) {
        SMESSAGE(comment)
        here = ps_io_ftell(fd);
-       if (pages_written) {
-          PS_free(comment);
-          continue;
+       if (strncmp(comment, "%%Pages:", 8) == 0) {
+          if (!pages_written) fputs("%%Pages: (atend)\n", to);
+          pages_written = True;
+       } else if (strncmp(comment, "%%PageOrder:", 12) == 0 && d->pageorder == DESCEND) {
+          /* pages are written in the order they are copied */
+          fputs("%%PageOrder: Ascend\n", to);
+       } else {
+          fputs(comment, to);
        }
-       fputs("%%Pages: (atend)\n", to);
-       pages_written = True;
        PS_free(comment);
     }
 
@@ -2038,36 +3443,45 @@ pscopyheaders (FILE *from, FILE *to, Document d)
     pscopyuntil(fd, to, d->begindefaults, d->enddefaults,NULL);
     pscopyuntil(fd, to, d->beginprolog, d->endprolog,NULL);
     pscopyuntil(fd, to, d->beginsetup, d->endsetup,NULL);
-
-    ps_io_exit(fd);
 }
 
 void
 pscopypage (FILE *from, FILE *to, Document d, unsigned int page, unsigned int n_page)
 {
     FileData fd;
-    char *comment;
 
-    fd = ps_io_init(from);
+    fd = ps_io_init_doc(from, d);
+    pscopypagefd(fd, to, d, page, n_page);
+    ps_io_exit(fd);
+}
+
+void
+pscopypagefd (FileData fd, FILE *to, Document d, unsigned int page, unsigned int n_page)
+{
+    char *comment;
 
     comment = pscopyuntil(fd,to,d->pages[page].begin,d->pages[page].end, "%%Page:");
     fprintf(to, "%%%%Page: %s %d\n",d->pages[page].label, n_page);
     PS_free(comment);
     pscopyuntil(fd, to, -1, d->pages[page].end,NULL);
-
-    ps_io_exit(fd);
 }
 
 void
 pscopytrailer (FILE *from, FILE *to, Document d, unsigned int n_pages)
 {
     FileData fd;
-    Boolean pages_written = False;
+
+    fd = ps_io_init_doc(from, d);
+    pscopytrailerfd(fd, to, d, n_pages);
+    ps_io_exit(fd);
+}
+
+void
+pscopytrailerfd (FileData fd, FILE *to, Document d, unsigned int n_pages)
+{
     char *comment;
-    int here;
+    off_t here;
 
-    fd = ps_io_init(from);
-    
     here = d->begintrailer;
     if (!d->epsf) {
         pscopyuntil(fd, to, here, here + strlen ("%%Trailer") + 1, NULL);
@@ -2075,17 +3489,15 @@ pscopytrailer (FILE *from, FILE *to, Document d, unsigned int n_pages)
 	fprintf(to, "%%%%Pages: %d\n",n_pages);
     }
     
-    while ((comment = pscopyuntil(fd, to, here, d->endtrailer, "%%Pages:"))) {
+    while ((comment = pscopyuntil(fd, to, here, d->endtrailer, "%%Page"))) {
         here = ps_io_ftell(fd);
-	if (pages_written) {
-          PS_free(comment);
-	  continue;
-	}
-	pages_written = True;
+	/* the number of pages has already been written */
+	if (strncmp(comment, "%%PageOrder:", 12) == 0 && d->pageorder == DESCEND)
+	  fputs("%%PageOrder: Ascend\n", to);
+	else if (strncmp(comment, "%%Pages:", 8) != 0)
+	  fputs(comment, to);
 	PS_free(comment);
     }
-
-    ps_io_exit(fd);
 }
 
 /*##########################################################*/
@@ -2108,7 +3520,7 @@ pscopydoc(dest_file,src_filename,d,pagelist)
     int pages;
     int page = 1;
     unsigned int i, j;
-    int here;
+    off_t here;
     FileData fd;
 
     BEGINMESSAGE(pscopydoc)
@@ -2189,14 +3601,14 @@ pscopydoc(dest_file,src_filename,d,pagelist)
 #undef length
 
 /* rjl: routines to handle reading DOS EPS files */
-static unsigned long dsc_arch = 0x00000001;
+static const unsigned long dsc_arch = 0x00000001;
 
 /* change byte order if architecture is big-endian */
 static PS_DWORD
 reorder_dword(val)
     PS_DWORD val;
 {
-    if (*((char *)(&dsc_arch)))
+    if (*((const char *)(&dsc_arch)))
         return val;	/* little endian machine */
     else
 	return ((val&0xff) << 24) | ((val&0xff00) << 8)
@@ -2207,7 +3619,7 @@ reorder_dword(val)
 static PS_WORD
 reorder_word(PS_WORD val)
 {
-    if (*((char *)(&dsc_arch)))
+    if (*((const char *)(&dsc_arch)))
         return val;	/* little endian machine */
     else
 	return (PS_WORD) ((PS_WORD)(val&0xff) << 8) | (PS_WORD)((val&0xff00) >> 8);
@@ -2216,7 +3628,7 @@ reorder_word(PS_WORD val)
 static void
 ps_read_doseps_dword(FileData fd, PS_DWORD *dword)
 {
-    const size_t read = fread(dword, 4, 1, FD_FILE);
+    const size_t read = ps_io_fread(dword, 4, 1, fd);
     if (read == 4) {
         *dword = (unsigned long)reorder_dword(*dword);
     } else {
@@ -2227,7 +3639,7 @@ ps_read_doseps_dword(FileData fd, PS_DWORD *dword)
 static void
 ps_read_doseps_word(FileData fd, PS_WORD *word)
 {
-    const size_t read = fread(word, 2, 1, FD_FILE);
+    const size_t read = ps_io_fread(word, 2, 1, fd);
     if (read == 2) {
         *word = (unsigned short)reorder_word(*word);
     } else {
@@ -2241,7 +3653,7 @@ ps_read_doseps(fd,doseps)
     FileData fd;
     DOSEPS *doseps;
 {
-    const size_t read = fread(doseps->id, 1, 4, FD_FILE);
+    const size_t read = ps_io_fread(doseps->id, 1, 4, fd);
     if (! ((read == 4) && (doseps->id[0]==0xc5) && (doseps->id[1]==0xd0)
 	   && (doseps->id[2]==0xd3) && (doseps->id[3]==0xc6)) ) {
         /* id is "EPSF" with bit 7 set */
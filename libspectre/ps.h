@@ -30,6 +30,7 @@
 
 #include <libspectre/spectre-macros.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 SPECTRE_BEGIN_DECLS
 
@@ -94,6 +95,12 @@ typedef struct documentmedia {
 
 typedef const struct documentmedia *ConstMedia;
 
+struct scanstate;
+struct spool;
+
+	/* reads the contents of a document, see pscopyopen() */
+typedef struct FileDataStruct_ *FileData;
+
 typedef struct document {
     unsigned int ref_count;
 	
@@ -110,18 +117,18 @@ typedef struct document {
     char *fortext;
     char *languagelevel;
     int  pageorder;			/* ASCEND, DESCEND, SPECIAL */
-    long beginheader, endheader;	/* offsets into file */
-    unsigned int lenheader;
-    long beginpreview, endpreview;
-    unsigned int lenpreview;
-    long begindefaults, enddefaults;
-    unsigned int lendefaults;
-    long beginprolog, endprolog;
-    unsigned int lenprolog;
-    long beginsetup, endsetup;
-    unsigned int lensetup;
-    long begintrailer, endtrailer;
-    unsigned int lentrailer;
+    off_t beginheader, endheader;	/* offsets into file */
+    off_t lenheader;
+    off_t beginpreview, endpreview;
+    off_t lenpreview;
+    off_t begindefaults, enddefaults;
+    off_t lendefaults;
+    off_t beginprolog, endprolog;
+    off_t lenprolog;
+    off_t beginsetup, endsetup;
+    off_t lensetup;
+    off_t begintrailer, endtrailer;
+    off_t lentrailer;
     int  boundingbox[4];
     int  default_page_boundingbox[4];
     int  orientation;			/* PORTRAIT, LANDSCAPE */
@@ -132,6 +139,13 @@ typedef struct document {
     DOSEPS *doseps;
     unsigned int numpages;
     struct page *pages;
+    struct scanstate *scan;             /* pending page scan, NULL when complete */
+    struct scanstate *resume;           /* state of a complete scan, to resume it */
+    const char *data;                   /* contents, when not read from filename */
+    long data_length;
+    struct spool *spool;                /* owns data for non-seekable input */
+    int  fd;                            /* shared descriptor for reading sections, or -1 */
+    struct SpectreZIndex *zindex;       /* restart points of compressed input, or NULL */
 } *Document;
 
 struct page {
@@ -139,8 +153,8 @@ struct page {
     int  boundingbox[4];
     const struct documentmedia *media;
     int  orientation;			/* PORTRAIT, LANDSCAPE */
-    long begin, end;			/* offsets into file */
-    unsigned int len;
+    off_t begin, end;			/* offsets into file */
+    off_t len;
 };
 
 	/* scans a PostScript file and return a pointer to the document
@@ -150,6 +164,7 @@ struct page {
 #define SCANSTYLE_NORMAL     0
 #define SCANSTYLE_IGNORE_EOF (1<<0)
 #define SCANSTYLE_IGNORE_DSC (1<<1)
+#define SCANSTYLE_SERIAL     (1<<2)  /* never look for page boundaries in parallel */
 
 Document				psscan (
 #if NeedFunctionPrototypes
@@ -157,6 +172,96 @@ Document				psscan (
     const char *,
     int     /* scanstyle */
 #endif
+);
+
+	/* scans the header, prolog and setup of a PostScript file, but
+	   only the first maxscan pages (all of them when maxscan is 0).
+	   The scan of the remaining pages is left pending in doc->scan. */
+
+Document				psscanpartial (
+#if NeedFunctionPrototypes
+    FILE *,
+    const char *,
+    int,    /* scanstyle */
+    unsigned int  /* maxscan */
+#endif
+);
+
+	/* same as psscanpartial(), but scans the contents of a document
+	   already in memory. The data is not copied, it must be valid for
+	   as long as the document is. */
+
+Document				psscandata (
+#if NeedFunctionPrototypes
+    const char *,
+    long,   /* length */
+    const char *,
+    int,    /* scanstyle */
+    unsigned int  /* maxscan */
+#endif
+);
+
+	/* same as psscanpartial(), but for input that can't be seeked.
+	   The input is copied to memory as the scan needs it, and the
+	   document data points to the copy. The file is read by
+	   psscancontinue() until the scan is complete. */
+
+Document				psscanstream (
+#if NeedFunctionPrototypes
+    FILE *,
+    const char *,
+    int,    /* scanstyle */
+    unsigned int  /* maxscan */
+#endif
+);
+
+	/* scans only the header comments of a PostScript file, and its
+	   trailer for the values deferred to it with (atend). The document
+	   has no pages, the number of pages declared by %%Pages:, or 0,
+	   is returned in the last argument. */
+
+Document				psprobe (
+#if NeedFunctionPrototypes
+    FILE *,
+    const char *,
+    unsigned int *  /* declared pages */
+#endif
+);
+
+	/* resumes a pending scan until at least maxscan pages are known,
+	   or until the end of the file when maxscan is 0. The file must
+	   be the same one given to psscanpartial(), it is not used for
+	   documents scanned with psscandata() or psscanstream(). Returns True when
+	   the whole document has been scanned. */
+
+int					psscancontinue (
+#if NeedFunctionPrototypes
+    FILE *,
+    struct document *,
+    unsigned int  /* maxscan */
+#endif
+);
+
+	/* scans again the last page and whatever follows it, for a file
+	   that has grown since it was completely scanned with psscan() or
+	   psscanpartial(). Pages are added and the trailer updated in
+	   place. Returns False, leaving the document untouched, when the
+	   file must be scanned again from the beginning. */
+
+int					psscanresume (
+#if NeedFunctionPrototypes
+    FILE *,
+    struct document *
+#endif
+);
+
+	/* returns the expected number of pages of a document whose scan
+	   is still pending, or the actual number once it is complete. */
+
+unsigned int				psscanestimate (
+#if NeedFunctionPrototypes
+    const struct document *
+#endif
 );
 
 void					psdocdestroy (
@@ -207,8 +312,8 @@ void                                    pscopy (
     FILE *,
     FILE *,
     Document,
-    long,
-    long
+    off_t,  /* begin, negative to not seek */
+    off_t   /* end, negative to copy until the end */
 #endif
 );
 
@@ -237,6 +342,70 @@ void                                    pscopytrailer (
     Document,
     unsigned int
 #endif
+);
+
+	/* opens the contents of a document for copying several of its
+	   sections, reading from file unless the document was loaded from
+	   memory or is compressed. When file is NULL the document's fd is
+	   read with positional reads, so that several threads can copy
+	   from it at once. Sections copied in the order they are in the
+	   file are read sequentially. */
+
+FileData                                pscopyopen (
+#if NeedFunctionPrototypes
+    FILE *,
+    Document
+#endif
+);
+
+void                                    pscopyclose (
+#if NeedFunctionPrototypes
+    FileData
+#endif
+);
+
+	/* like pscopyheaders(), pscopypage() and pscopytrailer(), but
+	   reading from contents opened with pscopyopen() */
+
+void                                    pscopyheadersfd (
+#if NeedFunctionPrototypes
+    FileData,
+    FILE *,
+    Document
+#endif
+);
+
+void                                    pscopypagefd (
+#if NeedFunctionPrototypes
+    FileData,
+    FILE *,
+    Document,
+    unsigned int,
+    unsigned int
+#endif
+);
+
+void                                    pscopytrailerfd (
+#if NeedFunctionPrototypes
+    FileData,
+    FILE *,
+    Document,
+    unsigned int
+#endif
+);
+
+	/* returns True when str is found in a line of the section of the
+	   document from begin to end, reading file unless the document was
+	   loaded from memory or is compressed, or its fd when file is NULL. */
+
+int                                     pssectioncontains (
+#if NeedFunctionPrototypes
+    FILE *,
+    Document,
+    off_t,
+    off_t,
+    const char *
+#endif
 );
 
 SPECTRE_END_DECLS
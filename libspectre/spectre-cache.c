@@ -0,0 +1,668 @@
+/* This file is part of Libspectre.
+ *
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* For fstat */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spectre-cache.h"
+#include "spectre-utils.h"
+
+/* The index of a document is stored as a single file made of a fixed
+ * size header followed by the media records, the page records and a
+ * table of NUL terminated strings. Records only contain fixed width
+ * integers and offsets, never pointers, so the file can be read or
+ * mapped in place. Every integer is stored in host byte order, caches
+ * written by a host with a different byte order are just ignored.
+ *
+ * Bump CACHE_VERSION whenever the layout or the meaning of any field
+ * changes.
+ */
+#define CACHE_MAGIC      "SPCIDX\r\n"
+#define CACHE_VERSION    2
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_NO_STRING  0xffffffff
+#define CACHE_HASH_SIZE  65536
+
+typedef struct {
+	int64_t  begin;
+	int64_t  end;
+	uint64_t len;
+} CacheSection;
+
+typedef struct {
+	uint32_t name;
+	int32_t  width;
+	int32_t  height;
+	uint32_t padding;
+} CacheMedia;
+
+typedef struct {
+	int64_t  begin;
+	int64_t  end;
+	uint64_t len;
+	uint32_t label;
+	int32_t  media;
+	int32_t  orientation;
+	int32_t  boundingbox[4];
+	uint32_t padding;
+} CachePage;
+
+typedef struct {
+	char         magic[8];
+	uint32_t     version;
+	uint32_t     byte_order;
+	uint32_t     header_size;
+	uint32_t     page_size;
+
+	/* File identity */
+	uint64_t     dev;
+	uint64_t     ino;
+	uint64_t     size;
+	uint64_t     mtime;
+	uint64_t     head_hash;
+	uint64_t     tail_hash;
+
+	/* Document */
+	uint32_t     format;
+	uint32_t     title;
+	uint32_t     date;
+	uint32_t     creator;
+	uint32_t     fortext;
+	uint32_t     languagelevel;
+	int32_t      epsf;
+	int32_t      pageorder;
+	CacheSection header;
+	CacheSection preview;
+	CacheSection defaults;
+	CacheSection prolog;
+	CacheSection setup;
+	CacheSection trailer;
+	int32_t      boundingbox[4];
+	int32_t      default_page_boundingbox[4];
+	int32_t      orientation;
+	int32_t      default_page_orientation;
+	int32_t      default_page_media;
+	uint32_t     has_doseps;
+	uint64_t     doseps[6];
+	uint32_t     doseps_checksum;
+	uint32_t     nummedia;
+	uint32_t     numpages;
+	uint32_t     strings_size;
+	uint64_t     media_offset;
+	uint64_t     pages_offset;
+	uint64_t     strings_offset;
+} CacheHeader;
+
+typedef struct {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime;
+	uint64_t head_hash;
+	uint64_t tail_hash;
+} CacheKey;
+
+/* FNV-1a */
+static uint64_t
+cache_hash (const unsigned char *data,
+	    size_t               len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t   i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t
+cache_hash_range (FILE *file,
+		  off_t  offset,
+		  size_t len)
+{
+	unsigned char *buf;
+	size_t         read;
+	uint64_t       hash;
+
+	buf = malloc (len);
+	if (!buf)
+		return 0;
+
+	fseeko (file, offset, SEEK_SET);
+	read = fread (buf, 1, len, file);
+	hash = cache_hash (buf, read);
+	free (buf);
+
+	return hash;
+}
+
+/* Hashes the beginning and the end of the first size bytes of file,
+ * which tells whether they changed without reading them all. The file
+ * position is kept.
+ */
+void
+spectre_cache_hash_file (FILE     *file,
+			 off_t     size,
+			 uint64_t *head_hash,
+			 uint64_t *tail_hash)
+{
+	off_t  pos = ftello (file);
+	size_t len;
+
+	len = size < CACHE_HASH_SIZE ? size : CACHE_HASH_SIZE;
+	*head_hash = cache_hash_range (file, 0, len);
+	*tail_hash = cache_hash_range (file, size - len, len);
+	fseeko (file, pos, SEEK_SET);
+}
+
+/* In nanoseconds where the system keeps them, so that a file rewritten
+ * within the same second is told apart */
+uint64_t
+spectre_cache_file_mtime (const struct stat *stat_buf)
+{
+	uint64_t mtime = (uint64_t) stat_buf->st_mtime * 1000000000;
+
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+	mtime += stat_buf->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+	mtime += stat_buf->st_mtimespec.tv_nsec;
+#endif
+
+	return mtime;
+}
+
+/* The identity of the open file, not of its path, which could have been
+ * replaced since it was opened */
+static int
+cache_get_key (FILE     *file,
+	       CacheKey *key)
+{
+	struct stat stat_buf;
+
+	if (fstat (fileno (file), &stat_buf) != 0)
+		return FALSE;
+
+	key->dev = stat_buf.st_dev;
+	key->ino = stat_buf.st_ino;
+	key->size = stat_buf.st_size;
+	key->mtime = spectre_cache_file_mtime (&stat_buf);
+
+	spectre_cache_hash_file (file, stat_buf.st_size,
+				 &key->head_hash, &key->tail_hash);
+	rewind (file);
+
+	return TRUE;
+}
+
+static char *
+cache_get_filename (const char     *cache_dir,
+		    const CacheKey *key)
+{
+	return _spectre_strdup_printf ("%s/%llx-%llx.psidx", cache_dir,
+				       (unsigned long long) key->dev,
+				       (unsigned long long) key->ino);
+}
+
+/* Loading */
+
+static char *
+cache_get_string (const char *strings,
+		  uint32_t    strings_size,
+		  uint32_t    offset,
+		  int        *error)
+{
+	if (offset == CACHE_NO_STRING)
+		return NULL;
+
+	if (offset >= strings_size) {
+		*error = TRUE;
+		return NULL;
+	}
+
+	return _spectre_strdup (strings + offset);
+}
+
+static void
+cache_get_section (const CacheSection *section,
+		   off_t              *begin,
+		   off_t              *end,
+		   off_t              *len)
+{
+	*begin = section->begin;
+	*end = section->end;
+	*len = section->len;
+}
+
+static struct document *
+cache_read_document (const char        *data,
+		     size_t             size,
+		     const char        *filename,
+		     const CacheKey    *key)
+{
+	const CacheHeader *header = (const CacheHeader *) data;
+	const CacheMedia  *media;
+	const CachePage   *pages;
+	const char        *strings;
+	struct document   *doc;
+	unsigned int       i;
+	int                error = FALSE;
+
+	if (size < sizeof (CacheHeader) ||
+	    memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != CACHE_VERSION ||
+	    header->byte_order != CACHE_BYTE_ORDER ||
+	    header->header_size != sizeof (CacheHeader) ||
+	    header->page_size != sizeof (CachePage))
+		return NULL;
+
+	if (header->dev != key->dev || header->ino != key->ino ||
+	    header->size != key->size || header->mtime != key->mtime ||
+	    header->head_hash != key->head_hash ||
+	    header->tail_hash != key->tail_hash)
+		return NULL;
+
+	if (header->media_offset > size ||
+	    header->nummedia > (size - header->media_offset) / sizeof (CacheMedia) ||
+	    header->pages_offset > size ||
+	    header->numpages > (size - header->pages_offset) / sizeof (CachePage) ||
+	    header->strings_offset > size ||
+	    header->strings_size > size - header->strings_offset ||
+	    header->strings_size == 0)
+		return NULL;
+
+	media = (const CacheMedia *) (data + header->media_offset);
+	pages = (const CachePage *) (data + header->pages_offset);
+	strings = data + header->strings_offset;
+	if (strings[header->strings_size - 1] != '\0')
+		return NULL;
+
+	if (header->default_page_media >= (int32_t) header->nummedia)
+		return NULL;
+
+	doc = calloc (1, sizeof (struct document));
+	if (!doc)
+		return NULL;
+
+	doc->ref_count = 1;
+	doc->fd = -1;
+	doc->filename = _spectre_strdup (filename);
+	doc->format = cache_get_string (strings, header->strings_size, header->format, &error);
+	doc->title = cache_get_string (strings, header->strings_size, header->title, &error);
+	doc->date = cache_get_string (strings, header->strings_size, header->date, &error);
+	doc->creator = cache_get_string (strings, header->strings_size, header->creator, &error);
+	doc->fortext = cache_get_string (strings, header->strings_size, header->fortext, &error);
+	doc->languagelevel = cache_get_string (strings, header->strings_size,
+					       header->languagelevel, &error);
+	doc->epsf = header->epsf;
+	doc->pageorder = header->pageorder;
+	cache_get_section (&header->header, &doc->beginheader, &doc->endheader, &doc->lenheader);
+	cache_get_section (&header->preview, &doc->beginpreview, &doc->endpreview, &doc->lenpreview);
+	cache_get_section (&header->defaults, &doc->begindefaults, &doc->enddefaults, &doc->lendefaults);
+	cache_get_section (&header->prolog, &doc->beginprolog, &doc->endprolog, &doc->lenprolog);
+	cache_get_section (&header->setup, &doc->beginsetup, &doc->endsetup, &doc->lensetup);
+	cache_get_section (&header->trailer, &doc->begintrailer, &doc->endtrailer, &doc->lentrailer);
+	for (i = 0; i < 4; i++) {
+		doc->boundingbox[i] = header->boundingbox[i];
+		doc->default_page_boundingbox[i] = header->default_page_boundingbox[i];
+	}
+	doc->orientation = header->orientation;
+	doc->default_page_orientation = header->default_page_orientation;
+
+	if (header->has_doseps) {
+		doc->doseps = calloc (1, sizeof (DOSEPS));
+		if (!doc->doseps) {
+			psdocdestroy (doc);
+			return NULL;
+		}
+		memcpy (doc->doseps->id, "\305\320\323\306", 4);
+		doc->doseps->ps_begin = header->doseps[0];
+		doc->doseps->ps_length = header->doseps[1];
+		doc->doseps->mf_begin = header->doseps[2];
+		doc->doseps->mf_length = header->doseps[3];
+		doc->doseps->tiff_begin = header->doseps[4];
+		doc->doseps->tiff_length = header->doseps[5];
+		doc->doseps->checksum = header->doseps_checksum;
+	}
+
+	if (header->nummedia > 0) {
+		doc->media = calloc (header->nummedia, sizeof (MediaStruct));
+		if (!doc->media) {
+			psdocdestroy (doc);
+			return NULL;
+		}
+		doc->nummedia = header->nummedia;
+		for (i = 0; i < header->nummedia; i++) {
+			doc->media[i].name = cache_get_string (strings, header->strings_size,
+							       media[i].name, &error);
+			doc->media[i].width = media[i].width;
+			doc->media[i].height = media[i].height;
+		}
+		if (header->default_page_media >= 0)
+			doc->default_page_media = doc->media + header->default_page_media;
+	}
+
+	/* psscan always allocates at least one page */
+	doc->pages = calloc (header->numpages > 0 ? header->numpages : 1,
+			     sizeof (struct page));
+	if (!doc->pages) {
+		psdocdestroy (doc);
+		return NULL;
+	}
+	doc->numpages = header->numpages;
+	for (i = 0; i < header->numpages; i++) {
+		struct page *page = doc->pages + i;
+
+		page->label = cache_get_string (strings, header->strings_size,
+						pages[i].label, &error);
+		page->begin = pages[i].begin;
+		page->end = pages[i].end;
+		page->len = pages[i].len;
+		page->orientation = pages[i].orientation;
+		memcpy (page->boundingbox, pages[i].boundingbox, sizeof (page->boundingbox));
+		if (pages[i].media >= (int32_t) header->nummedia)
+			error = TRUE;
+		else if (pages[i].media >= 0)
+			page->media = doc->media + pages[i].media;
+	}
+
+	if (error) {
+		psdocdestroy (doc);
+		return NULL;
+	}
+
+	return doc;
+}
+
+struct document *
+spectre_cache_load (const char *cache_dir,
+		    const char *filename,
+		    FILE       *file)
+{
+	CacheKey         key;
+	char            *cache_filename;
+	FILE            *cache;
+	char            *data;
+	long             size;
+	struct document *doc = NULL;
+
+	if (!cache_get_key (file, &key))
+		return NULL;
+
+	cache_filename = cache_get_filename (cache_dir, &key);
+	cache = fopen (cache_filename, "rb");
+	free (cache_filename);
+	if (!cache)
+		return NULL;
+
+	fseek (cache, 0, SEEK_END);
+	size = ftell (cache);
+	rewind (cache);
+
+	if (size < (long) sizeof (CacheHeader)) {
+		fclose (cache);
+		return NULL;
+	}
+
+	data = malloc (size);
+	if (data && fread (data, 1, size, cache) == (size_t) size)
+		doc = cache_read_document (data, size, filename, &key);
+
+	free (data);
+	fclose (cache);
+
+	return doc;
+}
+
+/* Saving */
+
+typedef struct {
+	char    *data;
+	uint32_t size;
+	uint32_t allocated;
+} CacheStrings;
+
+static uint32_t
+cache_add_string (CacheStrings *strings,
+		  const char   *str,
+		  int          *error)
+{
+	size_t   len;
+	uint32_t offset;
+
+	if (!str)
+		return CACHE_NO_STRING;
+
+	len = strlen (str) + 1;
+	if (strings->size + len > strings->allocated) {
+		char *data;
+
+		while (strings->size + len > strings->allocated)
+			strings->allocated = strings->allocated ? strings->allocated * 2 : 1024;
+		data = realloc (strings->data, strings->allocated);
+		if (!data) {
+			*error = TRUE;
+			return CACHE_NO_STRING;
+		}
+		strings->data = data;
+	}
+
+	offset = strings->size;
+	memcpy (strings->data + offset, str, len);
+	strings->size += len;
+
+	return offset;
+}
+
+static void
+cache_set_section (CacheSection *section,
+		   off_t         begin,
+		   off_t         end,
+		   off_t         len)
+{
+	section->begin = begin;
+	section->end = end;
+	section->len = len;
+}
+
+static int
+cache_write_document (FILE            *cache,
+		      struct document *doc,
+		      const CacheKey  *key)
+{
+	CacheHeader  header;
+	CacheMedia  *media = NULL;
+	CachePage   *pages = NULL;
+	CacheStrings strings = { NULL, 0, 0 };
+	unsigned int i;
+	int          error = FALSE;
+	int          retval = FALSE;
+
+	memset (&header, 0, sizeof (CacheHeader));
+	memcpy (header.magic, CACHE_MAGIC, sizeof (header.magic));
+	header.version = CACHE_VERSION;
+	header.byte_order = CACHE_BYTE_ORDER;
+	header.header_size = sizeof (CacheHeader);
+	header.page_size = sizeof (CachePage);
+
+	header.dev = key->dev;
+	header.ino = key->ino;
+	header.size = key->size;
+	header.mtime = key->mtime;
+	header.head_hash = key->head_hash;
+	header.tail_hash = key->tail_hash;
+
+	/* Offset 0 of the string table is always a valid empty string */
+	cache_add_string (&strings, "", &error);
+	header.format = cache_add_string (&strings, doc->format, &error);
+	header.title = cache_add_string (&strings, doc->title, &error);
+	header.date = cache_add_string (&strings, doc->date, &error);
+	header.creator = cache_add_string (&strings, doc->creator, &error);
+	header.fortext = cache_add_string (&strings, doc->fortext, &error);
+	header.languagelevel = cache_add_string (&strings, doc->languagelevel, &error);
+	header.epsf = doc->epsf;
+	header.pageorder = doc->pageorder;
+	cache_set_section (&header.header, doc->beginheader, doc->endheader, doc->lenheader);
+	cache_set_section (&header.preview, doc->beginpreview, doc->endpreview, doc->lenpreview);
+	cache_set_section (&header.defaults, doc->begindefaults, doc->enddefaults, doc->lendefaults);
+	cache_set_section (&header.prolog, doc->beginprolog, doc->endprolog, doc->lenprolog);
+	cache_set_section (&header.setup, doc->beginsetup, doc->endsetup, doc->lensetup);
+	cache_set_section (&header.trailer, doc->begintrailer, doc->endtrailer, doc->lentrailer);
+	for (i = 0; i < 4; i++) {
+		header.boundingbox[i] = doc->boundingbox[i];
+		header.default_page_boundingbox[i] = doc->default_page_boundingbox[i];
+	}
+	header.orientation = doc->orientation;
+	header.default_page_orientation = doc->default_page_orientation;
+	header.default_page_media = doc->default_page_media ?
+		doc->default_page_media - doc->media : -1;
+
+	if (doc->doseps) {
+		header.has_doseps = TRUE;
+		header.doseps[0] = doc->doseps->ps_begin;
+		header.doseps[1] = doc->doseps->ps_length;
+		header.doseps[2] = doc->doseps->mf_begin;
+		header.doseps[3] = doc->doseps->mf_length;
+		header.doseps[4] = doc->doseps->tiff_begin;
+		header.doseps[5] = doc->doseps->tiff_length;
+		header.doseps_checksum = doc->doseps->checksum;
+	}
+
+	header.nummedia = doc->nummedia;
+	if (doc->nummedia > 0) {
+		media = calloc (doc->nummedia, sizeof (CacheMedia));
+		if (!media)
+			goto out;
+		for (i = 0; i < doc->nummedia; i++) {
+			media[i].name = cache_add_string (&strings, doc->media[i].name, &error);
+			media[i].width = doc->media[i].width;
+			media[i].height = doc->media[i].height;
+		}
+	}
+
+	header.numpages = doc->numpages;
+	if (doc->numpages > 0) {
+		pages = calloc (doc->numpages, sizeof (CachePage));
+		if (!pages)
+			goto out;
+		for (i = 0; i < doc->numpages; i++) {
+			const struct page *page = doc->pages + i;
+
+			pages[i].begin = page->begin;
+			pages[i].end = page->end;
+			pages[i].len = page->len;
+			pages[i].label = cache_add_string (&strings, page->label, &error);
+			pages[i].media = page->media ? page->media - doc->media : -1;
+			pages[i].orientation = page->orientation;
+			memcpy (pages[i].boundingbox, page->boundingbox, sizeof (pages[i].boundingbox));
+		}
+	}
+
+	if (error)
+		goto out;
+
+	header.media_offset = sizeof (CacheHeader);
+	header.pages_offset = header.media_offset + doc->nummedia * sizeof (CacheMedia);
+	header.strings_offset = header.pages_offset + doc->numpages * sizeof (CachePage);
+	header.strings_size = strings.size;
+
+	if (fwrite (&header, sizeof (CacheHeader), 1, cache) != 1)
+		goto out;
+	if (doc->nummedia > 0 &&
+	    fwrite (media, sizeof (CacheMedia), doc->nummedia, cache) != doc->nummedia)
+		goto out;
+	if (doc->numpages > 0 &&
+	    fwrite (pages, sizeof (CachePage), doc->numpages, cache) != doc->numpages)
+		goto out;
+	if (fwrite (strings.data, 1, strings.size, cache) != strings.size)
+		goto out;
+
+	retval = TRUE;
+ out:
+	free (media);
+	free (pages);
+	free (strings.data);
+
+	return retval;
+}
+
+int
+spectre_cache_save (const char      *cache_dir,
+		    struct document *doc,
+		    FILE            *file)
+{
+	CacheKey key;
+	char    *cache_filename;
+	char    *tmp_filename;
+	FILE    *cache = NULL;
+	int      fd;
+	int      retval;
+
+	/* Only complete indexes are worth saving. Compressed documents
+	 * also need their restart points, which aren't cached */
+	if (doc->scan || doc->zindex)
+		return FALSE;
+
+	if (!cache_get_key (file, &key))
+		return FALSE;
+
+	cache_filename = cache_get_filename (cache_dir, &key);
+	/* Unique to every save, documents loaded from the same file on
+	 * other threads or processes are saved at the same time */
+	tmp_filename = _spectre_strdup_printf ("%s.XXXXXX", cache_filename);
+
+	fd = tmp_filename ? mkstemp (tmp_filename) : -1;
+	if (fd >= 0) {
+		cache = fdopen (fd, "wb");
+		if (!cache) {
+			close (fd);
+			remove (tmp_filename);
+		}
+	}
+	if (!cache) {
+		free (tmp_filename);
+		free (cache_filename);
+		return FALSE;
+	}
+
+	retval = cache_write_document (cache, doc, &key);
+	if (fclose (cache) != 0)
+		retval = FALSE;
+
+	/* Readers never see a partially written index */
+	if (!retval || rename (tmp_filename, cache_filename) != 0) {
+		remove (tmp_filename);
+		retval = FALSE;
+	}
+
+	free (tmp_filename);
+	free (cache_filename);
+
+	return retval;
+}
@@ -0,0 +1,49 @@
+/* This file is part of Libspectre.
+ *
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SPECTRE_CACHE_H
+#define SPECTRE_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <libspectre/spectre-macros.h>
+
+#include "ps.h"
+
+SPECTRE_BEGIN_DECLS
+
+struct document *spectre_cache_load       (const char        *cache_dir,
+					   const char        *filename,
+					   FILE              *file);
+int              spectre_cache_save       (const char        *cache_dir,
+					   struct document   *doc,
+					   FILE              *file);
+void             spectre_cache_hash_file  (FILE              *file,
+					   off_t              size,
+					   uint64_t          *head_hash,
+					   uint64_t          *tail_hash);
+uint64_t         spectre_cache_file_mtime (const struct stat *stat_buf);
+
+SPECTRE_END_DECLS
+
+#endif /* SPECTRE_CACHE_H */
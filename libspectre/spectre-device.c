@@ -38,8 +38,47 @@ struct SpectreDevice {
 	unsigned char *gs_image; /*! Image buffer we received from Ghostscript library */
 	unsigned char *user_image;
 	int page_called;
+
+	/* Pages given to page_func are not copied */
+	SpectreDevicePageFunc page_func;
+	void *closure;
+	int page_failed;
+
+	/* Memory of the frame buffers and the rotation buffer, in bytes */
+	size_t memory_limit;
+	size_t memory;
+	size_t peak_memory;
+	size_t frame_memory; /*! Of the frame buffers of the current size */
+	int memory_exceeded;
 };
 
+#define PIXEL_SIZE 4
+#define ROW_ALIGN 32
+
+/* Fails when size more bytes would be over the limit */
+static int
+device_reserve_memory (SpectreDevice *sd,
+		       size_t         size)
+{
+	if (sd->memory_limit > 0 && size > sd->memory_limit - sd->memory) {
+		sd->memory_exceeded = TRUE;
+		return FALSE;
+	}
+
+	sd->memory += size;
+	if (sd->memory > sd->peak_memory)
+		sd->peak_memory = sd->memory;
+
+	return TRUE;
+}
+
+static void
+device_release_memory (SpectreDevice *sd,
+		       size_t         size)
+{
+	sd->memory -= size;
+}
+
 static int
 spectre_open (void *handle, void *device)
 {
@@ -67,12 +106,33 @@ spectre_presize (void *handle, void *device, int width, int height,
 	if (!handle)
 		return 0;
 
+	_spectre_trace_begin ("display_presize", (const char *) NULL);
 	sd = (SpectreDevice *)handle;
 	sd->width = width;
 	sd->height = height;
 	sd->row_length = raster;
 	sd->gs_image = NULL;
-	sd->user_image = malloc (sd->row_length * sd->height);
+
+	/* The frame buffer of Ghostscript and our copy of it */
+	free (sd->user_image);
+	sd->user_image = NULL;
+	device_release_memory (sd, sd->frame_memory);
+	sd->frame_memory = (size_t) raster * height;
+	if (!sd->page_func)
+		sd->frame_memory *= 2;
+	if (!device_reserve_memory (sd, sd->frame_memory)) {
+		sd->frame_memory = 0;
+		_spectre_trace_end ("display_presize");
+
+		return -1;
+	}
+
+	if (!sd->page_func) {
+		sd->user_image = malloc ((size_t) sd->row_length * sd->height);
+		_spectre_stats_add (allocations, 1);
+		_spectre_stats_add (allocated_bytes, (size_t) sd->row_length * sd->height);
+	}
+	_spectre_trace_end ("display_presize");
 	
 	return 0;
 }
@@ -86,8 +146,10 @@ spectre_size (void *handle, void *device, int width, int height, int raster,
 	if (!handle)
 		return 0;
 
+	_spectre_trace_begin ("display_size", (const char *) NULL);
 	sd = (SpectreDevice *)handle;
 	sd->gs_image = pimage;
+	_spectre_trace_end ("display_size");
 
 	return 0;
 }
@@ -107,8 +169,25 @@ spectre_page (void *handle, void *device, int copies, int flush)
 		return 0;
 	
 	sd = (SpectreDevice *)handle;
-	sd->page_called = TRUE;
-	memcpy (sd->user_image, sd->gs_image, sd->row_length * sd->height);
+	/* Only the first page is given to page_func */
+	if (sd->page_func && sd->page_called)
+		return 0;
+
+	_spectre_trace_begin ("display_page", (const char *) NULL);
+	if (sd->page_func) {
+		sd->page_called = TRUE;
+		if (!sd->gs_image ||
+		    !sd->page_func (sd->closure, sd->gs_image,
+				    sd->width, sd->height, sd->row_length))
+			sd->page_failed = TRUE;
+	} else {
+		sd->page_called = TRUE;
+		_spectre_phase_begin (SPECTRE_PHASE_DISPLAY_COPY);
+		memcpy (sd->user_image, sd->gs_image, sd->row_length * sd->height);
+		_spectre_phase_end (SPECTRE_PHASE_DISPLAY_COPY);
+		_spectre_stats_add (frames_copied, 1);
+	}
+	_spectre_trace_end ("display_page");
 	
 	return 0;
 }
@@ -126,10 +205,14 @@ spectre_update (void *handle, void *device, int x, int y, int w, int h)
 	if (!sd->gs_image || sd->page_called || !sd->user_image)
 		return 0;
 
+	_spectre_trace_begin ("display_update", (const char *) NULL);
+	_spectre_phase_begin (SPECTRE_PHASE_DISPLAY_COPY);
 	for (i = y; i < y + h; ++i) {
 		memcpy (sd->user_image + sd->row_length * i + x * 4,
 			sd->gs_image + sd->row_length * i + x * 4, w * 4);
 	}
+	_spectre_phase_end (SPECTRE_PHASE_DISPLAY_COPY);
+	_spectre_trace_end ("display_update");
 	
 	return 0;
 }
@@ -162,8 +245,14 @@ spectre_device_new (struct document *doc)
 	return device;
 }
 
-#define PIXEL_SIZE 4
-#define ROW_ALIGN 32
+void
+spectre_device_set_page_func (SpectreDevice        *device,
+			      SpectreDevicePageFunc page_func,
+			      void                 *closure)
+{
+	device->page_func = page_func;
+	device->closure = closure;
+}
 
 static void
 swap_pixels (unsigned char *data,
@@ -189,8 +278,9 @@ copy_pixel (unsigned char *dest,
         memcpy (dest + dest_pixel_start, src + src_pixel_start, PIXEL_SIZE);
 }
 
-static void
-rotate_image_to_orientation (unsigned char    **page_data,
+static SpectreStatus
+rotate_image_to_orientation (SpectreDevice     *device,
+                             unsigned char    **page_data,
                              int               *row_length,
                              int                width,
                              int                height,
@@ -222,17 +312,23 @@ rotate_image_to_orientation (unsigned char    **page_data,
                 break;
         case SPECTRE_ORIENTATION_LANDSCAPE:
         case SPECTRE_ORIENTATION_REVERSE_LANDSCAPE:
-                if (height % ROW_ALIGN > 0) {
-                        padding = (ROW_ALIGN - height % ROW_ALIGN) * PIXEL_SIZE;
-                        stride = height * PIXEL_SIZE + padding;
-                        user_image = malloc (width * stride);
-
-                        for (j = 0; j < width; ++j)
-                                memset (user_image + j * stride + stride - padding, 0, padding);
-                } else {
-                        stride = height * PIXEL_SIZE;
-                        user_image = malloc (width * stride);
+                padding = height % ROW_ALIGN > 0 ?
+                        (ROW_ALIGN - height % ROW_ALIGN) * PIXEL_SIZE : 0;
+                stride = height * PIXEL_SIZE + padding;
+
+                /* Both images are kept while rotating */
+                if (!device_reserve_memory (device, width * stride))
+                        return SPECTRE_STATUS_MEMORY_LIMIT;
+                user_image = malloc (width * stride);
+                if (!user_image) {
+                        device_release_memory (device, width * stride);
+                        return SPECTRE_STATUS_NO_MEMORY;
                 }
+                _spectre_stats_add (allocations, 1);
+                _spectre_stats_add (allocated_bytes, width * stride);
+
+                for (j = 0; padding > 0 && j < width; ++j)
+                        memset (user_image + j * stride + stride - padding, 0, padding);
 
                 if (orientation == SPECTRE_ORIENTATION_LANDSCAPE) {
                         for (j = 0; j < height; ++j) {
@@ -255,22 +351,41 @@ rotate_image_to_orientation (unsigned char    **page_data,
                 }
 
                 free (*page_data);
+                device_release_memory (device, (size_t) *row_length * height);
                 *page_data = user_image;
                 *row_length = stride;
                 break;
         }
+
+        return SPECTRE_STATUS_SUCCESS;
 }
 
-SpectreStatus
-spectre_device_render (SpectreDevice        *device,
-		       unsigned int          page,
-		       SpectreRenderContext *rc,
-		       int                   x,
-		       int                   y,
-		       int                   width,
-		       int                   height,
-		       unsigned char       **page_data,
-		       int                  *row_length)
+/* Frees the instance of a failed render, which failed because of the
+ * memory limit when our frame buffers or Ghostscript went over it */
+static SpectreStatus
+render_error (SpectreDevice *device,
+	      SpectreGS     *gs)
+{
+	SpectreStatus status = SPECTRE_STATUS_RENDER_ERROR;
+
+	if (device->memory_limit > 0 &&
+	    (device->memory_exceeded || spectre_gs_out_of_memory (gs)))
+		status = SPECTRE_STATUS_MEMORY_LIMIT;
+	spectre_gs_free (gs);
+
+	return status;
+}
+
+static SpectreStatus
+device_render (SpectreDevice        *device,
+	       unsigned int          page,
+	       SpectreRenderContext *rc,
+	       int                   x,
+	       int                   y,
+	       int                   width,
+	       int                   height,
+	       unsigned char       **page_data,
+	       int                  *row_length)
 {
 	SpectreGS *gs;
 	char     **args;
@@ -284,7 +399,29 @@ spectre_device_render (SpectreDevice        *device,
 	char      *dsp_format, *dsp_handle;
 	char      *width_points = NULL;
 	char      *height_points = NULL;
+	char      *memory_limit = NULL;
+	size_t     frame_size = 0;
+	size_t     user_size = 0;
+	SpectreStatus status;
+	unsigned long long rotation_start;
+
+	width = (int) ((width * rc->x_scale) + 0.5);
+	height = (int) ((height * rc->y_scale) + 0.5);
 
+	/* Pages whose frame buffers don't fit are not rendered at all,
+	 * they are known beforehand unless the page size is given */
+	device->memory_limit = rc->memory_limit;
+	if (rc->memory_limit > 0 && (rc->width == -1 || rc->height == -1)) {
+		/* Rows are aligned to 32 bytes */
+		frame_size = ((size_t) width * PIXEL_SIZE + 31) / 32 * 32 * height;
+		if (!device->page_func)
+			user_size = frame_size;
+		if (user_size > rc->memory_limit ||
+		    frame_size > rc->memory_limit - user_size)
+			return SPECTRE_STATUS_MEMORY_LIMIT;
+	}
+
+	_spectre_phase_begin (SPECTRE_PHASE_CREATE_INSTANCE);
 	gs = spectre_gs_new ();
 	if (!gs)
 		return SPECTRE_STATUS_NO_MEMORY;
@@ -295,6 +432,7 @@ spectre_device_render (SpectreDevice        *device,
 		
 		return SPECTRE_STATUS_RENDER_ERROR;
 	}
+	_spectre_phase_end (SPECTRE_PHASE_CREATE_INSTANCE);
 
 	if (!spectre_gs_set_display_callback (gs, (display_callback *)&spectre_device)) {
 		spectre_gs_cleanup (gs, CLEANUP_DELETE_INSTANCE);
@@ -303,13 +441,12 @@ spectre_device_render (SpectreDevice        *device,
 		return SPECTRE_STATUS_RENDER_ERROR;
 	}
 
-	width = (int) ((width * rc->x_scale) + 0.5);
-	height = (int) ((height * rc->y_scale) + 0.5);
-
 	if (rc->use_platform_fonts == FALSE)
 		n_args++;
 	if (rc->width != -1 && rc->height != -1)
 		n_args += 3;
+	if (rc->memory_limit > 0)
+		n_args++;
 	
 	args = calloc (sizeof (char *), n_args);
 	args[arg++] = "libspectre"; /* This value doesn't really matter */
@@ -360,7 +497,16 @@ spectre_device_render (SpectreDevice        *device,
 		args[arg++] = "-dFIXEDMEDIA";
 	}
 
+	/* What's left after our copy of the page is for the allocator of
+	 * Ghostscript, in KB */
+	if (rc->memory_limit > 0) {
+		args[arg++] = memory_limit = _spectre_strdup_printf ("-K%lu",
+								     (unsigned long) ((rc->memory_limit - user_size) / 1024 + 1));
+	}
+
+	_spectre_phase_begin (SPECTRE_PHASE_INIT);
 	success = spectre_gs_run (gs, n_args, args);
+	_spectre_phase_end (SPECTRE_PHASE_INIT);
 	free (text_alpha);
 	free (graph_alpha);
 	free (size);
@@ -369,11 +515,11 @@ spectre_device_render (SpectreDevice        *device,
 	free (resolution);
 	free (dsp_format);
 	free (dsp_handle);
+	free (memory_limit);
 	free (args);
 	if (!success) {
 		free (device->user_image);
-		spectre_gs_free (gs);
-		return SPECTRE_STATUS_RENDER_ERROR;
+		return render_error (device, gs);
 	}
 
 	set = _spectre_strdup_printf ("<< /Orientation %d >> setpagedevice .locksafe",
@@ -381,25 +527,72 @@ spectre_device_render (SpectreDevice        *device,
 	if (!spectre_gs_send_string (gs, set)) {
 		free (set);
 		free (device->user_image);
-		spectre_gs_free (gs);
-		return SPECTRE_STATUS_RENDER_ERROR;
+		return render_error (device, gs);
 	}
 	free (set);
 
 	if (!spectre_gs_send_page (gs, device->doc, page, x, y)) {
 		free (device->user_image);
+		return render_error (device, gs);
+	}
+
+	/* The page has already been handled, the orientation too */
+	if (device->page_func) {
 		spectre_gs_free (gs);
-		return SPECTRE_STATUS_RENDER_ERROR;
+
+		return device->page_called && !device->page_failed ?
+			SPECTRE_STATUS_SUCCESS : SPECTRE_STATUS_RENDER_ERROR;
 	}
 
+	/* The frame buffer of Ghostscript is not needed to rotate */
+	spectre_gs_free (gs);
+	device_release_memory (device, device->frame_memory / 2);
+
 	*page_data = device->user_image;
 	*row_length = device->row_length;
 
-        rotate_image_to_orientation (page_data, row_length, width, height, rc->orientation);
+	_spectre_phase_begin (SPECTRE_PHASE_ROTATION);
+	rotation_start = _spectre_stats_time_begin ();
+        status = rotate_image_to_orientation (device, page_data, row_length,
+                                              width, height, rc->orientation);
+	_spectre_stats_time_end (rotation_time, rotation_start);
+	_spectre_phase_end (SPECTRE_PHASE_ROTATION);
 
-	spectre_gs_free (gs);
+	if (status != SPECTRE_STATUS_SUCCESS) {
+		free (*page_data);
+		*page_data = NULL;
+	}
+
+	return status;
+}
+
+SpectreStatus
+spectre_device_render (SpectreDevice        *device,
+		       unsigned int          page,
+		       SpectreRenderContext *rc,
+		       int                   x,
+		       int                   y,
+		       int                   width,
+		       int                   height,
+		       unsigned char       **page_data,
+		       int                  *row_length)
+{
+	SpectreStatus status;
+	unsigned long long start = _spectre_stats_time_begin ();
 
-	return SPECTRE_STATUS_SUCCESS;
+	status = device_render (device, page, rc, x, y, width, height,
+				page_data, row_length);
+
+	_spectre_stats_add (renders, 1);
+	_spectre_stats_time_end (render_time, start);
+
+	return status;
+}
+
+size_t
+spectre_device_get_peak_memory (SpectreDevice *device)
+{
+	return device->peak_memory;
 }
 
 void
@@ -31,17 +31,30 @@ SPECTRE_BEGIN_DECLS
 
 typedef struct SpectreDevice SpectreDevice;
 
-SpectreDevice *spectre_device_new    (struct document      *doc);
-SpectreStatus  spectre_device_render (SpectreDevice        *device,
-				      unsigned int          page,
-				      SpectreRenderContext *rc,
-				      int                   x,
-				      int                   y,
-				      int                   width,
-				      int                   height,
-				      unsigned char       **page_data,
-				      int                  *row_length);
-void           spectre_device_free   (SpectreDevice        *device);
+/* Receives the image of a rendered page, the buffer of Ghostscript that
+ * is only valid during the call. It returns FALSE on errors
+ */
+typedef int (* SpectreDevicePageFunc) (void                *closure,
+				       const unsigned char *image,
+				       int                  width,
+				       int                  height,
+				       int                  row_length);
+
+SpectreDevice *spectre_device_new             (struct document      *doc);
+void           spectre_device_set_page_func   (SpectreDevice        *device,
+					       SpectreDevicePageFunc page_func,
+					       void                 *closure);
+SpectreStatus  spectre_device_render          (SpectreDevice        *device,
+					       unsigned int          page,
+					       SpectreRenderContext *rc,
+					       int                   x,
+					       int                   y,
+					       int                   width,
+					       int                   height,
+					       unsigned char       **page_data,
+					       int                  *row_length);
+size_t         spectre_device_get_peak_memory (SpectreDevice        *device);
+void           spectre_device_free            (SpectreDevice        *device);
 
 
 SPECTRE_END_DECLS
@@ -18,6 +18,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,15 @@
 #include "spectre-private.h"
 #include "spectre-exporter.h"
 #include "spectre-utils.h"
+#include "spectre-cache.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* Every file repeats the prolog and the setup, the copies are limited by
+ * the disk rather than by the threads */
+#define SPLIT_MAX_WORKERS 16
 
 struct SpectreDocument
 {
@@ -39,6 +49,15 @@ struct SpectreDocument
 	SpectreStatus    status;
 
 	int              structured;
+
+	int              probed;	/* only the metadata has been read */
+	unsigned int     n_probed_pages;
+
+	struct stat      file_stat;	/* the loaded file, to notice changes */
+	uint64_t         head_hash;	/* of the loaded contents, to notice rewrites */
+	uint64_t         tail_hash;
+
+	char            *cache_dir;
 };
 
 SpectreDocument *
@@ -51,28 +70,33 @@ spectre_document_new (void)
 }
 
 static void
-document_load (SpectreDocument *document,
-	       const char      *filename,
-	       FILE            *file)
+document_update_structured (SpectreDocument *document)
 {
-	_spectre_return_if_fail (document != NULL);
-
-	if (document->doc && strcmp (filename, document->doc->filename) == 0) {
-		document->status = SPECTRE_STATUS_SUCCESS;
+	/* A pending scan always has at least one page left */
+	if (document->doc->scan) {
+		document->structured = TRUE;
 		return;
 	}
 
-	if (document->doc) {
-		psdocdestroy (document->doc);
-		document->doc = NULL;
-	}
+	document->structured = ((!document->doc->epsf && document->doc->numpages > 0) ||
+				(document->doc->epsf && document->doc->numpages > 1));
+}
 
-	if (!file) {
-		document->status = SPECTRE_STATUS_LOAD_ERROR;
-		return;
-	}
-	
-	document->doc = psscan (file, filename, SCANSTYLE_NORMAL);
+static void
+document_keep_file (SpectreDocument *document,
+		    FILE            *file)
+{
+	/* Keep the file open while the document is alive, so that
+	 * sections are read from it without reopening the file
+	 */
+	if (document->doc && document->doc->fd < 0)
+		document->doc->fd = dup (fileno (file));
+}
+
+static void
+document_check_loaded (SpectreDocument *document,
+		       FILE            *file)
+{
 	if (!document->doc) {
 		document->status = SPECTRE_STATUS_LOAD_ERROR;
 		return;
@@ -101,14 +125,186 @@ document_load (SpectreDocument *document,
 		}
 	}
 
-	document->structured = ((!document->doc->epsf && document->doc->numpages > 0) ||
-				(document->doc->epsf && document->doc->numpages > 1));
+	document_update_structured (document);
+
+	if (document->cache_dir && file)
+		spectre_cache_save (document->cache_dir, document->doc, file);
 
 	if (document->status != SPECTRE_STATUS_SUCCESS)
 		document->status = SPECTRE_STATUS_SUCCESS;
 
 }
 
+static void
+document_stat_file (SpectreDocument *document,
+		    FILE            *file)
+{
+	if (fstat (fileno (file), &document->file_stat) != 0) {
+		memset (&document->file_stat, 0, sizeof (struct stat));
+		document->head_hash = document->tail_hash = 0;
+		return;
+	}
+
+	spectre_cache_hash_file (file, document->file_stat.st_size,
+				 &document->head_hash, &document->tail_hash);
+}
+
+/* Brings the document up to date with the file it was loaded from,
+ * returns FALSE when it has to be loaded again from the beginning
+ */
+static int
+document_rescan (SpectreDocument *document,
+		 FILE            *file)
+{
+	struct stat  file_stat;
+	struct stat *loaded = &document->file_stat;
+	uint64_t     head_hash;
+	uint64_t     tail_hash;
+
+	if (!file || fstat (fileno (file), &file_stat) != 0)
+		return FALSE;
+
+	if (file_stat.st_dev != loaded->st_dev || file_stat.st_ino != loaded->st_ino)
+		return FALSE;
+
+	if (file_stat.st_size == loaded->st_size &&
+	    spectre_cache_file_mtime (&file_stat) == spectre_cache_file_mtime (loaded))
+		return TRUE;
+
+	/* Only a file that has been appended to can be resumed: it has
+	 * grown and what was loaded is still there. Anything else is
+	 * loaded again, even with a pending scan.
+	 */
+	if (file_stat.st_size <= loaded->st_size || document->doc->zindex)
+		return FALSE;
+
+	spectre_cache_hash_file (file, loaded->st_size, &head_hash, &tail_hash);
+	if (head_hash != document->head_hash || tail_hash != document->tail_hash)
+		return FALSE;
+
+	/* A pending scan will find the new pages when it's continued */
+	if (!document->doc->scan) {
+		if (!psscanresume (file, document->doc))
+			return FALSE;
+
+		document_update_structured (document);
+		if (document->cache_dir)
+			spectre_cache_save (document->cache_dir, document->doc, file);
+	}
+	*loaded = file_stat;
+	spectre_cache_hash_file (file, file_stat.st_size,
+				 &document->head_hash, &document->tail_hash);
+
+	return TRUE;
+}
+
+static void
+document_load (SpectreDocument *document,
+	       const char      *filename,
+	       FILE            *file,
+	       unsigned int     n_pages)
+{
+	_spectre_return_if_fail (document != NULL);
+
+	if (document->doc && !document->probed &&
+	    strcmp (filename, document->doc->filename) == 0 &&
+	    document_rescan (document, file)) {
+		document->status = SPECTRE_STATUS_SUCCESS;
+		return;
+	}
+
+	if (document->doc) {
+		psdocdestroy (document->doc);
+		document->doc = NULL;
+	}
+	document->probed = FALSE;
+
+	if (!file) {
+		document->status = SPECTRE_STATUS_LOAD_ERROR;
+		return;
+	}
+
+	if (document->cache_dir) {
+		document->doc = spectre_cache_load (document->cache_dir, filename, file);
+		if (document->doc) {
+			document_keep_file (document, file);
+			document_stat_file (document, file);
+			document_update_structured (document);
+			document->status = SPECTRE_STATUS_SUCCESS;
+
+			return;
+		}
+	}
+	
+	document->doc = psscanpartial (file, filename, SCANSTYLE_NORMAL, n_pages);
+	document_keep_file (document, file);
+	document_stat_file (document, file);
+	document_check_loaded (document, file);
+}
+
+static void
+document_load_probed (SpectreDocument *document,
+		      unsigned int     n_pages)
+{
+	struct document *doc = document->doc;
+	FILE            *file;
+
+	/* Only the metadata has been read, load the document now */
+	document->doc = NULL;
+	document->probed = FALSE;
+
+	file = fopen (doc->filename, "rb");
+	_spectre_stats_add (file_opens, 1);
+	document_load (document, doc->filename, file, n_pages);
+	if (file)
+		fclose (file);
+
+	psdocdestroy (doc);
+}
+
+static void
+document_scan_pages (SpectreDocument *document,
+		     unsigned int     n_pages)
+{
+	FILE *file;
+
+	if (document->probed) {
+		document_load_probed (document, n_pages);
+		return;
+	}
+
+	if (!document->doc->scan)
+		return;
+
+	if (document->doc->data) {
+		psscancontinue (NULL, document->doc, n_pages);
+		document_update_structured (document);
+		return;
+	}
+
+	if (document->doc->fd >= 0) {
+		int fd;
+
+		fd = dup (document->doc->fd);
+		file = fd >= 0 ? fdopen (fd, "rb") : NULL;
+		if (!file && fd >= 0)
+			close (fd);
+	} else {
+		file = fopen (document->doc->filename, "rb");
+		_spectre_stats_add (file_opens, 1);
+	}
+	if (!file) {
+		document->status = SPECTRE_STATUS_LOAD_ERROR;
+		return;
+	}
+
+	if (psscancontinue (file, document->doc, n_pages) && document->cache_dir)
+		spectre_cache_save (document->cache_dir, document->doc, file);
+	fclose (file);
+
+	document_update_structured (document);
+}
+
 void
 spectre_document_load (SpectreDocument *document,
 		       const char *filename)
@@ -118,15 +314,152 @@ spectre_document_load (SpectreDocument *document,
 	_spectre_return_if_fail (filename != NULL);
 
 	file = fopen (filename, "rb");
-	document_load (document, filename, file);
+	_spectre_stats_add (file_opens, 1);
+	document_load (document, filename, file, 0);
 	fclose (file);
 }
 
+void
+spectre_document_load_partial (SpectreDocument *document,
+			       const char      *filename,
+			       unsigned int     n_pages)
+{
+	FILE *file;
+
+	_spectre_return_if_fail (filename != NULL);
+
+	file = fopen (filename, "rb");
+	_spectre_stats_add (file_opens, 1);
+	document_load (document, filename, file, n_pages > 0 ? n_pages : 1);
+	if (file)
+		fclose (file);
+}
+
 void
 spectre_document_load_from_stream (SpectreDocument *document,
 				   FILE            *file)
 {
-	document_load (document, "stream", file);
+	/* Pipes can't be rewound, read them through a spool */
+	if (file && fseek (file, 0, SEEK_CUR) != 0) {
+		spectre_document_load_from_pipe (document, file, 0);
+		return;
+	}
+
+	document_load (document, "stream", file, 0);
+}
+
+void
+spectre_document_load_from_pipe (SpectreDocument *document,
+				 FILE            *file,
+				 unsigned int     n_pages)
+{
+	_spectre_return_if_fail (document != NULL);
+	_spectre_return_if_fail (file != NULL);
+
+	if (document->doc) {
+		psdocdestroy (document->doc);
+		document->doc = NULL;
+	}
+	document->probed = FALSE;
+
+	document->doc = psscanstream (file, "stream", SCANSTYLE_NORMAL, n_pages);
+	document_check_loaded (document, NULL);
+}
+
+void
+spectre_document_load_from_data (SpectreDocument *document,
+				 const void      *data,
+				 size_t           length)
+{
+	_spectre_return_if_fail (document != NULL);
+	_spectre_return_if_fail (data != NULL);
+
+	if (document->doc) {
+		psdocdestroy (document->doc);
+		document->doc = NULL;
+	}
+	document->probed = FALSE;
+
+	document->doc = psscandata (data, length, "data", SCANSTYLE_NORMAL, 0);
+	document_check_loaded (document, NULL);
+}
+
+void
+spectre_document_probe (SpectreDocument *document,
+			const char      *filename)
+{
+	FILE         *file;
+	unsigned int  n_pages = 0;
+
+	_spectre_return_if_fail (document != NULL);
+	_spectre_return_if_fail (filename != NULL);
+
+	if (document->doc) {
+		psdocdestroy (document->doc);
+		document->doc = NULL;
+	}
+	document->probed = FALSE;
+
+	file = fopen (filename, "rb");
+	_spectre_stats_add (file_opens, 1);
+	if (!file) {
+		document->status = SPECTRE_STATUS_LOAD_ERROR;
+		return;
+	}
+
+	/* A cached index is as cheap as the header, and complete */
+	if (document->cache_dir) {
+		document->doc = spectre_cache_load (document->cache_dir, filename, file);
+		if (document->doc) {
+			document_keep_file (document, file);
+			document_stat_file (document, file);
+			document_update_structured (document);
+			document->status = SPECTRE_STATUS_SUCCESS;
+			fclose (file);
+
+			return;
+		}
+	}
+
+	document->doc = psprobe (file, filename, &n_pages);
+	fclose (file);
+
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_LOAD_ERROR;
+		return;
+	}
+
+	document->probed = TRUE;
+	document->n_probed_pages = n_pages;
+	document->status = SPECTRE_STATUS_SUCCESS;
+}
+
+int
+spectre_document_is_complete (SpectreDocument *document)
+{
+	_spectre_return_val_if_fail (document != NULL, FALSE);
+
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
+		return FALSE;
+	}
+
+	return document->doc->scan == NULL && !document->probed;
+}
+
+void
+spectre_document_scan_pages (SpectreDocument *document,
+			     unsigned int     n_pages)
+{
+	_spectre_return_if_fail (document != NULL);
+
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
+		return;
+	}
+
+	document->status = SPECTRE_STATUS_SUCCESS;
+	document_scan_pages (document, n_pages);
 }
 
 void
@@ -140,9 +473,25 @@ spectre_document_free (SpectreDocument *document)
 		document->doc = NULL;
 	}
 
+	if (document->cache_dir) {
+		free (document->cache_dir);
+		document->cache_dir = NULL;
+	}
+
 	free (document);
 }
 
+void
+spectre_document_set_cache_dir (SpectreDocument *document,
+				const char      *cache_dir)
+{
+	_spectre_return_if_fail (document != NULL);
+
+	if (document->cache_dir)
+		free (document->cache_dir);
+	document->cache_dir = cache_dir ? _spectre_strdup (cache_dir) : NULL;
+}
+
 SpectreStatus
 spectre_document_status (SpectreDocument *document)
 {
@@ -161,7 +510,10 @@ spectre_document_get_n_pages (SpectreDocument *document)
 		return 0;
 	}
 	
-	return document->structured ? document->doc->numpages : 1;
+	if (document->probed)
+		return document->n_probed_pages;
+
+	return document->structured ? psscanestimate (document->doc) : 1;
 }
 
 SpectreOrientation
@@ -270,6 +622,30 @@ spectre_document_is_eps (SpectreDocument *document)
 	return document->doc->epsf;
 }
 
+void
+spectre_document_get_bounding_box (SpectreDocument *document,
+				   int             *left,
+				   int             *bottom,
+				   int             *right,
+				   int             *top)
+{
+	_spectre_return_if_fail (document != NULL);
+
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
+		return;
+	}
+
+	if (left)
+		*left = document->doc->boundingbox[LLX];
+	if (bottom)
+		*bottom = document->doc->boundingbox[LLY];
+	if (right)
+		*right = document->doc->boundingbox[URX];
+	if (top)
+		*top = document->doc->boundingbox[URY];
+}
+
 unsigned int 
 spectre_document_get_language_level (SpectreDocument *document)
 {
@@ -292,6 +668,18 @@ spectre_document_get_page (SpectreDocument *document,
 
 	_spectre_return_val_if_fail (document != NULL, NULL);
 
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
+		return NULL;
+	}
+
+	if ((document->doc->scan || document->probed) &&
+	    page_index >= document->doc->numpages) {
+		document_scan_pages (document, page_index + 1);
+		if (document->status == SPECTRE_STATUS_LOAD_ERROR)
+			return NULL;
+	}
+
 	index = (document->doc->pageorder == DESCEND) ?
 		(document->doc->numpages - 1) - page_index :
 		page_index;
@@ -301,11 +689,6 @@ spectre_document_get_page (SpectreDocument *document,
 		return NULL;
 	}
 
-	if (!document->doc) {
-		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
-		return NULL;
-	}
-	
 	page = _spectre_page_new (index, document->doc);
 	if (!page) {
 		document->status = SPECTRE_STATUS_NO_MEMORY;
@@ -337,11 +720,16 @@ spectre_document_get_page_by_label (SpectreDocument *document,
 		return NULL;
 	}
 
-	for (i = 0; i < document->doc->numpages; i++) {
-		if (strcmp (document->doc->pages[i].label, label) == 0) {
-			page_index = i;
-			break;
+	for (i = 0; page_index == -1; i++) {
+		if (i == document->doc->numpages) {
+			if (!document->doc->scan && !document->probed)
+				break;
+			document_scan_pages (document, i + 1);
+			if (!document->doc || i == document->doc->numpages)
+				break;
 		}
+		if (strcmp (document->doc->pages[i].label, label) == 0)
+			page_index = i;
 	}
 
 	if (page_index == -1) {
@@ -352,6 +740,73 @@ spectre_document_get_page_by_label (SpectreDocument *document,
 	return spectre_document_get_page (document, page_index);
 }
 
+unsigned int
+spectre_document_get_pages_info (SpectreDocument *document,
+				 unsigned int     first_page,
+				 unsigned int     n_pages,
+				 SpectrePageInfo *info)
+{
+	struct document *doc;
+	unsigned int     n_doc_pages;
+	unsigned int     last_page;
+	unsigned int     i;
+
+	_spectre_return_val_if_fail (document != NULL, 0);
+	_spectre_return_val_if_fail (info != NULL || n_pages == 0, 0);
+
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
+		return 0;
+	}
+
+	last_page = n_pages > UINT_MAX - first_page ? UINT_MAX : first_page + n_pages;
+	if ((document->doc->scan || document->probed) &&
+	    last_page > document->doc->numpages) {
+		document_scan_pages (document, last_page);
+		if (document->status == SPECTRE_STATUS_LOAD_ERROR)
+			return 0;
+	}
+
+	/* Only scanned pages, the count of partially loaded documents
+	 * can be an estimate */
+	doc = document->doc;
+	n_doc_pages = spectre_document_get_n_pages (document);
+	if (doc->numpages > 0 && n_doc_pages > doc->numpages)
+		n_doc_pages = doc->numpages;
+	if (first_page >= n_doc_pages) {
+		document->status = SPECTRE_STATUS_INVALID_PAGE;
+		return 0;
+	}
+	if (n_pages > n_doc_pages - first_page)
+		n_pages = n_doc_pages - first_page;
+
+	/* The same as spectre_document_get_page and the SpectrePage getters */
+	for (i = 0; i < n_pages; i++) {
+		unsigned int index;
+		int          urx, ury, llx, lly;
+
+		index = (doc->pageorder == DESCEND && doc->numpages > 0) ?
+			(doc->numpages - 1) - (first_page + i) :
+			first_page + i;
+
+		psgetpagebox (doc, index, &urx, &ury, &llx, &lly);
+		info[i].width = urx - llx;
+		info[i].height = ury - lly;
+		info[i].orientation = _spectre_page_orientation (doc, index);
+		info[i].label = doc->numpages > 0 ? doc->pages[index].label : NULL;
+		psgetpagebbox (doc, index, &urx, &ury, &llx, &lly);
+		info[i].bbox[0] = llx;
+		info[i].bbox[1] = lly;
+		info[i].bbox[2] = urx;
+		info[i].bbox[3] = ury;
+	}
+
+	if (document->status != SPECTRE_STATUS_SUCCESS)
+		document->status = SPECTRE_STATUS_SUCCESS;
+
+	return n_pages;
+}
+
 void
 spectre_document_render_full (SpectreDocument      *document,
 			      SpectreRenderContext *rc,
@@ -428,9 +883,9 @@ void
 spectre_document_save (SpectreDocument *document,
 		       const char      *filename)
 {
-	struct stat stat_buf;
 	FILE *from;
 	FILE *to;
+	int   ok;
 
 	_spectre_return_if_fail (document != NULL);
 	_spectre_return_if_fail (filename != NULL);
@@ -439,14 +894,29 @@ spectre_document_save (SpectreDocument *document,
 		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
 		return;
 	}
+
+	/* A probed document doesn't know yet whether it's compressed */
+	if (document->probed) {
+		document_scan_pages (document, 1);
+		if (!document->doc)
+			return;
+	}
 	
-	if (stat (document->doc->filename, &stat_buf) != 0) {
-		document->status = SPECTRE_STATUS_SAVE_ERROR;
+	if (document->doc->data) {
+		to = fopen (filename, "wb");
+		if (!to || fwrite (document->doc->data, 1, document->doc->data_length, to) !=
+		    (size_t) document->doc->data_length) {
+			document->status = SPECTRE_STATUS_SAVE_ERROR;
+			if (to)
+				fclose (to);
+			return;
+		}
+		document->status = fclose (to) == 0 ?
+			SPECTRE_STATUS_SUCCESS : SPECTRE_STATUS_SAVE_ERROR;
 		return;
 	}
 
-	from = fopen (document->doc->filename, "rb");
-	if (!from) {
+	if (!_spectre_document_open_file (document->doc, &from)) {
 		document->status = SPECTRE_STATUS_SAVE_ERROR;
 		return;
 	}
@@ -454,40 +924,130 @@ spectre_document_save (SpectreDocument *document,
 	to = fopen (filename, "wb");
 	if (!to) {
 		document->status = SPECTRE_STATUS_SAVE_ERROR;
+		if (from)
+			fclose (from);
+		return;
+	}
+
+	/* Nothing is rewritten, the whole file is copied as it is. Compressed
+	 * documents are saved uncompressed
+	 */
+	pscopy (from, to, document->doc, 0, -1);
+	ok = !ferror (to);
+
+	if (from)
 		fclose (from);
+	if (fclose (to) != 0)
+		ok = FALSE;
+
+	document->status = ok ? SPECTRE_STATUS_SUCCESS : SPECTRE_STATUS_SAVE_ERROR;
+}
+
+void
+spectre_document_save_to_data (SpectreDocument *document,
+			       unsigned char  **data,
+			       size_t          *length)
+{
+	SpectreBuffer buffer = { NULL, 0, 0 };
+	FILE *from;
+	FILE *to;
+	int ok;
+
+	_spectre_return_if_fail (document != NULL);
+	_spectre_return_if_fail (data != NULL);
+	_spectre_return_if_fail (length != NULL);
+
+	*data = NULL;
+	*length = 0;
+
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
+		return;
+	}
+
+	/* A probed document doesn't know yet whether it's compressed */
+	if (document->probed) {
+		document_scan_pages (document, 1);
+		if (!document->doc)
+			return;
+	}
+
+	if (document->doc->data) {
+		*data = malloc (document->doc->data_length ? document->doc->data_length : 1);
+		if (!*data) {
+			document->status = SPECTRE_STATUS_NO_MEMORY;
+			return;
+		}
+		memcpy (*data, document->doc->data, document->doc->data_length);
+		*length = document->doc->data_length;
+		document->status = SPECTRE_STATUS_SUCCESS;
+		return;
+	}
+
+	if (!_spectre_document_open_file (document->doc, &from)) {
+		document->status = SPECTRE_STATUS_SAVE_ERROR;
+		return;
+	}
+
+	to = _spectre_stream_open (_spectre_buffer_write, &buffer);
+	if (!to) {
+		document->status = SPECTRE_STATUS_SAVE_ERROR;
+		if (from)
+			fclose (from);
 		return;
 	}
 
-	pscopy (from, to, document->doc, 0, stat_buf.st_size - 1);
+	pscopy (from, to, document->doc, 0, -1);
 
-	fclose (from);
-	fclose (to);
+	if (from)
+		fclose (from);
+	ok = _spectre_stream_close (to, _spectre_buffer_write, &buffer);
+	if (!ok) {
+		free (buffer.data);
+		document->status = SPECTRE_STATUS_SAVE_ERROR;
+		return;
+	}
 
+	*data = buffer.data;
+	*length = buffer.length;
 	document->status = SPECTRE_STATUS_SUCCESS;
 }
 
-void
-spectre_document_save_to_pdf (SpectreDocument *document,
-			      const char      *filename)
+/* Exports pages, or every page when pages is NULL, in format */
+static void
+document_export (SpectreDocument      *document,
+		 SpectreExporterFormat format,
+		 const char           *filename,
+		 const unsigned int   *pages,
+		 unsigned int          n_pages)
 {
 	SpectreExporter *exporter;
-	SpectreStatus    status;
+	SpectreStatus    status = SPECTRE_STATUS_SUCCESS;
 	unsigned int     i;
 
-	_spectre_return_if_fail (document != NULL);
-	_spectre_return_if_fail (filename != NULL);
-
 	if (!document->doc) {
 		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
 		return;
 	}
 
-	exporter = spectre_exporter_new (document, SPECTRE_EXPORTER_FORMAT_PDF);
+	exporter = spectre_exporter_new (document, format);
 	if (!exporter) {
 		document->status = SPECTRE_STATUS_NO_MEMORY;
 		return;
 	}
 
+	if (!pages)
+		n_pages = spectre_document_get_n_pages (document);
+
+	/* Nothing is written when a page doesn't exist */
+	for (i = 0; pages && i < n_pages; i++) {
+		if (pages[i] >= spectre_document_get_n_pages (document)) {
+			document->status = SPECTRE_STATUS_INVALID_PAGE;
+			spectre_exporter_free (exporter);
+			return;
+		}
+	}
+
 	status = spectre_exporter_begin (exporter, filename);
 	if (status) {
 		document->status = status == SPECTRE_STATUS_NO_MEMORY ?
@@ -496,8 +1056,14 @@ spectre_document_save_to_pdf (SpectreDocument *document,
 		return;
 	}
 
-	for (i = 0; i < spectre_document_get_n_pages (document); i++) {
-		status = spectre_exporter_do_page (exporter, i);
+	for (i = 0; i < n_pages; i++) {
+		unsigned int index = pages ? pages[i] : i;
+
+		/* Given pages are numbered like spectre_document_get_page() does */
+		if (pages && document->doc->pageorder == DESCEND)
+			index = (document->doc->numpages - 1) - index;
+
+		status = spectre_exporter_do_page (exporter, index);
 		if (status)
 			break;
 	}
@@ -520,8 +1086,301 @@ spectre_document_save_to_pdf (SpectreDocument *document,
 	}
 }
 
+void
+spectre_document_save_to_pdf (SpectreDocument *document,
+			      const char      *filename)
+{
+	_spectre_return_if_fail (document != NULL);
+	_spectre_return_if_fail (filename != NULL);
+
+	document_export (document, SPECTRE_EXPORTER_FORMAT_PDF, filename, NULL, 0);
+}
+
+void
+spectre_document_save_pages (SpectreDocument    *document,
+			     const char         *filename,
+			     const unsigned int *pages,
+			     unsigned int        n_pages)
+{
+	static const unsigned int no_pages[1] = { 0 };
+	struct document *doc;
+	unsigned int i;
+
+	_spectre_return_if_fail (document != NULL);
+	_spectre_return_if_fail (filename != NULL);
+	_spectre_return_if_fail (pages != NULL || n_pages == 0);
+
+	/* Pages in a special order may depend on the ones before them,
+	 * only the first pages can be saved, in their order */
+	doc = document->doc ? _spectre_document_get_doc (document) : NULL;
+	for (i = 0; doc && doc->pageorder == SPECIAL && i < n_pages; i++) {
+		if (pages[i] != i) {
+			document->status = SPECTRE_STATUS_SAVE_ERROR;
+			return;
+		}
+	}
+
+	/* The PostScript exporter only copies byte ranges of the file */
+	document_export (document, SPECTRE_EXPORTER_FORMAT_PS, filename,
+			 pages ? pages : no_pages, n_pages);
+}
+
+typedef struct {
+	struct document     *doc;
+	const SpectreBuffer *header;
+	const SpectreBuffer *trailer;
+	const char          *prefix;
+	int                  width;
+	unsigned int         first;	/* pages of the file, first to last */
+	unsigned int         last;
+	int                  ok;
+} SplitRange;
+
+/* Writes every page of the range to its own file, between the header and
+ * the trailer that were produced once for all the files
+ */
+static int
+document_split_range (SplitRange *range)
+{
+	struct document *doc = range->doc;
+	FILE *from = NULL;
+	FileData reader;
+	unsigned int i;
+	int ok = TRUE;
+
+	/* Workers share the descriptor of the document, which is read
+	 * with positional reads */
+	if (!_spectre_document_open_file (doc, &from))
+		return FALSE;
+
+	reader = pscopyopen (from, doc);
+	for (i = range->first; ok && i <= range->last; i++) {
+		unsigned int number;
+		char *filename;
+		FILE *to;
+
+		/* Files are numbered like spectre_document_get_page() does */
+		number = (doc->pageorder == DESCEND) ? doc->numpages - i : i + 1;
+		filename = _spectre_strdup_printf ("%s%0*u.ps", range->prefix,
+						   range->width, number);
+		to = filename ? fopen (filename, "wb") : NULL;
+		free (filename);
+		if (!to) {
+			ok = FALSE;
+			break;
+		}
+
+		fwrite (range->header->data, 1, range->header->length, to);
+		pscopypagefd (reader, to, doc, i, 1);
+		fwrite (range->trailer->data, 1, range->trailer->length, to);
+		ok = !ferror (to);
+		ok = fclose (to) == 0 && ok;
+	}
+	pscopyclose (reader);
+	if (from)
+		fclose (from);
+
+	return ok;
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+document_split_range_thread (void *data)
+{
+	SplitRange *range = data;
+
+	range->ok = document_split_range (range);
+
+	return NULL;
+}
+#endif
+
+/* Splits the pages into ranges of about the same size and writes them at
+ * the same time, the first one in this thread
+ */
+static int
+document_split_pages (struct document     *doc,
+		      const char          *prefix,
+		      const SpectreBuffer *header,
+		      const SpectreBuffer *trailer)
+{
+	SplitRange ranges[SPLIT_MAX_WORKERS];
+#ifdef HAVE_PTHREAD
+	pthread_t threads[SPLIT_MAX_WORKERS];
+	int started[SPLIT_MAX_WORKERS];
+	long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	unsigned int n_workers = n_cpus > 0 ? n_cpus : 1;
+#else
+	unsigned int n_workers = 1;
+#endif
+	unsigned int n_ranges = 0;
+	unsigned int n;
+	unsigned int i;
+	off_t total = 0;
+	off_t done = 0;
+	int width = 1;
+	int ok = TRUE;
+
+	for (n = doc->numpages; n >= 10; n /= 10)
+		width++;
+
+	if (n_workers > SPLIT_MAX_WORKERS)
+		n_workers = SPLIT_MAX_WORKERS;
+	if (n_workers > doc->numpages)
+		n_workers = doc->numpages;
+	for (i = 0; i < doc->numpages; i++)
+		total += doc->pages[i].len;
+
+	memset (ranges, 0, sizeof (ranges));
+	for (i = 0; i < doc->numpages; i++) {
+		unsigned int left = doc->numpages - i - 1;
+
+		ranges[n_ranges].last = i;
+		done += doc->pages[i].len;
+
+		/* A range ends when it has its share of the document, or
+		 * when the pages left are just enough for the other ones */
+		if (n_ranges < n_workers - 1 &&
+		    (done >= total * (n_ranges + 1) / n_workers ||
+		     left == n_workers - n_ranges - 1)) {
+			n_ranges++;
+			ranges[n_ranges].first = i + 1;
+		}
+	}
+	n_ranges++;
+
+	for (i = 0; i < n_ranges; i++) {
+		ranges[i].doc = doc;
+		ranges[i].header = header;
+		ranges[i].trailer = trailer;
+		ranges[i].prefix = prefix;
+		ranges[i].width = width;
+	}
+
+#ifdef HAVE_PTHREAD
+	for (i = 1; i < n_ranges; i++)
+		started[i] = pthread_create (&threads[i], NULL,
+					     document_split_range_thread,
+					     &ranges[i]) == 0;
+	started[0] = FALSE;
+	for (i = 0; i < n_ranges; i++) {
+		if (!started[i])
+			document_split_range_thread (&ranges[i]);
+	}
+	for (i = 1; i < n_ranges; i++) {
+		if (started[i])
+			pthread_join (threads[i], NULL);
+	}
+#else
+	ranges[0].ok = document_split_range (&ranges[0]);
+#endif
+	for (i = 0; i < n_ranges; i++)
+		ok = ok && ranges[i].ok;
+
+	return ok;
+}
+
+void
+spectre_document_split (SpectreDocument *document,
+			const char      *prefix)
+{
+	SpectreBuffer header = { NULL, 0, 0 };
+	SpectreBuffer trailer = { NULL, 0, 0 };
+	struct document *doc;
+	FILE *from = NULL;
+	FileData reader;
+	FILE *to;
+	int ok;
+
+	_spectre_return_if_fail (document != NULL);
+	_spectre_return_if_fail (prefix != NULL);
+
+	if (!document->doc) {
+		document->status = SPECTRE_STATUS_DOCUMENT_NOT_LOADED;
+		return;
+	}
+
+	doc = _spectre_document_get_doc (document);
+	if (!doc)
+		return;
+
+	/* Without pages the whole document is the only page */
+	if (doc->numpages == 0) {
+		char *filename;
+
+		filename = _spectre_strdup_printf ("%s1.ps", prefix);
+		if (!filename) {
+			document->status = SPECTRE_STATUS_NO_MEMORY;
+			return;
+		}
+		spectre_document_save (document, filename);
+		free (filename);
+		return;
+	}
+
+	/* Pages in a special order may depend on the ones before them */
+	if (doc->pageorder == SPECIAL) {
+		document->status = SPECTRE_STATUS_SAVE_ERROR;
+		return;
+	}
+
+	if (!_spectre_document_open_file (doc, &from)) {
+		document->status = SPECTRE_STATUS_SAVE_ERROR;
+		return;
+	}
+
+	/* The header and the trailer are the same for every page, they are
+	 * read once and kept in memory */
+	reader = pscopyopen (from, doc);
+	to = _spectre_stream_open (_spectre_buffer_write, &header);
+	if (to) {
+		pscopyheadersfd (reader, to, doc);
+		ok = _spectre_stream_close (to, _spectre_buffer_write, &header);
+	} else {
+		ok = FALSE;
+	}
+	to = ok ? _spectre_stream_open (_spectre_buffer_write, &trailer) : NULL;
+	if (to) {
+		pscopytrailerfd (reader, to, doc, 1);
+		ok = _spectre_stream_close (to, _spectre_buffer_write, &trailer);
+	} else {
+		ok = FALSE;
+	}
+	pscopyclose (reader);
+	if (from)
+		fclose (from);
+
+	ok = ok && document_split_pages (doc, prefix, &header, &trailer);
+	free (header.data);
+	free (trailer.data);
+
+	document->status = ok ? SPECTRE_STATUS_SUCCESS : SPECTRE_STATUS_SAVE_ERROR;
+}
+
 struct document *
 _spectre_document_get_doc (SpectreDocument *document)
 {
+	/* Exporters need every page and the trailer */
+	if (document->doc && (document->doc->scan || document->probed))
+		document_scan_pages (document, 0);
+
 	return document->doc;
 }
+
+int
+_spectre_document_open_file (struct document *doc,
+			     FILE           **from)
+{
+	*from = NULL;
+
+	/* Sections are read from the contents of documents loaded from
+	 * memory, and through the descriptor kept since the others were
+	 * loaded, which is still the file that was scanned */
+	if (doc->data || doc->fd >= 0)
+		return TRUE;
+
+	*from = fopen (doc->filename, "rb");
+	_spectre_stats_add (file_opens, 1);
+
+	return *from != NULL;
+}
@@ -29,14 +29,43 @@
 
 SPECTRE_BEGIN_DECLS
 
-/*! This is the object that represents a PostScript document. */
+/*! This is the object that represents a PostScript document.
+
+    Different documents can be used from different threads at the same time.
+    A single document must only be used from one thread at a time, but the
+    pages obtained from it can be rendered concurrently from different
+    threads, each page from one thread at a time. They keep working after
+    the document is freed. While a partially loaded document is not complete,
+    scanning more of it (spectre_document_get_page() on a page that has not
+    been scanned yet, or spectre_document_scan_pages()) must not run while
+    its pages are being rendered. Rendering from several threads also requires
+    a Ghostscript that supports several instances per process. */
 typedef struct SpectreDocument SpectreDocument;
 
+/*! The metadata of a page, as filled by ::spectre_document_get_pages_info */
+typedef struct {
+	int                width;	/*! Width of the page, as given by spectre_page_get_size */
+	int                height;	/*! Height of the page, as given by spectre_page_get_size */
+	SpectreOrientation orientation;	/*! Orientation of the page */
+	const char        *label;	/*! Label of the page, or NULL. It's owned by the document */
+	int                bbox[4];	/*! Bounding box of the page, or of the document if the
+					    page has none, as left, bottom, right and top. All
+					    the values are 0 if there's no bounding box */
+} SpectrePageInfo;
+
 /*! Creates a document */
 SPECTRE_PUBLIC
 SpectreDocument   *spectre_document_new                (void);
 
-/*! Loads a the given file into the document. This function can fail
+/*! Loads a the given file into the document. Files compressed with gzip or
+    bzip2 are decompressed as they are read, and only the part needed by each
+    page is decompressed again when it's rendered. Loading again the file
+    the document was loaded from does nothing if the file has not changed.
+    If it has been appended to, growing while what was loaded stays the same,
+    only its last page and what follows it are scanned again, so the pages
+    found before are kept and new ones are added. The file is loaded from the
+    beginning when it has changed in any other way.
+    This function can fail
     @param document the document where the file will be loaded
     @param filename the file to loa
     @see spectre_document_status
@@ -45,6 +74,92 @@ SPECTRE_PUBLIC
 void               spectre_document_load               (SpectreDocument *document,
 							const char      *filename);
 
+/*! Loads a document from memory. The data is not copied, it's used
+    directly for scanning, rendering and exporting, so it must remain valid
+    and unchanged until the document and all of its pages have been freed.
+    This function can fail
+    @param document the document where the data will be loaded
+    @param data the contents of the PostScript document
+    @param length the length of data in bytes
+    @see spectre_document_status
+*/
+SPECTRE_PUBLIC
+void               spectre_document_load_from_data     (SpectreDocument *document,
+							const void      *data,
+							size_t           length);
+
+/*! Loads a document from a stream that can't be seeked, like a pipe. The
+    stream is copied to memory as it is read, and rendering reads from that
+    copy. Only the header, the prolog, the setup and the first n_pages pages
+    are read at first, use 0 to read the whole document. The rest is read on
+    demand like with spectre_document_load_partial(), so the stream must stay
+    open until spectre_document_is_complete() returns TRUE. Once complete, the
+    stream has been read until its end. This function can fail
+    @param document the document where the stream will be loaded
+    @param file the stream to load
+    @param n_pages the number of pages to read at first
+    @see spectre_document_status, spectre_document_load_partial
+*/
+SPECTRE_PUBLIC
+void               spectre_document_load_from_pipe     (SpectreDocument *document,
+							FILE            *file,
+							unsigned int     n_pages);
+
+/*! Loads the given file into the document, scanning only the header, the
+    prolog, the setup and the first n_pages pages. This makes the first pages
+    available much sooner on large documents. The rest of the pages are scanned
+    on demand when they are requested, or explicitly with
+    spectre_document_scan_pages(). Documents whose bounding box, orientation or
+    page order are deferred to the trailer are always scanned completely.
+    This function can fail
+    @param document the document where the file will be loaded
+    @param filename the file to load
+    @param n_pages the number of pages to scan at first
+    @see spectre_document_status, spectre_document_is_complete
+*/
+SPECTRE_PUBLIC
+void               spectre_document_load_partial       (SpectreDocument *document,
+							const char      *filename,
+							unsigned int     n_pages);
+
+/*! Reads only the metadata of the given file: the header comments, and the
+    trailer for the values deferred to it with (atend). The rest of the file
+    is not read, so it takes the same time regardless of the document size.
+    The title, creator, for, creation date, format, language level,
+    orientation and bounding box can be queried as usual, and
+    spectre_document_get_n_pages() returns the number of pages declared by
+    the document, or 0 if it declares none. The document is loaded like with
+    spectre_document_load_partial() when its pages are first requested.
+    Compressed files are decompressed until the trailer when it's needed.
+    This function can fail
+    @param document the document where the file will be probed
+    @param filename the file to probe
+    @see spectre_document_status, spectre_document_load_partial
+*/
+SPECTRE_PUBLIC
+void               spectre_document_probe              (SpectreDocument *document,
+							const char      *filename);
+
+/*! Returns whether all the pages of the document have been scanned. While
+    the document is not complete spectre_document_get_n_pages() returns a
+    provisional number of pages. This function can fail
+    @param document the document to query
+    @see spectre_document_status, spectre_document_load_partial
+*/
+SPECTRE_PUBLIC
+int                spectre_document_is_complete        (SpectreDocument *document);
+
+/*! Continues scanning a partially loaded document until at least n_pages
+    pages are known or the whole document has been scanned. Use 0 to scan
+    the rest of the document. This function can fail
+    @param document the document to scan
+    @param n_pages the number of pages that should be known
+    @see spectre_document_status, spectre_document_load_partial
+*/
+SPECTRE_PUBLIC
+void               spectre_document_scan_pages         (SpectreDocument *document,
+							unsigned int     n_pages);
+
 /*! Returns the document status 
     @param document the document whose status will be returned
 */
@@ -57,7 +172,20 @@ SpectreStatus      spectre_document_status             (SpectreDocument *documen
 SPECTRE_PUBLIC
 void               spectre_document_free               (SpectreDocument *document);
 
-/*! Returns the number of pages of the document. This function can fail
+/*! Sets the directory where the page index of loaded documents is cached.
+    When set, loading a file that has not changed since it was last indexed
+    reads the index from the cache instead of scanning the whole file again.
+    Only complete indexes are cached. The directory must already exist.
+    @param document the document
+    @param cache_dir the cache directory, or NULL to disable the cache
+*/
+SPECTRE_PUBLIC
+void               spectre_document_set_cache_dir      (SpectreDocument *document,
+							const char      *cache_dir);
+
+/*! Returns the number of pages of the document. If the document has been
+    partially loaded and is not complete yet, the number of pages announced by
+    the document header, or a lower bound, is returned. This function can fail
     @param document the document whose pages number will be returned
     @see spectre_document_status
 */
@@ -118,6 +246,23 @@ const char        *spectre_document_get_format         (SpectreDocument *documen
 SPECTRE_PUBLIC
 int                spectre_document_is_eps             (SpectreDocument *document);
 
+/*! Gets the bounding box given by the %%BoundingBox comment of the document,
+    in PostScript points. All the values are 0 if the document has no
+    bounding box. This function can fail
+    @param document the document whose bounding box will be returned
+    @param left the lower left x coordinate will be returned here, or NULL
+    @param bottom the lower left y coordinate will be returned here, or NULL
+    @param right the upper right x coordinate will be returned here, or NULL
+    @param top the upper right y coordinate will be returned here, or NULL
+    @see spectre_document_status
+*/
+SPECTRE_PUBLIC
+void               spectre_document_get_bounding_box   (SpectreDocument *document,
+							int             *left,
+							int             *bottom,
+							int             *right,
+							int             *top);
+
 /*! Returns the PostScript language level of the document. It returns 0 if no
     language level was defined on the file. This function can fail
     @param document the document whose language level will be returned
@@ -144,6 +289,25 @@ SPECTRE_PUBLIC
 SpectrePage       *spectre_document_get_page_by_label  (SpectreDocument *document,
 							const char      *label);
 
+/*! Gets the size, orientation, label and bounding box of n_pages pages
+    at once, without creating a SpectrePage for each of them. Pages of
+    partially loaded documents are scanned as needed. The labels are valid
+    until the document is freed or loaded again. This function can fail
+    @param document the document whose pages will be queried
+    @param first_page the index of the first page to query. First page has index 0.
+    @param n_pages the number of pages to query
+    @param info an array of at least n_pages elements where the metadata of
+                the pages will be stored
+    @return the number of pages stored in info, fewer than n_pages
+            when the document ends before
+    @see spectre_document_status
+*/
+SPECTRE_PUBLIC
+unsigned int       spectre_document_get_pages_info     (SpectreDocument *document,
+							unsigned int     first_page,
+							unsigned int     n_pages,
+							SpectrePageInfo *info);
+
 /*! Convenient function for rendering documents with no pages, tipically eps.
     When used with multi-page documents the first page will be rendered.
     @param document the document to render
@@ -203,6 +367,50 @@ void               spectre_document_save               (SpectreDocument *documen
 SPECTRE_PUBLIC
 void               spectre_document_save_to_pdf        (SpectreDocument *document,
 							const char      *filename);
+/*! Save the given pages of document as filename, in that order. Pages
+    can be repeated. The pages are copied as they are, the document
+    is not interpreted. Pages of documents with %%PageOrder: Special may
+    depend on the pages before them, so only their first pages can be
+    saved, in order, SPECTRE_STATUS_SAVE_ERROR is set for any other
+    selection. This function can fail
+    @param document the document that will be saved
+    @param filename the path where the pages will be saved
+    @param pages the indices of the pages to save
+    @param n_pages the number of pages to save
+    @see spectre_document_status
+*/
+SPECTRE_PUBLIC
+void               spectre_document_save_pages         (SpectreDocument    *document,
+							const char         *filename,
+							const unsigned int *pages,
+							unsigned int        n_pages);
+/*! Save every page of document to its own PostScript file, with the
+    header, prolog, setup and trailer of the document, so that each file
+    can be rendered on its own. Pages are named prefix followed by their
+    number, starting at 1 and padded with zeros to the same width, and
+    ".ps". The files are written from several threads, the document is not
+    interpreted. Documents with %%PageOrder: Special, whose pages may depend
+    on the pages before them, are not split and SPECTRE_STATUS_SAVE_ERROR is
+    set. This function can fail, files written before the error are left in
+    place
+    @param document the document that will be split
+    @param prefix the beginning of the path of every file
+    @see spectre_document_status
+*/
+SPECTRE_PUBLIC
+void               spectre_document_split              (SpectreDocument *document,
+							const char      *prefix);
+/*! Save document to memory. This function can fail
+    @param document the document that will be saved
+    @param data a pointer that will point to the contents of the document,
+           it must be freed with free()
+    @param length the length of data in bytes will be returned here
+    @see spectre_document_status
+*/
+SPECTRE_PUBLIC
+void               spectre_document_save_to_data       (SpectreDocument *document,
+							unsigned char  **data,
+							size_t          *length);
 SPECTRE_END_DECLS
 
 #endif /* SPECTRE_DOCUMENT_H */
@@ -18,27 +18,61 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "spectre-private.h"
 #include "spectre-utils.h"
+#include "spectre-pdf.h"
 
-static SpectreStatus
-spectre_exporter_pdf_begin (SpectreExporter *exporter,
-			    const char      *filename)
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* Each instance replays the prolog and the setup, more than this is
+ * rarely worth it */
+#define PDF_MAX_WORKERS 16
+
+typedef struct {
+	struct document    *doc;
+	const char         *filename;
+	FILE               *output;
+	const unsigned int *pages;
+	unsigned int        n_pages;
+	int                 page_labels;
+	int                 ok;
+} PdfRange;
+
+/* Creates a pdfwrite instance for filename, or for output when there's
+ * no filename, with the prolog and the setup of the document already
+ * processed.
+ */
+static SpectreGS *
+spectre_exporter_pdf_gs_new (struct document *doc,
+			     const char      *filename,
+			     FILE            *output,
+			     int              for_merge)
 {
-	char *args[10];
+	SpectreGS *gs;
+	char *args[16];
 	int arg = 0;
-	char *output_file;
-	struct document *doc = exporter->doc;
+	char *output_file = NULL;
+	int ok;
 
-	exporter->gs = spectre_gs_new ();
-	if (!spectre_gs_create_instance (exporter->gs, NULL)) {
-		spectre_gs_cleanup (exporter->gs, CLEANUP_DELETE_INSTANCE);
-		spectre_gs_free (exporter->gs);
-		exporter->gs = NULL;
+	gs = spectre_gs_new ();
+	if (!gs)
+		return NULL;
 
-		return SPECTRE_STATUS_EXPORTER_ERROR;
+	if (!filename)
+		spectre_gs_set_output (gs, output);
+
+	if (!spectre_gs_create_instance (gs, NULL)) {
+		spectre_gs_cleanup (gs, CLEANUP_DELETE_INSTANCE);
+		spectre_gs_free (gs);
+
+		return NULL;
 	}
 
 	args[arg++] = "libspectre"; /* This value doesn't really matter */
@@ -48,39 +82,346 @@ spectre_exporter_pdf_begin (SpectreExporter *exporter,
 	args[arg++] = "-dSAFER";
 	args[arg++] = "-P-";
 	args[arg++] = "-sDEVICE=pdfwrite";
-	args[arg++] = output_file = _spectre_strdup_printf ("-sOutputFile=%s",
-							    filename);
+	if (for_merge) {
+		/* Files to merge need a plain cross-reference table */
+		args[arg++] = "-dWriteXRefStm=false";
+		args[arg++] = "-dWriteObjStms=false";
+	}
+	if (filename) {
+		args[arg++] = output_file = _spectre_strdup_printf ("-sOutputFile=%s",
+								    filename);
+	} else {
+		/* Only the document goes to stdout */
+		args[arg++] = "-q";
+		args[arg++] = "-sstdout=%stderr";
+		args[arg++] = "-sOutputFile=-";
+	}
 	args[arg++] = "-c";
 	args[arg++] = ".setpdfwrite";
 
-	if (!spectre_gs_run (exporter->gs, 10, args)) {
-		free (output_file);
-		spectre_gs_free (exporter->gs);
-		exporter->gs = NULL;
+	ok = spectre_gs_run (gs, arg, args);
+	free (output_file);
 
-		return SPECTRE_STATUS_EXPORTER_ERROR;
+	ok = ok && spectre_gs_process (gs,
+				       doc,
+				       0, 0,
+				       doc->beginprolog,
+				       doc->endprolog);
+	ok = ok && spectre_gs_process (gs,
+				       doc,
+				       0, 0,
+				       doc->beginsetup,
+				       doc->endsetup);
+	if (!ok) {
+		spectre_gs_free (gs);
+
+		return NULL;
 	}
 
-	free (output_file);
+	return gs;
+}
 
-	if (!spectre_gs_process (exporter->gs,
-				 doc->filename,
-				 0, 0,
-				 doc->beginprolog,
-				 doc->endprolog)) {
-		spectre_gs_free (exporter->gs);
-		exporter->gs = NULL;
+static int
+spectre_exporter_pdf_process_page (SpectreGS       *gs,
+				   struct document *doc,
+				   unsigned int     page_index,
+				   int              page_labels)
+{
+	if (page_labels && doc->pages[page_index].label) {
+		char *label;
+		char *mark;
+		int ok;
 
-		return SPECTRE_STATUS_EXPORTER_ERROR;
+		label = spectre_pdf_string (doc->pages[page_index].label);
+		if (!label)
+			return FALSE;
+		mark = _spectre_strdup_printf ("[/Label %s /PAGELABEL pdfmark\n", label);
+		free (label);
+		ok = mark && spectre_gs_send_string (gs, mark);
+		free (mark);
+		if (!ok)
+			return FALSE;
 	}
 
-	if (!spectre_gs_process (exporter->gs,
-				 doc->filename,
-				 0, 0,
-				 doc->beginsetup,
-				 doc->endsetup)) {
-		spectre_gs_free (exporter->gs);
-		exporter->gs = NULL;
+	return spectre_gs_process (gs,
+				   doc,
+				   0, 0,
+				   doc->pages[page_index].begin,
+				   doc->pages[page_index].end);
+}
+
+/* Converts a range of pages into its own file */
+static int
+spectre_exporter_pdf_range (PdfRange *range,
+			    int       for_merge)
+{
+	struct document *doc = range->doc;
+	SpectreGS *gs;
+	unsigned int i;
+	int ok = TRUE;
+
+	gs = spectre_exporter_pdf_gs_new (doc, range->filename, range->output,
+					  for_merge);
+	if (!gs)
+		return FALSE;
+
+	for (i = 0; i < range->n_pages && ok; i++)
+		ok = spectre_exporter_pdf_process_page (gs, doc, range->pages[i],
+							range->page_labels);
+	ok = ok && spectre_gs_process (gs,
+				       doc,
+				       0, 0,
+				       doc->begintrailer,
+				       doc->endtrailer);
+	spectre_gs_free (gs);
+
+	return ok;
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+spectre_exporter_pdf_range_thread (void *data)
+{
+	PdfRange *range = data;
+
+	range->ok = spectre_exporter_pdf_range (range, TRUE);
+
+	return NULL;
+}
+
+static unsigned int
+spectre_exporter_pdf_get_n_workers (SpectreExporter *exporter)
+{
+	struct document *doc = exporter->doc;
+	unsigned int n_workers = exporter->n_workers;
+
+	/* Pages can't be converted separately */
+	if (doc->numpages == 0 || doc->pageorder == SPECIAL)
+		return 1;
+
+	if (n_workers == 0) {
+		long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+		n_workers = n_cpus > 0 ? n_cpus : 1;
+	}
+
+	return n_workers > PDF_MAX_WORKERS ? PDF_MAX_WORKERS : n_workers;
+}
+
+/* Creates an empty file next to the exported one, or in the temporary
+ * directory when exporting to a stream.
+ */
+static char *
+spectre_exporter_pdf_temp_file (SpectreExporter *exporter,
+				const char      *suffix)
+{
+	char *filename;
+	int fd;
+
+	if (exporter->filename) {
+		filename = _spectre_strdup_printf ("%s.%s.XXXXXX",
+						   exporter->filename, suffix);
+	} else {
+		const char *dir = getenv ("TMPDIR");
+
+		filename = _spectre_strdup_printf ("%s/libspectre-%s.XXXXXX",
+						   dir && *dir ? dir : "/tmp",
+						   suffix);
+	}
+
+	fd = filename ? mkstemp (filename) : -1;
+	if (fd < 0) {
+		free (filename);
+		return NULL;
+	}
+	close (fd);
+
+	return filename;
+}
+
+static int
+spectre_exporter_pdf_copy (const char *filename,
+			   FILE       *to)
+{
+	FILE *from;
+	char buf[BUFSIZ];
+	size_t read;
+	int ok = TRUE;
+
+	from = fopen (filename, "rb");
+	if (!from)
+		return FALSE;
+
+	while (ok && (read = fread (buf, 1, sizeof (buf), from)) > 0)
+		ok = fwrite (buf, 1, read, to) == read;
+	ok = ok && !ferror (from);
+	fclose (from);
+
+	return ok;
+}
+
+/* Splits the exported pages into ranges of about the same size and
+ * converts them at the same time, the first one in this thread. The
+ * ranges are merged into filename.
+ */
+static int
+spectre_exporter_pdf_parallel (SpectreExporter *exporter,
+			       unsigned int     n_workers,
+			       const char      *filename)
+{
+	struct document *doc = exporter->doc;
+	PdfRange ranges[PDF_MAX_WORKERS];
+	pthread_t threads[PDF_MAX_WORKERS];
+	int started[PDF_MAX_WORKERS];
+	const char *parts[PDF_MAX_WORKERS];
+	const char **labels = NULL;
+	off_t total = 0;
+	off_t done = 0;
+	unsigned int n_ranges = 0;
+	unsigned int i;
+	int ok = TRUE;
+
+	if (n_workers > exporter->n_exported)
+		n_workers = exporter->n_exported;
+	for (i = 0; i < exporter->n_exported; i++)
+		total += doc->pages[exporter->pages[i]].len;
+
+	memset (ranges, 0, sizeof (ranges));
+	for (i = 0; i < exporter->n_exported; i++) {
+		PdfRange *range = &ranges[n_ranges];
+		unsigned int left = exporter->n_exported - i - 1;
+
+		if (range->n_pages == 0)
+			range->pages = exporter->pages + i;
+		range->n_pages++;
+		done += doc->pages[exporter->pages[i]].len;
+
+		/* A range ends when it has its share of the document, or
+		 * when the pages left are just enough for the other ones */
+		if (n_ranges < n_workers - 1 &&
+		    (done >= total * (n_ranges + 1) / n_workers ||
+		     left == n_workers - n_ranges - 1))
+			n_ranges++;
+	}
+	n_ranges++;
+
+	for (i = 0; i < n_ranges && ok; i++) {
+		char suffix[16];
+
+		sprintf (suffix, "%u", i);
+		ranges[i].doc = doc;
+		ranges[i].filename = spectre_exporter_pdf_temp_file (exporter, suffix);
+		parts[i] = ranges[i].filename;
+		ok = ranges[i].filename != NULL;
+	}
+
+	if (ok) {
+		for (i = 1; i < n_ranges; i++)
+			started[i] = pthread_create (&threads[i], NULL,
+						     spectre_exporter_pdf_range_thread,
+						     &ranges[i]) == 0;
+		started[0] = FALSE;
+		for (i = 0; i < n_ranges; i++) {
+			if (!started[i])
+				spectre_exporter_pdf_range_thread (&ranges[i]);
+		}
+		for (i = 1; i < n_ranges; i++) {
+			if (started[i])
+				pthread_join (threads[i], NULL);
+		}
+		for (i = 0; i < n_ranges; i++)
+			ok = ok && ranges[i].ok;
+	}
+
+	if (ok && exporter->page_labels) {
+		labels = calloc (exporter->n_exported, sizeof (char *));
+		for (i = 0; labels && i < exporter->n_exported; i++)
+			labels[i] = doc->pages[exporter->pages[i]].label;
+		ok = labels != NULL;
+	}
+
+	ok = ok && spectre_pdf_merge (filename, parts, n_ranges,
+				      labels, exporter->n_exported);
+
+	for (i = 0; i < n_ranges; i++) {
+		if (!ranges[i].filename)
+			continue;
+		unlink (ranges[i].filename);
+		free ((char *) ranges[i].filename);
+	}
+	free (labels);
+
+	return ok;
+}
+
+/* Merging keeps the pages and their labels only, the outlines, document
+ * info and the rest of what pdfmarks add to the catalog would be lost,
+ * wherever they are in the exported part of the document
+ */
+static int
+spectre_exporter_pdf_has_pdfmarks (SpectreExporter *exporter)
+{
+	struct document *doc = exporter->doc;
+	FILE            *from;
+	unsigned int     i;
+	int              found;
+
+	if (!_spectre_document_open_file (doc, &from))
+		return TRUE;
+
+	found = pssectioncontains (from, doc, doc->beginprolog, doc->endprolog, "pdfmark") ||
+		pssectioncontains (from, doc, doc->beginsetup, doc->endsetup, "pdfmark") ||
+		pssectioncontains (from, doc, doc->begintrailer, doc->endtrailer, "pdfmark");
+	for (i = 0; !found && i < exporter->n_exported; i++) {
+		struct page *page = &doc->pages[exporter->pages[i]];
+
+		found = pssectioncontains (from, doc, page->begin, page->end, "pdfmark");
+	}
+	if (from)
+		fclose (from);
+
+	return found;
+}
+#endif /* HAVE_PTHREAD */
+
+static SpectreStatus
+spectre_exporter_pdf_begin (SpectreExporter *exporter,
+			    const char      *filename)
+{
+#ifdef HAVE_PTHREAD
+	/* Pages are only collected, they are converted at the end */
+	if (spectre_exporter_pdf_get_n_workers (exporter) > 1) {
+		free (exporter->filename);
+		exporter->filename = NULL;
+		exporter->n_exported = 0;
+
+		if (filename) {
+			exporter->filename = _spectre_strdup (filename);
+			if (!exporter->filename)
+				return SPECTRE_STATUS_NO_MEMORY;
+		} else {
+			exporter->to = _spectre_exporter_open_output (exporter, NULL);
+			if (!exporter->to)
+				return SPECTRE_STATUS_EXPORTER_ERROR;
+		}
+		exporter->parallel = TRUE;
+
+		return SPECTRE_STATUS_SUCCESS;
+	}
+#endif
+
+	if (!filename) {
+		exporter->to = _spectre_exporter_open_output (exporter, NULL);
+		if (!exporter->to)
+			return SPECTRE_STATUS_EXPORTER_ERROR;
+	}
+
+	exporter->gs = spectre_exporter_pdf_gs_new (exporter->doc, filename,
+						    exporter->to, FALSE);
+	if (!exporter->gs) {
+		if (exporter->to)
+			fclose (exporter->to);
+		exporter->to = NULL;
 
 		return SPECTRE_STATUS_EXPORTER_ERROR;
 	}
@@ -94,14 +435,27 @@ spectre_exporter_pdf_do_page (SpectreExporter *exporter,
 {
 	struct document *doc = exporter->doc;
 
+	if (exporter->parallel) {
+		if (exporter->n_exported == exporter->max_exported) {
+			unsigned int *pages;
+			unsigned int n = exporter->max_exported ? exporter->max_exported * 2 : 64;
+
+			pages = realloc (exporter->pages, n * sizeof (unsigned int));
+			if (!pages)
+				return SPECTRE_STATUS_NO_MEMORY;
+			exporter->pages = pages;
+			exporter->max_exported = n;
+		}
+		exporter->pages[exporter->n_exported++] = page_index;
+
+		return SPECTRE_STATUS_SUCCESS;
+	}
+
 	if (!exporter->gs)
 		return SPECTRE_STATUS_EXPORTER_ERROR;
 
-	if (!spectre_gs_process (exporter->gs,
-				 doc->filename,
-				 0, 0,
-				 doc->pages[page_index].begin,
-				 doc->pages[page_index].end)) {
+	if (!spectre_exporter_pdf_process_page (exporter->gs, doc, page_index,
+						exporter->page_labels)) {
 		spectre_gs_free (exporter->gs);
 		exporter->gs = NULL;
 
@@ -117,16 +471,63 @@ spectre_exporter_pdf_end (SpectreExporter *exporter)
 	int ret;
 	struct document *doc = exporter->doc;
 
-	if (!exporter->gs)
-		return SPECTRE_STATUS_EXPORTER_ERROR;
+	if (exporter->parallel) {
+		PdfRange range;
+		int merged = FALSE;
+
+		ret = FALSE;
+#ifdef HAVE_PTHREAD
+		if (exporter->n_exported > 1 &&
+		    !spectre_exporter_pdf_has_pdfmarks (exporter)) {
+			unsigned int n_workers = spectre_exporter_pdf_get_n_workers (exporter);
+
+			if (exporter->filename) {
+				merged = spectre_exporter_pdf_parallel (exporter, n_workers,
+									exporter->filename);
+				ret = merged;
+			} else {
+				char *filename;
+
+				/* The merged file is needed as a whole to be written */
+				filename = spectre_exporter_pdf_temp_file (exporter, "merged");
+				merged = filename &&
+					spectre_exporter_pdf_parallel (exporter, n_workers,
+								       filename);
+				ret = merged && spectre_exporter_pdf_copy (filename, exporter->to);
+				if (filename)
+					unlink (filename);
+				free (filename);
+			}
+		}
+#endif
+		/* Converting everything at once is always possible */
+		if (!merged) {
+			memset (&range, 0, sizeof (PdfRange));
+			range.doc = doc;
+			range.filename = exporter->filename;
+			range.output = exporter->to;
+			range.pages = exporter->pages;
+			range.n_pages = exporter->n_exported;
+			range.page_labels = exporter->page_labels;
+			ret = spectre_exporter_pdf_range (&range, FALSE);
+		}
+		free (exporter->filename);
+		exporter->filename = NULL;
+		exporter->parallel = FALSE;
+	} else {
+		ret = exporter->gs != NULL;
+		ret = ret && spectre_gs_process (exporter->gs,
+						 doc,
+						 0, 0,
+						 doc->begintrailer,
+						 doc->endtrailer);
+		if (exporter->gs)
+			spectre_gs_free (exporter->gs);
+		exporter->gs = NULL;
+	}
 
-	ret = spectre_gs_process (exporter->gs,
-				  doc->filename,
-				  0, 0,
-				  doc->begintrailer,
-				  doc->endtrailer);
-	spectre_gs_free (exporter->gs);
-	exporter->gs = NULL;
+	if (!_spectre_exporter_close_output (exporter))
+		ret = FALSE;
 
 	return ret ? SPECTRE_STATUS_SUCCESS : SPECTRE_STATUS_EXPORTER_ERROR;
 }
@@ -141,6 +542,7 @@ _spectre_exporter_pdf_new (struct document *doc)
 		return NULL;
 
 	exporter->doc = psdocreference (doc);
+	exporter->n_workers = 1;
 
 	exporter->begin = spectre_exporter_pdf_begin;
 	exporter->do_page = spectre_exporter_pdf_do_page;
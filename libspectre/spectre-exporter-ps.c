@@ -21,23 +21,29 @@
 #include <stdlib.h>
 
 #include "spectre-private.h"
+#include "spectre-utils.h"
 
 static SpectreStatus
 spectre_exporter_ps_begin (SpectreExporter *exporter,
 			   const char      *filename)
 {
-	exporter->from = fopen (exporter->doc->filename, "rb");
-	if (!exporter->from)
+	if (!_spectre_document_open_file (exporter->doc, &exporter->from))
 		return SPECTRE_STATUS_EXPORTER_ERROR;
 	
-	exporter->to = fopen (filename, "wb");
+	exporter->to = _spectre_exporter_open_output (exporter, filename);
 	if (!exporter->to) {
-		fclose (exporter->from);
+		if (exporter->from)
+			fclose (exporter->from);
 		exporter->from = NULL;
 		return SPECTRE_STATUS_EXPORTER_ERROR;
 	}
-		
-	pscopyheaders (exporter->from, exporter->to, exporter->doc);
+
+	/* Pages are usually exported in order, reading on from where the
+	 * previous one ended
+	 */
+	exporter->n_pages = 0;
+	exporter->reader = pscopyopen (exporter->from, exporter->doc);
+	pscopyheadersfd (exporter->reader, exporter->to, exporter->doc);
 	
 	return SPECTRE_STATUS_SUCCESS;
 }
@@ -49,8 +55,8 @@ spectre_exporter_ps_do_page (SpectreExporter *exporter,
 	if (exporter->doc->numpages <= 0)
 		return SPECTRE_STATUS_SUCCESS;
 	
-	pscopypage (exporter->from, exporter->to, exporter->doc,
-		    page_index, exporter->n_pages++);
+	pscopypagefd (exporter->reader, exporter->to, exporter->doc,
+		      page_index, ++exporter->n_pages);
 	
 	return SPECTRE_STATUS_SUCCESS;
 }
@@ -58,13 +64,16 @@ spectre_exporter_ps_do_page (SpectreExporter *exporter,
 static SpectreStatus
 spectre_exporter_ps_end (SpectreExporter *exporter)
 {
-	pscopytrailer (exporter->from, exporter->to, exporter->doc,
-		       exporter->n_pages);
+	pscopytrailerfd (exporter->reader, exporter->to, exporter->doc,
+			 exporter->n_pages);
 
-	fclose (exporter->from);
+	pscopyclose (exporter->reader);
+	exporter->reader = NULL;
+	if (exporter->from)
+		fclose (exporter->from);
 	exporter->from = NULL;
-	fclose (exporter->to);
-	exporter->to = NULL;
+	if (!_spectre_exporter_close_output (exporter))
+		return SPECTRE_STATUS_EXPORTER_ERROR;
 	
 	return SPECTRE_STATUS_SUCCESS;
 }
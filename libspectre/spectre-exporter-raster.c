@@ -0,0 +1,784 @@
+/* This file is part of Libspectre.
+ *
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spectre-private.h"
+#include "spectre-device.h"
+#include "spectre-utils.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* Bytes of a pixel rendered by the display device */
+#ifdef WORDS_BIGENDIAN
+#define PIXEL_RED   1
+#define PIXEL_GREEN 2
+#define PIXEL_BLUE  3
+#else
+#define PIXEL_RED   2
+#define PIXEL_GREEN 1
+#define PIXEL_BLUE  0
+#endif
+#define PIXEL_SIZE 4
+
+/* PNG pages are compressed by strips of at least MIN_STRIP_ROWS rows,
+ * at the same time when there are several ones */
+#define PNG_MAX_STRIPS 16
+#define PNG_MIN_STRIP_ROWS 64
+#define PNG_MAX_CHUNK (1 << 30)
+
+/* Uncompressed TIFF strips are about this size */
+#define TIFF_STRIP_SIZE 65536
+#define TIFF_N_ENTRIES 13
+
+/* A rendered page, as it's exported once rotated */
+typedef struct {
+	const unsigned char *data;
+	int                  row_length;
+	int                  data_width;
+	int                  data_height;
+	SpectreOrientation   orientation;
+	int                  width;
+	int                  height;
+	double               x_dpi;
+	double               y_dpi;
+} RasterImage;
+
+/* Gets a row of the rotated image as RGB */
+static void
+raster_image_get_row (const RasterImage *image,
+		      int                row,
+		      unsigned char     *rgb)
+{
+	const unsigned char *start;
+	long step;
+	int i;
+
+	switch (image->orientation) {
+	default:
+	case SPECTRE_ORIENTATION_PORTRAIT:
+		start = image->data + (long) image->row_length * row;
+		step = PIXEL_SIZE;
+		break;
+	case SPECTRE_ORIENTATION_REVERSE_PORTRAIT:
+		start = image->data + (long) image->row_length * (image->data_height - 1 - row) +
+			PIXEL_SIZE * (image->data_width - 1);
+		step = -PIXEL_SIZE;
+		break;
+	case SPECTRE_ORIENTATION_LANDSCAPE:
+		start = image->data + (long) image->row_length * (image->data_height - 1) +
+			PIXEL_SIZE * row;
+		step = -image->row_length;
+		break;
+	case SPECTRE_ORIENTATION_REVERSE_LANDSCAPE:
+		start = image->data + PIXEL_SIZE * (image->data_width - 1 - row);
+		step = image->row_length;
+		break;
+	}
+
+	for (i = 0; i < image->width; i++) {
+		const unsigned char *pixel = start + step * i;
+
+		rgb[3 * i] = pixel[PIXEL_RED];
+		rgb[3 * i + 1] = pixel[PIXEL_GREEN];
+		rgb[3 * i + 2] = pixel[PIXEL_BLUE];
+	}
+}
+
+static int
+raster_write (SpectreExporter *exporter,
+	      const void      *data,
+	      size_t           length)
+{
+	if (length > 0 && fwrite (data, 1, length, exporter->to) != length)
+		return FALSE;
+	exporter->offset += length;
+
+	return TRUE;
+}
+
+static void
+put_be32 (unsigned char *p,
+	  unsigned long  value)
+{
+	p[0] = (value >> 24) & 0xff;
+	p[1] = (value >> 16) & 0xff;
+	p[2] = (value >> 8) & 0xff;
+	p[3] = value & 0xff;
+}
+
+static void
+put_le16 (unsigned char *p,
+	  unsigned int   value)
+{
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+}
+
+static void
+put_le32 (unsigned char *p,
+	  unsigned long  value)
+{
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = (value >> 16) & 0xff;
+	p[3] = (value >> 24) & 0xff;
+}
+
+/* PPM */
+static int
+raster_ppm_page (SpectreExporter   *exporter,
+		 const RasterImage *image)
+{
+	char header[64];
+	unsigned char *rgb;
+	int i;
+	int ok;
+
+	rgb = malloc (3 * (size_t) image->width);
+	if (!rgb)
+		return FALSE;
+
+	sprintf (header, "P6\n%d %d\n255\n", image->width, image->height);
+	ok = raster_write (exporter, header, strlen (header));
+	for (i = 0; i < image->height && ok; i++) {
+		raster_image_get_row (image, i, rgb);
+		ok = raster_write (exporter, rgb, 3 * (size_t) image->width);
+	}
+	free (rgb);
+
+	return ok;
+}
+
+/* PNG */
+#ifdef HAVE_ZLIB
+typedef struct {
+	const RasterImage *image;
+	int                first_row;
+	int                n_rows;
+	int                last;
+	int                level;
+	SpectreBuffer      output;
+	uLong              adler;
+	int                ok;
+} PngStrip;
+
+/* Compresses the rows of a strip into a raw deflate stream. The streams
+ * of all the strips but the last one end with a sync flush, so that they
+ * can be written one after the other.
+ */
+static void *
+raster_png_deflate_strip (void *data)
+{
+	PngStrip *strip = data;
+	const RasterImage *image = strip->image;
+	size_t row_size = 3 * (size_t) image->width;
+	unsigned char *rgb;
+	unsigned char *filtered;
+	unsigned char out[16384];
+	z_stream stream;
+	int ok;
+	int i;
+
+	strip->ok = FALSE;
+	strip->adler = adler32 (0L, Z_NULL, 0);
+
+	memset (&stream, 0, sizeof (z_stream));
+	if (deflateInit2 (&stream, strip->level, Z_DEFLATED, -15, 8,
+			  Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	rgb = malloc (row_size);
+	filtered = malloc (row_size + 1);
+	ok = rgb && filtered;
+
+	for (i = 0; i < strip->n_rows && ok; i++) {
+		int flush = Z_NO_FLUSH;
+		size_t j;
+
+		/* Sub filter, every byte minus the one of the pixel on its left */
+		raster_image_get_row (image, strip->first_row + i, rgb);
+		filtered[0] = 1;
+		for (j = 0; j < row_size; j++)
+			filtered[j + 1] = rgb[j] - (j >= 3 ? rgb[j - 3] : 0);
+		strip->adler = adler32 (strip->adler, filtered, row_size + 1);
+
+		if (i == strip->n_rows - 1)
+			flush = strip->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+		stream.next_in = filtered;
+		stream.avail_in = row_size + 1;
+		do {
+			stream.next_out = out;
+			stream.avail_out = sizeof (out);
+			if (deflate (&stream, flush) == Z_STREAM_ERROR)
+				ok = FALSE;
+			else if (_spectre_buffer_write (&strip->output, out,
+							sizeof (out) - stream.avail_out))
+				ok = FALSE;
+		} while (ok && stream.avail_out == 0);
+	}
+
+	deflateEnd (&stream);
+	free (rgb);
+	free (filtered);
+	strip->ok = ok;
+
+	return NULL;
+}
+
+static int
+raster_png_chunk (SpectreExporter     *exporter,
+		  const char          *type,
+		  const unsigned char *data,
+		  size_t               length)
+{
+	unsigned char header[8];
+	unsigned char crc[4];
+	uLong value;
+
+	put_be32 (header, length);
+	memcpy (header + 4, type, 4);
+	value = crc32 (0L, header + 4, 4);
+	if (length > 0)
+		value = crc32 (value, data, length);
+	put_be32 (crc, value);
+
+	return raster_write (exporter, header, 8) &&
+		raster_write (exporter, data, length) &&
+		raster_write (exporter, crc, 4);
+}
+
+static unsigned int
+raster_png_get_n_strips (SpectreExporter   *exporter,
+			 const RasterImage *image)
+{
+	unsigned int n_strips = 1;
+
+#ifdef HAVE_PTHREAD
+	n_strips = exporter->n_workers;
+	if (n_strips == 0) {
+		long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+		n_strips = n_cpus > 0 ? n_cpus : 1;
+	}
+	if (n_strips > PNG_MAX_STRIPS)
+		n_strips = PNG_MAX_STRIPS;
+	if (n_strips > (unsigned int) image->height / PNG_MIN_STRIP_ROWS)
+		n_strips = image->height / PNG_MIN_STRIP_ROWS;
+	if (n_strips == 0)
+		n_strips = 1;
+#endif
+
+	return n_strips;
+}
+
+static int
+raster_png_page (SpectreExporter   *exporter,
+		 const RasterImage *image)
+{
+	static const unsigned char signature[8] = {
+		137, 'P', 'N', 'G', '\r', '\n', 26, '\n'
+	};
+	PngStrip strips[PNG_MAX_STRIPS];
+#ifdef HAVE_PTHREAD
+	pthread_t threads[PNG_MAX_STRIPS];
+	int started[PNG_MAX_STRIPS];
+#endif
+	unsigned char header[13];
+	unsigned char phys[9];
+	unsigned char zlib_header[2] = { 0x78, 0x9c };
+	unsigned char trailer[4];
+	unsigned int n_strips;
+	unsigned int i;
+	uLong adler;
+	int ok = TRUE;
+
+	put_be32 (header, image->width);
+	put_be32 (header + 4, image->height);
+	header[8] = 8;	/* bit depth */
+	header[9] = 2;	/* truecolor */
+	header[10] = 0;
+	header[11] = 0;
+	header[12] = 0;
+
+	put_be32 (phys, (unsigned long) (image->x_dpi / 0.0254 + 0.5));
+	put_be32 (phys + 4, (unsigned long) (image->y_dpi / 0.0254 + 0.5));
+	phys[8] = 1;	/* meters */
+
+	ok = raster_write (exporter, signature, sizeof (signature)) &&
+		raster_png_chunk (exporter, "IHDR", header, sizeof (header)) &&
+		raster_png_chunk (exporter, "pHYs", phys, sizeof (phys));
+	if (!ok)
+		return FALSE;
+
+	n_strips = raster_png_get_n_strips (exporter, image);
+	memset (strips, 0, sizeof (strips));
+	for (i = 0; i < n_strips; i++) {
+		strips[i].image = image;
+		strips[i].first_row = (long) image->height * i / n_strips;
+		strips[i].n_rows = (long) image->height * (i + 1) / n_strips - strips[i].first_row;
+		strips[i].last = i == n_strips - 1;
+		strips[i].level = exporter->compress ? Z_DEFAULT_COMPRESSION : Z_NO_COMPRESSION;
+	}
+
+#ifdef HAVE_PTHREAD
+	for (i = 1; i < n_strips; i++)
+		started[i] = pthread_create (&threads[i], NULL,
+					     raster_png_deflate_strip,
+					     &strips[i]) == 0;
+	started[0] = FALSE;
+	for (i = 0; i < n_strips; i++) {
+		if (!started[i])
+			raster_png_deflate_strip (&strips[i]);
+	}
+	for (i = 1; i < n_strips; i++) {
+		if (started[i])
+			pthread_join (threads[i], NULL);
+	}
+#else
+	raster_png_deflate_strip (&strips[0]);
+#endif
+
+	/* The strips are written as they are between the zlib header and
+	 * the checksum of the whole image data */
+	if (!exporter->compress)
+		zlib_header[1] = 0x01;
+	ok = raster_png_chunk (exporter, "IDAT", zlib_header, sizeof (zlib_header));
+	adler = adler32 (0L, Z_NULL, 0);
+	for (i = 0; i < n_strips; i++) {
+		size_t done;
+
+		ok = ok && strips[i].ok;
+		for (done = 0; ok && done < strips[i].output.length; done += PNG_MAX_CHUNK) {
+			size_t length = strips[i].output.length - done;
+
+			ok = raster_png_chunk (exporter, "IDAT", strips[i].output.data + done,
+					       length > PNG_MAX_CHUNK ? PNG_MAX_CHUNK : length);
+		}
+		adler = adler32_combine (adler, strips[i].adler,
+					 (z_off_t) strips[i].n_rows * (3 * (z_off_t) image->width + 1));
+		free (strips[i].output.data);
+	}
+	put_be32 (trailer, adler);
+	ok = ok && raster_png_chunk (exporter, "IDAT", trailer, sizeof (trailer));
+
+	return ok;
+}
+#endif /* HAVE_ZLIB */
+
+/* TIFF */
+
+/* Compresses a row with PackBits into out, which must have room for
+ * length + (length + 127) / 128 bytes. Returns the compressed length.
+ */
+static size_t
+raster_packbits (const unsigned char *in,
+		 size_t               length,
+		 unsigned char       *out)
+{
+	size_t i = 0;
+	size_t o = 0;
+
+	while (i < length) {
+		size_t run = 1;
+
+		while (i + run < length && run < 128 && in[i + run] == in[i])
+			run++;
+
+		if (run >= 3) {
+			out[o++] = 257 - run;
+			out[o++] = in[i];
+			i += run;
+		} else {
+			size_t start = i;
+
+			/* Literal bytes, up to the next run of 3 */
+			while (i < length && i - start < 128) {
+				if (i + 2 < length && in[i] == in[i + 1] && in[i] == in[i + 2])
+					break;
+				i++;
+			}
+			out[o++] = i - start - 1;
+			memcpy (out + o, in + start, i - start);
+			o += i - start;
+		}
+	}
+
+	return o;
+}
+
+static unsigned char *
+raster_tiff_entry (unsigned char *p,
+		   unsigned int   tag,
+		   unsigned int   type,
+		   unsigned long  count,
+		   unsigned long  value)
+{
+	put_le16 (p, tag);
+	put_le16 (p + 2, type);
+	put_le32 (p + 4, count);
+	/* A single short is at the start of the value */
+	if (type == 3 && count == 1)
+		put_le32 (p + 8, value & 0xffff);
+	else
+		put_le32 (p + 8, value);
+
+	return p + 12;
+}
+
+/* Writes the rows of a page, or only computes the length of its strips
+ * when write is FALSE.
+ */
+static int
+raster_tiff_strips (SpectreExporter   *exporter,
+		    const RasterImage *image,
+		    int                rows_per_strip,
+		    unsigned long     *lengths,
+		    unsigned char     *rgb,
+		    unsigned char     *packed,
+		    int                write)
+{
+	size_t row_size = 3 * (size_t) image->width;
+	int i;
+
+	for (i = 0; i < image->height; i++) {
+		const unsigned char *row = rgb;
+		size_t length = row_size;
+
+		raster_image_get_row (image, i, rgb);
+		if (exporter->compress) {
+			length = raster_packbits (rgb, row_size, packed);
+			row = packed;
+		}
+
+		if (!write)
+			lengths[i / rows_per_strip] += length;
+		else if (!raster_write (exporter, row, length))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Pages are written one after the other, each followed by its
+ * directory. A directory is only written once the next page is known,
+ * so that it can point to the directory of that page.
+ */
+static int
+raster_tiff_page (SpectreExporter   *exporter,
+		  const RasterImage *image)
+{
+	size_t row_size = 3 * (size_t) image->width;
+	int rows_per_strip;
+	int n_strips;
+	unsigned long *lengths;
+	unsigned char *rgb;
+	unsigned char *packed;
+	unsigned char *p;
+	off_t data_length = 0;
+	off_t data_offset;
+	off_t ifd_offset;
+	off_t extra;
+	size_t ifd_length;
+	int i;
+	int ok;
+
+	rows_per_strip = TIFF_STRIP_SIZE / row_size;
+	if (rows_per_strip < 1)
+		rows_per_strip = 1;
+	n_strips = (image->height + rows_per_strip - 1) / rows_per_strip;
+
+	lengths = calloc (n_strips, sizeof (unsigned long));
+	rgb = malloc (row_size);
+	packed = malloc (row_size + (row_size + 127) / 128);
+	ok = lengths && rgb && packed;
+
+	/* Compressed strips are compressed twice to know their length
+	 * before they are written */
+	if (ok && exporter->compress) {
+		raster_tiff_strips (exporter, image, rows_per_strip, lengths,
+				    rgb, packed, FALSE);
+	} else if (ok) {
+		for (i = 0; i < n_strips; i++)
+			lengths[i] = row_size * (i < n_strips - 1 ?
+						 rows_per_strip :
+						 image->height - rows_per_strip * i);
+	}
+	for (i = 0; ok && i < n_strips; i++)
+		data_length += lengths[i];
+
+	/* Directories start on a word boundary */
+	data_offset = exporter->offset + (exporter->n_pages == 0 ? 8 : (off_t) exporter->ifd_length);
+	ifd_offset = data_offset + data_length + (data_length & 1);
+	ifd_length = 2 + 12 * TIFF_N_ENTRIES + 4 + 6 + 16 +
+		(n_strips > 1 ? 8 * (size_t) n_strips : 0);
+	if (ifd_offset + (off_t) ifd_length > (off_t) 0xffffffffUL)
+		ok = FALSE;
+
+	if (ok && exporter->n_pages == 0) {
+		unsigned char header[8] = { 'I', 'I', 42, 0 };
+
+		put_le32 (header + 4, ifd_offset);
+		ok = raster_write (exporter, header, sizeof (header));
+	} else if (ok) {
+		put_le32 (exporter->ifd + 2 + 12 * TIFF_N_ENTRIES, ifd_offset);
+		ok = raster_write (exporter, exporter->ifd, exporter->ifd_length);
+	}
+
+	ok = ok && raster_tiff_strips (exporter, image, rows_per_strip, lengths,
+				       rgb, packed, TRUE);
+	if (ok && (data_length & 1))
+		ok = raster_write (exporter, "", 1);
+
+	free (rgb);
+	free (packed);
+	free (exporter->ifd);
+	exporter->ifd = NULL;
+	exporter->ifd_length = 0;
+	if (ok)
+		exporter->ifd = malloc (ifd_length);
+	if (!exporter->ifd) {
+		free (lengths);
+		return FALSE;
+	}
+	exporter->ifd_length = ifd_length;
+
+	/* Values that don't fit in the entries follow them */
+	p = exporter->ifd;
+	extra = ifd_offset + 2 + 12 * TIFF_N_ENTRIES + 4;
+	put_le16 (p, TIFF_N_ENTRIES);
+	p += 2;
+	p = raster_tiff_entry (p, 254, 4, 1, 2);	/* NewSubfileType: page */
+	p = raster_tiff_entry (p, 256, 4, 1, image->width);
+	p = raster_tiff_entry (p, 257, 4, 1, image->height);
+	p = raster_tiff_entry (p, 258, 3, 3, extra);	/* BitsPerSample */
+	p = raster_tiff_entry (p, 259, 3, 1, exporter->compress ? 32773 : 1);
+	p = raster_tiff_entry (p, 262, 3, 1, 2);	/* PhotometricInterpretation: RGB */
+	p = raster_tiff_entry (p, 273, 4, n_strips,	/* StripOffsets */
+			       n_strips > 1 ? extra + 22 : data_offset);
+	p = raster_tiff_entry (p, 277, 3, 1, 3);	/* SamplesPerPixel */
+	p = raster_tiff_entry (p, 278, 4, 1, rows_per_strip);
+	p = raster_tiff_entry (p, 279, 4, n_strips,	/* StripByteCounts */
+			       n_strips > 1 ? (unsigned long) extra + 22 + 4 * n_strips : lengths[0]);
+	p = raster_tiff_entry (p, 282, 5, 1, extra + 6);	/* XResolution */
+	p = raster_tiff_entry (p, 283, 5, 1, extra + 14);	/* YResolution */
+	p = raster_tiff_entry (p, 296, 3, 1, 2);	/* ResolutionUnit: inch */
+	put_le32 (p, 0);	/* The next directory, set with the next page */
+	p += 4;
+
+	for (i = 0; i < 3; i++) {
+		put_le16 (p, 8);
+		p += 2;
+	}
+	put_le32 (p, (unsigned long) (image->x_dpi * 100 + 0.5));
+	put_le32 (p + 4, 100);
+	put_le32 (p + 8, (unsigned long) (image->y_dpi * 100 + 0.5));
+	put_le32 (p + 12, 100);
+	p += 16;
+	if (n_strips > 1) {
+		off_t offset = data_offset;
+
+		for (i = 0; i < n_strips; i++) {
+			put_le32 (p, offset);
+			put_le32 (p + 4 * n_strips, lengths[i]);
+			offset += lengths[i];
+			p += 4;
+		}
+	}
+	free (lengths);
+
+	return TRUE;
+}
+
+static int
+spectre_exporter_raster_page (void                *closure,
+			      const unsigned char *data,
+			      int                  width,
+			      int                  height,
+			      int                  row_length)
+{
+	SpectreExporter *exporter = closure;
+	SpectreRenderContext *rc = exporter->rc;
+	RasterImage image;
+
+	image.data = data;
+	image.row_length = row_length;
+	image.data_width = width;
+	image.data_height = height;
+	image.orientation = rc->orientation;
+	image.x_dpi = rc->x_dpi * rc->x_scale;
+	image.y_dpi = rc->y_dpi * rc->y_scale;
+	if (rc->orientation == SPECTRE_ORIENTATION_LANDSCAPE ||
+	    rc->orientation == SPECTRE_ORIENTATION_REVERSE_LANDSCAPE) {
+		image.width = height;
+		image.height = width;
+		image.x_dpi = rc->y_dpi * rc->y_scale;
+		image.y_dpi = rc->x_dpi * rc->x_scale;
+	} else {
+		image.width = width;
+		image.height = height;
+	}
+
+	if (image.width <= 0 || image.height <= 0)
+		return FALSE;
+
+	switch (exporter->format) {
+	case SPECTRE_EXPORTER_FORMAT_PPM:
+		return raster_ppm_page (exporter, &image);
+	case SPECTRE_EXPORTER_FORMAT_PNG:
+#ifdef HAVE_ZLIB
+		return raster_png_page (exporter, &image);
+#else
+		return FALSE;
+#endif
+	case SPECTRE_EXPORTER_FORMAT_TIFF:
+		return raster_tiff_page (exporter, &image);
+	case SPECTRE_EXPORTER_FORMAT_PS:
+	case SPECTRE_EXPORTER_FORMAT_PDF:
+		break;
+	}
+
+	return FALSE;
+}
+
+static SpectreStatus
+spectre_exporter_raster_begin (SpectreExporter *exporter,
+			       const char      *filename)
+{
+	exporter->to = _spectre_exporter_open_output (exporter, filename);
+	if (!exporter->to)
+		return SPECTRE_STATUS_EXPORTER_ERROR;
+
+	exporter->offset = 0;
+	exporter->n_pages = 0;
+	free (exporter->ifd);
+	exporter->ifd = NULL;
+	exporter->ifd_length = 0;
+
+	return SPECTRE_STATUS_SUCCESS;
+}
+
+/* Pages are written from the image of the display device as soon as
+ * it's rendered, it's never copied
+ */
+static SpectreStatus
+spectre_exporter_raster_do_page (SpectreExporter *exporter,
+				 unsigned int     page_index)
+{
+	SpectreDevice *device;
+	SpectreStatus status;
+	int urx, ury, llx, lly;
+
+	if (!exporter->to)
+		return SPECTRE_STATUS_EXPORTER_ERROR;
+
+	/* A PNG file holds a single image */
+	if (exporter->format == SPECTRE_EXPORTER_FORMAT_PNG && exporter->n_pages > 0)
+		return SPECTRE_STATUS_EXPORTER_ERROR;
+
+	psgetpagebox (exporter->doc, page_index, &urx, &ury, &llx, &lly);
+
+	device = spectre_device_new (exporter->doc);
+	if (!device)
+		return SPECTRE_STATUS_NO_MEMORY;
+
+	spectre_device_set_page_func (device, spectre_exporter_raster_page, exporter);
+	status = spectre_device_render (device, page_index, exporter->rc,
+					0, 0, urx - llx, ury - lly,
+					NULL, NULL);
+	spectre_device_free (device);
+	if (status)
+		return status == SPECTRE_STATUS_NO_MEMORY ?
+			status : SPECTRE_STATUS_EXPORTER_ERROR;
+
+	exporter->n_pages++;
+
+	return SPECTRE_STATUS_SUCCESS;
+}
+
+static SpectreStatus
+spectre_exporter_raster_end (SpectreExporter *exporter)
+{
+	int ok;
+
+	ok = exporter->to && exporter->n_pages > 0;
+
+#ifdef HAVE_ZLIB
+	if (ok && exporter->format == SPECTRE_EXPORTER_FORMAT_PNG)
+		ok = raster_png_chunk (exporter, "IEND", NULL, 0);
+#endif
+
+	/* The last directory has no next one */
+	if (ok && exporter->ifd) {
+		put_le32 (exporter->ifd + 2 + 12 * TIFF_N_ENTRIES, 0);
+		ok = raster_write (exporter, exporter->ifd, exporter->ifd_length);
+	}
+	free (exporter->ifd);
+	exporter->ifd = NULL;
+	exporter->ifd_length = 0;
+
+	if (!_spectre_exporter_close_output (exporter))
+		ok = FALSE;
+
+	return ok ? SPECTRE_STATUS_SUCCESS : SPECTRE_STATUS_EXPORTER_ERROR;
+}
+
+SpectreExporter *
+_spectre_exporter_raster_new (struct document      *doc,
+			      SpectreExporterFormat format)
+{
+	SpectreExporter *exporter;
+
+#ifndef HAVE_ZLIB
+	if (format == SPECTRE_EXPORTER_FORMAT_PNG)
+		return NULL;
+#endif
+
+	exporter = calloc (1, sizeof (SpectreExporter));
+	if (!exporter)
+		return NULL;
+
+	exporter->rc = spectre_render_context_new ();
+	if (!exporter->rc) {
+		free (exporter);
+		return NULL;
+	}
+
+	exporter->doc = psdocreference (doc);
+	exporter->format = format;
+	exporter->n_workers = 1;
+	exporter->compress = TRUE;
+
+	exporter->begin = spectre_exporter_raster_begin;
+	exporter->do_page = spectre_exporter_raster_do_page;
+	exporter->end = spectre_exporter_raster_end;
+
+	return exporter;
+}
@@ -18,12 +18,191 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+/* For fopencookie */
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "spectre-exporter.h"
 #include "spectre-private.h"
 #include "spectre-utils.h"
 
+#define STREAM_BUFFER_SIZE 65536
+
+typedef struct {
+	SpectreWriteFunc write_func;
+	void            *closure;
+} StreamCookie;
+
+#if defined(HAVE_FOPENCOOKIE)
+static ssize_t
+stream_write (void       *cookie,
+	      const char *data,
+	      size_t      length)
+{
+	StreamCookie *stream = cookie;
+
+	if (stream->write_func (stream->closure,
+				(const unsigned char *) data,
+				length) != SPECTRE_STATUS_SUCCESS)
+		return 0;
+
+	return length;
+}
+
+static int
+stream_close (void *cookie)
+{
+	free (cookie);
+
+	return 0;
+}
+#elif defined(HAVE_FUNOPEN)
+static int
+stream_write (void       *cookie,
+	      const char *data,
+	      int         length)
+{
+	StreamCookie *stream = cookie;
+
+	if (stream->write_func (stream->closure,
+				(const unsigned char *) data,
+				length) != SPECTRE_STATUS_SUCCESS)
+		return -1;
+
+	return length;
+}
+
+static int
+stream_close (void *cookie)
+{
+	free (cookie);
+
+	return 0;
+}
+#endif
+
+/* Opens a stream whose contents are given to write_func. Without
+ * fopencookie() or funopen() they're kept in a temporary file and
+ * given to write_func when the stream is closed.
+ */
+FILE *
+_spectre_stream_open (SpectreWriteFunc write_func,
+		      void            *closure)
+{
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+	StreamCookie *stream;
+	FILE *file;
+
+	stream = malloc (sizeof (StreamCookie));
+	if (!stream)
+		return NULL;
+	stream->write_func = write_func;
+	stream->closure = closure;
+
+#if defined(HAVE_FOPENCOOKIE)
+	{
+		cookie_io_functions_t funcs = { NULL, stream_write, NULL, stream_close };
+
+		file = fopencookie (stream, "w", funcs);
+	}
+#else
+	file = funopen (stream, NULL, stream_write, NULL, stream_close);
+#endif
+	if (!file) {
+		free (stream);
+		return NULL;
+	}
+	setvbuf (file, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+
+	return file;
+#else
+	return tmpfile ();
+#endif
+}
+
+int
+_spectre_stream_close (FILE            *stream,
+		       SpectreWriteFunc write_func,
+		       void            *closure)
+{
+	int ok = TRUE;
+
+#if !defined(HAVE_FOPENCOOKIE) && !defined(HAVE_FUNOPEN)
+	unsigned char buf[STREAM_BUFFER_SIZE];
+	size_t read;
+
+	ok = fflush (stream) == 0 && fseek (stream, 0, SEEK_SET) == 0;
+	while (ok && (read = fread (buf, 1, sizeof (buf), stream)) > 0)
+		ok = write_func (closure, buf, read) == SPECTRE_STATUS_SUCCESS;
+	ok = ok && !ferror (stream);
+#endif
+
+	if (fclose (stream) != 0)
+		ok = FALSE;
+
+	return ok;
+}
+
+/* Appends data to the SpectreBuffer closure */
+SpectreStatus
+_spectre_buffer_write (void                *closure,
+		       const unsigned char *data,
+		       size_t               length)
+{
+	SpectreBuffer *buffer = closure;
+
+	if (length == 0)
+		return SPECTRE_STATUS_SUCCESS;
+
+	if (length > buffer->size - buffer->length) {
+		unsigned char *new_data;
+		size_t size = buffer->size ? buffer->size : STREAM_BUFFER_SIZE;
+
+		while (length > size - buffer->length) {
+			if (size > ((size_t) -1) / 2)
+				return SPECTRE_STATUS_NO_MEMORY;
+			size *= 2;
+		}
+		new_data = realloc (buffer->data, size);
+		if (!new_data)
+			return SPECTRE_STATUS_NO_MEMORY;
+		buffer->data = new_data;
+		buffer->size = size;
+	}
+	memcpy (buffer->data + buffer->length, data, length);
+	buffer->length += length;
+
+	return SPECTRE_STATUS_SUCCESS;
+}
+
+/* Opens the file or the stream the exporter writes to */
+FILE *
+_spectre_exporter_open_output (SpectreExporter *exporter,
+			       const char      *filename)
+{
+	if (filename)
+		return fopen (filename, "wb");
+
+	return _spectre_stream_open (exporter->write_func, exporter->closure);
+}
+
+int
+_spectre_exporter_close_output (SpectreExporter *exporter)
+{
+	FILE *to = exporter->to;
+
+	exporter->to = NULL;
+	if (!to)
+		return TRUE;
+
+	if (exporter->write_func)
+		return _spectre_stream_close (to, exporter->write_func, exporter->closure);
+
+	return fclose (to) == 0;
+}
+
 SpectreExporter *
 spectre_exporter_new (SpectreDocument      *document,
 		      SpectreExporterFormat format)
@@ -39,6 +218,10 @@ spectre_exporter_new (SpectreDocument      *document,
 		return _spectre_exporter_ps_new (doc);
 	case SPECTRE_EXPORTER_FORMAT_PDF:
 		return _spectre_exporter_pdf_new (doc);
+	case SPECTRE_EXPORTER_FORMAT_PNG:
+	case SPECTRE_EXPORTER_FORMAT_PPM:
+	case SPECTRE_EXPORTER_FORMAT_TIFF:
+		return _spectre_exporter_raster_new (doc, format);
 	}
 
 	return NULL;
@@ -60,6 +243,23 @@ spectre_exporter_free (SpectreExporter *exporter)
 		exporter->gs = NULL;
 	}
 
+	free (exporter->filename);
+	exporter->filename = NULL;
+	free (exporter->pages);
+	exporter->pages = NULL;
+	free (exporter->ifd);
+	exporter->ifd = NULL;
+
+	if (exporter->rc) {
+		spectre_render_context_free (exporter->rc);
+		exporter->rc = NULL;
+	}
+
+	if (exporter->reader) {
+		pscopyclose (exporter->reader);
+		exporter->reader = NULL;
+	}
+
 	if (exporter->from) {
 		fclose (exporter->from);
 		exporter->from = NULL;
@@ -70,38 +270,170 @@ spectre_exporter_free (SpectreExporter *exporter)
 		exporter->to = NULL;
 	}
 
+	/* Closing the stream may still write to the buffer */
+	free (exporter->buffer.data);
+	exporter->buffer.data = NULL;
+
 	free (exporter);
 }
 
+void
+spectre_exporter_set_n_workers (SpectreExporter *exporter,
+				unsigned int     n_workers)
+{
+	_spectre_return_if_fail (exporter != NULL);
+
+	exporter->n_workers = n_workers;
+}
+
+void
+spectre_exporter_set_page_labels (SpectreExporter *exporter,
+				  int              page_labels)
+{
+	_spectre_return_if_fail (exporter != NULL);
+
+	exporter->page_labels = page_labels;
+}
+
+void
+spectre_exporter_set_render_context (SpectreExporter      *exporter,
+				     SpectreRenderContext *rc)
+{
+	_spectre_return_if_fail (exporter != NULL);
+	_spectre_return_if_fail (rc != NULL);
+
+	/* Only raster exporters render the pages */
+	if (exporter->rc)
+		*exporter->rc = *rc;
+}
+
+void
+spectre_exporter_set_compression (SpectreExporter *exporter,
+				  int              compress)
+{
+	_spectre_return_if_fail (exporter != NULL);
+
+	exporter->compress = compress;
+}
+
 SpectreStatus
 spectre_exporter_begin (SpectreExporter *exporter,
 			const char      *filename)
 {
 	_spectre_return_val_if_fail (exporter != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
 	_spectre_return_val_if_fail (filename != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
+
+	/* Forget the stream or the buffer of a previous export */
+	exporter->write_func = NULL;
+	exporter->closure = NULL;
+	free (exporter->buffer.data);
+	memset (&exporter->buffer, 0, sizeof (SpectreBuffer));
+	exporter->data = NULL;
+	exporter->length = NULL;
 	
-	if (exporter->begin)
-		return exporter->begin (exporter, filename);
+	if (exporter->begin) {
+		SpectreStatus status;
+
+		_spectre_trace_begin ("spectre_exporter_begin", "file", filename,
+				      (const char *) NULL);
+		status = exporter->begin (exporter, filename);
+		_spectre_trace_end ("spectre_exporter_begin");
+
+		return status;
+	}
 
 	return SPECTRE_STATUS_SUCCESS;
 }
 
+SpectreStatus
+spectre_exporter_begin_for_stream (SpectreExporter *exporter,
+				   SpectreWriteFunc write_func,
+				   void            *closure)
+{
+	_spectre_return_val_if_fail (exporter != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
+	_spectre_return_val_if_fail (write_func != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
+
+	exporter->write_func = write_func;
+	exporter->closure = closure;
+
+	if (exporter->begin) {
+		SpectreStatus status;
+
+		_spectre_trace_begin ("spectre_exporter_begin", (const char *) NULL);
+		status = exporter->begin (exporter, NULL);
+		_spectre_trace_end ("spectre_exporter_begin");
+
+		return status;
+	}
+
+	return SPECTRE_STATUS_SUCCESS;
+}
+
+SpectreStatus
+spectre_exporter_begin_for_data (SpectreExporter *exporter,
+				 unsigned char  **data,
+				 size_t          *length)
+{
+	_spectre_return_val_if_fail (exporter != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
+	_spectre_return_val_if_fail (data != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
+	_spectre_return_val_if_fail (length != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
+
+	free (exporter->buffer.data);
+	memset (&exporter->buffer, 0, sizeof (SpectreBuffer));
+	exporter->data = data;
+	exporter->length = length;
+
+	return spectre_exporter_begin_for_stream (exporter,
+						  _spectre_buffer_write,
+						  &exporter->buffer);
+}
+
 SpectreStatus
 spectre_exporter_do_page (SpectreExporter *exporter,
 			  unsigned int     page_index)
 {
+	SpectreStatus status;
+
 	_spectre_return_val_if_fail (exporter != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
-	
-	return exporter->do_page (exporter, page_index);
+
+	if (_spectre_trace_enabled ()) {
+		char page[16];
+
+		snprintf (page, sizeof (page), "%u", page_index);
+		_spectre_trace_begin ("spectre_exporter_do_page", "page", page,
+				      (const char *) NULL);
+	}
+	status = exporter->do_page (exporter, page_index);
+	_spectre_trace_end ("spectre_exporter_do_page");
+
+	return status;
 }
 
 SpectreStatus
 spectre_exporter_end (SpectreExporter *exporter)
 {
+	SpectreStatus status = SPECTRE_STATUS_SUCCESS;
+
 	_spectre_return_val_if_fail (exporter != NULL, SPECTRE_STATUS_EXPORTER_ERROR);
 	
-	if (exporter->end)
-		return exporter->end (exporter);
+	if (exporter->end) {
+		_spectre_trace_begin ("spectre_exporter_end", (const char *) NULL);
+		status = exporter->end (exporter);
+		_spectre_trace_end ("spectre_exporter_end");
+	}
+
+	/* The output is handed over once it's complete */
+	if (exporter->data) {
+		if (status == SPECTRE_STATUS_SUCCESS) {
+			*exporter->data = exporter->buffer.data;
+			*exporter->length = exporter->buffer.length;
+		} else {
+			free (exporter->buffer.data);
+		}
+		memset (&exporter->buffer, 0, sizeof (SpectreBuffer));
+		exporter->data = NULL;
+		exporter->length = NULL;
+	}
 	
-	return SPECTRE_STATUS_SUCCESS;		
+	return status;
 }
@@ -21,32 +21,125 @@
 #ifndef SPECTRE_EXPORTER_H
 #define SPECTRE_EXPORTER_H
 
+#include <stddef.h>
+
 #include <libspectre/spectre-macros.h>
 #include <libspectre/spectre-document.h>
+#include <libspectre/spectre-render-context.h>
 #include <libspectre/spectre-status.h>
 
 SPECTRE_BEGIN_DECLS
 
 typedef enum {
 	SPECTRE_EXPORTER_FORMAT_PS,
-	SPECTRE_EXPORTER_FORMAT_PDF
+	SPECTRE_EXPORTER_FORMAT_PDF,
+	SPECTRE_EXPORTER_FORMAT_PNG,
+	SPECTRE_EXPORTER_FORMAT_PPM,
+	SPECTRE_EXPORTER_FORMAT_TIFF
 } SpectreExporterFormat;
 
 typedef struct SpectreExporter SpectreExporter;
 
+/*! Receives the output of an export as it's produced
+    @param closure the closure given to spectre_exporter_begin_for_stream
+    @param data the data to write
+    @param length the length of data in bytes
+    @return SPECTRE_STATUS_SUCCESS, any other status makes the export fail
+*/
+typedef SpectreStatus (* SpectreWriteFunc) (void                *closure,
+					    const unsigned char *data,
+					    size_t               length);
+
+/*! Creates an exporter for document. Raster formats render the pages,
+    a PNG file holds a single page, PPM and TIFF files any number of them.
+    PNG exports are not available when libspectre is built without zlib,
+    NULL is returned then
+    @param document The document to export
+    @param format The format of the exported file
+*/
+SPECTRE_PUBLIC
+SpectreExporter *spectre_exporter_new                (SpectreDocument      *document,
+						      SpectreExporterFormat format);
+SPECTRE_PUBLIC
+void             spectre_exporter_free               (SpectreExporter      *exporter);
+
+/*! Sets the number of Ghostscript instances used to convert the pages
+    exported to PDF. With more than one, the pages are split into that
+    many ranges which are converted at the same time and merged at the
+    end. Merging keeps the pages and their labels, but not what pdfmarks add
+    to the whole document, like outlines, named destinations or document
+    info: when any of the exported pages, the prolog, the setup or the
+    trailer contain pdfmarks, the pages are converted by a single instance.
+    For PNG exports it's the number of threads compressing the page.
+    The default is 1, 0 uses one per CPU. It has no effect on other
+    formats and must be called before spectre_exporter_begin
+    @param exporter The exporter to modify
+    @param n_workers The number of instances to use
+*/
+SPECTRE_PUBLIC
+void             spectre_exporter_set_n_workers      (SpectreExporter      *exporter,
+						      unsigned int          n_workers);
+
+/*! Sets whether the labels of the exported pages become the page labels
+    of the PDF file. The default is FALSE. It has no effect on PostScript
+    exports and must be called before spectre_exporter_begin
+    @param exporter The exporter to modify
+    @param page_labels whether to keep the page labels
+*/
 SPECTRE_PUBLIC
-SpectreExporter *spectre_exporter_new     (SpectreDocument      *document,
-					   SpectreExporterFormat format);
+void             spectre_exporter_set_page_labels    (SpectreExporter      *exporter,
+						      int                   page_labels);
+
+/*! Sets how the pages exported to raster formats are rendered. The
+    default is the one of a new SpectreRenderContext. rc is copied, it
+    can be freed afterwards
+    @param exporter The exporter to modify
+    @param rc The render context to use
+*/
+SPECTRE_PUBLIC
+void             spectre_exporter_set_render_context (SpectreExporter      *exporter,
+						      SpectreRenderContext *rc);
+
+/*! Sets whether the pages exported to raster formats are compressed,
+    with deflate for PNG and PackBits for TIFF. The default is TRUE.
+    PPM files are never compressed
+    @param exporter The exporter to modify
+    @param compress whether to compress the pages
+*/
+SPECTRE_PUBLIC
+void             spectre_exporter_set_compression    (SpectreExporter      *exporter,
+						      int                   compress);
 SPECTRE_PUBLIC
-void             spectre_exporter_free    (SpectreExporter      *exporter);
+SpectreStatus    spectre_exporter_begin              (SpectreExporter      *exporter,
+						      const char           *filename);
+
+/*! Begins an export whose output is given to write_func instead of
+    being written to a file
+    @param exporter The exporter to begin
+    @param write_func the function that receives the output
+    @param closure the first argument of write_func
+*/
+SPECTRE_PUBLIC
+SpectreStatus    spectre_exporter_begin_for_stream   (SpectreExporter      *exporter,
+						      SpectreWriteFunc      write_func,
+						      void                 *closure);
+
+/*! Begins an export whose output is kept in memory. When
+    spectre_exporter_end succeeds, data is set to a buffer with the
+    output that must be freed with free(), and length to its length
+    @param exporter The exporter to begin
+    @param data the output will be returned here
+    @param length the length of the output will be returned here
+*/
 SPECTRE_PUBLIC
-SpectreStatus    spectre_exporter_begin   (SpectreExporter      *exporter,
-					   const char           *filename);
+SpectreStatus    spectre_exporter_begin_for_data     (SpectreExporter      *exporter,
+						      unsigned char       **data,
+						      size_t               *length);
 SPECTRE_PUBLIC
-SpectreStatus    spectre_exporter_do_page (SpectreExporter      *exporter,
-					   unsigned int          page_index);
+SpectreStatus    spectre_exporter_do_page            (SpectreExporter      *exporter,
+						      unsigned int          page_index);
 SPECTRE_PUBLIC
-SpectreStatus    spectre_exporter_end     (SpectreExporter      *exporter);
+SpectreStatus    spectre_exporter_end                (SpectreExporter      *exporter);
 
 SPECTRE_END_DECLS
 
@@ -21,9 +21,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "spectre-gs.h"
 #include "spectre-utils.h"
+#include "spectre-zindex.h"
 
 /* ghostscript stuff */
 #include <ghostscript/iapi.h>
@@ -38,6 +42,8 @@
 
 struct SpectreGS {
 	void *ghostscript_instance;
+	FILE *output;	/* gets what's written to stdout */
+	int   out_of_memory;	/* a VMerror was reported */
 };
 
 static int
@@ -73,38 +79,173 @@ critic_error_code (int code)
 	}
 }
 
+/* Like critic_error_code, remembering whether the instance ran out of
+ * memory, which happens when it's over the limit given with -K */
+static int
+gs_critic_error (SpectreGS *gs,
+		 int        code)
+{
+	if (code == gs_error_VMerror)
+		gs->out_of_memory = TRUE;
+
+	return critic_error_code (code);
+}
+
 static int
 spectre_gs_stdout (void *handler, const char *out, int len)
 {
 	return len;
 }
 
-int
-spectre_gs_process (SpectreGS  *gs,
-		    const char *filename,
-		    int         x,
-		    int         y,
-		    long        begin,
-		    long        end)
+static int
+spectre_gs_output (void *handler, const char *out, int len)
+{
+	SpectreGS *gs = handler;
+
+	if (fwrite (out, 1, len, gs->output) != (size_t) len)
+		return -1;
+
+	return len;
+}
+
+static int
+spectre_gs_process_data (void       *ghostscript_instance,
+			 const char *data,
+			 size_t      left)
+{
+	int error = 0;
+	int exit_code;
+
+	while (left > 0 && !critic_error_code (error)) {
+		size_t to_write = BUFFER_SIZE;
+
+		if (left < to_write)
+			to_write = left;
+
+		error = gsapi_run_string_continue (ghostscript_instance,
+						   data, to_write, 0, &exit_code);
+		_spectre_stats_add (gs_bytes, to_write);
+		error = error == gs_error_NeedInput ? 0 : error;
+		data += to_write;
+		left -= to_write;
+	}
+
+	return error;
+}
+
+static int
+spectre_gs_process_compressed (void          *ghostscript_instance,
+			       SpectreZIndex *zindex,
+			       off_t          offset,
+			       off_t          left)
 {
-	FILE *fd;
+	SpectreZReader *reader;
+	char buf[BUFFER_SIZE];
+	size_t read;
+	int error = 0;
+	int exit_code;
+
+	/* Decompression starts at the closest restart point */
+	reader = spectre_zreader_new (zindex, FALSE);
+	if (!reader)
+		return gs_error_VMerror;
+	if (spectre_zreader_seek (reader, offset) != 0)
+		left = 0;
+
+	while (left > 0 && !critic_error_code (error)) {
+		size_t to_read = BUFFER_SIZE;
+
+		if (left < BUFFER_SIZE)
+			to_read = left;
+
+		read = spectre_zreader_read (reader, buf, to_read);
+		if (read == 0)
+			break;
+
+		error = gsapi_run_string_continue (ghostscript_instance,
+						   buf, read, 0, &exit_code);
+		_spectre_stats_add (gs_bytes, read);
+		error = error == gs_error_NeedInput ? 0 : error;
+		left -= read;
+	}
+	spectre_zreader_free (reader);
+
+	return error;
+}
+
+static int
+spectre_gs_process_file (void       *ghostscript_instance,
+			 int         fd,
+			 off_t       offset,
+			 off_t       left)
+{
+	char buf[BUFFER_SIZE];
+	ssize_t read;
+	int error = 0;
+	int exit_code;
+
+	while (left > 0 && !critic_error_code (error)) {
+		size_t to_read = BUFFER_SIZE;
+		
+		if (left < BUFFER_SIZE)
+			to_read = left;
+
+		/* Positional reads don't move the shared file offset,
+		 * so several renders can read from the same descriptor */
+		read = pread (fd, buf, to_read, offset);
+		if (read < 0 && errno == EINTR)
+			continue;
+		if (read <= 0)
+			break;
+		
+		error = gsapi_run_string_continue (ghostscript_instance,
+						   buf, read, 0, &exit_code);
+		_spectre_stats_add (gs_bytes, read);
+		error = error == gs_error_NeedInput ? 0 : error;
+		offset += read;
+		left -= read;
+	}
+
+	return error;
+}
+
+static int
+gs_process (SpectreGS       *gs,
+	    struct document *doc,
+	    int              x,
+	    int              y,
+	    off_t            begin,
+	    off_t            end)
+{
+	int fd = -1;
 	int error;
-	static char buf[BUFFER_SIZE];
-	unsigned int read;
 	int exit_code;
-	size_t left = end - begin;
+	off_t left = end - begin;
 	void *ghostscript_instance = gs->ghostscript_instance;
-	
-	fd = fopen (filename, "rb");
-	if (!fd) {
-		return FALSE;
+
+	_spectre_stats_add (gs_process_calls, 1);
+
+	if (doc->data) {
+		/* Sections are fed straight from the document contents */
+		if (begin < 0 || end > doc->data_length || begin > end)
+			return FALSE;
+	} else if (doc->zindex) {
+		if (begin < 0 || begin > end)
+			return FALSE;
+	} else if (doc->fd >= 0) {
+		fd = doc->fd;
+	} else {
+		fd = open (doc->filename, O_RDONLY);
+		if (fd < 0) {
+			return FALSE;
+		}
+		_spectre_stats_add (file_opens, 1);
 	}
-	
-	fseek (fd, begin, SEEK_SET);
 
 	error = gsapi_run_string_begin (ghostscript_instance, 0, &exit_code);
-	if (critic_error_code (error)) {
-		fclose (fd);
+	if (gs_critic_error (gs, error)) {
+		if (fd >= 0 && fd != doc->fd)
+			close (fd);
 		return FALSE;
 	}
 
@@ -114,38 +255,78 @@ spectre_gs_process (SpectreGS  *gs,
 		set = _spectre_strdup_printf ("%d %d translate\n", -x, -y);
 		error = gsapi_run_string_continue (ghostscript_instance, set, strlen (set),
 						   0, &exit_code);
+		_spectre_stats_add (gs_bytes, strlen (set));
 		error = error == gs_error_NeedInput ? 0 : error;
 		free (set);
-		if (error != gs_error_NeedInput && critic_error_code (error)) {
-			fclose (fd);
+		if (error != gs_error_NeedInput && gs_critic_error (gs, error)) {
+			if (fd >= 0 && fd != doc->fd)
+				close (fd);
 			return FALSE;
 		}
 	}
 
-	while (left > 0 && !critic_error_code (error)) {
-		size_t to_read = BUFFER_SIZE;
-		
-		if (left < to_read)
-			to_read = left;
-		
-		read = fread (buf, sizeof (char), to_read, fd);
-		error = gsapi_run_string_continue (ghostscript_instance,
-						   buf, read, 0, &exit_code);
-		error = error == gs_error_NeedInput ? 0 : error;
-		left -= read;
-	}
+	if (doc->zindex)
+		error = spectre_gs_process_compressed (ghostscript_instance,
+						       doc->zindex, begin, left);
+	else if (fd >= 0)
+		error = spectre_gs_process_file (ghostscript_instance, fd, begin, left);
+	else
+		error = spectre_gs_process_data (ghostscript_instance,
+						 doc->data + begin, left);
 	
-	fclose (fd);
-	if (critic_error_code (error))
+	if (fd >= 0 && fd != doc->fd)
+		close (fd);
+	if (gs_critic_error (gs, error))
 		return FALSE;
 	
 	error = gsapi_run_string_end (ghostscript_instance, 0, &exit_code);
-	if (critic_error_code (error))
+	if (gs_critic_error (gs, error))
 		return FALSE;
 
 	return TRUE;
 }
 
+static const char *
+section_name (struct document *doc,
+	      off_t            begin)
+{
+	if (begin == doc->beginprolog)
+		return "prolog";
+	if (begin == doc->beginsetup)
+		return "setup";
+	if (begin == doc->begintrailer)
+		return "trailer";
+
+	return "page";
+}
+
+int
+spectre_gs_process (SpectreGS       *gs,
+		    struct document *doc,
+		    int              x,
+		    int              y,
+		    off_t            begin,
+		    off_t            end)
+{
+	int result;
+
+	if (_spectre_trace_enabled ()) {
+		char offset[32], length[32];
+
+		snprintf (offset, sizeof (offset), "%lld", (long long) begin);
+		snprintf (length, sizeof (length), "%lld", (long long) (end - begin));
+		_spectre_trace_begin ("spectre_gs_process",
+				      "section", section_name (doc, begin),
+				      "offset", offset,
+				      "length", length,
+				      (const char *) NULL);
+	}
+	result = gs_process (gs, doc, x, y, begin, end);
+	_spectre_trace_end ("spectre_gs_process");
+
+	return result;
+}
+
 SpectreGS *
 spectre_gs_new (void)
 {
@@ -167,11 +348,17 @@ spectre_gs_create_instance (SpectreGS *gs,
         if (version < GS_MIN_VERSION)
                 return FALSE;
 
+	/* The output is written from the stdout callback, which gets
+	 * the caller handle */
+	if (gs->output)
+		caller_handle = gs;
+
 	error = gsapi_new_instance (&gs->ghostscript_instance, caller_handle);
 	if (!critic_error_code (error)) {
+		_spectre_stats_add (gs_instances, 1);
 		gsapi_set_stdio (gs->ghostscript_instance,
 				 NULL,
-				 spectre_gs_stdout,
+				 gs->output ? spectre_gs_output : spectre_gs_stdout,
 				 NULL);
 		return TRUE;
 	}
@@ -179,6 +366,17 @@ spectre_gs_create_instance (SpectreGS *gs,
 	return FALSE;
 }
 
+/* Sends what the instance writes to stdout, the output of a device
+ * writing to "-", to output. Must be called before creating the
+ * instance, the caller handle is not used then.
+ */
+void
+spectre_gs_set_output (SpectreGS *gs,
+		       FILE      *output)
+{
+	gs->output = output;
+}
+
 int
 spectre_gs_set_display_callback (SpectreGS *gs,
 				 void      *callback)
@@ -197,9 +395,11 @@ spectre_gs_run (SpectreGS *gs,
 {
 	int error;
 	
+	_spectre_trace_begin ("spectre_gs_run", (const char *) NULL);
 	error = gsapi_init_with_args (gs->ghostscript_instance, n_args, args);
+	_spectre_trace_end ("spectre_gs_run");
 
-	return !critic_error_code (error);
+	return !gs_critic_error (gs, error);
 }
 
 int
@@ -212,7 +412,7 @@ spectre_gs_send_string (SpectreGS  *gs,
 	error = gsapi_run_string_with_length (gs->ghostscript_instance,
 					      str, strlen (str), 0, &exit_code);
 
-	return !critic_error_code (error);
+	return !gs_critic_error (gs, error);
 }
 
 int
@@ -248,21 +448,26 @@ spectre_gs_send_page (SpectreGS       *gs,
 		doc_yoffset = yoffset + y;
 	}
 	
+	_spectre_phase_begin (SPECTRE_PHASE_PROLOG);
 	if (!spectre_gs_process (gs,
-				 doc->filename,
+				 doc,
 				 doc_xoffset,
 				 doc_yoffset,
 				 doc->beginprolog,
 				 doc->endprolog))
 		return FALSE;
+	_spectre_phase_end (SPECTRE_PHASE_PROLOG);
 
+	_spectre_phase_begin (SPECTRE_PHASE_SETUP);
 	if (!spectre_gs_process (gs,
-				 doc->filename,
+				 doc,
 				 0, 0,
 				 doc->beginsetup,
 				 doc->endsetup))
 		return FALSE;
+	_spectre_phase_end (SPECTRE_PHASE_SETUP);
 
+	_spectre_phase_begin (SPECTRE_PHASE_PAGE);
 	if (doc->numpages > 0) {
 		if (doc->pageorder == SPECIAL) {
 			unsigned int i;
@@ -271,7 +476,7 @@ spectre_gs_send_page (SpectreGS       *gs,
 
 			for (i = 0; i < page_index; i++) {
 				if (!spectre_gs_process (gs,
-							 doc->filename,
+							 doc,
 							 page_xoffset,
 							 page_yoffset,
 							 doc->pages[i].begin,
@@ -281,24 +486,33 @@ spectre_gs_send_page (SpectreGS       *gs,
 		}
 		
 		if (!spectre_gs_process (gs,
-					 doc->filename,
+					 doc,
 					 page_xoffset,
 					 page_yoffset,
 					 doc->pages[page_index].begin,
 					 doc->pages[page_index].end))
 			return FALSE;
 	}
+	_spectre_phase_end (SPECTRE_PHASE_PAGE);
 	
+	_spectre_phase_begin (SPECTRE_PHASE_TRAILER);
 	if (!spectre_gs_process (gs,
-				 doc->filename,
+				 doc,
 				 0, 0,
 				 doc->begintrailer,
 				 doc->endtrailer))
 		return FALSE;
+	_spectre_phase_end (SPECTRE_PHASE_TRAILER);
 
 	return TRUE;
 }
 
+int
+spectre_gs_out_of_memory (SpectreGS *gs)
+{
+	return gs->out_of_memory;
+}
+
 void
 spectre_gs_cleanup (SpectreGS           *gs,
 		    SpectreGSCleanupFlag flag)
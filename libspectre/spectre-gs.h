@@ -37,17 +37,19 @@ typedef struct SpectreGS SpectreGS;
 SpectreGS *spectre_gs_new                  (void);
 int        spectre_gs_create_instance      (SpectreGS           *gs,
 					    void                *caller_handle);
+void       spectre_gs_set_output           (SpectreGS           *gs,
+					    FILE                *output);
 int        spectre_gs_set_display_callback (SpectreGS           *gs,
 					    void                *callback);
 int        spectre_gs_run                  (SpectreGS           *gs,
 					    int                  n_args,
 					    char               **args);
 int        spectre_gs_process              (SpectreGS           *gs,
-					    const char          *filename,
+					    struct document     *doc,
 					    int                  x,
 					    int                  y,
-					    long                 begin,
-					    long                 end);
+					    off_t                begin,
+					    off_t                end);
 int        spectre_gs_send_string          (SpectreGS           *gs,
 					    const char          *str);
 int        spectre_gs_send_page            (SpectreGS           *gs,
@@ -55,6 +57,7 @@ int        spectre_gs_send_page            (SpectreGS           *gs,
 					    unsigned int         page_index,
 					    int                  x,
 					    int                  y);
+int        spectre_gs_out_of_memory        (SpectreGS           *gs);
 void       spectre_gs_cleanup              (SpectreGS           *gs,
 					    SpectreGSCleanupFlag flag);
 void       spectre_gs_free                 (SpectreGS           *gs);
@@ -32,6 +32,7 @@ struct SpectrePage
 	struct document *doc;
 	
 	SpectreStatus    status;
+	size_t           peak_memory;	/* of the last render */
 
 	unsigned int     index;
 	int              width;
@@ -95,20 +96,19 @@ spectre_page_get_label (SpectrePage *page)
 }
 
 SpectreOrientation
-spectre_page_get_orientation (SpectrePage *page)
+_spectre_page_orientation (struct document *doc,
+			   unsigned int     page_index)
 {
 	int page_orientation = NONE;
 
-	_spectre_return_val_if_fail (page != NULL, SPECTRE_ORIENTATION_PORTRAIT);
-
-	if (page->doc->numpages > 0) {
-		page_orientation = page->doc->pages[page->index].orientation != NONE ?
-			page->doc->pages[page->index].orientation :
-			page->doc->default_page_orientation;
+	if (doc->numpages > 0) {
+		page_orientation = doc->pages[page_index].orientation != NONE ?
+			doc->pages[page_index].orientation :
+			doc->default_page_orientation;
 	}
 
 	if (page_orientation == NONE)
-		page_orientation = page->doc->orientation;
+		page_orientation = doc->orientation;
 
 	switch (page_orientation) {
 	default:
@@ -123,6 +123,14 @@ spectre_page_get_orientation (SpectrePage *page)
 	}
 }
 
+SpectreOrientation
+spectre_page_get_orientation (SpectrePage *page)
+{
+	_spectre_return_val_if_fail (page != NULL, SPECTRE_ORIENTATION_PORTRAIT);
+
+	return _spectre_page_orientation (page->doc, page->index);
+}
+
 void
 spectre_page_get_size (SpectrePage *page,
 		       int         *width,
@@ -164,6 +172,7 @@ spectre_page_render (SpectrePage          *page,
 	page->status = spectre_device_render (device, page->index, rc,
 					      0, 0, width, height,
 					      page_data, row_length);
+	page->peak_memory = spectre_device_get_peak_memory (device);
 	spectre_device_free (device);
 }
 
@@ -190,5 +199,14 @@ spectre_page_render_slice (SpectrePage          *page,
 					      x, page_height - (y + height),
 					      width, height,
 					      page_data, row_length);
+	page->peak_memory = spectre_device_get_peak_memory (device);
 	spectre_device_free (device);
 }
+
+size_t
+spectre_page_get_peak_memory (SpectrePage *page)
+{
+	_spectre_return_val_if_fail (page != NULL, 0);
+
+	return page->peak_memory;
+}
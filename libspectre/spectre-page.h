@@ -120,6 +120,16 @@ void               spectre_page_render_slice    (SpectrePage          *page,
 						 unsigned char       **page_data,
 						 int                  *row_length);
 
+/*! Gets the peak memory used by the frame buffers of the last render of
+    the page, in bytes, including the ones of Ghostscript. Other allocations
+    of Ghostscript are kept under the limit of the rendering context, but
+    are not included
+    @param page The page whose last render will be queried
+    @see spectre_render_context_set_memory_limit
+*/
+SPECTRE_PUBLIC
+size_t             spectre_page_get_peak_memory (SpectrePage          *page);
+
 SPECTRE_END_DECLS
 
 #endif /* SPECTRE_PAGE_H */
@@ -0,0 +1,839 @@
+/* This file is part of Libspectre.
+ *
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "spectre-pdf.h"
+#include "spectre-utils.h"
+
+/* PDF files written by pdfwrite are merged at the object level, they
+ * are not interpreted again. The objects of every part are copied with
+ * their numbers shifted past the ones of the previous parts, and the
+ * references to them are rewritten the same way. Stream contents are
+ * copied as they are. The page tree of every part becomes a kid of a
+ * new root, and a new catalog points to it.
+ *
+ * Only files with a cross-reference table and without incremental
+ * updates or encryption are handled, anything else makes the merge
+ * fail.
+ */
+
+/* Objects 1 and 2 are the new catalog and page tree root */
+#define MERGE_CATALOG    1
+#define MERGE_PAGES      2
+#define MERGE_FIRST_FREE 3
+
+#define STARTXREF_SEARCH 1024
+
+typedef struct {
+	const char *p;
+	const char *end;
+	const char *start;	/* of the current token */
+	size_t      len;
+} PdfLexer;
+
+typedef struct {
+	char         *data;
+	size_t        length;
+	size_t       *offsets;	/* of every object by number, 0 if free */
+	unsigned int  n_offsets;
+	unsigned int  root;
+	unsigned int  info;
+	unsigned int  pages;
+	unsigned int  count;
+} PdfPart;
+
+typedef struct {
+	FILE         *out;
+	off_t        *offsets;	/* of every object written, by number */
+	unsigned int  n_objects;
+	unsigned int  max_objects;
+} PdfMerge;
+
+static int
+pdf_is_space (char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+		c == '\f' || c == '\0';
+}
+
+static int
+pdf_is_regular (char c)
+{
+	if (pdf_is_space (c))
+		return FALSE;
+
+	switch (c) {
+	case '(': case ')': case '<': case '>': case '[': case ']':
+	case '{': case '}': case '/': case '%':
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
+static void
+pdf_lexer_init (PdfLexer   *lex,
+		PdfPart    *part,
+		const char *p)
+{
+	lex->p = p;
+	lex->end = part->data + part->length;
+	lex->start = p;
+	lex->len = 0;
+}
+
+/* Reads the next token, strings and hexadecimal strings are single
+ * tokens so references are never looked for in them.
+ */
+static int
+pdf_lexer_next (PdfLexer *lex)
+{
+	const char *p = lex->p;
+	const char *end = lex->end;
+	int depth = 0;
+
+	while (p < end) {
+		if (*p == '%') {
+			while (p < end && *p != '\r' && *p != '\n')
+				p++;
+		} else if (pdf_is_space (*p)) {
+			p++;
+		} else {
+			break;
+		}
+	}
+	if (p >= end)
+		return FALSE;
+
+	lex->start = p;
+	switch (*p) {
+	case '(':
+		for (; p < end; p++) {
+			if (*p == '\\')
+				p++;
+			else if (*p == '(')
+				depth++;
+			else if (*p == ')' && --depth == 0)
+				break;
+		}
+		if (p >= end)
+			return FALSE;
+		p++;
+		break;
+	case '<':
+		if (p + 1 < end && p[1] == '<') {
+			p += 2;
+		} else {
+			p = memchr (p, '>', end - p);
+			if (!p)
+				return FALSE;
+			p++;
+		}
+		break;
+	case '>':
+		if (p + 1 >= end || p[1] != '>')
+			return FALSE;
+		p += 2;
+		break;
+	case '[': case ']': case '{': case '}':
+		p++;
+		break;
+	case ')':
+		return FALSE;
+	case '/':
+		p++;
+		while (p < end && pdf_is_regular (*p))
+			p++;
+		break;
+	default:
+		while (p < end && pdf_is_regular (*p))
+			p++;
+	}
+	lex->p = p;
+	lex->len = p - lex->start;
+
+	return TRUE;
+}
+
+static int
+pdf_token_is (PdfLexer   *lex,
+	      const char *str)
+{
+	return lex->len == strlen (str) && memcmp (lex->start, str, lex->len) == 0;
+}
+
+static int
+pdf_token_number (PdfLexer           *lex,
+		  unsigned long long *value)
+{
+	unsigned long long v = 0;
+	size_t i;
+
+	if (lex->len == 0 || lex->len > 18)
+		return FALSE;
+	for (i = 0; i < lex->len; i++) {
+		if (lex->start[i] < '0' || lex->start[i] > '9')
+			return FALSE;
+		v = v * 10 + (lex->start[i] - '0');
+	}
+	*value = v;
+
+	return TRUE;
+}
+
+static int
+pdf_token_uint (PdfLexer     *lex,
+		unsigned int *value)
+{
+	unsigned long long v;
+
+	if (!pdf_token_number (lex, &v) || v > UINT_MAX)
+		return FALSE;
+	*value = v;
+
+	return TRUE;
+}
+
+/* Reads "gen R" after the number of a reference, or leaves the
+ * lexer untouched.
+ */
+static int
+pdf_lexer_ref (PdfLexer *lex)
+{
+	PdfLexer save = *lex;
+	unsigned int gen;
+
+	if (pdf_lexer_next (lex) && pdf_token_uint (lex, &gen) &&
+	    pdf_lexer_next (lex) && pdf_token_is (lex, "R"))
+		return TRUE;
+	*lex = save;
+
+	return FALSE;
+}
+
+/* Leaves the lexer after "num gen obj" */
+static int
+pdf_object_start (PdfPart      *part,
+		  unsigned int  num,
+		  PdfLexer     *lex)
+{
+	unsigned int value;
+
+	if (num == 0 || num >= part->n_offsets || part->offsets[num] == 0)
+		return FALSE;
+
+	pdf_lexer_init (lex, part, part->data + part->offsets[num]);
+
+	return pdf_lexer_next (lex) && pdf_token_uint (lex, &value) && value == num &&
+		pdf_lexer_next (lex) && pdf_token_uint (lex, &value) && value == 0 &&
+		pdf_lexer_next (lex) && pdf_token_is (lex, "obj");
+}
+
+/* Looks for key in the dictionary that starts at p and leaves the
+ * lexer on its value.
+ */
+static int
+pdf_dict_lookup (PdfPart    *part,
+		 const char *p,
+		 const char *key,
+		 PdfLexer   *lex)
+{
+	unsigned int value;
+	int is_key = TRUE;
+	int depth = 0;
+
+	pdf_lexer_init (lex, part, p);
+	if (!pdf_lexer_next (lex) || !pdf_token_is (lex, "<<"))
+		return FALSE;
+
+	while (pdf_lexer_next (lex)) {
+		if (depth > 0) {
+			if (pdf_token_is (lex, "<<") || pdf_token_is (lex, "["))
+				depth++;
+			else if (pdf_token_is (lex, ">>") || pdf_token_is (lex, "]"))
+				depth--;
+		} else if (is_key) {
+			if (lex->start[0] != '/')
+				return FALSE;
+			if (pdf_token_is (lex, key))
+				return pdf_lexer_next (lex);
+			is_key = FALSE;
+		} else {
+			if (pdf_token_is (lex, "<<") || pdf_token_is (lex, "["))
+				depth++;
+			else if (pdf_token_uint (lex, &value))
+				pdf_lexer_ref (lex);
+			is_key = TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static int
+pdf_dict_lookup_ref (PdfPart      *part,
+		     const char   *p,
+		     const char   *key,
+		     unsigned int *num)
+{
+	PdfLexer lex;
+
+	return pdf_dict_lookup (part, p, key, &lex) &&
+		pdf_token_uint (&lex, num) && pdf_lexer_ref (&lex);
+}
+
+/* Integers are often written as references by pdfwrite, stream lengths
+ * in particular, those are resolved.
+ */
+static int
+pdf_dict_lookup_uint (PdfPart      *part,
+		      const char   *p,
+		      const char   *key,
+		      unsigned int *value)
+{
+	PdfLexer lex;
+
+	if (!pdf_dict_lookup (part, p, key, &lex) || !pdf_token_uint (&lex, value))
+		return FALSE;
+	if (!pdf_lexer_ref (&lex))
+		return TRUE;
+
+	return pdf_object_start (part, *value, &lex) &&
+		pdf_lexer_next (&lex) && pdf_token_uint (&lex, value);
+}
+
+static int
+pdf_part_read (PdfPart    *part,
+	       const char *filename)
+{
+	FILE *file;
+	off_t length;
+	int ok;
+
+	file = fopen (filename, "rb");
+	if (!file)
+		return FALSE;
+
+	ok = fseeko (file, 0, SEEK_END) == 0 && (length = ftello (file)) > 0 &&
+		(off_t) (size_t) length == length && fseeko (file, 0, SEEK_SET) == 0;
+	if (ok) {
+		part->length = length;
+		part->data = malloc (part->length);
+		ok = part->data && fread (part->data, 1, part->length, file) == part->length;
+	}
+	fclose (file);
+
+	return ok;
+}
+
+static int
+pdf_part_set_offset (PdfPart      *part,
+		     unsigned int  num,
+		     size_t        offset)
+{
+	if (num >= part->n_offsets) {
+		size_t *offsets;
+		unsigned int n = num + 1;
+
+		offsets = realloc (part->offsets, n * sizeof (size_t));
+		if (!offsets)
+			return FALSE;
+		memset (offsets + part->n_offsets, 0,
+			(n - part->n_offsets) * sizeof (size_t));
+		part->offsets = offsets;
+		part->n_offsets = n;
+	}
+	part->offsets[num] = offset;
+
+	return TRUE;
+}
+
+static int
+pdf_part_parse (PdfPart *part)
+{
+	PdfLexer lex;
+	const char *p;
+	const char *trailer;
+	unsigned long long xref;
+	unsigned int value;
+
+	if (part->length < 16 || memcmp (part->data, "%PDF-", 5) != 0)
+		return FALSE;
+
+	/* The cross-reference table is found from the end of the file */
+	for (p = part->data + part->length - 9; p > part->data; p--) {
+		if (memcmp (p, "startxref", 9) == 0)
+			break;
+		if (part->data + part->length - p > STARTXREF_SEARCH)
+			return FALSE;
+	}
+	pdf_lexer_init (&lex, part, p + 9);
+	if (!pdf_lexer_next (&lex) || !pdf_token_number (&lex, &xref) || xref >= part->length)
+		return FALSE;
+
+	pdf_lexer_init (&lex, part, part->data + xref);
+	if (!pdf_lexer_next (&lex) || !pdf_token_is (&lex, "xref"))
+		return FALSE;
+
+	while (pdf_lexer_next (&lex) && !pdf_token_is (&lex, "trailer")) {
+		unsigned int first, count, i;
+
+		if (!pdf_token_uint (&lex, &first) ||
+		    !pdf_lexer_next (&lex) || !pdf_token_uint (&lex, &count))
+			return FALSE;
+		/* Entries take 20 bytes, don't trust larger counts */
+		if (count > (size_t) (lex.end - lex.p) / 20)
+			return FALSE;
+
+		for (i = 0; i < count; i++) {
+			unsigned long long offset;
+			unsigned int gen;
+
+			if (!pdf_lexer_next (&lex) || !pdf_token_number (&lex, &offset) ||
+			    !pdf_lexer_next (&lex) || !pdf_token_uint (&lex, &gen) ||
+			    !pdf_lexer_next (&lex))
+				return FALSE;
+			if (pdf_token_is (&lex, "f"))
+				continue;
+			if (!pdf_token_is (&lex, "n") || gen != 0 ||
+			    offset == 0 || offset >= part->length)
+				return FALSE;
+			if (!pdf_part_set_offset (part, first + i, offset))
+				return FALSE;
+		}
+	}
+	if (!pdf_token_is (&lex, "trailer"))
+		return FALSE;
+
+	trailer = lex.p;
+	if (pdf_dict_lookup (part, trailer, "/Prev", &lex) ||
+	    pdf_dict_lookup (part, trailer, "/XRefStm", &lex) ||
+	    pdf_dict_lookup (part, trailer, "/Encrypt", &lex))
+		return FALSE;
+	if (!pdf_dict_lookup_ref (part, trailer, "/Root", &part->root))
+		return FALSE;
+	if (!pdf_dict_lookup_ref (part, trailer, "/Info", &part->info))
+		part->info = 0;
+
+	if (!pdf_object_start (part, part->root, &lex) ||
+	    !pdf_dict_lookup_ref (part, lex.p, "/Pages", &part->pages) ||
+	    part->pages == part->root)
+		return FALSE;
+	if (!pdf_object_start (part, part->pages, &lex) ||
+	    !pdf_dict_lookup_uint (part, lex.p, "/Count", &value))
+		return FALSE;
+	part->count = value;
+
+	return TRUE;
+}
+
+static void
+pdf_part_free (PdfPart *part)
+{
+	free (part->data);
+	free (part->offsets);
+	memset (part, 0, sizeof (PdfPart));
+}
+
+static int
+pdf_merge_begin_object (PdfMerge     *merge,
+			unsigned int  num)
+{
+	off_t offset;
+
+	if (num >= merge->max_objects) {
+		off_t *offsets;
+		unsigned int n = merge->max_objects ? merge->max_objects : 64;
+
+		while (n <= num)
+			n *= 2;
+		offsets = realloc (merge->offsets, n * sizeof (off_t));
+		if (!offsets)
+			return FALSE;
+		memset (offsets + merge->max_objects, 0,
+			(n - merge->max_objects) * sizeof (off_t));
+		merge->offsets = offsets;
+		merge->max_objects = n;
+	}
+	if (num >= merge->n_objects)
+		merge->n_objects = num + 1;
+
+	offset = ftello (merge->out);
+	if (offset <= 0)
+		return FALSE;
+	merge->offsets[num] = offset;
+
+	return fprintf (merge->out, "%u 0 obj", num) > 0;
+}
+
+static int
+pdf_merge_write (PdfMerge   *merge,
+		 const char *from,
+		 const char *to)
+{
+	size_t len = to - from;
+
+	return fwrite (from, 1, len, merge->out) == len;
+}
+
+/* Copies an object, shifting its number and the numbers of the
+ * objects it references by base. The root of the page tree of a part
+ * also gets a parent, the new root.
+ */
+static int
+pdf_merge_copy_object (PdfMerge     *merge,
+		       PdfPart      *part,
+		       unsigned int  num,
+		       unsigned int  base)
+{
+	PdfLexer lex;
+	PdfLexer prev[2];
+	const char *body;
+	const char *copied;
+	int n_prev = 0;
+	int add_parent = num == part->pages;
+
+	if (!pdf_object_start (part, num, &lex))
+		return FALSE;
+	if (!pdf_merge_begin_object (merge, num + base))
+		return FALSE;
+
+	body = copied = lex.p;
+	while (pdf_lexer_next (&lex)) {
+		unsigned int ref, gen;
+
+		if (pdf_token_is (&lex, "R") && n_prev == 2 &&
+		    pdf_token_uint (&prev[0], &ref) && pdf_token_uint (&prev[1], &gen)) {
+			if (ref == 0 || ref >= part->n_offsets)
+				return FALSE;
+			if (!pdf_merge_write (merge, copied, prev[0].start) ||
+			    fprintf (merge->out, "%u", ref + base) < 0)
+				return FALSE;
+			copied = prev[0].p;
+		} else if (add_parent && pdf_token_is (&lex, "<<")) {
+			if (!pdf_merge_write (merge, copied, lex.p) ||
+			    fprintf (merge->out, " /Parent %u 0 R", MERGE_PAGES) < 0)
+				return FALSE;
+			copied = lex.p;
+			add_parent = FALSE;
+		} else if (pdf_token_is (&lex, "stream")) {
+			unsigned int length;
+			const char *p = lex.p;
+
+			if (!pdf_dict_lookup_uint (part, body, "/Length", &length))
+				return FALSE;
+			if (p < lex.end && *p == '\r')
+				p++;
+			if (p < lex.end && *p == '\n')
+				p++;
+			if (length > (size_t) (lex.end - p))
+				return FALSE;
+
+			lex.p = p + length;
+			if (!pdf_lexer_next (&lex) || !pdf_token_is (&lex, "endstream") ||
+			    !pdf_lexer_next (&lex) || !pdf_token_is (&lex, "endobj"))
+				return FALSE;
+
+			return pdf_merge_write (merge, copied, lex.p) &&
+				fputc ('\n', merge->out) != EOF;
+		} else if (pdf_token_is (&lex, "endobj")) {
+			return pdf_merge_write (merge, copied, lex.p) &&
+				fputc ('\n', merge->out) != EOF;
+		} else if (pdf_token_is (&lex, "obj")) {
+			break;
+		}
+
+		if (n_prev == 2)
+			prev[0] = prev[1];
+		else
+			n_prev++;
+		prev[n_prev - 1] = lex;
+	}
+
+	return FALSE;
+}
+
+static int
+pdf_merge_copy_part (PdfMerge     *merge,
+		     PdfPart      *part,
+		     unsigned int  base)
+{
+	unsigned int num;
+
+	for (num = 1; num < part->n_offsets; num++) {
+		if (part->offsets[num] == 0)
+			continue;
+
+		/* The catalog is replaced by the new one */
+		if (num == part->root) {
+			if (!pdf_merge_begin_object (merge, num + base) ||
+			    fputs ("\nnull\nendobj\n", merge->out) == EOF)
+				return FALSE;
+			continue;
+		}
+
+		if (!pdf_merge_copy_object (merge, part, num, base))
+			return FALSE;
+	}
+	if (part->n_offsets + base > merge->n_objects)
+		merge->n_objects = part->n_offsets + base;
+
+	return TRUE;
+}
+
+static int
+pdf_label_number (const char   *label,
+		  unsigned int *number)
+{
+	unsigned long value = 0;
+	const char *p;
+
+	if (label[0] < '1' || label[0] > '9')
+		return FALSE;
+	for (p = label; *p; p++) {
+		if (*p < '0' || *p > '9' || p - label > 8)
+			return FALSE;
+		value = value * 10 + (*p - '0');
+	}
+	*number = value;
+
+	return TRUE;
+}
+
+/* Consecutive numeric labels become a single decimal range, and so do
+ * consecutive pages with the same label. A page without a label gets
+ * its number in the document.
+ */
+static int
+pdf_merge_write_labels (PdfMerge     *merge,
+			const char  **labels,
+			unsigned int  n_labels)
+{
+	const char *prefix = NULL;
+	unsigned int next = 0;
+	unsigned int i;
+
+	if (fputs ("/PageLabels << /Nums [", merge->out) == EOF)
+		return FALSE;
+
+	for (i = 0; i < n_labels; i++) {
+		unsigned int number;
+		char *str;
+		int ok;
+
+		if (!labels[i] || pdf_label_number (labels[i], &number)) {
+			if (!labels[i])
+				number = i + 1;
+			if (!prefix && next > 0 && number == next) {
+				next++;
+				continue;
+			}
+			if (fprintf (merge->out, " %u << /S /D /St %u >>", i, number) < 0)
+				return FALSE;
+			prefix = NULL;
+			next = number + 1;
+			continue;
+		}
+
+		if (prefix && strcmp (prefix, labels[i]) == 0)
+			continue;
+		str = spectre_pdf_string (labels[i]);
+		if (!str)
+			return FALSE;
+		ok = fprintf (merge->out, " %u << /P %s >>", i, str) > 0;
+		free (str);
+		if (!ok)
+			return FALSE;
+		prefix = labels[i];
+		next = 0;
+	}
+
+	return fputs (" ] >>\n", merge->out) != EOF;
+}
+
+static int
+pdf_merge_finish (PdfMerge     *merge,
+		  unsigned int *kids,
+		  unsigned int  n_parts,
+		  unsigned int  count,
+		  unsigned int  info,
+		  const char  **labels,
+		  unsigned int  n_labels)
+{
+	off_t xref;
+	unsigned int i;
+
+	if (!pdf_merge_begin_object (merge, MERGE_PAGES) ||
+	    fprintf (merge->out, "\n<< /Type /Pages /Count %u /Kids [", count) < 0)
+		return FALSE;
+	for (i = 0; i < n_parts; i++) {
+		if (fprintf (merge->out, " %u 0 R", kids[i]) < 0)
+			return FALSE;
+	}
+	if (fputs (" ] >>\nendobj\n", merge->out) == EOF)
+		return FALSE;
+
+	if (!pdf_merge_begin_object (merge, MERGE_CATALOG) ||
+	    fprintf (merge->out, "\n<< /Type /Catalog /Pages %u 0 R\n", MERGE_PAGES) < 0)
+		return FALSE;
+	/* Labels are only right if every page made exactly one */
+	if (labels && n_labels == count &&
+	    !pdf_merge_write_labels (merge, labels, n_labels))
+		return FALSE;
+	if (fputs (">>\nendobj\n", merge->out) == EOF)
+		return FALSE;
+
+	xref = ftello (merge->out);
+	if (xref <= 0 ||
+	    fprintf (merge->out, "xref\n0 %u\n0000000000 65535 f \n", merge->n_objects) < 0)
+		return FALSE;
+	for (i = 1; i < merge->n_objects; i++) {
+		int ret;
+
+		if (i < merge->max_objects && merge->offsets[i])
+			ret = fprintf (merge->out, "%010lld 00000 n \n",
+				       (long long) merge->offsets[i]);
+		else
+			ret = fputs ("0000000000 65535 f \n", merge->out);
+		if (ret < 0)
+			return FALSE;
+	}
+
+	if (fprintf (merge->out, "trailer\n<< /Size %u /Root %u 0 R",
+		     merge->n_objects, MERGE_CATALOG) < 0)
+		return FALSE;
+	if (info && fprintf (merge->out, " /Info %u 0 R", info) < 0)
+		return FALSE;
+
+	return fprintf (merge->out, " >>\nstartxref\n%lld\n%%%%EOF\n", (long long) xref) > 0;
+}
+
+/* Merges the PDF files parts into filename, in order. When labels is
+ * not NULL it has the label of every page of the result.
+ */
+int
+spectre_pdf_merge (const char  *filename,
+		   const char **parts,
+		   unsigned int n_parts,
+		   const char **labels,
+		   unsigned int n_labels)
+{
+	PdfMerge merge;
+	PdfPart part;
+	unsigned int *kids;
+	unsigned int base = MERGE_FIRST_FREE - 1;
+	unsigned int count = 0;
+	unsigned int info = 0;
+	unsigned int i;
+	int ok = TRUE;
+
+	if (n_parts == 0)
+		return FALSE;
+
+	kids = calloc (n_parts, sizeof (unsigned int));
+	if (!kids)
+		return FALSE;
+
+	memset (&merge, 0, sizeof (PdfMerge));
+	merge.n_objects = MERGE_FIRST_FREE;
+	merge.out = fopen (filename, "wb");
+	if (!merge.out) {
+		free (kids);
+		return FALSE;
+	}
+
+	memset (&part, 0, sizeof (PdfPart));
+	for (i = 0; i < n_parts && ok; i++) {
+		ok = pdf_part_read (&part, parts[i]) && pdf_part_parse (&part);
+
+		/* The header of the first part is kept, all the parts are
+		 * written by the same device with the same settings */
+		if (ok && i == 0) {
+			const char *eol = part.data;
+
+			while (eol < part.data + part.length && *eol != '\r' && *eol != '\n')
+				eol++;
+			ok = pdf_merge_write (&merge, part.data, eol) &&
+				fputs ("\n%\307\354\217\242\n", merge.out) != EOF;
+		}
+
+		if (ok)
+			ok = pdf_merge_copy_part (&merge, &part, base);
+		if (ok) {
+			kids[i] = part.pages + base;
+			if (!info && part.info)
+				info = part.info + base;
+			count += part.count;
+			base = merge.n_objects - 1;
+		}
+		pdf_part_free (&part);
+	}
+
+	if (ok)
+		ok = pdf_merge_finish (&merge, kids, n_parts, count, info,
+				       labels, n_labels);
+	if (fclose (merge.out) != 0)
+		ok = FALSE;
+	if (!ok)
+		unlink (filename);
+
+	free (merge.offsets);
+	free (kids);
+
+	return ok;
+}
+
+/* Returns str as a PDF or PostScript string literal */
+char *
+spectre_pdf_string (const char *str)
+{
+	const unsigned char *p;
+	char *retval;
+	char *q;
+
+	retval = malloc (strlen (str) * 4 + 3);
+	if (!retval)
+		return NULL;
+
+	q = retval;
+	*q++ = '(';
+	for (p = (const unsigned char *) str; *p; p++) {
+		if (*p == '(' || *p == ')' || *p == '\\') {
+			*q++ = '\\';
+			*q++ = *p;
+		} else if (*p < 32 || *p >= 127) {
+			sprintf (q, "\\%03o", *p);
+			q += 4;
+		} else {
+			*q++ = *p;
+		}
+	}
+	*q++ = ')';
+	*q = '\0';
+
+	return retval;
+}
@@ -42,19 +42,49 @@ struct SpectreRenderContext {
 	int                text_alpha_bits;
 	int                graphic_alpha_bits;
 	int                use_platform_fonts;
+	size_t             memory_limit;	/* in bytes, 0 for none */
 };
 
+typedef struct {
+	unsigned char *data;
+	size_t         length;
+	size_t         size;
+} SpectreBuffer;
+
 struct SpectreExporter {
 	struct document *doc;
 
+	/* Output of exports that don't write to a file */
+	SpectreWriteFunc write_func;
+	void            *closure;
+	SpectreBuffer    buffer;	/* of exports to memory */
+	unsigned char  **data;
+	size_t          *length;
+
 	/* PDF specific */
 	SpectreGS       *gs;
+	unsigned int     n_workers;
+	int              page_labels;
+	int              parallel;
+	char            *filename;	/* of a parallel export to a file */
+	unsigned int    *pages;		/* exported in parallel, in order */
+	unsigned int     n_exported;
+	unsigned int     max_exported;
 
 	/* PS specific */
 	FILE            *from;
+	FileData         reader;	/* reads from, kept for the whole export */
 	FILE            *to;
 	int              n_pages;
 
+	/* Raster specific, also uses to and n_pages */
+	SpectreExporterFormat format;
+	SpectreRenderContext *rc;
+	int              compress;
+	off_t            offset;	/* written to the output so far */
+	unsigned char   *ifd;		/* TIFF directory of the last page */
+	size_t           ifd_length;
+
 	
 	SpectreStatus (* begin)   (SpectreExporter *exporter,
 				   const char      *filename);
@@ -63,11 +93,29 @@ struct SpectreExporter {
 	SpectreStatus (* end)     (SpectreExporter *exporter);
 };
 
-SpectrePage     *_spectre_page_new         (unsigned int     page_index,
-					    struct document *doc);
-struct document *_spectre_document_get_doc (SpectreDocument *document);
-SpectreExporter *_spectre_exporter_ps_new  (struct document *doc);
-SpectreExporter *_spectre_exporter_pdf_new (struct document *doc);
+SpectrePage     *_spectre_page_new              (unsigned int         page_index,
+						struct document     *doc);
+struct document *_spectre_document_get_doc      (SpectreDocument     *document);
+int              _spectre_document_open_file    (struct document     *doc,
+						FILE               **from);
+SpectreExporter *_spectre_exporter_ps_new       (struct document     *doc);
+SpectreExporter *_spectre_exporter_pdf_new      (struct document     *doc);
+SpectreExporter *_spectre_exporter_raster_new   (struct document     *doc,
+						SpectreExporterFormat format);
+FILE            *_spectre_exporter_open_output  (SpectreExporter     *exporter,
+						const char          *filename);
+int              _spectre_exporter_close_output (SpectreExporter     *exporter);
+FILE            *_spectre_stream_open           (SpectreWriteFunc     write_func,
+						void                *closure);
+int              _spectre_stream_close          (FILE                *stream,
+						SpectreWriteFunc     write_func,
+						void                *closure);
+SpectreStatus    _spectre_buffer_write          (void                *closure,
+						const unsigned char *data,
+						size_t               length);
+
+SpectreOrientation _spectre_page_orientation (struct document *doc,
+					      unsigned int     page_index);
 
 /*! Loads the given open file into the document. This function can fail
     @param document the document where the file will be loaded
@@ -44,6 +44,7 @@ spectre_render_context_new (void)
 	rc->text_alpha_bits = 4;
 	rc->graphic_alpha_bits = 2;
 	rc->use_platform_fonts = TRUE;
+	rc->memory_limit = 0;
 	
 	return rc;
 }
@@ -207,3 +208,20 @@ spectre_render_context_get_antialias_bits (SpectreRenderContext *rc,
 	if (text_bits)
 		*text_bits = rc->text_alpha_bits;
 }
+
+void
+spectre_render_context_set_memory_limit (SpectreRenderContext *rc,
+					 size_t                limit)
+{
+	_spectre_return_if_fail (rc != NULL);
+
+	rc->memory_limit = limit;
+}
+
+size_t
+spectre_render_context_get_memory_limit (SpectreRenderContext *rc)
+{
+	_spectre_return_val_if_fail (rc != NULL, 0);
+
+	return rc->memory_limit;
+}
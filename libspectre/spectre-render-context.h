@@ -21,6 +21,8 @@
 #ifndef SPECTRE_RENDER_CONTEXT_H
 #define SPECTRE_RENDER_CONTEXT_H
 
+#include <stddef.h>
+
 #include <libspectre/spectre-macros.h>
 
 SPECTRE_BEGIN_DECLS
@@ -152,6 +154,24 @@ void                  spectre_render_context_get_antialias_bits     (SpectreRend
 								     int                  *graphics_bits,
 								     int                  *text_bits);
 
+/*! Sets the most memory a render may use, in bytes. The default is 0,
+    no limit. Renders that need more fail with SPECTRE_STATUS_MEMORY_LIMIT,
+    without rendering when the frame buffers alone are over the limit.
+    The limit covers the frame buffers of the library, the rotation buffer
+    and the allocations of the Ghostscript instance
+    @param rc The rendering context to modify
+    @param limit the memory limit, in bytes, or 0 for no limit
+*/
+SPECTRE_PUBLIC
+void                  spectre_render_context_set_memory_limit       (SpectreRenderContext *rc,
+								     size_t                limit);
+
+/*! Gets the memory limit of renders, 0 if there's no limit
+    @param rc The rendering context to query
+*/
+SPECTRE_PUBLIC
+size_t                spectre_render_context_get_memory_limit       (SpectreRenderContext *rc);
+
 SPECTRE_END_DECLS
 
 #endif /* SPECTRE_PAGE_H */
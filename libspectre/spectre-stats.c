@@ -0,0 +1,82 @@
+/* This file is part of Libspectre.
+ * 
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "spectre-stats.h"
+#include "spectre-utils.h"
+
+#ifdef SPECTRE_ENABLE_STATS
+#include <time.h>
+
+SpectreStats _spectre_stats;
+
+unsigned long long
+_spectre_stats_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif /* SPECTRE_ENABLE_STATS */
+
+void
+spectre_stats_get (SpectreStats *stats)
+{
+	_spectre_return_if_fail (stats != NULL);
+
+#ifdef SPECTRE_ENABLE_STATS
+	stats->gs_instances = _spectre_atomic_get (&_spectre_stats.gs_instances);
+	stats->gs_bytes = _spectre_atomic_get (&_spectre_stats.gs_bytes);
+	stats->gs_process_calls = _spectre_atomic_get (&_spectre_stats.gs_process_calls);
+	stats->file_opens = _spectre_atomic_get (&_spectre_stats.file_opens);
+	stats->scan_lines = _spectre_atomic_get (&_spectre_stats.scan_lines);
+	stats->scan_bytes = _spectre_atomic_get (&_spectre_stats.scan_bytes);
+	stats->allocations = _spectre_atomic_get (&_spectre_stats.allocations);
+	stats->allocated_bytes = _spectre_atomic_get (&_spectre_stats.allocated_bytes);
+	stats->frames_copied = _spectre_atomic_get (&_spectre_stats.frames_copied);
+	stats->rotation_time = _spectre_atomic_get (&_spectre_stats.rotation_time);
+	stats->renders = _spectre_atomic_get (&_spectre_stats.renders);
+	stats->render_time = _spectre_atomic_get (&_spectre_stats.render_time);
+#else
+	memset (stats, 0, sizeof (SpectreStats));
+#endif
+}
+
+void
+spectre_stats_reset (void)
+{
+#ifdef SPECTRE_ENABLE_STATS
+	_spectre_atomic_set (&_spectre_stats.gs_instances, 0);
+	_spectre_atomic_set (&_spectre_stats.gs_bytes, 0);
+	_spectre_atomic_set (&_spectre_stats.gs_process_calls, 0);
+	_spectre_atomic_set (&_spectre_stats.file_opens, 0);
+	_spectre_atomic_set (&_spectre_stats.scan_lines, 0);
+	_spectre_atomic_set (&_spectre_stats.scan_bytes, 0);
+	_spectre_atomic_set (&_spectre_stats.allocations, 0);
+	_spectre_atomic_set (&_spectre_stats.allocated_bytes, 0);
+	_spectre_atomic_set (&_spectre_stats.frames_copied, 0);
+	_spectre_atomic_set (&_spectre_stats.rotation_time, 0);
+	_spectre_atomic_set (&_spectre_stats.renders, 0);
+	_spectre_atomic_set (&_spectre_stats.render_time, 0);
+#endif
+}
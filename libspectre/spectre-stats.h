@@ -0,0 +1,59 @@
+/* This file is part of Libspectre.
+ * 
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SPECTRE_STATS_H
+#define SPECTRE_STATS_H
+
+#include <libspectre/spectre-macros.h>
+
+SPECTRE_BEGIN_DECLS
+
+/*! Counters of what the library has done since it was loaded or since
+    the last call to spectre_stats_reset(), for all the documents and
+    threads of the process. They are only kept when the library was built
+    with --enable-stats, otherwise they are always 0 and cost nothing. */
+typedef struct {
+	unsigned long long gs_instances;	/*! Ghostscript instances created */
+	unsigned long long gs_bytes;		/*! Bytes fed through gsapi_run_string_continue() */
+	unsigned long long gs_process_calls;	/*! Document sections sent to Ghostscript */
+	unsigned long long file_opens;		/*! Times a document file was opened */
+	unsigned long long scan_lines;		/*! Lines read while scanning documents */
+	unsigned long long scan_bytes;		/*! Bytes of those lines and of the sections they skipped */
+	unsigned long long allocations;		/*! Allocations of the scanner, frame buffers and rotations */
+	unsigned long long allocated_bytes;	/*! Bytes requested by those allocations */
+	unsigned long long frames_copied;	/*! Pages copied from the display device */
+	unsigned long long rotation_time;	/*! Nanoseconds spent rotating rendered pages */
+	unsigned long long renders;		/*! Pages and slices rendered */
+	unsigned long long render_time;		/*! Nanoseconds spent rendering them */
+} SpectreStats;
+
+/*! Gets the current values of the counters
+    @param stats where the counters are returned
+*/
+SPECTRE_PUBLIC
+void spectre_stats_get   (SpectreStats *stats);
+
+/*! Sets all the counters to 0 */
+SPECTRE_PUBLIC
+void spectre_stats_reset (void);
+
+SPECTRE_END_DECLS
+
+#endif /* SPECTRE_STATS_H */
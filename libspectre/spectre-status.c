@@ -40,6 +40,8 @@ spectre_status_to_string (SpectreStatus status)
 		return "exporter error";
 	case SPECTRE_STATUS_SAVE_ERROR:
 		return "save error";
+	case SPECTRE_STATUS_MEMORY_LIMIT:
+		return "memory limit exceeded";
 	}
 
 	return "unknown error status";
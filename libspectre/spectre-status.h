@@ -45,7 +45,10 @@ typedef enum _SpectreStatus {
 	SPECTRE_STATUS_EXPORTER_ERROR        /*! There has been a problem
 					         exporting the document */,
 	SPECTRE_STATUS_SAVE_ERROR            /*! There has been a problem
-					         saving the document */
+					         saving the document */,
+	SPECTRE_STATUS_MEMORY_LIMIT          /*! Rendering the page needs
+					         more memory than the limit
+					         of the rendering context */
 } SpectreStatus;
 
 /*! Gets a textual description of the given status
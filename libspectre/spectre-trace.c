@@ -0,0 +1,242 @@
+/* This file is part of Libspectre.
+ * 
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spectre-trace.h"
+#include "spectre-utils.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define TRACE_MAX_ARGS 4
+
+SpectreTraceBeginFunc _spectre_trace_begin_func = NULL;
+static SpectreTraceEndFunc trace_end_func = NULL;
+static void *trace_user_data = NULL;
+
+/* The Chrome trace event writer */
+static FILE *trace_file = NULL;
+static double trace_start;
+static unsigned long trace_pid;
+static int trace_n_events;
+static int trace_failed;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void
+_spectre_trace_begin (const char *name,
+		      ...)
+{
+	SpectreTraceBeginFunc begin = _spectre_trace_begin_func;
+	const char *args[TRACE_MAX_ARGS * 2 + 1];
+	const char *arg;
+	unsigned int n_args = 0;
+	va_list va;
+
+	if (!begin)
+		return;
+
+	va_start (va, name);
+	while ((arg = va_arg (va, const char *)) && n_args < TRACE_MAX_ARGS * 2) {
+		args[n_args++] = arg;
+		args[n_args++] = va_arg (va, const char *);
+	}
+	va_end (va);
+	args[n_args] = NULL;
+
+	begin (name, args, trace_user_data);
+}
+
+void
+_spectre_trace_end (const char *name)
+{
+	SpectreTraceEndFunc end = trace_end_func;
+
+	if (end && _spectre_trace_begin_func)
+		end (name, trace_user_data);
+}
+
+void
+spectre_trace_set_hooks (SpectreTraceBeginFunc begin,
+			 SpectreTraceEndFunc   end,
+			 void                 *user_data)
+{
+	trace_end_func = end;
+	trace_user_data = user_data;
+	_spectre_trace_begin_func = begin;
+}
+
+static double
+trace_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static unsigned long
+trace_thread_id (void)
+{
+#ifdef HAVE_PTHREAD
+	return (unsigned long) pthread_self ();
+#else
+	return 0;
+#endif
+}
+
+static void
+trace_write_string (const char *str)
+{
+	const unsigned char *p;
+
+	if (!str) {
+		fputs ("null", trace_file);
+		return;
+	}
+
+	putc ('"', trace_file);
+	for (p = (const unsigned char *) str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			fprintf (trace_file, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf (trace_file, "\\u%04x", *p);
+		else
+			putc (*p, trace_file);
+	}
+	putc ('"', trace_file);
+}
+
+static void
+trace_write_event (const char         *name,
+		   char                phase,
+		   const char * const *args)
+{
+	double ts = trace_now () - trace_start;
+	unsigned int i;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock (&trace_mutex);
+#endif
+	if (!trace_file) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock (&trace_mutex);
+#endif
+		return;
+	}
+
+	fputs (trace_n_events++ > 0 ? ",\n{\"name\":" : "{\"name\":", trace_file);
+	trace_write_string (name);
+	fprintf (trace_file, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu",
+		 phase, ts, trace_pid, trace_thread_id ());
+	if (args && args[0]) {
+		fputs (",\"args\":{", trace_file);
+		for (i = 0; args[i]; i += 2) {
+			if (i > 0)
+				putc (',', trace_file);
+			trace_write_string (args[i]);
+			putc (':', trace_file);
+			trace_write_string (args[i + 1]);
+		}
+		putc ('}', trace_file);
+	}
+	putc ('}', trace_file);
+	if (ferror (trace_file))
+		trace_failed = TRUE;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock (&trace_mutex);
+#endif
+}
+
+static void
+trace_writer_begin (const char         *name,
+		    const char * const *args,
+		    void               *user_data)
+{
+	trace_write_event (name, 'B', args);
+}
+
+static void
+trace_writer_end (const char *name,
+		  void       *user_data)
+{
+	trace_write_event (name, 'E', NULL);
+}
+
+SpectreStatus
+spectre_trace_start (const char *filename)
+{
+	FILE *file;
+
+	_spectre_return_val_if_fail (filename != NULL, SPECTRE_STATUS_SAVE_ERROR);
+
+	spectre_trace_stop ();
+
+	file = fopen (filename, "w");
+	if (!file)
+		return SPECTRE_STATUS_SAVE_ERROR;
+	fputs ("{\"traceEvents\":[\n", file);
+
+	trace_file = file;
+	trace_start = trace_now ();
+	trace_pid = getpid ();
+	trace_n_events = 0;
+	trace_failed = FALSE;
+
+	spectre_trace_set_hooks (trace_writer_begin, trace_writer_end, NULL);
+
+	return SPECTRE_STATUS_SUCCESS;
+}
+
+SpectreStatus
+spectre_trace_stop (void)
+{
+	FILE *file;
+	int   failed;
+
+	if (_spectre_trace_begin_func == trace_writer_begin)
+		spectre_trace_set_hooks (NULL, NULL, NULL);
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock (&trace_mutex);
+#endif
+	file = trace_file;
+	failed = trace_failed;
+	trace_file = NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock (&trace_mutex);
+#endif
+
+	if (!file)
+		return SPECTRE_STATUS_SUCCESS;
+
+	fputs ("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+	if (fclose (file) != 0 || failed)
+		return SPECTRE_STATUS_SAVE_ERROR;
+
+	return SPECTRE_STATUS_SUCCESS;
+}
@@ -0,0 +1,77 @@
+/* This file is part of Libspectre.
+ * 
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SPECTRE_TRACE_H
+#define SPECTRE_TRACE_H
+
+#include <libspectre/spectre-macros.h>
+#include <libspectre/spectre-status.h>
+
+SPECTRE_BEGIN_DECLS
+
+/*! Called when the library begins a span of work: scanning a document,
+    running Ghostscript, sending it a section of a document, a display
+    device callback or an exporter call. The spans of a thread are nested
+    and each one is ended with a call to the end hook with the same name
+    @param name the name of the span
+    @param args NULL terminated array of name, value pairs describing the span
+    @param user_data the data given to spectre_trace_set_hooks
+*/
+typedef void (* SpectreTraceBeginFunc) (const char         *name,
+					const char * const *args,
+					void               *user_data);
+
+/*! Called when a span of work ends
+    @param name the name of the span
+    @param user_data the data given to spectre_trace_set_hooks
+*/
+typedef void (* SpectreTraceEndFunc)   (const char         *name,
+					void               *user_data);
+
+/*! Sets the functions called at the beginning and at the end of every
+    span, they are called from any thread that uses the library. The hooks
+    must not be changed while other threads are using the library
+    @param begin the function called when a span begins, NULL to stop tracing
+    @param end the function called when a span ends
+    @param user_data data passed to begin and end
+*/
+SPECTRE_PUBLIC
+void          spectre_trace_set_hooks (SpectreTraceBeginFunc begin,
+				       SpectreTraceEndFunc   end,
+				       void                 *user_data);
+
+/*! Starts writing every span to filename in the Chrome trace event
+    format, that can be loaded in chrome://tracing or Perfetto. It
+    replaces the hooks set with spectre_trace_set_hooks
+    @param filename the file to write the trace to
+    @return SPECTRE_STATUS_SAVE_ERROR if the file can't be created
+*/
+SPECTRE_PUBLIC
+SpectreStatus spectre_trace_start     (const char           *filename);
+
+/*! Stops tracing and completes the file written since spectre_trace_start
+    @return SPECTRE_STATUS_SAVE_ERROR if the file couldn't be written
+*/
+SPECTRE_PUBLIC
+SpectreStatus spectre_trace_stop      (void);
+
+SPECTRE_END_DECLS
+
+#endif /* SPECTRE_TRACE_H */
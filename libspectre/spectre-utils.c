@@ -38,6 +38,14 @@
 #include <windows.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef SPECTRE_PHASE_TIMINGS
+#include <time.h>
+#endif
+
 static unsigned long
 _spectre_get_pid (void)
 {
@@ -48,20 +56,14 @@ _spectre_get_pid (void)
 #endif
 }
 
-static int warn_initted = FALSE;
 static int fatal_warnings = FALSE;
 static int fatal_warnings_on_check_failed = FALSE;
 
 static void
-init_warnings (void)
+read_warnings_env (void)
 {
 	const char *s;
 	
-	if (warn_initted)
-		return;
-
-	warn_initted = TRUE;
-	
 	s = getenv ("SPECTRE_FATAL_WARNINGS");
 	if (!s || !(*s))
 		return;
@@ -79,6 +81,26 @@ init_warnings (void)
 	}
 }
 
+#ifdef HAVE_PTHREAD
+static pthread_once_t warn_once = PTHREAD_ONCE_INIT;
+#else
+static int warn_initted = FALSE;
+#endif
+
+static void
+init_warnings (void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_once (&warn_once, read_warnings_env);
+#else
+	if (warn_initted)
+		return;
+
+	warn_initted = TRUE;
+	read_warnings_env ();
+#endif
+}
+
 /**
  * Prints a warning message to stderr. Can optionally be made to exit
  * fatally by setting SPECTRE_FATAL_WARNINGS, but this is rarely
@@ -92,8 +114,7 @@ _spectre_warn (const char *format,
 {
 	va_list args;
 
-	if (!warn_initted)
-		init_warnings ();
+	init_warnings ();
   
 	va_start (args, format);
 	vfprintf (stderr, format, args);
@@ -118,8 +139,7 @@ _spectre_warn_check_failed (const char *format,
 {
 	va_list args;
 
-	if (!warn_initted)
-		init_warnings ();
+	init_warnings ();
 
 	fprintf (stderr, "process %lu: ", _spectre_get_pid ());
 
@@ -380,3 +400,43 @@ _spectre_strtod (const char *nptr,
 
 	return val;
 }
+
+#ifdef SPECTRE_PHASE_TIMINGS
+static double phase_begin[SPECTRE_N_PHASES];
+static double phase_time[SPECTRE_N_PHASES];
+
+static double
+phase_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+_spectre_phase_begin (SpectrePhase phase)
+{
+	phase_begin[phase] = phase_now ();
+}
+
+/* Phases can happen several times in a render, their times add up */
+void
+_spectre_phase_end (SpectrePhase phase)
+{
+	phase_time[phase] += phase_now () - phase_begin[phase];
+}
+
+void
+_spectre_phase_reset (void)
+{
+	memset (phase_time, 0, sizeof (phase_time));
+}
+
+double
+_spectre_phase_get (SpectrePhase phase)
+{
+	return phase_time[phase];
+}
+#endif /* SPECTRE_PHASE_TIMINGS */
@@ -28,6 +28,8 @@
 #include <stdarg.h>
 
 #include <libspectre/spectre-macros.h>
+#include <libspectre/spectre-stats.h>
+#include <libspectre/spectre-trace.h>
 
 SPECTRE_BEGIN_DECLS
 
@@ -120,6 +122,75 @@ void _spectre_real_assert (int          condition,
 	} } while (0)
 #endif /* SPECTRE_DISABLE_CHECKS */
 
+/* Atomic operations, used for reference counts that are shared between threads */
+#if defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define _spectre_atomic_get(ptr)          (__atomic_load_n ((ptr), __ATOMIC_ACQUIRE))
+#define _spectre_atomic_set(ptr, val)     (__atomic_store_n ((ptr), (val), __ATOMIC_RELEASE))
+#define _spectre_atomic_inc(ptr)          ((void) __atomic_add_fetch ((ptr), 1, __ATOMIC_RELAXED))
+#define _spectre_atomic_add(ptr, val)     ((void) __atomic_add_fetch ((ptr), (val), __ATOMIC_RELAXED))
+#define _spectre_atomic_dec_and_test(ptr) (__atomic_sub_fetch ((ptr), 1, __ATOMIC_ACQ_REL) == 0)
+#else
+#define _spectre_atomic_get(ptr)          (*(ptr))
+#define _spectre_atomic_set(ptr, val)     ((void) (*(ptr) = (val)))
+#define _spectre_atomic_inc(ptr)          ((void) ++(*(ptr)))
+#define _spectre_atomic_add(ptr, val)     ((void) (*(ptr) += (val)))
+#define _spectre_atomic_dec_and_test(ptr) (--(*(ptr)) == 0)
+#endif
+
+/* Library statistics, kept when configured with --enable-stats */
+#ifdef SPECTRE_ENABLE_STATS
+extern SpectreStats _spectre_stats;
+unsigned long long _spectre_stats_now (void);
+#define _spectre_stats_add(counter, val)  _spectre_atomic_add (&_spectre_stats.counter, (val))
+#define _spectre_stats_time_begin()       _spectre_stats_now ()
+#define _spectre_stats_time_end(counter, start) \
+	_spectre_stats_add (counter, _spectre_stats_now () - (start))
+#else
+#define _spectre_stats_add(counter, val)  ((void) 0)
+#define _spectre_stats_time_begin()       0ULL
+#define _spectre_stats_time_end(counter, start) ((void) (start))
+#endif
+
+/* Tracing spans, reported to the hooks set with spectre_trace_set_hooks().
+ * The name, value pairs describing a span are terminated by
+ * (const char *) NULL, values that have to be formatted should only
+ * be when tracing is enabled */
+extern SpectreTraceBeginFunc _spectre_trace_begin_func;
+#define _spectre_trace_enabled() (_spectre_trace_begin_func != NULL)
+#if defined(__GNUC__) && (__GNUC__ >= 4)
+#define _SPECTRE_SENTINEL __attribute__((__sentinel__))
+#else
+#define _SPECTRE_SENTINEL
+#endif
+void _spectre_trace_begin (const char *name,
+			   ...) _SPECTRE_SENTINEL;
+void _spectre_trace_end   (const char *name);
+
+/* Time spent in each phase of a render. Only measured when built with
+ * SPECTRE_PHASE_TIMINGS, like bench/render-bench does, and only for
+ * renders from a single thread */
+typedef enum {
+	SPECTRE_PHASE_CREATE_INSTANCE,
+	SPECTRE_PHASE_INIT,
+	SPECTRE_PHASE_PROLOG,
+	SPECTRE_PHASE_SETUP,
+	SPECTRE_PHASE_PAGE,
+	SPECTRE_PHASE_TRAILER,
+	SPECTRE_PHASE_DISPLAY_COPY,
+	SPECTRE_PHASE_ROTATION,
+	SPECTRE_N_PHASES
+} SpectrePhase;
+
+#ifdef SPECTRE_PHASE_TIMINGS
+void   _spectre_phase_begin (SpectrePhase phase);
+void   _spectre_phase_end   (SpectrePhase phase);
+void   _spectre_phase_reset (void);
+double _spectre_phase_get   (SpectrePhase phase);
+#else
+#define _spectre_phase_begin(phase)
+#define _spectre_phase_end(phase)
+#endif
+
 /* String handling helpers */
 char  *_spectre_strdup_printf (const char *format,
 			       ...);
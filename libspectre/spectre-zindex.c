@@ -0,0 +1,577 @@
+/* This file is part of Libspectre.
+ *
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "spectre-zindex.h"
+#include "spectre-utils.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZLIB
+#include <bzlib.h>
+#endif
+
+/* Compressed documents can't be read from an arbitrary offset, so while
+ * they are scanned the state of the decompressor is saved every now and
+ * then. Reading a section later only decompresses from the closest
+ * restart point before it, instead of from the beginning of the file.
+ *
+ * A gzip restart point is a deflate block boundary. The decompressor is
+ * restored from the bits of the boundary byte and the last 32K of output,
+ * like zlib's examples/zran.c does. libbz2 can't restart in the middle of
+ * a stream, so bzip2 restart points are only the beginnings of concatenated
+ * streams, as written by parallel compressors. Every gzip member and bzip2
+ * stream start is also a restart point that needs no saved output.
+ */
+
+#define ZINDEX_WINDOW_SIZE 32768	/* deflate history */
+#define ZINDEX_SPAN        1048576	/* output between gzip restart points */
+#define ZINDEX_CHUNK_SIZE  16384	/* compressed input read at once */
+
+typedef enum {
+	ZINDEX_GZIP,
+	ZINDEX_BZIP2
+} ZIndexFormat;
+
+typedef struct {
+	off_t          out;	/* uncompressed offset */
+	off_t          in;	/* compressed offset of the next byte to read */
+	int            bits;	/* unused bits of the byte before in */
+	unsigned char *window;	/* last output before out, NULL at stream starts */
+} ZIndexPoint;
+
+struct SpectreZIndex {
+	int           fd;
+	ZIndexFormat  format;
+	ZIndexPoint  *points;
+	unsigned int  n_points;
+	unsigned int  max_points;
+	off_t         length;	/* uncompressed length, -1 until known */
+};
+
+struct SpectreZReader {
+	SpectreZIndex *index;
+	int            build;	/* add restart points while reading */
+
+	int            active;	/* decompressor initialized */
+	int            raw;	/* gzip restored from a point, without header */
+	int            eof;
+#ifdef HAVE_ZLIB
+	z_stream       zs;
+#endif
+#ifdef HAVE_BZLIB
+	bz_stream      bs;
+#endif
+
+	off_t          in;	/* compressed offset of the next read */
+	int            input_eof;
+	unsigned char *next_in;
+	unsigned int   avail_in;
+	unsigned int   skip;	/* input bytes to skip, gzip trailer */
+	unsigned char  input[ZINDEX_CHUNK_SIZE];
+
+	/* Output goes round the window, which always holds the
+	 * last output for the restart points and short seeks back */
+	unsigned char  window[ZINDEX_WINDOW_SIZE];
+	unsigned int   wpos;	/* where the next output is written */
+	off_t          out;	/* uncompressed bytes produced */
+	off_t          pos;	/* read position, never after out */
+	off_t          window_start; /* first offset held by the window */
+};
+
+static int
+zindex_add_point (SpectreZIndex       *index,
+		  off_t                out,
+		  off_t                in,
+		  int                  bits,
+		  const unsigned char *window,
+		  unsigned int         wpos)
+{
+	ZIndexPoint *point;
+
+	if (index->n_points > 0 && index->points[index->n_points - 1].out >= out)
+		return TRUE;
+
+	if (index->n_points == index->max_points) {
+		ZIndexPoint *points;
+		unsigned int max_points;
+
+		max_points = index->max_points ? index->max_points * 2 : 16;
+		points = realloc (index->points, max_points * sizeof (ZIndexPoint));
+		if (!points)
+			return FALSE;
+		index->points = points;
+		index->max_points = max_points;
+	}
+
+	point = &index->points[index->n_points];
+	point->out = out;
+	point->in = in;
+	point->bits = bits;
+	point->window = NULL;
+	if (window) {
+		/* Unroll the window so that the oldest byte comes first */
+		point->window = malloc (ZINDEX_WINDOW_SIZE);
+		if (!point->window)
+			return FALSE;
+		wpos %= ZINDEX_WINDOW_SIZE;
+		memcpy (point->window, window + wpos, ZINDEX_WINDOW_SIZE - wpos);
+		memcpy (point->window + ZINDEX_WINDOW_SIZE - wpos, window, wpos);
+	}
+	index->n_points++;
+
+	return TRUE;
+}
+
+static const ZIndexPoint *
+zindex_find_point (SpectreZIndex *index,
+		   off_t          offset)
+{
+	unsigned int low = 0;
+	unsigned int high = index->n_points;
+
+	/* Last point at or before offset, the first one is at 0 */
+	while (high - low > 1) {
+		unsigned int mid = (low + high) / 2;
+
+		if (index->points[mid].out <= offset)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return &index->points[low];
+}
+
+SpectreZIndex *
+spectre_zindex_new (int fd)
+{
+	SpectreZIndex *index;
+	unsigned char  magic[3];
+	ZIndexFormat   format;
+
+	if (pread (fd, magic, sizeof (magic), 0) != sizeof (magic))
+		return NULL;
+
+	if (magic[0] == 0x1f && magic[1] == 0x8b) {
+#ifdef HAVE_ZLIB
+		format = ZINDEX_GZIP;
+#else
+		return NULL;
+#endif
+	} else if (magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h') {
+#ifdef HAVE_BZLIB
+		format = ZINDEX_BZIP2;
+#else
+		return NULL;
+#endif
+	} else {
+		return NULL;
+	}
+
+	index = calloc (1, sizeof (SpectreZIndex));
+	if (!index)
+		return NULL;
+
+	index->format = format;
+	index->length = -1;
+	index->fd = dup (fd);
+	if (index->fd < 0 || !zindex_add_point (index, 0, 0, 0, NULL, 0)) {
+		spectre_zindex_free (index);
+		return NULL;
+	}
+
+	return index;
+}
+
+void
+spectre_zindex_free (SpectreZIndex *index)
+{
+	unsigned int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < index->n_points; i++)
+		free (index->points[i].window);
+	free (index->points);
+	if (index->fd >= 0)
+		close (index->fd);
+	free (index);
+}
+
+off_t
+spectre_zindex_get_length (SpectreZIndex *index)
+{
+	return index->length;
+}
+
+static void
+zreader_end (SpectreZReader *reader)
+{
+	if (!reader->active)
+		return;
+
+#ifdef HAVE_ZLIB
+	if (reader->index->format == ZINDEX_GZIP)
+		inflateEnd (&reader->zs);
+#endif
+#ifdef HAVE_BZLIB
+	if (reader->index->format == ZINDEX_BZIP2)
+		BZ2_bzDecompressEnd (&reader->bs);
+#endif
+	reader->active = FALSE;
+}
+
+/* Starts a new gzip member or bzip2 stream at the current input */
+static void
+zreader_begin_stream (SpectreZReader *reader)
+{
+	zreader_end (reader);
+
+#ifdef HAVE_ZLIB
+	if (reader->index->format == ZINDEX_GZIP) {
+		memset (&reader->zs, 0, sizeof (z_stream));
+		/* 15 + 32: largest window, gzip or zlib header */
+		reader->active = inflateInit2 (&reader->zs, 15 + 32) == Z_OK;
+		reader->raw = FALSE;
+	}
+#endif
+#ifdef HAVE_BZLIB
+	if (reader->index->format == ZINDEX_BZIP2) {
+		memset (&reader->bs, 0, sizeof (bz_stream));
+		reader->active = BZ2_bzDecompressInit (&reader->bs, 0, 0) == BZ_OK;
+	}
+#endif
+	if (!reader->active)
+		reader->eof = TRUE;
+}
+
+static void
+zreader_restore (SpectreZReader    *reader,
+		 const ZIndexPoint *point)
+{
+	zreader_end (reader);
+
+	reader->eof = FALSE;
+	reader->in = point->in;
+	reader->input_eof = FALSE;
+	reader->avail_in = 0;
+	reader->skip = 0;
+	reader->wpos = 0;
+	reader->out = reader->pos = reader->window_start = point->out;
+
+	if (!point->window) {
+		zreader_begin_stream (reader);
+		return;
+	}
+
+#ifdef HAVE_ZLIB
+	memset (&reader->zs, 0, sizeof (z_stream));
+	if (inflateInit2 (&reader->zs, -15) != Z_OK) {
+		reader->eof = TRUE;
+		return;
+	}
+	reader->active = TRUE;
+	reader->raw = TRUE;
+
+	if (point->bits) {
+		unsigned char byte;
+
+		if (pread (reader->index->fd, &byte, 1, point->in - 1) != 1) {
+			reader->eof = TRUE;
+			return;
+		}
+		inflatePrime (&reader->zs, point->bits, byte >> (8 - point->bits));
+	}
+	inflateSetDictionary (&reader->zs, point->window, ZINDEX_WINDOW_SIZE);
+	memcpy (reader->window, point->window, ZINDEX_WINDOW_SIZE);
+#endif
+}
+
+static void
+zreader_fill (SpectreZReader *reader)
+{
+	ssize_t n;
+
+	if (reader->avail_in > 0 || reader->input_eof)
+		return;
+
+	do {
+		n = pread (reader->index->fd, reader->input, ZINDEX_CHUNK_SIZE, reader->in);
+	} while (n < 0 && errno == EINTR);
+
+	if (n <= 0) {
+		reader->input_eof = TRUE;
+		return;
+	}
+
+	reader->next_in = reader->input;
+	reader->avail_in = n;
+	reader->in += n;
+}
+
+/* Called when a stream has ended, looks for another one after it */
+static void
+zreader_next_stream (SpectreZReader *reader)
+{
+	zreader_end (reader);
+
+	while (reader->skip > 0) {
+		unsigned int n;
+
+		zreader_fill (reader);
+		if (reader->avail_in == 0) {
+			reader->eof = TRUE;
+			return;
+		}
+		n = reader->skip < reader->avail_in ? reader->skip : reader->avail_in;
+		reader->next_in += n;
+		reader->avail_in -= n;
+		reader->skip -= n;
+	}
+
+	zreader_fill (reader);
+	if (reader->avail_in == 0) {
+		reader->eof = TRUE;
+		return;
+	}
+
+	if (reader->build)
+		zindex_add_point (reader->index, reader->out,
+				  reader->in - reader->avail_in, 0, NULL, 0);
+	zreader_begin_stream (reader);
+}
+
+#ifdef HAVE_ZLIB
+static void
+zreader_inflate (SpectreZReader *reader,
+		 unsigned int    avail_out)
+{
+	z_stream    *zs = &reader->zs;
+	unsigned int produced;
+	unsigned int consumed;
+	int          ret;
+
+	zs->next_in = reader->next_in;
+	zs->avail_in = reader->avail_in;
+	zs->next_out = reader->window + reader->wpos;
+	zs->avail_out = avail_out;
+
+	/* Stop at block boundaries, they are the only restart points */
+	ret = inflate (zs, Z_BLOCK);
+
+	consumed = reader->avail_in - zs->avail_in;
+	produced = avail_out - zs->avail_out;
+	reader->next_in = zs->next_in;
+	reader->avail_in = zs->avail_in;
+	reader->wpos += produced;
+	reader->out += produced;
+
+	if (ret == Z_STREAM_END) {
+		/* A raw stream leaves the gzip trailer unread */
+		reader->skip = reader->raw ? 8 : 0;
+		zreader_next_stream (reader);
+	} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+		reader->eof = TRUE;
+	} else if (produced == 0 && consumed == 0) {
+		/* Truncated, there's no more input */
+		reader->eof = TRUE;
+	} else if (reader->build &&
+		   (zs->data_type & 128) && !(zs->data_type & 64) &&
+		   reader->out - reader->index->points[reader->index->n_points - 1].out >= ZINDEX_SPAN) {
+		zindex_add_point (reader->index, reader->out,
+				  reader->in - reader->avail_in,
+				  zs->data_type & 7,
+				  reader->window, reader->wpos);
+	}
+}
+#endif
+
+#ifdef HAVE_BZLIB
+static void
+zreader_bunzip (SpectreZReader *reader,
+		unsigned int    avail_out)
+{
+	bz_stream   *bs = &reader->bs;
+	unsigned int produced;
+	unsigned int consumed;
+	int          ret;
+
+	bs->next_in = (char *) reader->next_in;
+	bs->avail_in = reader->avail_in;
+	bs->next_out = (char *) reader->window + reader->wpos;
+	bs->avail_out = avail_out;
+
+	ret = BZ2_bzDecompress (bs);
+
+	consumed = reader->avail_in - bs->avail_in;
+	produced = avail_out - bs->avail_out;
+	reader->next_in = (unsigned char *) bs->next_in;
+	reader->avail_in = bs->avail_in;
+	reader->wpos += produced;
+	reader->out += produced;
+
+	if (ret == BZ_STREAM_END) {
+		zreader_next_stream (reader);
+	} else if (ret != BZ_OK) {
+		reader->eof = TRUE;
+	} else if (produced == 0 && consumed == 0) {
+		/* Truncated, there's no more input */
+		reader->eof = TRUE;
+	}
+}
+#endif
+
+/* Decompresses more output into the window, only when everything
+ * before has been read */
+static void
+zreader_decompress (SpectreZReader *reader)
+{
+	off_t out = reader->out;
+
+	if (reader->wpos == ZINDEX_WINDOW_SIZE)
+		reader->wpos = 0;
+
+	while (!reader->eof && reader->out == out) {
+		unsigned int avail_out = ZINDEX_WINDOW_SIZE - reader->wpos;
+
+		zreader_fill (reader);
+#ifdef HAVE_ZLIB
+		if (reader->index->format == ZINDEX_GZIP)
+			zreader_inflate (reader, avail_out);
+#endif
+#ifdef HAVE_BZLIB
+		if (reader->index->format == ZINDEX_BZIP2)
+			zreader_bunzip (reader, avail_out);
+#endif
+	}
+
+	if (reader->eof && reader->build)
+		reader->index->length = reader->out;
+}
+
+SpectreZReader *
+spectre_zreader_new (SpectreZIndex *index,
+		     int            build)
+{
+	SpectreZReader *reader;
+
+	reader = calloc (1, sizeof (SpectreZReader));
+	if (!reader)
+		return NULL;
+
+	reader->index = index;
+	reader->build = build;
+	zreader_restore (reader, &index->points[0]);
+
+	return reader;
+}
+
+void
+spectre_zreader_free (SpectreZReader *reader)
+{
+	if (!reader)
+		return;
+
+	zreader_end (reader);
+	free (reader);
+}
+
+size_t
+spectre_zreader_read (SpectreZReader *reader,
+		      void           *buffer,
+		      size_t          length)
+{
+	unsigned char *dest = buffer;
+	size_t         done = 0;
+
+	while (done < length) {
+		unsigned int start;
+		size_t       n;
+
+		if (reader->pos == reader->out) {
+			if (reader->eof)
+				break;
+			zreader_decompress (reader);
+			continue;
+		}
+
+		start = (reader->wpos + ZINDEX_WINDOW_SIZE - (reader->out - reader->pos)) %
+			ZINDEX_WINDOW_SIZE;
+		n = reader->out - reader->pos;
+		if (n > ZINDEX_WINDOW_SIZE - start)
+			n = ZINDEX_WINDOW_SIZE - start;
+		if (n > length - done)
+			n = length - done;
+
+		memcpy (dest + done, reader->window + start, n);
+		reader->pos += n;
+		done += n;
+	}
+
+	return done;
+}
+
+int
+spectre_zreader_seek (SpectreZReader *reader,
+		      off_t           offset)
+{
+	const ZIndexPoint *point;
+	off_t              window_start;
+
+	if (offset < 0)
+		return -1;
+
+	/* Still in the window */
+	window_start = reader->out - ZINDEX_WINDOW_SIZE;
+	if (window_start < reader->window_start)
+		window_start = reader->window_start;
+	if (offset >= window_start && offset <= reader->out) {
+		reader->pos = offset;
+		return 0;
+	}
+
+	/* Restart from the closest point, unless it's behind us */
+	point = zindex_find_point (reader->index, offset);
+	if (offset < reader->out || point->out > reader->out)
+		zreader_restore (reader, point);
+
+	while (reader->out < offset && !reader->eof) {
+		reader->pos = reader->out;
+		zreader_decompress (reader);
+	}
+
+	if (reader->out < offset) {
+		reader->pos = reader->out;
+		return -1;
+	}
+
+	reader->pos = offset;
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/* This file is part of Libspectre.
+ *
+ * Copyright (C) 2007 Albert Astals Cid <aacid@kde.org>
+ * Copyright (C) 2007 Carlos Garcia Campos <carlosgc@gnome.org>
+ *
+ * Libspectre is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * Libspectre is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SPECTRE_ZINDEX_H
+#define SPECTRE_ZINDEX_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <libspectre/spectre-macros.h>
+
+SPECTRE_BEGIN_DECLS
+
+typedef struct SpectreZIndex  SpectreZIndex;
+typedef struct SpectreZReader SpectreZReader;
+
+SpectreZIndex  *spectre_zindex_new        (int             fd);
+void            spectre_zindex_free       (SpectreZIndex  *index);
+off_t           spectre_zindex_get_length (SpectreZIndex  *index);
+
+SpectreZReader *spectre_zreader_new       (SpectreZIndex  *index,
+					   int             build);
+size_t          spectre_zreader_read      (SpectreZReader *reader,
+					   void           *buffer,
+					   size_t          length);
+int             spectre_zreader_seek      (SpectreZReader *reader,
+					   off_t           offset);
+void            spectre_zreader_free      (SpectreZReader *reader);
+
+SPECTRE_END_DECLS
+
+#endif /* SPECTRE_ZINDEX_H */
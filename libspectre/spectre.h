@@ -26,6 +26,8 @@
 #include <libspectre/spectre-render-context.h>
 #include <libspectre/spectre-page.h>
 #include <libspectre/spectre-exporter.h>
+#include <libspectre/spectre-stats.h>
+#include <libspectre/spectre-trace.h>
 #include <libspectre/spectre-version.h>
 
 #endif /* SPECTRE_H */
@@ -0,0 +1,805 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <libspectre/spectre.h>
+
+#include "../libspectre/spectre-utils.h"
+
+/* Loads small documents written to a scratch directory, in the directory
+ * given as argument or the current one, and checks through the public API
+ * the index cache, loading again files that changed, saving pages and
+ * splitting documents. The cache entry is edited between loads so a load
+ * served from the cache can be told from a scan of the file.
+ */
+
+/* The cache file starts with an 8 bytes magic followed by the version */
+#define CACHE_VERSION_OFFSET 8
+
+static const char *document_contents =
+	"%!PS-Adobe-3.0\n"
+	"%%Pages: 3\n"
+	"%%EndComments\n"
+	"%%EndProlog\n"
+	"%%Page: A1 1\n"
+	"showpage\n"
+	"%%Page: A2 2\n"
+	"showpage\n"
+	"%%Page: A3 3\n"
+	"showpage\n"
+	"%%Trailer\n"
+	"%%EOF\n";
+
+static int
+write_file (const char *filename,
+	    const char *contents,
+	    size_t      length)
+{
+	FILE *file;
+	int   ok;
+
+	file = fopen (filename, "wb");
+	if (!file)
+		return 0;
+
+	ok = fwrite (contents, 1, length, file) == length;
+	if (fclose (file) != 0)
+		ok = 0;
+
+	return ok;
+}
+
+static char *
+read_file (const char *filename,
+	   size_t     *length)
+{
+	FILE *file;
+	char *contents;
+	long  size;
+
+	file = fopen (filename, "rb");
+	if (!file)
+		return NULL;
+
+	fseek (file, 0, SEEK_END);
+	size = ftell (file);
+	rewind (file);
+
+	contents = malloc (size + 1);
+	if (fread (contents, 1, size, file) != (size_t) size) {
+		free (contents);
+		fclose (file);
+		return NULL;
+	}
+	contents[size] = '\0';
+	fclose (file);
+	*length = size;
+
+	return contents;
+}
+
+/* Returns the label of the first page of filename loaded with a new
+ * document, or NULL when it can't be loaded
+ */
+static char *
+load_first_label (const char *filename,
+		  const char *cache_dir)
+{
+	SpectreDocument *document;
+	SpectrePage     *page;
+	char            *label = NULL;
+
+	document = spectre_document_new ();
+	spectre_document_set_cache_dir (document, cache_dir);
+	spectre_document_load (document, filename);
+	if (spectre_document_status (document)) {
+		printf ("Error loading %s: %s\n", filename,
+			spectre_status_to_string (spectre_document_status (document)));
+		spectre_document_free (document);
+		return NULL;
+	}
+
+	page = spectre_document_get_page (document, 0);
+	if (page) {
+		if (spectre_page_get_label (page))
+			label = _spectre_strdup (spectre_page_get_label (page));
+		spectre_page_free (page);
+	}
+	spectre_document_free (document);
+
+	return label;
+}
+
+static int
+check_first_label (const char *filename,
+		   const char *cache_dir,
+		   const char *expected,
+		   const char *what)
+{
+	char *label;
+	int   ok;
+
+	label = load_first_label (filename, cache_dir);
+	ok = label && strcmp (label, expected) == 0;
+	if (!ok)
+		printf ("Error %s: first page labeled %s instead of %s\n",
+			what, label ? label : "(null)", expected);
+	free (label);
+
+	return ok;
+}
+
+/* Returns the path of the only cache file in cache_dir */
+static char *
+find_cache_file (const char *cache_dir)
+{
+	DIR           *dir;
+	struct dirent *entry;
+	char          *filename = NULL;
+
+	dir = opendir (cache_dir);
+	if (!dir)
+		return NULL;
+
+	while ((entry = readdir (dir))) {
+		size_t len = strlen (entry->d_name);
+
+		if (len > 6 && strcmp (entry->d_name + len - 6, ".psidx") == 0) {
+			free (filename);
+			filename = _spectre_strdup_printf ("%s/%s", cache_dir,
+							   entry->d_name);
+		}
+	}
+	closedir (dir);
+
+	return filename;
+}
+
+/* Replaces the first NUL terminated string equal to from in the cache
+ * file with to, both must have the same length
+ */
+static int
+edit_cache_string (const char *cache_dir,
+		   const char *from,
+		   const char *to)
+{
+	char  *filename;
+	char  *contents;
+	size_t length;
+	size_t len = strlen (from) + 1;
+	size_t i;
+	int    ok = 0;
+
+	filename = find_cache_file (cache_dir);
+	if (!filename)
+		return 0;
+
+	contents = read_file (filename, &length);
+	for (i = 0; contents && i + len <= length; i++) {
+		if (memcmp (contents + i, from, len) == 0) {
+			memcpy (contents + i, to, len);
+			ok = write_file (filename, contents, length);
+			break;
+		}
+	}
+	free (contents);
+	free (filename);
+
+	return ok;
+}
+
+static int
+edit_cache_version (const char *cache_dir)
+{
+	char    *filename;
+	char    *contents;
+	size_t   length;
+	uint32_t version;
+	int      ok = 0;
+
+	filename = find_cache_file (cache_dir);
+	if (!filename)
+		return 0;
+
+	contents = read_file (filename, &length);
+	if (contents && length >= CACHE_VERSION_OFFSET + sizeof (version)) {
+		memcpy (&version, contents + CACHE_VERSION_OFFSET, sizeof (version));
+		version++;
+		memcpy (contents + CACHE_VERSION_OFFSET, &version, sizeof (version));
+		ok = write_file (filename, contents, length);
+	}
+	free (contents);
+	free (filename);
+
+	return ok;
+}
+
+static int
+set_mtime (const char *filename,
+	   time_t      mtime,
+	   long        usec)
+{
+	struct timeval times[2];
+
+	times[0].tv_sec = times[1].tv_sec = mtime;
+	times[0].tv_usec = times[1].tv_usec = usec;
+
+	return utimes (filename, times) == 0;
+}
+
+static int
+test_cache (const char *dir)
+{
+	char       *filename;
+	char       *cache_dir;
+	char       *contents;
+	struct stat stat_buf;
+	int         ok;
+
+	filename = _spectre_strdup_printf ("%s/cache.ps", dir);
+	cache_dir = _spectre_strdup_printf ("%s/cache", dir);
+
+	ok = mkdir (cache_dir, 0755) == 0 &&
+		write_file (filename, document_contents, strlen (document_contents)) &&
+		stat (filename, &stat_buf) == 0;
+	if (!ok) {
+		printf ("Error creating %s\n", filename);
+		goto out;
+	}
+
+	/* First load, the index is written to the cache */
+	ok = check_first_label (filename, cache_dir, "A1", "scanning");
+	if (!ok)
+		goto out;
+	contents = find_cache_file (cache_dir);
+	if (!contents) {
+		printf ("Error: no cache file written in %s\n", cache_dir);
+		ok = 0;
+		goto out;
+	}
+	free (contents);
+
+	/* Hit, the edited label is read back */
+	ok = edit_cache_string (cache_dir, "A1", "Z1") &&
+		check_first_label (filename, cache_dir, "Z1", "on cache hit");
+	if (!ok)
+		goto out;
+
+	/* Miss when the modification time changes */
+	ok = set_mtime (filename, stat_buf.st_mtime - 10, 0) &&
+		check_first_label (filename, cache_dir, "A1", "after changing mtime");
+	if (!ok)
+		goto out;
+
+	/* Miss when the contents change but the size and mtime don't */
+	ok = edit_cache_string (cache_dir, "A1", "Z1");
+	contents = _spectre_strdup (document_contents);
+	memcpy (strstr (contents, "A1"), "B1", 2);
+	ok = ok && write_file (filename, contents, strlen (contents)) &&
+		set_mtime (filename, stat_buf.st_mtime - 10, 0) &&
+		check_first_label (filename, cache_dir, "B1", "after changing contents");
+	free (contents);
+	if (!ok)
+		goto out;
+
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC) || defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+	/* Miss when the modification time changes within the same second */
+	ok = edit_cache_string (cache_dir, "B1", "Z1") &&
+		set_mtime (filename, stat_buf.st_mtime - 10, 500000) &&
+		check_first_label (filename, cache_dir, "B1", "after changing mtime by half a second");
+	if (!ok)
+		goto out;
+#endif
+
+	/* Miss when the cache was written by another version */
+	ok = edit_cache_string (cache_dir, "B1", "Z1") &&
+		edit_cache_version (cache_dir) &&
+		check_first_label (filename, cache_dir, "B1", "with another cache version");
+
+ out:
+	contents = find_cache_file (cache_dir);
+	if (contents)
+		unlink (contents);
+	free (contents);
+	rmdir (cache_dir);
+	unlink (filename);
+	free (cache_dir);
+	free (filename);
+
+	return ok;
+}
+
+static const char *header_contents =
+	"%!PS-Adobe-3.0\n"
+	"%%EndComments\n"
+	"%%EndProlog\n";
+
+/* Writes a document whose pages are labeled prefix1, prefix2... */
+static int
+write_pages (const char *filename,
+	     const char *mode,
+	     const char *header,
+	     const char *prefix,
+	     int         first,
+	     int         n_pages)
+{
+	FILE *file;
+	int   i;
+
+	file = fopen (filename, mode);
+	if (!file)
+		return 0;
+
+	if (header)
+		fputs (header, file);
+	for (i = first; i < first + n_pages; i++)
+		fprintf (file, "%%%%Page: %s%d %d\nshowpage\n", prefix, i, i);
+
+	return fclose (file) == 0;
+}
+
+/* Checks that the pages of document are labeled prefix1, prefix2... */
+static int
+check_labels (SpectreDocument *document,
+	      const char      *prefix,
+	      unsigned int     n_pages,
+	      const char      *what)
+{
+	unsigned int i;
+
+	if (spectre_document_status (document)) {
+		printf ("Error %s: %s\n", what,
+			spectre_status_to_string (spectre_document_status (document)));
+		return 0;
+	}
+
+	spectre_document_scan_pages (document, 0);
+	if (spectre_document_get_n_pages (document) != n_pages) {
+		printf ("Error %s: found %u pages instead of %u\n", what,
+			spectre_document_get_n_pages (document), n_pages);
+		return 0;
+	}
+
+	for (i = 0; i < n_pages; i++) {
+		SpectrePage *page;
+		char        *expected;
+		const char  *label;
+		int          ok;
+
+		page = spectre_document_get_page (document, i);
+		label = page ? spectre_page_get_label (page) : NULL;
+		expected = _spectre_strdup_printf ("%s%u", prefix, i + 1);
+		ok = label && strcmp (label, expected) == 0;
+		if (!ok)
+			printf ("Error %s: page %u labeled %s instead of %s\n", what,
+				i, label ? label : "(null)", expected);
+		free (expected);
+		if (page)
+			spectre_page_free (page);
+		if (!ok)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+test_reload (const char *dir)
+{
+	SpectreDocument *document;
+	char            *filename;
+	struct stat      stat_buf;
+	int              ok;
+
+	filename = _spectre_strdup_printf ("%s/reload.ps", dir);
+	document = spectre_document_new ();
+
+	/* Pages appended to a loaded file are added */
+	ok = write_pages (filename, "wb", header_contents, "A", 1, 2);
+	spectre_document_load (document, filename);
+	ok = ok && check_labels (document, "A", 2, "loading");
+	ok = ok && write_pages (filename, "ab", NULL, "A", 3, 2);
+	spectre_document_load (document, filename);
+	ok = ok && check_labels (document, "A", 4, "after appending pages");
+	if (!ok)
+		goto out;
+
+	/* Rewritten with the same size, the file is loaded again */
+	ok = write_pages (filename, "wb", header_contents, "B", 1, 4) &&
+		stat (filename, &stat_buf) == 0 &&
+		set_mtime (filename, stat_buf.st_mtime + 10, 0);
+	spectre_document_load (document, filename);
+	ok = ok && check_labels (document, "B", 4, "after rewriting at the same size");
+	if (!ok)
+		goto out;
+
+	/* Rewritten and grown, the file is loaded again too */
+	ok = write_pages (filename, "wb", header_contents, "C", 1, 5);
+	spectre_document_load (document, filename);
+	ok = ok && check_labels (document, "C", 5, "after rewriting a larger file");
+	if (!ok)
+		goto out;
+
+	/* Likewise with a scan still pending */
+	ok = write_pages (filename, "wb", header_contents, "D", 1, 3);
+	spectre_document_load_partial (document, filename, 1);
+	ok = ok && write_pages (filename, "wb", header_contents, "E", 1, 6);
+	spectre_document_load_partial (document, filename, 1);
+	ok = ok && check_labels (document, "E", 6, "after rewriting a partially loaded file");
+
+ out:
+	spectre_document_free (document);
+	unlink (filename);
+	free (filename);
+
+	return ok;
+}
+
+/* Pages are written last to first, labeled by their number */
+static const char *descend_contents =
+	"%!PS-Adobe-3.0\n"
+	"%%Pages: 3\n"
+	"%%PageOrder: Descend\n"
+	"%%EndComments\n"
+	"%%EndProlog\n"
+	"%%Page: 3 1\n"
+	"showpage\n"
+	"%%Page: 2 2\n"
+	"showpage\n"
+	"%%Page: 1 3\n"
+	"showpage\n"
+	"%%Trailer\n"
+	"%%EOF\n";
+
+static const char *special_contents =
+	"%!PS-Adobe-3.0\n"
+	"%%Pages: 3\n"
+	"%%PageOrder: Special\n"
+	"%%EndComments\n"
+	"%%EndProlog\n"
+	"%%Page: 1 1\n"
+	"/x 1 def showpage\n"
+	"%%Page: 2 2\n"
+	"showpage\n"
+	"%%Page: 3 3\n"
+	"showpage\n"
+	"%%Trailer\n"
+	"%%EOF\n";
+
+static SpectreDocument *
+load_contents (const char *filename,
+	       const char *contents)
+{
+	SpectreDocument *document;
+
+	if (!write_file (filename, contents, strlen (contents))) {
+		printf ("Error creating %s\n", filename);
+		return NULL;
+	}
+
+	document = spectre_document_new ();
+	spectre_document_load (document, filename);
+	if (spectre_document_status (document)) {
+		printf ("Error loading %s: %s\n", filename,
+			spectre_status_to_string (spectre_document_status (document)));
+		spectre_document_free (document);
+		return NULL;
+	}
+
+	return document;
+}
+
+/* Checks the labels of the pages of filename, in the order of the file,
+ * and that it has the given page order comment
+ */
+static int
+check_saved (const char *filename,
+	     const char *labels,
+	     const char *page_order)
+{
+	SpectreDocument *document;
+	char            *contents;
+	size_t           length;
+	unsigned int     n_pages = strlen (labels);
+	unsigned int     i;
+	int              ok;
+
+	contents = read_file (filename, &length);
+	ok = contents && strstr (contents, page_order) != NULL;
+	if (!ok)
+		printf ("Error: %s doesn't have %s\n", filename, page_order);
+	free (contents);
+	if (!ok)
+		return 0;
+
+	document = spectre_document_new ();
+	spectre_document_load (document, filename);
+	if (spectre_document_status (document) ||
+	    spectre_document_get_n_pages (document) != n_pages) {
+		printf ("Error: %s has %u pages instead of %u\n", filename,
+			spectre_document_get_n_pages (document), n_pages);
+		spectre_document_free (document);
+		return 0;
+	}
+
+	for (i = 0; ok && i < n_pages; i++) {
+		SpectrePage *page;
+		const char  *label;
+
+		page = spectre_document_get_page (document, i);
+		label = page ? spectre_page_get_label (page) : NULL;
+		ok = label && label[0] == labels[i] && label[1] == '\0';
+		if (!ok)
+			printf ("Error: page %u of %s labeled %s instead of %c\n", i,
+				filename, label ? label : "(null)", labels[i]);
+		if (page)
+			spectre_page_free (page);
+	}
+	spectre_document_free (document);
+
+	return ok;
+}
+
+static int
+test_save (const char *dir)
+{
+	SpectreDocument *document;
+	char            *filename;
+	char            *saved;
+	char            *replacement;
+	char            *contents;
+	size_t           length;
+	int              ok;
+
+	filename = _spectre_strdup_printf ("%s/save.ps", dir);
+	saved = _spectre_strdup_printf ("%s/save-saved.ps", dir);
+	replacement = _spectre_strdup_printf ("%s/save-replacement.ps", dir);
+
+	document = load_contents (filename, document_contents);
+	ok = document != NULL;
+	if (ok) {
+		/* The file is copied as it is */
+		spectre_document_save (document, saved);
+		contents = read_file (saved, &length);
+		ok = spectre_document_status (document) == SPECTRE_STATUS_SUCCESS &&
+			contents && length == strlen (document_contents) &&
+			memcmp (contents, document_contents, length) == 0;
+		if (!ok)
+			printf ("Error saving a document\n");
+		free (contents);
+
+		/* Still the file that was loaded once it has been replaced */
+		if (ok) {
+			ok = write_file (replacement, header_contents, strlen (header_contents)) &&
+				rename (replacement, filename) == 0;
+			spectre_document_save (document, saved);
+			contents = read_file (saved, &length);
+			ok = ok && spectre_document_status (document) == SPECTRE_STATUS_SUCCESS &&
+				contents && length == strlen (document_contents) &&
+				memcmp (contents, document_contents, length) == 0;
+			if (!ok)
+				printf ("Error saving a document whose file was replaced\n");
+			free (contents);
+		}
+
+		/* Writes that fail are reported, not only failed opens */
+		if (ok && access ("/dev/full", W_OK) == 0) {
+			spectre_document_save (document, "/dev/full");
+			if (spectre_document_status (document) != SPECTRE_STATUS_SAVE_ERROR) {
+				printf ("Error: saving to a full device succeeded\n");
+				ok = 0;
+			}
+		}
+		spectre_document_free (document);
+	}
+
+	unlink (replacement);
+	unlink (saved);
+	unlink (filename);
+	free (replacement);
+	free (saved);
+	free (filename);
+
+	return ok;
+}
+
+static int
+test_save_pages (const char *dir)
+{
+	static const unsigned int descend_pages[] = { 0, 2, 2 };
+	static const unsigned int first_pages[] = { 0, 1 };
+	static const unsigned int other_pages[] = { 1 };
+	SpectreDocument *document;
+	char            *filename;
+	char            *saved;
+	int              ok;
+
+	filename = _spectre_strdup_printf ("%s/pages.ps", dir);
+	saved = _spectre_strdup_printf ("%s/pages-saved.ps", dir);
+
+	/* Pages are numbered like spectre_document_get_page() does, and
+	 * written in the given order */
+	document = load_contents (filename, descend_contents);
+	ok = document != NULL;
+	if (ok) {
+		spectre_document_save_pages (document, saved, descend_pages, 3);
+		ok = spectre_document_status (document) == SPECTRE_STATUS_SUCCESS &&
+			check_saved (saved, "133", "%%PageOrder: Ascend\n");
+		if (!ok)
+			printf ("Error saving pages of a document in descending order\n");
+		spectre_document_free (document);
+	}
+	unlink (saved);
+	if (!ok)
+		goto out;
+
+	/* Only the first pages of a document in a special order */
+	document = load_contents (filename, special_contents);
+	ok = document != NULL;
+	if (ok) {
+		spectre_document_save_pages (document, saved, first_pages, 2);
+		ok = spectre_document_status (document) == SPECTRE_STATUS_SUCCESS &&
+			check_saved (saved, "12", "%%PageOrder: Special\n");
+		unlink (saved);
+
+		spectre_document_save_pages (document, saved, other_pages, 1);
+		if (spectre_document_status (document) != SPECTRE_STATUS_SAVE_ERROR ||
+		    access (saved, F_OK) == 0) {
+			printf ("Error: saved page 2 of a document in a special order alone\n");
+			ok = 0;
+		}
+		spectre_document_free (document);
+	}
+	unlink (saved);
+
+ out:
+	unlink (filename);
+	free (saved);
+	free (filename);
+
+	return ok;
+}
+
+#define SPLIT_PAGES 12
+
+/* Checks the file written for every page of a split document */
+static int
+check_split (const char *prefix,
+	     const char *labels,
+	     int         width,
+	     const char *comment)
+{
+	unsigned int i;
+	int          ok = 1;
+
+	for (i = 0; ok && labels[i]; i++) {
+		char  label[2] = { labels[i], '\0' };
+		char *filename;
+
+		filename = _spectre_strdup_printf ("%s%0*u.ps", prefix, width, i + 1);
+		ok = check_saved (filename, label, "%%Pages: 1\n") &&
+			check_saved (filename, label, comment);
+		unlink (filename);
+		free (filename);
+	}
+
+	return ok;
+}
+
+static int
+test_split (const char *dir)
+{
+	SpectreDocument *document;
+	char            *filename;
+	char            *prefix;
+	char            *contents;
+	char            *labels;
+	char            *tmp;
+	int              i;
+	int              ok;
+
+	filename = _spectre_strdup_printf ("%s/split.ps", dir);
+	prefix = _spectre_strdup_printf ("%s/split-", dir);
+
+	/* Enough pages for the numbers to be padded */
+	contents = _spectre_strdup_printf ("%%!PS-Adobe-3.0\n"
+					   "%%%%Pages: %d\n"
+					   "%%%%EndComments\n"
+					   "%%%%EndProlog\n", SPLIT_PAGES);
+	labels = calloc (SPLIT_PAGES + 1, 1);
+	for (i = 0; i < SPLIT_PAGES; i++) {
+		tmp = contents;
+		labels[i] = 'a' + i;
+		contents = _spectre_strdup_printf ("%s%%%%Page: %c %d\nshowpage\n",
+						   tmp, labels[i], i + 1);
+		free (tmp);
+	}
+	tmp = contents;
+	contents = _spectre_strdup_printf ("%s%%%%Trailer\n%%%%EOF\n", tmp);
+	free (tmp);
+	document = load_contents (filename, contents);
+	free (contents);
+	ok = document != NULL;
+	if (ok) {
+		spectre_document_split (document, prefix);
+		ok = spectre_document_status (document) == SPECTRE_STATUS_SUCCESS &&
+			check_split (prefix, labels, 2, "%%Pages: (atend)\n");
+		if (!ok)
+			printf ("Error splitting a document\n");
+		spectre_document_free (document);
+	}
+	free (labels);
+	if (!ok)
+		goto out;
+
+	/* Files are numbered like spectre_document_get_page() does */
+	document = load_contents (filename, descend_contents);
+	ok = document != NULL;
+	if (ok) {
+		spectre_document_split (document, prefix);
+		ok = spectre_document_status (document) == SPECTRE_STATUS_SUCCESS &&
+			check_split (prefix, "123", 1, "%%PageOrder: Ascend\n");
+		if (!ok)
+			printf ("Error splitting a document in descending order\n");
+		spectre_document_free (document);
+	}
+	if (!ok)
+		goto out;
+
+	/* Pages in a special order can't be split */
+	document = load_contents (filename, special_contents);
+	ok = document != NULL;
+	if (ok) {
+		char *first;
+
+		spectre_document_split (document, prefix);
+		first = _spectre_strdup_printf ("%s1.ps", prefix);
+		if (spectre_document_status (document) != SPECTRE_STATUS_SAVE_ERROR ||
+		    access (first, F_OK) == 0) {
+			printf ("Error: split a document in a special order\n");
+			ok = 0;
+		}
+		unlink (first);
+		free (first);
+		spectre_document_free (document);
+	}
+
+ out:
+	unlink (filename);
+	free (prefix);
+	free (filename);
+
+	return ok;
+}
+
+int main (int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : ".";
+	char       *scratch;
+	int         ok;
+
+	scratch = _spectre_strdup_printf ("%s/document-test.XXXXXX", dir);
+	if (!mkdtemp (scratch)) {
+		printf ("Skipped, could not create %s\n", scratch);
+		free (scratch);
+		return 0;
+	}
+
+	ok = test_cache (scratch);
+	ok = test_reload (scratch) && ok;
+	ok = test_save (scratch) && ok;
+	ok = test_save_pages (scratch) && ok;
+	ok = test_split (scratch) && ok;
+
+	rmdir (scratch);
+	free (scratch);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,733 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../libspectre/spectre-utils.h"
+#include "../libspectre/spectre-zindex.h"
+#include "../libspectre/ps.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZLIB
+#include <bzlib.h>
+#endif
+
+/* Scans and copies a document whose last page starts after 4GB. The
+ * file is sparse, the pages before the last one embed a hole as binary
+ * data, so it takes little disk space where the filesystem supports it.
+ * The test is skipped when the file can't be created.
+ *
+ * Then compares the serial and the parallel scans of generated documents
+ * large enough to be searched in parallel: one with nested documents
+ * spanning several chunks, so that the chunks are stitched together, and
+ * one with binary data, so that the scan falls back to reading every line.
+ * ps.c is built with SKIP_N_CPUS so the documents are split in chunks on
+ * hosts with a single CPU too, the comparison is skipped without threads.
+ *
+ * Finally compresses a document several times larger than the output
+ * between gzip restart points, with gzip and bzip2, in one and in several
+ * members, and checks that scanning it finds the same sections and pages as
+ * scanning the uncompressed document, and that seeking back and forth reads
+ * the uncompressed bytes.
+ */
+
+#define HOLE_SIZE 2500000000LL
+#define N_HOLES   2
+
+static const char *header =
+	"%!PS-Adobe-3.0\n"
+	"%%Pages: 3\n"
+	"%%EndComments\n"
+	"%%EndProlog\n";
+
+static const char *last_page =
+	"%%Page: 3 3\n"
+	"/Helvetica findfont 12 scalefont setfont\n"
+	"72 72 moveto (last page) show\n"
+	"showpage\n";
+
+static const char *trailer =
+	"%%Trailer\n"
+	"%%EOF\n";
+
+static int
+write_all (int         fd,
+	   const char *str,
+	   off_t      *offset)
+{
+	size_t len = strlen (str);
+
+	if (pwrite (fd, str, len, *offset) != (ssize_t) len)
+		return 0;
+	*offset += len;
+
+	return 1;
+}
+
+static int
+create_file (const char *filename)
+{
+	off_t offset = 0;
+	int   fd;
+	int   ok;
+	int   i;
+
+	fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return 0;
+
+	ok = write_all (fd, header, &offset);
+	for (i = 0; ok && i < N_HOLES; i++) {
+		char *page;
+
+		page = _spectre_strdup_printf ("%%%%Page: %d %d\n"
+					       "%%%%BeginData: %lld Binary Bytes\n",
+					       i + 1, i + 1, HOLE_SIZE);
+		ok = write_all (fd, page, &offset);
+		free (page);
+		/* The hole is left unwritten */
+		offset += HOLE_SIZE;
+		ok = ok && write_all (fd, "\n%%EndData\nshowpage\n", &offset);
+	}
+	ok = ok && write_all (fd, last_page, &offset);
+	ok = ok && write_all (fd, trailer, &offset);
+
+	if (close (fd) != 0)
+		ok = 0;
+
+	return ok;
+}
+
+static char *
+read_section (FILE *file,
+	      off_t begin,
+	      off_t end)
+{
+	char  *buf;
+	size_t len = end - begin;
+
+	buf = malloc (len + 1);
+	if (fseeko (file, begin, SEEK_SET) != 0 ||
+	    fread (buf, 1, len, file) != len) {
+		free (buf);
+		return NULL;
+	}
+	buf[len] = '\0';
+
+	return buf;
+}
+
+static int
+check_document (FILE            *file,
+		struct document *doc)
+{
+	char *contents;
+	int   ok;
+
+	if (doc->numpages != 3) {
+		printf ("Found %u pages instead of 3\n", doc->numpages);
+		return 0;
+	}
+
+	if (doc->pages[2].begin <= UINT32_MAX) {
+		printf ("Last page found at %lld, before 4GB\n",
+			(long long) doc->pages[2].begin);
+		return 0;
+	}
+
+	contents = read_section (file, doc->pages[2].begin, doc->pages[2].end);
+	ok = contents && strcmp (contents, last_page) == 0;
+	if (!ok)
+		printf ("Wrong offsets for the last page: %lld-%lld\n",
+			(long long) doc->pages[2].begin,
+			(long long) doc->pages[2].end);
+	free (contents);
+
+	contents = read_section (file, doc->begintrailer, doc->endtrailer);
+	if (!contents || strcmp (contents, trailer) != 0) {
+		printf ("Wrong offsets for the trailer: %lld-%lld\n",
+			(long long) doc->begintrailer,
+			(long long) doc->endtrailer);
+		ok = 0;
+	}
+	free (contents);
+
+	return ok;
+}
+
+static int
+check_copy (FILE            *file,
+	    struct document *doc)
+{
+	FILE  *copy;
+	char   buf[256];
+	size_t read;
+	int    ok;
+
+	copy = tmpfile ();
+	if (!copy)
+		return 0;
+
+	pscopypage (file, copy, doc, 2, 1);
+	rewind (copy);
+	read = fread (buf, 1, sizeof (buf) - 1, copy);
+	buf[read] = '\0';
+	fclose (copy);
+
+	/* The page is renumbered, the rest is copied verbatim */
+	ok = strncmp (buf, "%%Page: 3 1\n", 12) == 0 &&
+		strcmp (buf + 12, strchr (last_page, '\n') + 1) == 0;
+	if (!ok)
+		printf ("Wrong copy of the last page:\n%s\n", buf);
+
+	return ok;
+}
+
+static int
+test_large_file (const char *dir)
+{
+	char            *filename;
+	FILE            *file;
+	struct document *doc;
+	int              ok;
+
+	if (sizeof (off_t) < 8) {
+		printf ("Skipped, no 64-bit file offsets\n");
+		return 1;
+	}
+
+	filename = _spectre_strdup_printf ("%s/large-file-test.ps", dir);
+	if (!create_file (filename)) {
+		printf ("Skipped, could not create %s\n", filename);
+		unlink (filename);
+		free (filename);
+		return 1;
+	}
+
+	file = fopen (filename, "rb");
+	if (!file) {
+		printf ("Error opening file %s\n", filename);
+		unlink (filename);
+		free (filename);
+		return 0;
+	}
+
+	doc = psscan (file, filename, SCANSTYLE_NORMAL);
+	if (!doc) {
+		printf ("Error parsing document\n");
+		ok = 0;
+	} else {
+		ok = check_document (file, doc) && check_copy (file, doc);
+		psdocdestroy (doc);
+	}
+
+	fclose (file);
+	unlink (filename);
+	free (filename);
+
+	return ok;
+}
+
+#define GEN_PAGES       40
+#define GEN_PAGE_LINES  2000
+#define GEN_NESTED_PAGE 10
+#define GEN_DATA_PAGE   20
+
+static const char *filler =
+	"0 0 moveto 72 72 lineto stroke % not a DSC comment\n";
+
+static const char *binary =
+	"\n%%Page: data 99\n\r%%EndData\n\r\n%%Trailer\n";
+
+static void
+write_filler (FILE *file,
+	      int   n_lines)
+{
+	int i;
+
+	for (i = 0; i < n_lines; i++)
+		fputs (filler, file);
+}
+
+/* Writes a document of about 12MB, with a nested document spanning
+ * several chunks and, when with_data is set, binary data whose contents
+ * look like DSC comments
+ */
+static int
+create_generated_file (const char *filename,
+		       int         with_data)
+{
+	FILE *file;
+	int   i;
+
+	file = fopen (filename, "wb");
+	if (!file)
+		return 0;
+
+	fputs ("%!PS-Adobe-3.0\n"
+	       "%%Pages: (atend)\n"
+	       "%%EndComments\n"
+	       "%%BeginProlog\n", file);
+	write_filler (file, 100);
+	fputs ("%%EndProlog\n"
+	       "%%BeginSetup\n"
+	       "%%EndSetup\n", file);
+
+	for (i = 0; i < GEN_PAGES; i++) {
+		fprintf (file, "%%%%Page: p%d %d\n", i + 1, i + 1);
+		write_filler (file, GEN_PAGE_LINES);
+		if (i == GEN_NESTED_PAGE) {
+			fputs ("%%BeginDocument: nested.eps\n"
+			       "%!PS-Adobe-3.0 EPSF-3.0\n"
+			       "%%Pages: 2\n"
+			       "%%Page: 1 1\n", file);
+			write_filler (file, 20 * GEN_PAGE_LINES);
+			fputs ("%%Page: 2 2\n", file);
+			write_filler (file, 20 * GEN_PAGE_LINES);
+			fputs ("%%Trailer\n"
+			       "%%EOF\n"
+			       "%%EndDocument\n", file);
+		} else if (i == GEN_DATA_PAGE && with_data) {
+			fprintf (file, "%%%%BeginData: %lu Binary Bytes\n",
+				 (unsigned long) strlen (binary));
+			fputs (binary, file);
+			fputs ("\n%%EndData\n", file);
+			fprintf (file, "%%%%BeginBinary: %lu\n",
+				 (unsigned long) strlen (binary));
+			fputs (binary, file);
+			fputs ("\n%%EndBinary\n", file);
+		}
+		write_filler (file, GEN_PAGE_LINES);
+		fputs ("showpage\n", file);
+	}
+
+	fputs ("%%Trailer\n"
+	       "%%Pages: 40\n"
+	       "%%EOF\n", file);
+
+	return fclose (file) == 0;
+}
+
+static int
+str_equal (const char *a,
+	   const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return strcmp (a, b) == 0;
+}
+
+#define CHECK_SECTION(name) \
+	if (serial->begin##name != other->begin##name || \
+	    serial->end##name != other->end##name || \
+	    serial->len##name != other->len##name) { \
+		printf ("Different " #name ": %lld-%lld, %lld-%lld in %s\n", \
+			(long long) serial->begin##name, (long long) serial->end##name, \
+			(long long) other->begin##name, (long long) other->end##name, \
+			what); \
+		ok = 0; \
+	}
+
+static int
+compare_documents (struct document *serial,
+		   struct document *other,
+		   const char      *what)
+{
+	unsigned int i;
+	int          ok = 1;
+
+	CHECK_SECTION (header);
+	CHECK_SECTION (preview);
+	CHECK_SECTION (defaults);
+	CHECK_SECTION (prolog);
+	CHECK_SECTION (setup);
+	CHECK_SECTION (trailer);
+
+	if (serial->numpages != other->numpages) {
+		printf ("Found %u pages, %u in %s\n",
+			serial->numpages, other->numpages, what);
+		return 0;
+	}
+
+	for (i = 0; i < serial->numpages; i++) {
+		struct page *a = &serial->pages[i];
+		struct page *b = &other->pages[i];
+
+		if (a->begin != b->begin || a->end != b->end || a->len != b->len ||
+		    !str_equal (a->label, b->label)) {
+			printf ("Different page %u: %s %lld-%lld, %s %lld-%lld in %s\n",
+				i, a->label, (long long) a->begin, (long long) a->end,
+				b->label, (long long) b->begin, (long long) b->end, what);
+			ok = 0;
+		}
+	}
+
+	return ok;
+}
+
+static int
+compare_scans (const char *filename,
+	       int         with_data)
+{
+	FILE            *file;
+	struct document *serial;
+	struct document *parallel;
+	int              ok;
+
+	if (!create_generated_file (filename, with_data)) {
+		printf ("Skipped, could not create %s\n", filename);
+		unlink (filename);
+		return 1;
+	}
+
+	file = fopen (filename, "rb");
+	if (!file) {
+		printf ("Error opening file %s\n", filename);
+		unlink (filename);
+		return 0;
+	}
+
+	serial = psscan (file, filename, SCANSTYLE_SERIAL);
+	parallel = psscan (file, filename, SCANSTYLE_NORMAL);
+	if (!serial || !parallel) {
+		printf ("Error parsing document\n");
+		ok = 0;
+	} else if (serial->numpages != GEN_PAGES) {
+		printf ("Found %u pages instead of %d\n", serial->numpages, GEN_PAGES);
+		ok = 0;
+	} else {
+		ok = compare_documents (serial, parallel, "parallel");
+	}
+	if (serial)
+		psdocdestroy (serial);
+	if (parallel)
+		psdocdestroy (parallel);
+
+	fclose (file);
+	unlink (filename);
+
+	return ok;
+}
+
+static int
+test_parallel_scan (const char *dir)
+{
+#ifdef HAVE_PTHREAD
+	char *filename;
+	int   ok;
+
+	filename = _spectre_strdup_printf ("%s/large-file-test-parallel.ps", dir);
+	ok = compare_scans (filename, 0) && compare_scans (filename, 1);
+	free (filename);
+
+	return ok;
+#else
+	printf ("Skipped parallel scans, built without threads\n");
+
+	return 1;
+#endif
+}
+
+#define Z_PAGES      30
+#define Z_PAGE_LINES 10000
+#define Z_SPAN       1048576	/* ZINDEX_SPAN, output between gzip restart points */
+#define Z_READ_SIZE  4096
+#define Z_N_SEEKS    50
+
+typedef int (* CompressFunc) (FILE       *file,
+			      const char *data,
+			      size_t      length);
+
+/* Every line is numbered, so reading from the wrong offset is noticed */
+static char *
+create_numbered_contents (size_t *length)
+{
+	char  *contents;
+	size_t size = (size_t) Z_PAGES * Z_PAGE_LINES * 48 + 1024;
+	size_t len = 0;
+	int    i, j;
+
+	contents = malloc (size);
+	if (!contents)
+		return NULL;
+
+	len += sprintf (contents + len,
+			"%%!PS-Adobe-3.0\n"
+			"%%%%Pages: %d\n"
+			"%%%%EndComments\n"
+			"%%%%EndProlog\n", Z_PAGES);
+	for (i = 0; i < Z_PAGES; i++) {
+		len += sprintf (contents + len, "%%%%Page: z%d %d\n", i + 1, i + 1);
+		for (j = 0; j < Z_PAGE_LINES; j++)
+			len += sprintf (contents + len, "%d %d moveto %% line %d\n",
+					i, j, i * Z_PAGE_LINES + j);
+		len += sprintf (contents + len, "showpage\n");
+	}
+	len += sprintf (contents + len, "%%%%Trailer\n%%%%EOF\n");
+
+	*length = len;
+
+	return contents;
+}
+
+#ifdef HAVE_ZLIB
+static int
+write_gzip_member (FILE       *file,
+		   const char *data,
+		   size_t      length)
+{
+	z_stream      zs;
+	unsigned char out[16384];
+	size_t        n;
+	int           status;
+
+	memset (&zs, 0, sizeof (z_stream));
+	/* 15 + 16: largest window, gzip header */
+	if (deflateInit2 (&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			  Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+
+	zs.next_in = (unsigned char *) data;
+	zs.avail_in = length;
+	do {
+		zs.next_out = out;
+		zs.avail_out = sizeof (out);
+		status = deflate (&zs, Z_FINISH);
+		n = sizeof (out) - zs.avail_out;
+		if (fwrite (out, 1, n, file) != n)
+			status = Z_ERRNO;
+	} while (status == Z_OK);
+	deflateEnd (&zs);
+
+	return status == Z_STREAM_END;
+}
+#endif
+
+#ifdef HAVE_BZLIB
+static int
+write_bzip2_stream (FILE       *file,
+		    const char *data,
+		    size_t      length)
+{
+	char        *out;
+	unsigned int out_length = length + length / 100 + 600;
+	int          ok;
+
+	out = malloc (out_length);
+	if (!out)
+		return 0;
+
+	ok = BZ2_bzBuffToBuffCompress (out, &out_length, (char *) data, length,
+				       9, 0, 0) == BZ_OK &&
+		fwrite (out, 1, out_length, file) == out_length;
+	free (out);
+
+	return ok;
+}
+#endif
+
+/* Each member holds a part of the data, cut in the middle of a line */
+static int
+create_compressed_file (const char  *filename,
+			const char  *data,
+			size_t       length,
+			CompressFunc compress,
+			int          n_members)
+{
+	FILE  *file;
+	size_t begin = 0;
+	int    ok = 1;
+	int    i;
+
+	file = fopen (filename, "wb");
+	if (!file)
+		return 0;
+
+	for (i = 1; ok && i <= n_members; i++) {
+		size_t end = i == n_members ? length : length / n_members * i + 7;
+
+		ok = compress (file, data + begin, end - begin);
+		begin = end;
+	}
+
+	return fclose (file) == 0 && ok;
+}
+
+static int
+check_read (SpectreZReader *reader,
+	    const char     *data,
+	    size_t          length,
+	    off_t           offset)
+{
+	char   buf[Z_READ_SIZE];
+	size_t want = length - offset < Z_READ_SIZE ? length - offset : Z_READ_SIZE;
+	size_t read;
+
+	if (spectre_zreader_seek (reader, offset) != 0) {
+		printf ("Error seeking to %lld\n", (long long) offset);
+		return 0;
+	}
+
+	read = spectre_zreader_read (reader, buf, want);
+	if (read != want || memcmp (buf, data + offset, want) != 0) {
+		printf ("Wrong %lu bytes read at %lld\n",
+			(unsigned long) read, (long long) offset);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+check_seeks (SpectreZIndex *zindex,
+	     const char    *data,
+	     size_t         length)
+{
+	SpectreZReader *reader;
+	off_t           offset;
+	int             ok = 1;
+	int             i;
+
+	if (spectre_zindex_get_length (zindex) != (off_t) length) {
+		printf ("Uncompressed length %lld instead of %lu\n",
+			(long long) spectre_zindex_get_length (zindex),
+			(unsigned long) length);
+		return 0;
+	}
+
+	reader = spectre_zreader_new (zindex, 0);
+	if (!reader)
+		return 0;
+
+	/* Backwards across the restart points, from the end */
+	for (offset = length - 1; ok && offset > 0; offset -= Z_SPAN / 3 + 1)
+		ok = check_read (reader, data, length, offset);
+
+	/* Anywhere, back and forth */
+	srand (1);
+	for (i = 0; ok && i < Z_N_SEEKS; i++) {
+		offset = (((off_t) rand () << 16) ^ rand ()) % length;
+		ok = check_read (reader, data, length, offset);
+	}
+
+	/* And the beginning again */
+	ok = ok && check_read (reader, data, length, 0);
+
+	spectre_zreader_free (reader);
+
+	return ok;
+}
+
+static int
+check_compressed (const char      *filename,
+		  struct document *plain,
+		  const char      *data,
+		  size_t           length,
+		  CompressFunc     compress,
+		  int              n_members)
+{
+	FILE            *file;
+	struct document *doc;
+	int              ok;
+
+	if (!create_compressed_file (filename, data, length, compress, n_members)) {
+		printf ("Error creating %s\n", filename);
+		unlink (filename);
+		return 0;
+	}
+
+	file = fopen (filename, "rb");
+	if (!file) {
+		printf ("Error opening file %s\n", filename);
+		unlink (filename);
+		return 0;
+	}
+
+	doc = psscan (file, filename, SCANSTYLE_NORMAL);
+	if (!doc || !doc->zindex) {
+		printf ("Error parsing compressed document %s\n", filename);
+		ok = 0;
+	} else {
+		ok = compare_documents (plain, doc, filename) &&
+			check_seeks (doc->zindex, data, length);
+	}
+	if (doc)
+		psdocdestroy (doc);
+
+	fclose (file);
+	unlink (filename);
+
+	return ok;
+}
+
+static int
+test_compressed (const char *dir)
+{
+	char            *filename;
+	char            *data;
+	size_t           length;
+	FILE            *file = NULL;
+	struct document *plain = NULL;
+	int              ok = 1;
+
+	data = create_numbered_contents (&length);
+	filename = _spectre_strdup_printf ("%s/large-file-test-compressed.ps", dir);
+	if (data) {
+		file = fopen (filename, "w+b");
+		if (file && fwrite (data, 1, length, file) == length && fflush (file) == 0)
+			plain = psscan (file, filename, SCANSTYLE_NORMAL);
+	}
+	if (!plain || plain->numpages != Z_PAGES) {
+		printf ("Error parsing uncompressed document %s\n", filename);
+		ok = 0;
+	}
+	if (file)
+		fclose (file);
+	unlink (filename);
+	free (filename);
+
+#ifdef HAVE_ZLIB
+	filename = _spectre_strdup_printf ("%s/large-file-test-compressed.ps.gz", dir);
+	ok = ok && check_compressed (filename, plain, data, length, write_gzip_member, 1) &&
+		check_compressed (filename, plain, data, length, write_gzip_member, 3);
+	free (filename);
+#else
+	printf ("Skipped gzip documents, built without zlib\n");
+#endif
+
+#ifdef HAVE_BZLIB
+	filename = _spectre_strdup_printf ("%s/large-file-test-compressed.ps.bz2", dir);
+	ok = ok && check_compressed (filename, plain, data, length, write_bzip2_stream, 1) &&
+		check_compressed (filename, plain, data, length, write_bzip2_stream, 3);
+	free (filename);
+#else
+	printf ("Skipped bzip2 documents, built without libbz2\n");
+#endif
+
+	if (plain)
+		psdocdestroy (plain);
+	free (data);
+
+	return ok;
+}
+
+int main (int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : ".";
+	int         ok;
+
+	ok = test_large_file (dir);
+	ok = test_parallel_scan (dir) && ok;
+	ok = test_compressed (dir) && ok;
+
+	printf ("%s\n", ok ? "OK" : "FAILED");
+
+	return ok ? 0 : 1;
+}
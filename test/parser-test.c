@@ -9,13 +9,13 @@ static char *outputdir;
 #define BUFFER_SIZE 32768
 
 static void
-write_section (FILE *fd, const char *section, long begin, long end)
+write_section (FILE *fd, const char *section, off_t begin, off_t end)
 {
 	FILE *dst;
 	char *filename;
 	static char buf[BUFFER_SIZE];
 	unsigned int read;
-	size_t left = end - begin;
+	off_t left = end - begin;
 
 	filename = _spectre_strdup_printf ("%s/%s.txt", outputdir, section);
 	dst = fopen (filename, "w");
@@ -27,12 +27,12 @@ write_section (FILE *fd, const char *section, long begin, long end)
 	}
 	free (filename);
 
-	fseek (fd, begin, SEEK_SET);
+	fseeko (fd, begin, SEEK_SET);
 
 	while (left > 0) {
 		size_t to_read = BUFFER_SIZE;
 
-		if (left < to_read)
+		if (left < BUFFER_SIZE)
 			to_read = left;
 
 		read = fread (buf, sizeof (char), to_read, fd);
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "../libspectre/spectre-utils.h"
+#include "../libspectre/spectre-pdf.h"
+
+/* Merges files laid out like the ones written by pdfwrite and checks
+ * the cross-reference table, the page tree and the page labels of the
+ * result. Stream contents include things that look like references and
+ * keywords, they must be copied untouched.
+ */
+
+#define N_PARTS 3
+
+static const char *stream_data =
+	"q 1 0 0 1 0 0 cm (1 0 R) Tj Q\n"
+	"endobj 3 0 R stream )\001\377\n";
+
+static const char *labels[] = {
+	"1", "2", "3", "iv", "iv", "A (1)"
+};
+
+static const char *expected_labels =
+	"/PageLabels << /Nums [ 0 << /S /D /St 1 >> 3 << /P (iv) >> "
+	"5 << /P (A \\(1\\)) >> ] >>";
+
+static char *
+read_file (const char *filename,
+	   size_t     *length)
+{
+	FILE *file;
+	char *data;
+	long  len;
+
+	file = fopen (filename, "rb");
+	if (!file)
+		return NULL;
+	fseek (file, 0, SEEK_END);
+	len = ftell (file);
+	rewind (file);
+	data = malloc (len + 1);
+	if (fread (data, 1, len, file) != (size_t) len) {
+		free (data);
+		fclose (file);
+		return NULL;
+	}
+	data[len] = '\0';
+	*length = len;
+	fclose (file);
+
+	return data;
+}
+
+/* Writes a part with n_pages pages. The objects are numbered like
+ * pdfwrite does: the catalog and info first, then the page tree, then
+ * for every page its contents, their length and the page itself.
+ */
+static int
+write_part (const char *filename,
+	    int         n_pages,
+	    int         xref_stream)
+{
+	FILE *file;
+	long  offsets[64];
+	long  xref;
+	int   n_objects = 4 + 3 * n_pages;
+	int   i;
+
+	file = fopen (filename, "wb");
+	if (!file)
+		return 0;
+
+	fprintf (file, "%%PDF-1.7\n%%\307\354\217\242\n");
+	for (i = 0; i < n_pages; i++) {
+		int contents = 4 + 3 * i;
+
+		offsets[contents] = ftell (file);
+		fprintf (file, "%d 0 obj\n<</Length %d 0 R/Filter /FlateDecode>>\nstream\n",
+			 contents, contents + 1);
+		fputs (stream_data, file);
+		fprintf (file, "\nendstream\nendobj\n");
+
+		offsets[contents + 1] = ftell (file);
+		fprintf (file, "%d 0 obj\n%d\nendobj\n", contents + 1,
+			 (int) strlen (stream_data) + 1);
+
+		offsets[contents + 2] = ftell (file);
+		fprintf (file, "%d 0 obj\n<</Type/Page/MediaBox [0 0 612 792]\n"
+			 "/Parent 3 0 R\n/Resources<</ProcSet[/PDF /Text]\n>>\n"
+			 "/Contents %d 0 R\n>>\nendobj\n", contents + 2, contents);
+	}
+
+	offsets[3] = ftell (file);
+	fprintf (file, "3 0 obj\n<< /Type /Pages /Kids [\n");
+	for (i = 0; i < n_pages; i++)
+		fprintf (file, "%d 0 R\n", 6 + 3 * i);
+	fprintf (file, "] /Count %d\n>>\nendobj\n", n_pages);
+
+	offsets[1] = ftell (file);
+	fprintf (file, "1 0 obj\n<</Type /Catalog /Pages 3 0 R\n>>\nendobj\n");
+
+	offsets[2] = ftell (file);
+	fprintf (file, "2 0 obj\n<</Producer(GPL Ghostscript \\(2 0 R\\))\n"
+		 "/Title<FEFF0031>>>endobj\n");
+
+	xref = ftell (file);
+	if (xref_stream) {
+		fprintf (file, "%d 0 obj\n<</Type/XRef/Size %d>>\nendobj\n",
+			 n_objects, n_objects + 1);
+	} else {
+		fprintf (file, "xref\n0 %d\n0000000000 65535 f \n", n_objects);
+		for (i = 1; i < n_objects; i++)
+			fprintf (file, "%010ld 00000 n \n", offsets[i]);
+		fprintf (file, "trailer\n<< /Size %d /Root 1 0 R /Info 2 0 R\n"
+			 "/ID [<0A1B><0A1B>]\n>>\n", n_objects);
+	}
+	fprintf (file, "startxref\n%ld\n%%%%EOF\n", xref);
+
+	return fclose (file) == 0;
+}
+
+/* Every entry of the table must point to its object */
+static int
+check_xref (const char *data,
+	    size_t      length,
+	    int        *n_objects)
+{
+	const char *p;
+	long xref;
+	int i;
+
+	p = strstr (data, "startxref\n");
+	if (!p || sscanf (p, "startxref\n%ld", &xref) != 1 || xref >= (long) length)
+		return 0;
+	if (sscanf (data + xref, "xref\n0 %d\n", n_objects) != 1)
+		return 0;
+
+	p = strchr (data + xref + 5, '\n') + 1;
+	for (i = 0; i < *n_objects; i++, p += 20) {
+		char header[32];
+		long offset;
+		char type;
+
+		if (sscanf (p, "%ld %*d %c", &offset, &type) != 2)
+			return 0;
+		if (type != 'n')
+			continue;
+		sprintf (header, "%d 0 obj\n", i);
+		if (offset >= (long) length ||
+		    strncmp (data + offset, header, strlen (header)) != 0) {
+			printf ("Wrong offset for object %d\n", i);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+count (const char *data,
+       const char *str)
+{
+	const char *p = data;
+	int n = 0;
+
+	while ((p = strstr (p, str))) {
+		n++;
+		p++;
+	}
+
+	return n;
+}
+
+static int
+check_merge (const char *filename)
+{
+	char  *data;
+	size_t length;
+	int    n_objects = 0;
+	int    ok = 1;
+
+	data = read_file (filename, &length);
+	if (!data)
+		return 0;
+
+	if (!check_xref (data, length, &n_objects)) {
+		printf ("Wrong cross-reference table\n");
+		ok = 0;
+	}
+
+	/* Parts take 6, 9 and 12 objects from 3 on */
+	if (n_objects != 3 + 6 + 9 + 12) {
+		printf ("Found %d objects instead of %d\n", n_objects, 3 + 6 + 9 + 12);
+		ok = 0;
+	}
+	if (!strstr (data, "2 0 obj\n<< /Type /Pages /Count 6 /Kids [ 5 0 R 11 0 R 20 0 R ] >>")) {
+		printf ("Wrong page tree root\n");
+		ok = 0;
+	}
+	if (!strstr (data, "5 0 obj\n<< /Parent 2 0 R /Type /Pages /Kids [\n8 0 R\n]") ||
+	    !strstr (data, "20 0 obj\n<< /Parent 2 0 R /Type /Pages /Kids [\n23 0 R\n26 0 R\n29 0 R\n]")) {
+		printf ("Wrong page tree of a part\n");
+		ok = 0;
+	}
+	if (!strstr (data, "29 0 obj\n<</Type/Page/MediaBox [0 0 612 792]\n/Parent 20 0 R\n"
+		     "/Resources<</ProcSet[/PDF /Text]\n>>\n/Contents 27 0 R\n>>\nendobj")) {
+		printf ("Wrong references in a page\n");
+		ok = 0;
+	}
+	if (!strstr (data, "27 0 obj\n<</Length 28 0 R/Filter /FlateDecode>>\nstream\n") ||
+	    count (data, stream_data) != 6) {
+		printf ("Wrong page contents\n");
+		ok = 0;
+	}
+	if (count (data, "<</Producer(GPL Ghostscript \\(2 0 R\\))\n/Title<FEFF0031>>>endobj") != 3) {
+		printf ("Wrong strings\n");
+		ok = 0;
+	}
+	if (!strstr (data, "trailer\n<< /Size 30 /Root 1 0 R /Info 4 0 R >>")) {
+		printf ("Wrong trailer\n");
+		ok = 0;
+	}
+	if (!strstr (data, expected_labels)) {
+		printf ("Wrong page labels\n");
+		ok = 0;
+	}
+
+	free (data);
+
+	return ok;
+}
+
+int main (int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : ".";
+	char       *parts[N_PARTS];
+	char       *filename;
+	int         ok = 1;
+	int         i;
+
+	filename = _spectre_strdup_printf ("%s/pdf-merge-test.pdf", dir);
+	for (i = 0; i < N_PARTS; i++) {
+		parts[i] = _spectre_strdup_printf ("%s/pdf-merge-test-%d.pdf", dir, i);
+		if (!write_part (parts[i], i + 1, 0)) {
+			printf ("Error writing %s\n", parts[i]);
+			ok = 0;
+		}
+	}
+
+	if (ok && !spectre_pdf_merge (filename, (const char **) parts, N_PARTS,
+				      labels, sizeof (labels) / sizeof (labels[0]))) {
+		printf ("Error merging the parts\n");
+		ok = 0;
+	}
+	ok = ok && check_merge (filename);
+
+	/* Cross-reference streams are not supported */
+	if (ok) {
+		write_part (parts[1], 2, 1);
+		if (spectre_pdf_merge (filename, (const char **) parts, N_PARTS, NULL, 0) ||
+		    access (filename, F_OK) == 0) {
+			printf ("Merged a part with a cross-reference stream\n");
+			ok = 0;
+		}
+	}
+
+	for (i = 0; i < N_PARTS; i++) {
+		unlink (parts[i]);
+		free (parts[i]);
+	}
+	unlink (filename);
+	free (filename);
+
+	printf ("%s\n", ok ? "OK" : "FAILED");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,312 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Performance fuzzing entry point for the fuzz target, works without
+ * libFuzzer. Every input is loaded several times and fails when the best
+ * time is over a budget per byte, so that inputs making the scanner
+ * superlinear are caught. Slow inputs can be minimized, removing lines
+ * while they stay slow.
+ */
+
+#define DEFAULT_BUDGET   1000	/* nanoseconds per byte */
+#define BASE_TIME        0.01	/* seconds any input may take */
+#define DEFAULT_RUNS     3
+#define MAX_TRIALS       500	/* inputs tried while minimizing one */
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static double budget = DEFAULT_BUDGET / 1e9;
+static unsigned int runs = DEFAULT_RUNS;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Best time of n_runs loads */
+static double
+time_input(const char *data, size_t size, unsigned int n_runs)
+{
+    double best = 0;
+    unsigned int i;
+
+    for (i = 0; i < n_runs; i++)
+    {
+        double start = now();
+        double elapsed;
+
+        (void)LLVMFuzzerTestOneInput((const uint8_t*)data, size);
+        elapsed = now() - start;
+        if(i == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/* How many times the budget an input took */
+static double
+budget_ratio(double elapsed, size_t size)
+{
+    return elapsed / (BASE_TIME + budget * size);
+}
+
+/* Compressed inputs are inflated, the corpus is kept compressed */
+static char *
+read_input(const char *filename, size_t *size)
+{
+    char *buf = NULL;
+    size_t allocated = 0;
+    size_t length = 0;
+    int n = 0;
+#ifdef HAVE_ZLIB
+    gzFile f = gzopen(filename, "rb");
+#else
+    FILE *f = fopen(filename, "rb");
+#endif
+
+    if(f == NULL)
+        return NULL;
+
+    do
+    {
+        if(length == allocated)
+        {
+            char *grown;
+
+            allocated = allocated ? allocated * 2 : 65536;
+            grown = (char*)realloc(buf, allocated);
+            if(grown == NULL)
+            {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+        }
+#ifdef HAVE_ZLIB
+        n = gzread(f, buf + length, (unsigned int)(allocated - length));
+#else
+        n = (int)fread(buf + length, 1, allocated - length, f);
+#endif
+        if(n > 0)
+            length += n;
+    } while(n > 0);
+
+#ifdef HAVE_ZLIB
+    if(n < 0)
+    {
+        free(buf);
+        buf = NULL;
+    }
+    gzclose(f);
+#else
+    fclose(f);
+#endif
+
+    *size = length;
+
+    return buf;
+}
+
+static size_t
+count_lines(const char *data, size_t size, size_t *starts)
+{
+    size_t n_lines = 0;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        if(i == 0 || data[i - 1] == '\n')
+        {
+            if(starts)
+                starts[n_lines] = i;
+            n_lines++;
+        }
+    }
+
+    return n_lines;
+}
+
+/* Removes chunks of lines, from halves of the input down to single
+ * lines, as long as the input stays at least ratio times over the
+ * budget. Candidates that look slow once are loaded again, so that
+ * noise isn't kept */
+static size_t
+minimize(char *data, size_t size, double ratio)
+{
+    char *candidate;
+    size_t *starts;
+    size_t n_lines, chunk, first;
+    unsigned int trials = 0;
+
+    candidate = (char*)malloc(size);
+    starts = (size_t*)malloc((size + 1) * sizeof(size_t));
+    if(candidate == NULL || starts == NULL)
+    {
+        free(candidate);
+        free(starts);
+        return size;
+    }
+
+    n_lines = count_lines(data, size, starts);
+    for (chunk = n_lines / 2; chunk > 0 && trials < MAX_TRIALS; chunk /= 2)
+    {
+        first = 0;
+        while(first < n_lines && trials < MAX_TRIALS)
+        {
+            size_t last = first + chunk < n_lines ? first + chunk : n_lines;
+            size_t begin = starts[first];
+            size_t end = last < n_lines ? starts[last] : size;
+            size_t length = size - (end - begin);
+
+            memcpy(candidate, data, begin);
+            memcpy(candidate + begin, data + end, size - end);
+            trials++;
+            if(length > 0 &&
+               budget_ratio(time_input(candidate, length, 1), length) > ratio &&
+               budget_ratio(time_input(candidate, length, runs), length) > ratio)
+            {
+                memcpy(data, candidate, length);
+                size = length;
+                n_lines = count_lines(data, size, starts);
+            }
+            else
+            {
+                first = last;
+            }
+        }
+    }
+
+    free(candidate);
+    free(starts);
+
+    return size;
+}
+
+static int
+write_output(const char *dir, const char *filename, const char *data, size_t size)
+{
+    const char *name = strrchr(filename, '/');
+    char *path;
+    size_t length;
+    FILE *f;
+    int ok;
+
+    name = name ? name + 1 : filename;
+    path = (char*)malloc(strlen(dir) + strlen(name) + 2);
+    if(path == NULL)
+        return 0;
+    sprintf(path, "%s/%s", dir, name);
+
+    /* Written uncompressed */
+    length = strlen(path);
+    if(length > 3 && strcmp(path + length - 3, ".gz") == 0)
+        path[length - 3] = '\0';
+
+    f = fopen(path, "wb");
+    if(f == NULL)
+    {
+        fprintf(stderr, "error writing %s\n", path);
+        free(path);
+        return 0;
+    }
+    ok = fwrite(data, 1, size, f) == size;
+    ok = fclose(f) == 0 && ok;
+    if(ok)
+        printf("  minimized to %lu bytes: %s\n", (unsigned long)size, path);
+    free(path);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *minimize_dir = NULL;
+    int status = 0;
+    int c;
+    int i;
+
+    while((c = getopt(argc, argv, "b:n:m:")) != -1)
+    {
+        switch(c)
+        {
+        case 'b':
+            budget = strtod(optarg, NULL) / 1e9;
+            break;
+        case 'n':
+            runs = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            minimize_dir = optarg;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-b NS_PER_BYTE] [-n RUNS] [-m DIR] FILE...\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if(optind >= argc || runs == 0)
+    {
+        fprintf(stderr, "no input file\n");
+        return 2;
+    }
+
+    for (i = optind; i < argc; i++)
+    {
+        char *buf;
+        size_t size;
+        double elapsed;
+        int slow;
+
+        buf = read_input(argv[i], &size);
+        if(buf == NULL)
+        {
+            fprintf(stderr, "error reading input file %s\n", argv[i]);
+            status = 1;
+            continue;
+        }
+
+        elapsed = time_input(buf, size, runs);
+        slow = budget_ratio(elapsed, size) > 1;
+        printf("%-40s %10lu bytes %10.3f ms %10.1f ns/byte %s\n", argv[i],
+               (unsigned long)size, elapsed * 1000,
+               size > 0 ? elapsed * 1e9 / size : 0, slow ? "SLOW" : "ok");
+        fflush(stdout);
+
+        if(slow)
+        {
+            status = 1;
+            if(minimize_dir)
+            {
+                /* Halfway between the budget and the input, so that
+                 * the minimized input is clearly slow */
+                size = minimize(buf, size, (1 + budget_ratio(elapsed, size)) / 2);
+                if(!write_output(minimize_dir, argv[i], buf, size))
+                    status = 2;
+            }
+        }
+        free(buf);
+    }
+
+    return status;
+}
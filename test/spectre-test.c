@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <cairo.h>
 
@@ -28,6 +29,7 @@ static void
 test_metadata (SpectreDocument *document)
 {
 	const char *format;
+	int         bbox[4];
 
 	format = spectre_document_get_format (document);
 	printf ("Document format: %s\n",
@@ -48,6 +50,25 @@ test_metadata (SpectreDocument *document)
 		spectre_document_get_creation_date (document));
 	printf ("Document Orientation: %s\n",
 		orientation_to_string (spectre_document_get_orientation (document)));
+	spectre_document_get_bounding_box (document, &bbox[0], &bbox[1], &bbox[2], &bbox[3]);
+	printf ("Bounding box: %d %d %d %d\n", bbox[0], bbox[1], bbox[2], bbox[3]);
+}
+
+static void
+test_probe (const char *filename)
+{
+	SpectreDocument *document;
+
+	document = spectre_document_new ();
+	spectre_document_probe (document, filename);
+	if (spectre_document_status (document)) {
+		printf ("Error probing document %s: %s\n", filename,
+			spectre_status_to_string (spectre_document_status (document)));
+	} else {
+		printf ("Probed metadata\n");
+		test_metadata (document);
+	}
+	spectre_document_free (document);
 }
 
 static void
@@ -206,6 +227,58 @@ test_page_size (SpectreDocument *document,
 	spectre_page_free (page);
 }
 
+static void
+test_memory_limit (SpectreDocument *document)
+{
+	SpectrePage          *page;
+	SpectreRenderContext *rc;
+	unsigned char        *data = NULL;
+	int                   row_length;
+	size_t                peak;
+
+	page = spectre_document_get_page (document, 0);
+
+	printf ("Rendering page 0 with a memory limit\n");
+
+	rc = spectre_render_context_new ();
+
+	spectre_page_render (page, rc, &data, &row_length);
+	free (data);
+	data = NULL;
+	peak = spectre_page_get_peak_memory (page);
+	if (spectre_page_status (page)) {
+		printf ("Error rendering page 0: %s\n",
+			spectre_status_to_string (spectre_page_status (page)));
+	} else {
+		printf ("\tPeak memory: %lu bytes\n", (unsigned long) peak);
+	}
+
+	/* The frame buffers alone don't fit */
+	spectre_render_context_set_memory_limit (rc, peak / 2);
+	spectre_page_render (page, rc, &data, &row_length);
+	if (spectre_page_status (page) != SPECTRE_STATUS_MEMORY_LIMIT) {
+		printf ("Error rendering page 0 with a memory limit of %lu bytes: %s\n",
+			(unsigned long) peak / 2,
+			spectre_status_to_string (spectre_page_status (page)));
+	}
+	free (data);
+	data = NULL;
+
+	/* The frame buffers fit, but there's little left for Ghostscript,
+	 * which should run out of memory with -K */
+	spectre_render_context_set_memory_limit (rc, peak + 64 * 1024);
+	spectre_page_render (page, rc, &data, &row_length);
+	if (spectre_page_status (page) != SPECTRE_STATUS_MEMORY_LIMIT) {
+		printf ("Error rendering page 0 with a memory limit of %lu bytes: %s\n",
+			(unsigned long) peak + 64 * 1024,
+			spectre_status_to_string (spectre_page_status (page)));
+	}
+
+	free (data);
+	spectre_render_context_free (rc);
+	spectre_page_free (page);
+}
+
 static void
 test_document_render (SpectreDocument *document,
 		      const char      *output)
@@ -292,9 +365,26 @@ test_export (SpectreDocument      *document,
 	SpectreExporter *exporter;
 	SpectreStatus status;
 	char *filename;
-	const char *format_str = format == SPECTRE_EXPORTER_FORMAT_PS ? "ps" : "pdf";
+	const char *format_str = "pdf";
 	int i;
 
+	switch (format) {
+	case SPECTRE_EXPORTER_FORMAT_PS:
+		format_str = "ps";
+		break;
+	case SPECTRE_EXPORTER_FORMAT_PDF:
+		break;
+	case SPECTRE_EXPORTER_FORMAT_PNG:
+		format_str = "png";
+		break;
+	case SPECTRE_EXPORTER_FORMAT_PPM:
+		format_str = "ppm";
+		break;
+	case SPECTRE_EXPORTER_FORMAT_TIFF:
+		format_str = "tiff";
+		break;
+	}
+
 	exporter = spectre_exporter_new (document, format);
 
 	filename = _spectre_strdup_printf ("%s/output.%s", output_dir, format_str);
@@ -341,6 +431,168 @@ test_save (SpectreDocument *document,
 	free (filename);
 }
 
+static SpectreStatus
+export_png (SpectreDocument *document,
+	    unsigned int     n_workers,
+	    const char      *filename)
+{
+	SpectreExporter *exporter;
+	SpectreStatus    status;
+
+	exporter = spectre_exporter_new (document, SPECTRE_EXPORTER_FORMAT_PNG);
+	if (!exporter)
+		return SPECTRE_STATUS_EXPORTER_ERROR;
+
+	spectre_exporter_set_n_workers (exporter, n_workers);
+	status = spectre_exporter_begin (exporter, filename);
+	if (!status)
+		status = spectre_exporter_do_page (exporter, 0);
+	if (!status)
+		status = spectre_exporter_end (exporter);
+	spectre_exporter_free (exporter);
+
+	return status;
+}
+
+/* Compares the pixels of two PNG files, their compressed data differs */
+static int
+png_equal (const char *filename1,
+	   const char *filename2)
+{
+	cairo_surface_t *surface1;
+	cairo_surface_t *surface2;
+	int              equal;
+
+	surface1 = cairo_image_surface_create_from_png (filename1);
+	surface2 = cairo_image_surface_create_from_png (filename2);
+	equal = cairo_surface_status (surface1) == CAIRO_STATUS_SUCCESS &&
+		cairo_surface_status (surface2) == CAIRO_STATUS_SUCCESS &&
+		cairo_image_surface_get_width (surface1) == cairo_image_surface_get_width (surface2) &&
+		cairo_image_surface_get_height (surface1) == cairo_image_surface_get_height (surface2) &&
+		cairo_image_surface_get_stride (surface1) == cairo_image_surface_get_stride (surface2) &&
+		memcmp (cairo_image_surface_get_data (surface1),
+			cairo_image_surface_get_data (surface2),
+			cairo_image_surface_get_stride (surface1) *
+			cairo_image_surface_get_height (surface1)) == 0;
+	cairo_surface_destroy (surface1);
+	cairo_surface_destroy (surface2);
+
+	return equal;
+}
+
+static void
+test_export_png (SpectreDocument *document,
+		 const char      *output_dir)
+{
+	SpectreExporter *exporter;
+	SpectreStatus    status;
+	char            *filename;
+	char            *filename_workers;
+
+	if (spectre_document_get_n_pages (document) == 0)
+		return;
+
+	/* Not available without zlib */
+	exporter = spectre_exporter_new (document, SPECTRE_EXPORTER_FORMAT_PNG);
+	if (!exporter)
+		return;
+	spectre_exporter_free (exporter);
+
+	/* The strips compressed by several threads make the same image */
+	filename = _spectre_strdup_printf ("%s/output.png", output_dir);
+	filename_workers = _spectre_strdup_printf ("%s/output-4-workers.png", output_dir);
+	status = export_png (document, 1, filename);
+	if (!status)
+		status = export_png (document, 4, filename_workers);
+	if (status) {
+		printf ("Error exporting page 0 as png: %s\n",
+			spectre_status_to_string (status));
+	} else if (!png_equal (filename, filename_workers)) {
+		printf ("Error: page 0 exported as png with 4 workers differs\n");
+	}
+	free (filename);
+	free (filename_workers);
+}
+
+/* Returns whether the contents of filename are data */
+static int
+file_equals_data (const char          *filename,
+		  const unsigned char *data,
+		  size_t               length)
+{
+	FILE          *file;
+	unsigned char *contents;
+	int            equal;
+
+	file = fopen (filename, "rb");
+	if (!file)
+		return 0;
+
+	/* One more byte to notice a longer file */
+	contents = malloc (length + 1);
+	equal = contents &&
+		fread (contents, 1, length + 1, file) == length &&
+		memcmp (contents, data, length) == 0;
+	free (contents);
+	fclose (file);
+
+	return equal;
+}
+
+static void
+test_save_to_data (SpectreDocument *document,
+		   const char      *output_dir)
+{
+	SpectreExporter *exporter;
+	SpectreStatus    status;
+	unsigned char   *data = NULL;
+	size_t           length = 0;
+	char            *filename;
+	unsigned int     i;
+
+	/* Same contents as test_save() */
+	filename = _spectre_strdup_printf ("%s/document-copy.ps", output_dir);
+	spectre_document_save_to_data (document, &data, &length);
+	if (spectre_document_status (document)) {
+		printf ("Error saving document to memory: %s\n",
+			spectre_status_to_string (spectre_document_status (document)));
+	} else if (!file_equals_data (filename, data, length)) {
+		printf ("Error: document saved to memory differs from %s\n", filename);
+	}
+	free (filename);
+	free (data);
+
+	/* An exporter used for memory first writes files afterwards */
+	exporter = spectre_exporter_new (document, SPECTRE_EXPORTER_FORMAT_PS);
+	if (!exporter)
+		return;
+
+	data = NULL;
+	status = spectre_exporter_begin_for_data (exporter, &data, &length);
+	for (i = 0; !status && i < spectre_document_get_n_pages (document); i++)
+		status = spectre_exporter_do_page (exporter, i);
+	if (!status)
+		status = spectre_exporter_end (exporter);
+
+	filename = _spectre_strdup_printf ("%s/output-after-data.ps", output_dir);
+	if (!status)
+		status = spectre_exporter_begin (exporter, filename);
+	for (i = 0; !status && i < spectre_document_get_n_pages (document); i++)
+		status = spectre_exporter_do_page (exporter, i);
+	if (!status)
+		status = spectre_exporter_end (exporter);
+	spectre_exporter_free (exporter);
+
+	if (status) {
+		printf ("Error exporting to memory and then to %s: %s\n", filename,
+			spectre_status_to_string (status));
+	} else if (!file_equals_data (filename, data, length)) {
+		printf ("Error: export to %s differs from the export to memory\n", filename);
+	}
+	free (filename);
+	free (data);
+}
+
 static void
 test_save_to_pdf (SpectreDocument *document,
 		  const char      *output_dir)
@@ -360,6 +612,8 @@ int main (int argc, char **argv)
 {
 	SpectreDocument      *document;
 	SpectreRenderContext *rc;
+	SpectrePageInfo      *info;
+	unsigned int          n_pages;
 	unsigned int          i;
 
 	/* TODO: check argv */
@@ -368,6 +622,8 @@ int main (int argc, char **argv)
 
 	spectre_document_load (NULL, argv[1]);
 
+	test_probe (argv[1]);
+
 	document = spectre_document_new ();
 	spectre_document_load (document, argv[1]);
 	if (spectre_document_status (document)) {
@@ -382,10 +638,23 @@ int main (int argc, char **argv)
 	test_document_render_full (document, argv[2]);
 	test_export (document, SPECTRE_EXPORTER_FORMAT_PDF, argv[2]);
 	test_export (document, SPECTRE_EXPORTER_FORMAT_PS, argv[2]);
+	test_export (document, SPECTRE_EXPORTER_FORMAT_PPM, argv[2]);
+	test_export (document, SPECTRE_EXPORTER_FORMAT_TIFF, argv[2]);
+	test_export_png (document, argv[2]);
 	test_save (document, argv[2]);
+	test_save_to_data (document, argv[2]);
 	test_save_to_pdf (document, argv[2]);
 	test_metadata (document);
 
+	n_pages = spectre_document_get_n_pages (document);
+	info = malloc (n_pages * sizeof (SpectrePageInfo));
+	if (info && spectre_document_get_pages_info (document, 0, n_pages, info) != n_pages) {
+		printf ("Error getting the info of %u pages: %s\n", n_pages,
+			spectre_status_to_string (spectre_document_status (document)));
+		free (info);
+		info = NULL;
+	}
+
 	rc = spectre_render_context_new ();
 
 	for (i = 0; i < spectre_document_get_n_pages (document); i++) {
@@ -409,6 +678,17 @@ int main (int argc, char **argv)
 		printf ("\tPage size: %d x %d\n", width, height);
 		printf ("\tPage orientation: %s\n", 
 			orientation_to_string (spectre_page_get_orientation (page)));
+		if (info && i < n_pages &&
+		    (info[i].width != width || info[i].height != height ||
+		     info[i].orientation != spectre_page_get_orientation (page) ||
+		     info[i].label != spectre_page_get_label (page))) {
+			printf ("Error: the info of page %d doesn't match the page\n", i);
+		}
+		if (info && i < n_pages) {
+			printf ("\tPage bounding box: %d %d %d %d\n",
+				info[i].bbox[0], info[i].bbox[1],
+				info[i].bbox[2], info[i].bbox[3]);
+		}
 
 		page2 = spectre_document_get_page_by_label (document, spectre_page_get_label (page));
 		if (!page2 || spectre_document_status (document)) {
@@ -444,9 +724,11 @@ int main (int argc, char **argv)
 	}
 
 	spectre_render_context_free (rc);
+	free (info);
 
 	test_render_slice (document, argv[2]);
 	test_page_size (document, argv[2]);
+	test_memory_limit (document);
 	test_rotation (document, argv[2]);
 	
 	spectre_document_free (document);
@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <libspectre/spectre.h>
+
+/* Scans and renders the same document from several threads at once and
+ * checks that the results match a serial run. Build it with
+ * CFLAGS="-fsanitize=thread -g" to look for data races. The document is
+ * also loaded from a pipe fed by another thread.
+ */
+
+#define N_THREADS    8
+#define N_ITERATIONS 4
+
+typedef struct {
+	unsigned char *data;
+	int            row_length;
+	int            height;
+	SpectreStatus  status;
+} Image;
+
+typedef struct {
+	const char   *filename;
+	const char   *contents;
+	size_t        length;
+
+	unsigned int  n_pages;
+	char        **labels;
+	Image        *images;
+} Reference;
+
+typedef struct {
+	const Reference *ref;
+	unsigned int     id;
+	SpectrePage    **pages;
+	int              failures;
+} ThreadData;
+
+static int
+str_equal (const char *a,
+	   const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return strcmp (a, b) == 0;
+}
+
+static char *
+read_file (const char *filename,
+	   size_t     *length)
+{
+	FILE *file;
+	char *contents;
+	long  size;
+
+	file = fopen (filename, "rb");
+	if (!file)
+		return NULL;
+
+	fseek (file, 0, SEEK_END);
+	size = ftell (file);
+	rewind (file);
+
+	contents = malloc (size > 0 ? size : 1);
+	if (contents && fread (contents, 1, size, file) != (size_t) size) {
+		free (contents);
+		contents = NULL;
+	}
+	fclose (file);
+
+	*length = size;
+
+	return contents;
+}
+
+static void
+render_page (SpectrePage *page,
+	     Image       *image)
+{
+	SpectreRenderContext *rc;
+	int                   width;
+
+	spectre_page_get_size (page, &width, &image->height);
+
+	rc = spectre_render_context_new ();
+	image->data = NULL;
+	spectre_page_render (page, rc, &image->data, &image->row_length);
+	image->status = spectre_page_status (page);
+	spectre_render_context_free (rc);
+}
+
+static int
+check_document (const Reference *ref,
+		SpectreDocument *document,
+		unsigned int     id)
+{
+	unsigned int i;
+
+	if (spectre_document_status (document)) {
+		printf ("Thread %u: error loading document: %s\n", id,
+			spectre_status_to_string (spectre_document_status (document)));
+		return 1;
+	}
+
+	if (spectre_document_get_n_pages (document) != ref->n_pages) {
+		printf ("Thread %u: found %u pages instead of %u\n", id,
+			spectre_document_get_n_pages (document), ref->n_pages);
+		return 1;
+	}
+
+	for (i = 0; i < ref->n_pages; i++) {
+		SpectrePage *page;
+		int          ok;
+
+		page = spectre_document_get_page (document, i);
+		if (!page)
+			return 1;
+
+		ok = str_equal (spectre_page_get_label (page), ref->labels[i]);
+		spectre_page_free (page);
+		if (!ok) {
+			printf ("Thread %u: wrong label for page %u\n", id, i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void *
+scan_thread (void *user_data)
+{
+	ThreadData      *thread = user_data;
+	const Reference *ref = thread->ref;
+	int              i;
+
+	for (i = 0; i < N_ITERATIONS; i++) {
+		SpectreDocument *document;
+
+		document = spectre_document_new ();
+		switch ((thread->id + i) % 3) {
+		case 0:
+			spectre_document_load (document, ref->filename);
+			break;
+		case 1:
+			spectre_document_load_partial (document, ref->filename, 1);
+			spectre_document_scan_pages (document, 0);
+			break;
+		case 2:
+			spectre_document_load_from_data (document, ref->contents, ref->length);
+			break;
+		}
+
+		thread->failures += check_document (ref, document, thread->id);
+		spectre_document_free (document);
+	}
+
+	return NULL;
+}
+
+static void *
+render_thread (void *user_data)
+{
+	ThreadData      *thread = user_data;
+	const Reference *ref = thread->ref;
+	unsigned int     i;
+
+	for (i = 0; i < ref->n_pages; i++) {
+		/* Start at a different page in each thread */
+		unsigned int index = (i + thread->id) % ref->n_pages;
+		Image        image;
+
+		render_page (thread->pages[index], &image);
+		if (image.status != ref->images[index].status ||
+		    (image.status == SPECTRE_STATUS_SUCCESS &&
+		     (image.row_length != ref->images[index].row_length ||
+		      memcmp (image.data, ref->images[index].data,
+			      image.row_length * image.height) != 0))) {
+			printf ("Thread %u: page %u rendered differently\n",
+				thread->id, index);
+			thread->failures++;
+		}
+		free (image.data);
+	}
+
+	/* The document has been freed by now, pages keep it alive */
+	for (i = 0; i < ref->n_pages; i++)
+		spectre_page_free (thread->pages[i]);
+
+	return NULL;
+}
+
+static int
+run_threads (Reference       *ref,
+	     SpectreDocument *document,
+	     int              n_threads,
+	     void          *(*func) (void *))
+{
+	pthread_t  *threads;
+	ThreadData *data;
+	int         failures = 0;
+	int         i;
+
+	threads = calloc (n_threads, sizeof (pthread_t));
+	data = calloc (n_threads, sizeof (ThreadData));
+
+	for (i = 0; i < n_threads; i++) {
+		data[i].ref = ref;
+		data[i].id = i;
+		if (document) {
+			unsigned int j;
+
+			data[i].pages = calloc (ref->n_pages, sizeof (SpectrePage *));
+			for (j = 0; j < ref->n_pages; j++)
+				data[i].pages[j] = spectre_document_get_page (document, j);
+		}
+	}
+
+	for (i = 0; i < n_threads; i++)
+		pthread_create (&threads[i], NULL, func, &data[i]);
+
+	if (document)
+		spectre_document_free (document);
+
+	for (i = 0; i < n_threads; i++) {
+		pthread_join (threads[i], NULL);
+		failures += data[i].failures;
+		free (data[i].pages);
+	}
+
+	free (data);
+	free (threads);
+
+	return failures;
+}
+
+typedef struct {
+	const Reference *ref;
+	int              fd;
+} PipeWriter;
+
+static void *
+pipe_writer_thread (void *user_data)
+{
+	PipeWriter *writer = user_data;
+	size_t      written = 0;
+
+	/* Small writes, so the reader gets the document in several reads */
+	while (written < writer->ref->length) {
+		size_t  len = writer->ref->length - written;
+		ssize_t n;
+
+		if (len > 4096)
+			len = 4096;
+		n = write (writer->fd, writer->ref->contents + written, len);
+		if (n <= 0)
+			break;
+		written += n;
+	}
+	close (writer->fd);
+
+	return NULL;
+}
+
+/* Partially loads the document from a pipe while another thread writes
+ * it, and compares with a partial load of the file
+ */
+static int
+test_pipe (const Reference *ref)
+{
+	SpectreDocument *document;
+	SpectreDocument *file_document;
+	PipeWriter       writer;
+	pthread_t        thread;
+	FILE            *file;
+	int              fds[2];
+	int              failures = 0;
+
+	/* The reader may close the pipe before the writer is done */
+	signal (SIGPIPE, SIG_IGN);
+	if (pipe (fds) != 0) {
+		printf ("Pipe: error creating pipe\n");
+		return 1;
+	}
+
+	writer.ref = ref;
+	writer.fd = fds[1];
+	if (pthread_create (&thread, NULL, pipe_writer_thread, &writer) != 0) {
+		printf ("Pipe: error creating writer thread\n");
+		close (fds[0]);
+		close (fds[1]);
+		return 1;
+	}
+
+	file = fdopen (fds[0], "rb");
+	document = spectre_document_new ();
+	spectre_document_load_from_pipe (document, file, 1);
+
+	file_document = spectre_document_new ();
+	spectre_document_load_partial (file_document, ref->filename, 1);
+
+	if (spectre_document_status (document)) {
+		printf ("Pipe: error loading document: %s\n",
+			spectre_status_to_string (spectre_document_status (document)));
+		failures++;
+	} else if (spectre_document_is_complete (document) !=
+		   spectre_document_is_complete (file_document) ||
+		   spectre_document_get_n_pages (document) !=
+		   spectre_document_get_n_pages (file_document)) {
+		printf ("Pipe: partial load found %u pages, complete %d, "
+			"instead of %u pages, complete %d\n",
+			spectre_document_get_n_pages (document),
+			spectre_document_is_complete (document),
+			spectre_document_get_n_pages (file_document),
+			spectre_document_is_complete (file_document));
+		failures++;
+	} else {
+		spectre_document_scan_pages (document, 0);
+		if (!spectre_document_is_complete (document)) {
+			printf ("Pipe: document not complete after scanning all pages\n");
+			failures++;
+		} else {
+			failures += check_document (ref, document, 0);
+		}
+	}
+
+	spectre_document_free (document);
+	spectre_document_free (file_document);
+	fclose (file);
+	pthread_join (thread, NULL);
+
+	return failures;
+}
+
+int main (int argc, char **argv)
+{
+	SpectreDocument *document;
+	Reference        ref;
+	int              n_threads = N_THREADS;
+	int              failures;
+	unsigned int     i;
+
+	if (argc < 2) {
+		printf ("Usage: %s filename [n_threads]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc > 2)
+		n_threads = atoi (argv[2]);
+	if (n_threads < 1)
+		n_threads = 1;
+
+	memset (&ref, 0, sizeof (Reference));
+	ref.filename = argv[1];
+	ref.contents = read_file (argv[1], &ref.length);
+	if (!ref.contents) {
+		printf ("Error reading %s\n", argv[1]);
+		return 1;
+	}
+
+	document = spectre_document_new ();
+	spectre_document_load (document, argv[1]);
+	if (spectre_document_status (document)) {
+		printf ("Error loading document %s: %s\n", argv[1],
+			spectre_status_to_string (spectre_document_status (document)));
+		spectre_document_free (document);
+		free ((char *) ref.contents);
+
+		return 1;
+	}
+
+	ref.n_pages = spectre_document_get_n_pages (document);
+	ref.labels = calloc (ref.n_pages, sizeof (char *));
+	ref.images = calloc (ref.n_pages, sizeof (Image));
+	for (i = 0; i < ref.n_pages; i++) {
+		SpectrePage *page;
+		const char  *label;
+
+		page = spectre_document_get_page (document, i);
+		label = spectre_page_get_label (page);
+		ref.labels[i] = label ? strdup (label) : NULL;
+		render_page (page, &ref.images[i]);
+		spectre_page_free (page);
+	}
+
+	failures = run_threads (&ref, NULL, n_threads, scan_thread);
+	failures += run_threads (&ref, document, n_threads, render_thread);
+	failures += test_pipe (&ref);
+
+	for (i = 0; i < ref.n_pages; i++) {
+		free (ref.labels[i]);
+		free (ref.images[i].data);
+	}
+	free (ref.labels);
+	free (ref.images);
+	free ((char *) ref.contents);
+
+	printf ("%d threads: %d failures\n", n_threads, failures);
+
+	return failures ? 1 : 0;
+}